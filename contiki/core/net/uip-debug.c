@@ -40,6 +40,12 @@
 
 #define DEBUG DEBUG_FULL
 #include "net/uip-debug.h"
+
+#ifdef ZGW_LOG_RING
+#include "zgw_log_ring.h"
+/* Keep the addresses in order with the log lines of the gateway */
+#define printf(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_RAW, f , ## __VA_ARGS__ )
+#endif
 /*---------------------------------------------------------------------------*/
 
 
@@ -100,25 +106,29 @@ void
 uip_debug_ipaddr_print(const uip_ipaddr_t *addr)
 {
 #if UIP_CONF_IPV6
+  char buf[sizeof("ffff:") * 8 + 2];
+  int len = 0;
   uint16_t a;
   int i, f;
+  /* Print the address at once, so it is not split up in the log */
   for(i = 0, f = 0; i < sizeof(uip_ipaddr_t); i += 2) {
     a = (addr->u8[i] << 8) + addr->u8[i + 1];
     if(a == 0 && f >= 0) {
       if(f++ == 0) {
-        printf(":");
-        printf(":");
+        buf[len++] = ':';
+        buf[len++] = ':';
       }
     } else {
       if(f > 0) {
         f = -1;
       } else if(i > 0) {
-        printf(":");
+        buf[len++] = ':';
       }
-      printf("%02x",a);
+      len += sprintf(buf + len, "%02x", a);
     }
   }
-  printf("\n");
+  buf[len] = '\0';
+  printf("%s\n", buf);
 #else /* UIP_CONF_IPV6 */
   printf("%u.%u.%u.%u", addr->u8[0], addr->u8[1], addr->u8[2], addr->u8[3]);
 #endif /* UIP_CONF_IPV6 */
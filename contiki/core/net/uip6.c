@@ -323,28 +323,40 @@ uip_add32(u8_t *op32, u16_t op16)
 u16_t
 chksum(u16_t sum, const u8_t *data, u16_t len)
 {
-  u16_t t;
-  const u8_t *dataptr;
-  const u8_t *last_byte;
-
-  dataptr = data;
-  last_byte = data + len - 1;
-
-  while(dataptr < last_byte) {   /* At least two more bytes */
-    t = (dataptr[0] << 8) + dataptr[1];
-    sum += t;
-    if(sum < t) {
-      sum++;      /* carry */
-    }
-    dataptr += 2;
+  /* The one's complement sum does not depend on the byte order (RFC 1071),
+   * so the data is summed 32 bits at a time in host byte order, and only
+   * the folded result is swapped. */
+  uint64_t acc = 0;
+  uint32_t w[4];
+  u16_t t = 0;
+
+  while(len >= sizeof(w)) {
+    memcpy(w, data, sizeof(w));
+    acc += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    data += sizeof(w);
+    len -= sizeof(w);
+  }
+  while(len >= 2) {
+    memcpy(&t, data, 2);
+    acc += t;
+    data += 2;
+    len -= 2;
+  }
+  if(len) {
+    /* The last byte is padded with a zero byte */
+    t = 0;
+    memcpy(&t, data, 1);
+    acc += t;
   }
 
-  if(dataptr == last_byte) {
-    t = (dataptr[0] << 8) + 0;
-    sum += t;
-    if(sum < t) {
-      sum++;      /* carry */
-    }
+  while(acc >> 16) {
+    acc = (acc & 0xffff) + (acc >> 16);
+  }
+  t = UIP_HTONS((u16_t)acc);
+
+  sum += t;
+  if(sum < t) {
+    sum++;      /* carry */
   }
 
   /* Return sum in host byte order. */
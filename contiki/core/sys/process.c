@@ -48,6 +48,13 @@
 
 #include "sys/process.h"
 #include "sys/arg.h"
+#if PROCESS_CONF_STATS
+#include "sys/clock.h"
+#endif
+#if PROCESS_CONF_NUMEVENTS_MAX > PROCESS_CONF_NUMEVENTS
+#include <stdlib.h>
+#include <string.h>
+#endif
 
 #define data _data  /* data is a reserved keyword in Keil C51 */
 
@@ -68,11 +75,26 @@ struct event_data {
   struct process *p;
 };
 
-static process_num_events_t nevents, fevent;
-static struct event_data events[PROCESS_CONF_NUMEVENTS];
+/*
+ * A circular queue of events of one priority. The queue starts in a static
+ * buffer, and is moved to the heap if it has to grow.
+ */
+struct event_queue {
+  struct event_data *events;
+  process_num_events_t size, nevents, fevent;
+};
+
+static struct event_data static_events[PROCESS_PRIOS][PROCESS_CONF_NUMEVENTS];
+static struct event_queue queues[PROCESS_PRIOS];
+
+/* Total number of events in the queues */
+static process_num_events_t nevents;
+/* High priority events delivered since the last normal priority event */
+static unsigned char high_burst;
 
 #if PROCESS_CONF_STATS
 process_num_events_t process_maxevents;
+static unsigned long overflows;
 #endif
 
 static volatile unsigned char poll_requested;
@@ -183,6 +205,26 @@ exit_process(struct process *p, struct process *fromprocess) CC_REENTRANT_ARG
   process_current = old_current;
 }
 /*---------------------------------------------------------------------------*/
+#if PROCESS_CONF_STATS
+static void
+stats_update(struct process *p, process_event_t ev, clock_time_t run)
+{
+  int bucket = 0;
+
+  if(ev == PROCESS_EVENT_POLL) {
+    p->npolls++;
+  } else {
+    p->nevents++;
+  }
+  p->run_ticks += run;
+  while(run > 0 && bucket < PROCESS_STATS_RUN_BUCKETS - 1) {
+    run >>= 1;
+    bucket++;
+  }
+  p->run_hist[bucket]++;
+}
+#endif /* PROCESS_CONF_STATS */
+/*---------------------------------------------------------------------------*/
 static void
 call_process(struct process *p, process_event_t ev, process_data_t data) CC_REENTRANT_ARG
 {
@@ -198,12 +240,18 @@ call_process(struct process *p, process_event_t ev, process_data_t data) CC_REEN
 
   if((p->state & PROCESS_STATE_RUNNING) &&
      p->thread != NULL) {
+#if PROCESS_CONF_STATS
+    clock_time_t start = clock_time();
+#endif
 #if ! CC_NO_VA_ARGS
     PRINTF("process: calling process '%s' with event %bu\n", PROCESS_NAME_STRING(p), ev);
 #endif
     process_current = p;
     p->state = PROCESS_STATE_CALLED;
     ret = p->thread(&p->pt, ev, data);
+#if PROCESS_CONF_STATS
+    stats_update(p, ev, clock_time() - start);
+#endif
     if(ret == PT_EXITED ||
        ret == PT_ENDED ||
        ev == PROCESS_EVENT_EXIT) {
@@ -233,11 +281,25 @@ process_exit(struct process *p) CC_REENTRANT_ARG
 void
 process_init(void)
 {
+  int i;
+
   lastevent = PROCESS_EVENT_MAX;
 
-  nevents = fevent = 0;
+  for(i = 0; i < PROCESS_PRIOS; i++) {
+#if PROCESS_CONF_NUMEVENTS_MAX > PROCESS_CONF_NUMEVENTS
+    if(queues[i].events != NULL && queues[i].events != static_events[i]) {
+      free(queues[i].events);
+    }
+#endif
+    queues[i].events = static_events[i];
+    queues[i].size = PROCESS_CONF_NUMEVENTS;
+    queues[i].nevents = queues[i].fevent = 0;
+  }
+  nevents = 0;
+  high_burst = 0;
 #if PROCESS_CONF_STATS
   process_maxevents = 0;
+  overflows = 0;
 #endif /* PROCESS_CONF_STATS */
 
   process_current = process_list = NULL;
@@ -268,6 +330,21 @@ do_poll(void) CC_REENTRANT_ARG
  * listening processes.
  */
 /*---------------------------------------------------------------------------*/
+static struct event_queue *
+next_queue(void)
+{
+  struct event_queue *high = &queues[PROCESS_PRIO_HIGH];
+  struct event_queue *normal = &queues[PROCESS_PRIO_NORMAL];
+
+  if(high->nevents > 0 &&
+     (normal->nevents == 0 || high_burst < PROCESS_CONF_HIGH_BURST)) {
+    high_burst++;
+    return high;
+  }
+  high_burst = 0;
+  return normal;
+}
+/*---------------------------------------------------------------------------*/
 static void
 do_event(void) CC_REENTRANT_ARG
 {
@@ -275,6 +352,7 @@ do_event(void) CC_REENTRANT_ARG
   static process_data_t data;
   static struct process *receiver;
   static struct process *p;
+  static struct event_queue *q;
 
   /*
    * If there are any events in the queue, take the first one and walk
@@ -287,14 +365,16 @@ do_event(void) CC_REENTRANT_ARG
   if(nevents > 0) {
 
     /* There are events that we should deliver. */
-    ev = events[fevent].ev;
+    q = next_queue();
+    ev = q->events[q->fevent].ev;
 
-    data = events[fevent].data;
-    receiver = events[fevent].p;
+    data = q->events[q->fevent].data;
+    receiver = q->events[q->fevent].p;
 
     /* Since we have seen the new event, we move pointer upwards
        and decrese the number of events. */
-    fevent = (fevent + 1) % PROCESS_CONF_NUMEVENTS;
+    q->fevent = (q->fevent + 1) % q->size;
+    --q->nevents;
     --nevents;
 
     /* If this is a broadcast event, we deliver it to all events, in
@@ -344,10 +424,52 @@ process_nevents(void)
   return nevents + poll_requested;
 }
 /*---------------------------------------------------------------------------*/
+#if PROCESS_CONF_NUMEVENTS_MAX > PROCESS_CONF_NUMEVENTS
+/*
+ * Move a full queue to a buffer twice the size, with the first event at
+ * the start of the buffer.
+ */
+static int
+grow_queue(struct event_queue *q)
+{
+  process_num_events_t size;
+  process_num_events_t head;
+  struct event_data *events;
+
+  if(q->size >= PROCESS_CONF_NUMEVENTS_MAX) {
+    return 0;
+  }
+  size = q->size * 2 > PROCESS_CONF_NUMEVENTS_MAX ?
+    PROCESS_CONF_NUMEVENTS_MAX : q->size * 2;
+  events = malloc(size * sizeof(struct event_data));
+  if(events == NULL) {
+    return 0;
+  }
+  head = q->size - q->fevent;
+  memcpy(events, &q->events[q->fevent], head * sizeof(struct event_data));
+  memcpy(&events[head], q->events, q->fevent * sizeof(struct event_data));
+  if(q->events != static_events[q - queues]) {
+    free(q->events);
+  }
+  q->events = events;
+  q->size = size;
+  q->fevent = 0;
+  return 1;
+}
+#endif /* PROCESS_CONF_NUMEVENTS_MAX > PROCESS_CONF_NUMEVENTS */
+/*---------------------------------------------------------------------------*/
 int
 process_post(struct process *p, process_event_t ev, process_data_t data) CC_REENTRANT_ARG
+{
+  return process_post_prio(p, ev, data, PROCESS_PRIO_NORMAL);
+}
+/*---------------------------------------------------------------------------*/
+int
+process_post_prio(struct process *p, process_event_t ev, process_data_t data,
+                  unsigned char prio) CC_REENTRANT_ARG
 {
   static process_num_events_t snum;
+  struct event_queue *q = &queues[prio < PROCESS_PRIOS ? prio : PROCESS_PRIO_HIGH];
 
   if(PROCESS_CURRENT() == NULL) {
 #if ! CC_NO_VA_ARGS
@@ -362,7 +484,14 @@ process_post(struct process *p, process_event_t ev, process_data_t data) CC_REEN
 #endif
   }
 
-  if(nevents == PROCESS_CONF_NUMEVENTS) {
+  if(q->nevents == q->size
+#if PROCESS_CONF_NUMEVENTS_MAX > PROCESS_CONF_NUMEVENTS
+     && !grow_queue(q)
+#endif
+     ) {
+#if PROCESS_CONF_STATS
+    overflows++;
+#endif
 #if DEBUG
     if(p == PROCESS_BROADCAST) {
 #if ! CC_NO_VA_ARGS
@@ -377,10 +506,11 @@ process_post(struct process *p, process_event_t ev, process_data_t data) CC_REEN
     return PROCESS_ERR_FULL;
   }
 
-  snum = (process_num_events_t)(fevent + nevents) % PROCESS_CONF_NUMEVENTS;
-  events[snum].ev = ev;
-  events[snum].data = data;
-  events[snum].p = p;
+  snum = (process_num_events_t)(q->fevent + q->nevents) % q->size;
+  q->events[snum].ev = ev;
+  q->events[snum].data = data;
+  q->events[snum].p = p;
+  ++q->nevents;
   ++nevents;
 
 #if PROCESS_CONF_STATS
@@ -392,6 +522,14 @@ process_post(struct process *p, process_event_t ev, process_data_t data) CC_REEN
   return PROCESS_ERR_OK;
 }
 /*---------------------------------------------------------------------------*/
+#if PROCESS_CONF_STATS
+unsigned long
+process_overflows(void)
+{
+  return overflows;
+}
+#endif /* PROCESS_CONF_STATS */
+/*---------------------------------------------------------------------------*/
 void
 process_post_synch(struct process *p, process_event_t ev, process_data_t data) CC_REENTRANT_ARG
 {
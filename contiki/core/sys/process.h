@@ -59,7 +59,7 @@
 
 typedef unsigned char process_event_t;
 typedef void *        process_data_t;
-typedef unsigned char process_num_events_t;
+typedef unsigned short process_num_events_t;
 
 /**
  * \name Return values
@@ -89,6 +89,42 @@ typedef unsigned char process_num_events_t;
 #define PROCESS_CONF_NUMEVENTS 32
 #endif /* PROCESS_CONF_NUMEVENTS */
 
+/**
+ * Largest number of events in each event queue. If this is larger than
+ * PROCESS_CONF_NUMEVENTS, a full queue is moved to a larger heap buffer
+ * instead of refusing the event.
+ */
+#ifndef PROCESS_CONF_NUMEVENTS_MAX
+#define PROCESS_CONF_NUMEVENTS_MAX PROCESS_CONF_NUMEVENTS
+#endif /* PROCESS_CONF_NUMEVENTS_MAX */
+
+/**
+ * Number of high priority events delivered in a row while normal priority
+ * events are waiting. After this, one normal priority event is delivered,
+ * so a stream of high priority events cannot starve the rest.
+ */
+#ifndef PROCESS_CONF_HIGH_BURST
+#define PROCESS_CONF_HIGH_BURST 8
+#endif /* PROCESS_CONF_HIGH_BURST */
+
+/**
+ * \name Event priorities
+ * @{
+ */
+/** Priority of process_post(). */
+#define PROCESS_PRIO_NORMAL   0
+/** Delivered before waiting normal priority events. Poll handlers, such as
+ * the one driving the Serial API callbacks, run before events of either
+ * priority. */
+#define PROCESS_PRIO_HIGH     1
+#define PROCESS_PRIOS         2
+/* @} */
+
+/** Number of buckets of the run time histogram of a process. Bucket 0 counts
+ * calls which took less than one clock tick, bucket i counts calls of
+ * [2^(i-1), 2^i) ticks, and the last bucket everything longer. */
+#define PROCESS_STATS_RUN_BUCKETS 8
+
 #define PROCESS_EVENT_NONE            0x80
 #define PROCESS_EVENT_INIT            0x81
 #define PROCESS_EVENT_POLL            0x82
@@ -324,6 +360,16 @@ struct process {
   PT_THREAD((* thread)(struct pt *, process_event_t, process_data_t));
   struct pt pt;
   unsigned char state, needspoll;
+#if PROCESS_CONF_STATS
+  /** Number of events delivered to the process, including synchronous ones */
+  unsigned long nevents;
+  /** Number of times the process was polled */
+  unsigned long npolls;
+  /** Run time of the calls of the process, see PROCESS_STATS_RUN_BUCKETS */
+  unsigned long run_hist[PROCESS_STATS_RUN_BUCKETS];
+  /** Sum of the run time of the calls of the process, in clock ticks */
+  unsigned long run_ticks;
+#endif /* PROCESS_CONF_STATS */
 };
 
 /**
@@ -365,6 +411,30 @@ CCIF void process_start(struct process *p, const char *arg) CC_REENTRANT_ARG;
  */
 CCIF int process_post(struct process *p, process_event_t ev, void* procdata) CC_REENTRANT_ARG;
 
+/**
+ * Post an asynchronous event with a priority.
+ *
+ * Events of higher priority are delivered before waiting events of lower
+ * priority. Events of the same priority are delivered in the order they
+ * were posted.
+ *
+ * \param p The process to which the event should be posted, or
+ * PROCESS_BROADCAST.
+ *
+ * \param ev The event to be posted.
+ *
+ * \param procdata The auxiliary data to be sent with the event
+ *
+ * \param prio PROCESS_PRIO_NORMAL or PROCESS_PRIO_HIGH.
+ *
+ * \retval PROCESS_ERR_OK The event could be posted.
+ *
+ * \retval PROCESS_ERR_FULL The event queue was full and the event could
+ * not be posted.
+ */
+CCIF int process_post_prio(struct process *p, process_event_t ev,
+                           void* procdata, unsigned char prio) CC_REENTRANT_ARG;
+
 /**
  * Post a synchronous event to a process.
  *
@@ -520,6 +590,18 @@ CCIF int process_is_running(struct process *p) CC_REENTRANT_ARG;
  */
 int process_nevents(void);
 
+#if PROCESS_CONF_STATS
+/**
+ * Largest number of events which have been waiting at the same time.
+ */
+CCIF extern process_num_events_t process_maxevents;
+
+/**
+ * Number of events which were refused because the event queue was full.
+ */
+unsigned long process_overflows(void);
+#endif /* PROCESS_CONF_STATS */
+
 /** @} */
 
 CCIF extern struct process *process_list;
@@ -27,6 +27,7 @@
 
 #include <sys/file.h>
 #include "ZIP_Router_logging.h"
+#include "zgw_poll.h"
 
 int serial_fd;
 //#define SERIAL_LOG
@@ -119,6 +120,7 @@ int SerialInit(const char* port) {
 }
 
 void SerialClose() {
+        zgw_poll_remove(serial_fd);
         flock(serial_fd, LOCK_UN);
 	close(serial_fd);
 }
@@ -136,6 +138,7 @@ int SerialRestart() {
 }
 
 void SerialDestroy() {
+  zgw_poll_remove(serial_fd);
   flock(serial_fd, LOCK_UN);
   close(serial_fd);
 #ifdef SERIAL_LOG
@@ -48,6 +48,10 @@
 #define IPBUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
 #define UIP_IP_BUF  ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 
+/** Largest number of frames handled each time the tap device is readable.
+ * If there are more, the rest are handled after the other pending events. */
+#define TAPDEV_RX_BATCH 32
+
 PROCESS(tapdev_process, "TAP driver");
 
 /*---------------------------------------------------------------------------*/
@@ -68,11 +72,8 @@ extern u8_t do_send(void);
 
 #include <string.h>
 static void
-pollhandler(void)
+input_frame(void)
 {
-  //process_poll(&tapdev_process);
-  uip_len = tapdev_poll();
-
   if(uip_len > 0) {
     //memcpy(uip_ipv4_aligned_buf.u8,uip_aligned_buf.u8, uip_len);
 
@@ -109,6 +110,28 @@ pollhandler(void)
   }
 }
 
+/**
+ * Handle the frames which have arrived since the last wakeup.
+ *
+ * The tap device is edge triggered in the main loop, so it is read until it
+ * is empty. If the batch is used up first, the process polls itself to get
+ * the rest after the other pending events.
+ */
+static void
+pollhandler(void)
+{
+  int n;
+
+  for(n = 0; n < TAPDEV_RX_BATCH; n++) {
+    uip_len = tapdev_poll();
+    if(uip_len == 0) {
+      return;
+    }
+    input_frame();
+  }
+  process_poll(&tapdev_process);
+}
+
 static struct etimer arptimer;
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(tapdev_process, ev, data)
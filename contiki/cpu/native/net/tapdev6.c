@@ -69,6 +69,7 @@
 #include "ipv46_if_handler.h"
 #include "uip-debug.h"
 #include "ZIP_Router_logging.h"
+#include "zgw_poll.h"
 
 int net_fd;
 
@@ -84,32 +85,32 @@ u8_t tapdev_send(uip_lladdr_t *lladdr);
 #ifdef __linux
 static struct ifreq ifr;
 #endif
+/**
+ * Read the next frame into uip_buf.
+ *
+ * The device is non-blocking, so this returns 0 when all pending frames
+ * have been read.
+ */
 u16_t
 tapdev_poll(void)
 {
-  fd_set fdset;
-  struct timeval tv;
   int ret;
 
-  tv.tv_sec = 0;
-  tv.tv_usec = 0;
-
-  FD_ZERO(&fdset);
-  if(net_fd > 0) {
-    FD_SET(net_fd, &fdset);
-  }
-
-  ret = select(net_fd + 1, &fdset, NULL, NULL, &tv);
-
-  if(ret == 0) {
+  if(net_fd <= 0) {
     return 0;
   }
-  ret = read(net_fd, uip_buf, UIP_BUFSIZE);
+
+  do {
+    ret = read(net_fd, uip_buf, UIP_BUFSIZE);
+  } while(ret == -1 && errno == EINTR);
 
   //PRINTF("tapdev6: read %d bytes (max %d)\n", ret, UIP_BUFSIZE);
 
   if(ret == -1) {
-    perror("tapdev_poll: read");
+    if(errno != EAGAIN && errno != EWOULDBLOCK) {
+      perror("tapdev_poll: read");
+    }
+    return 0;
   }
 #define DROP_RX 0
 #if DROP_RX
@@ -200,6 +201,10 @@ tapdev_init(void)
     return;
   }
 
+  /* Frames are read until the device would block, so the main loop needs
+   * only one wakeup for a burst */
+  fcntl(net_fd, F_SETFL, fcntl(net_fd, F_GETFL) | O_NONBLOCK);
+
 #ifdef __linux
   {
     memset(&ifr, 0, sizeof(ifr));
@@ -268,6 +273,8 @@ u8_t do_send(void)
 
   ret = write(net_fd, uip_buf, uip_len);
   if(ret == -1) {
+    /* The device is non-blocking, a full queue drops the frame like a
+     * congested link would */
     perror("tap_dev: tapdev_send: write");
     //exit(1);
   }
@@ -319,6 +326,7 @@ tapdev_do_send(void)
 void
 tapdev_exit(void)
 {
+  zgw_poll_remove(net_fd);
   close(net_fd);
   system_net_hook(0);
 }
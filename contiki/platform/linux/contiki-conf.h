@@ -92,6 +92,9 @@ typedef unsigned long clock_time_t;
 
 
 #define PROCESS_CONF_NO_PROCESS_NAMES 0
+/* Grow the event queues instead of dropping events under load */
+#define PROCESS_CONF_NUMEVENTS_MAX    1024
+#define PROCESS_CONF_STATS            1
 #define ENERGEST_CONF_ON              0
 
 #ifdef PROJECT_CONF_H
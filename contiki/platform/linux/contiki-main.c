@@ -37,7 +37,6 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -55,6 +54,11 @@
 #include "zgw_backup.h"
 #include <stdlib.h>
 #include "serial_api_process.h"
+#include "zgw_poll.h"
+#include "zgw_metrics_server.h"
+#ifdef ZGW_LOG_RING
+#include "zgw_log_ring.h"
+#endif
 PROCINIT(&etimer_process);
 
 extern void set_landev_outputfunc(u8_t (* f)(uip_lladdr_t *a));
@@ -66,6 +70,7 @@ static int interrupted = 0;
 
 extern int net_fd;
 extern int serial_fd;
+extern const char* linux_conf_metrics_socket;
 
 void sigusr1_handler(int num)
 {
@@ -98,6 +103,35 @@ void exit_handler(int num)
   interrupted = 1;
 }
 
+/*---------------------------------------------------------------------------*/
+static void
+process_ready(int fd, void *user)
+{
+  process_poll((struct process *) user);
+}
+
+static void
+stdin_ready(int fd, void *user)
+{
+  char c;
+
+  if (interrupted) {
+    /* Stop reading, the line would keep the loop busy otherwise */
+    zgw_poll_remove(fd);
+    return;
+  }
+  if (read(fd, &c, 1) > 0) {
+    serial_line_input_byte(c);
+  }
+}
+
+static void
+watch_fd(int fd, int flags, struct process *p)
+{
+  if (fd > 0 && !zgw_poll_watched(fd)) {
+    zgw_poll_add(fd, flags, process_ready, p);
+  }
+}
 /*---------------------------------------------------------------------------*/
 int
 main(int argc, char** argv)
@@ -129,11 +163,24 @@ main(int argc, char** argv)
   /* Make standard output unbuffered. */
   setvbuf(stdout, (char *)NULL, _IONBF, 0);
 
-  while(1) {
-    fd_set fds;
-    int n;
-    struct timeval tv;
+#ifdef ZGW_LOG_RING
+  if (zgw_log_ring_start()) {
+    printf("Could not start the log writer, logging directly\n");
+  }
+#endif
+
+  if (zgw_poll_init()) {
+    printf("Could not set up the main loop\n");
+    return 1;
+  }
+  if (isatty(STDIN_FILENO)) {
+    zgw_poll_add(STDIN_FILENO, 0, stdin_ready, NULL);
+  }
+  if (linux_conf_metrics_socket && *linux_conf_metrics_socket) {
+    zgw_metrics_server_start(linux_conf_metrics_socket);
+  }
 
+  while(1) {
     /* Keep going as long as there are events on the event queue or poll has
      * been requested (process_run() processes one event every time it's called)
      */
@@ -157,43 +204,17 @@ main(int argc, char** argv)
       delay = 200;
     }
 
-    tv.tv_sec = delay / 1000;
-    tv.tv_usec = (delay % 1000)*1000;
+    /* The serial port and the tap device are opened by their processes, and
+     * the serial port is reopened when the module is reset. Closing them
+     * removes them from the registry, so add them again when they are back. */
+    watch_fd(serial_fd, 0, &serial_api_process);
+    /* The tap driver reads until the device is empty */
+    watch_fd(net_fd, ZGW_POLL_EDGE, &tapdev_process);
 
-    FD_ZERO(&fds);
-    if (isatty(STDIN_FILENO))
-    {
-       FD_SET(STDIN_FILENO, &fds);
-    }
-    FD_SET(serial_fd, &fds);
-    FD_SET(net_fd, &fds);
-
-    n = serial_fd > net_fd ? serial_fd : net_fd;
-    //printf("delay %i\n",delay);
-    if( select(n+1, &fds, NULL, NULL, &tv) > 0) {
-
-      if (FD_ISSET(net_fd, &fds)) {
-        process_poll(&tapdev_process);
-        //printf("net input\n");
-      }
-
-      if (FD_ISSET(serial_fd, &fds)) {
-        process_poll(&serial_api_process);
-        //printf("serial input\n");
-      }
-
-      if(FD_ISSET(STDIN_FILENO, &fds) && interrupted==0) {
-        char c;
-        //printf("stdin input\n");
-        if(read(STDIN_FILENO, &c, 1) > 0) {
-          serial_line_input_byte(c);
-        }
-      }
-    } else {
-      //printf("timeout %i\n",delay);
-    }
+    zgw_poll_wait(delay);
     etimer_request_poll();
   }
+  zgw_metrics_server_stop();
 
   return 0;
 }
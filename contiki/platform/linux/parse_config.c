@@ -38,6 +38,8 @@ extern char** prog_argv;
 const char* linux_conf_database_file;
 const char* linux_conf_provisioning_cfg_file;
 const char* linux_conf_provisioning_list_storage_file;
+const char* linux_conf_mb_journal_file;
+const char* linux_conf_metrics_socket;
 const char* linux_conf_tun_script;
 const char* linux_conf_fin_script;
 #ifdef NO_ZW_NVM
@@ -289,12 +291,18 @@ void ConfigInit()
     uiplib_ipaddrconv(config_get_val("ZipMBDestinationIp6", "0::0"), &(cfg.mb_destination));
 
     cfg.mb_conf_mode = atoi(config_get_val("ZipMBMode", "1"));
+    linux_conf_mb_journal_file = config_get_val("ZipMBJournalFile", NULL);
     if (cfg.mb_conf_mode == 1) {
       WRN_PRINTF("Mailbox is enabled\n");
     } else if (cfg.mb_conf_mode == 0) {
       WRN_PRINTF("Mailbox is disabled\n");
     }
 
+    cfg.max_parallel_probes = atoi(config_get_val("ZipMaxParallelProbes", "4"));
+    cfg.max_send_requests = atoi(config_get_val("ZipMaxSendRequests", "16"));
+    cfg.fw_update_window = atoi(config_get_val("ZipFwUpdateWindow", "32"));
+    linux_conf_metrics_socket = config_get_val("ZipMetricsSocket", NULL);
+
     cfg.node_identify_script = config_get_val("ZipNodeIdentifyScript", "zipgateway_node_identify_generic.sh");
 
     s = config_get_val("ZipPSK", "123456789012345678901234567890AA");
@@ -0,0 +1,464 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+/** @file zgw_log_ring.c
+ *
+ * \addtogroup zgw_log_ring
+ *
+ * The ring is a bounded multi-producer queue. Each record has a sequence
+ * number. A producer owns record i % N when its sequence number is i. It
+ * claims it by advancing ring_head, and hands it over to the writer by
+ * setting the sequence number to i + 1. The writer sets it to i + N when it
+ * has written the record, which makes it free for the next round.
+ *
+ * A frame record holds the formatted line followed by the binary frame. The
+ * hex formatting of the frame is left to the writer.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "zgw_log_ring.h"
+
+/** Time the writer sleeps when the ring is empty. */
+#define WRITER_IDLE_NS (10 * 1000 * 1000)
+/** Size of the buffer the writer formats lines into before writing them. */
+#define WRITER_BUF_SZ (4 * ZGW_LOG_RING_TEXT)
+/** Room for the color, timestamp and color reset of a line. */
+#define LINE_PREFIX_SZ 64
+/** Longest frame in hex. */
+#define FRAME_MAX_SZ (3 * ZGW_LOG_RING_FRAME + 8)
+/** Longest line written, with a frame in hex. */
+#define LINE_MAX_SZ (LINE_PREFIX_SZ + ZGW_LOG_RING_TEXT + FRAME_MAX_SZ)
+
+#define RING_MASK (ZGW_LOG_RING_RECORDS - 1)
+
+typedef struct log_record {
+  uint32_t seq;
+  uint8_t level;
+  uint16_t len;
+  /** Set if a frame follows the line. */
+  uint8_t has_frame;
+  /** Set if the frame was longer than \ref ZGW_LOG_RING_FRAME. */
+  uint8_t frame_cut;
+  /** Length of the frame after the line. */
+  uint16_t frame_len;
+  struct timeval tv;
+  char text[ZGW_LOG_RING_TEXT];
+} log_record_t;
+
+static log_record_t ring[ZGW_LOG_RING_RECORDS];
+/** Next record to be claimed by a producer. */
+static uint32_t ring_head;
+/** Next record to be written. Only used by the writer. */
+static uint32_t ring_tail;
+
+static unsigned long dropped_total;
+static uint32_t dropped_unreported;
+
+static int running;
+static int stopping;
+static pthread_t writer;
+
+static const char *level_color[] = {
+  [ZGW_LOG_RING_ERR] = "\033[31;1m",
+  [ZGW_LOG_RING_WRN] = "\033[33;1m",
+  [ZGW_LOG_RING_LOG] = "\033[32;1m",
+  [ZGW_LOG_RING_DBG] = "\033[34;1m",
+  [ZGW_LOG_RING_RAW] = "",
+};
+
+static const char color_reset[] = "\033[0m";
+
+/** Time of day of the last timestamp, so localtime is only done once a second. */
+static time_t tm_sec = -1;
+static struct tm tm_cache;
+
+/**
+ * Format a timestamp like "2020-01-31T12:00:00.000000+0100".
+ */
+static size_t
+format_time(char *buf, size_t sz, const struct timeval *tv)
+{
+  size_t len;
+
+  if (tv->tv_sec != tm_sec)
+  {
+    localtime_r(&tv->tv_sec, &tm_cache);
+    tm_sec = tv->tv_sec;
+  }
+  len = strftime(buf, sz, "%FT%T.", &tm_cache);
+  len += snprintf(buf + len, sz - len, "%.6u", (unsigned int) tv->tv_usec);
+  len += strftime(buf + len, sz - len, "%z", &tm_cache);
+  return len;
+}
+
+/**
+ * Format a frame like " [01 02 03]\n", or " [01 02 ...]\n" if it was cut.
+ */
+static size_t
+format_frame(char *buf, const uint8_t *frame, size_t len, int cut)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  size_t n = 0;
+  size_t i;
+
+  buf[n++] = ' ';
+  buf[n++] = '[';
+  for (i = 0; i < len; i++)
+  {
+    buf[n++] = hex[frame[i] >> 4];
+    buf[n++] = hex[frame[i] & 0xF];
+    buf[n++] = ' ';
+  }
+  if (cut)
+  {
+    memcpy(buf + n, "...", 3);
+    n += 3;
+  }
+  buf[n++] = ']';
+  buf[n++] = '\n';
+  return n;
+}
+
+/**
+ * Put a line in the writer buffer.
+ *
+ * \param r Record with the frame to write after the text, NULL if there is none.
+ */
+static size_t
+format_line(char *buf, zgw_log_ring_level_t level, const struct timeval *tv,
+            const char *text, size_t len, const log_record_t *r)
+{
+  size_t n;
+
+  if (level == ZGW_LOG_RING_RAW)
+  {
+    memcpy(buf, text, len);
+    return len;
+  }
+  n = strlen(level_color[level]);
+  memcpy(buf, level_color[level], n);
+  n += format_time(buf + n, LINE_PREFIX_SZ - n, tv);
+  buf[n++] = ' ';
+  memcpy(buf + n, text, len);
+  n += len;
+  if (r && r->has_frame)
+  {
+    n += format_frame(buf + n, (const uint8_t *) r->text + r->len, r->frame_len, r->frame_cut);
+  }
+  memcpy(buf + n, color_reset, sizeof(color_reset) - 1);
+  return n + sizeof(color_reset) - 1;
+}
+
+/**
+ * Write up to max records from the ring to stdout.
+ * \return Number of records written.
+ */
+static int
+ring_drain(int max)
+{
+  static char buf[WRITER_BUF_SZ + LINE_MAX_SZ];
+  size_t len = 0;
+  int n = 0;
+  uint32_t dropped;
+
+  while (n < max)
+  {
+    log_record_t *r = &ring[ring_tail & RING_MASK];
+
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != ring_tail + 1)
+    {
+      break;
+    }
+    len += format_line(buf + len, r->level, &r->tv, r->text, r->len, r);
+    __atomic_store_n(&r->seq, ring_tail + ZGW_LOG_RING_RECORDS, __ATOMIC_RELEASE);
+    ring_tail++;
+    n++;
+
+    if (len >= WRITER_BUF_SZ)
+    {
+      fwrite(buf, 1, len, stdout);
+      len = 0;
+    }
+  }
+
+  dropped = __atomic_exchange_n(&dropped_unreported, 0, __ATOMIC_RELAXED);
+  if (dropped)
+  {
+    struct timeval tv;
+    char text[64];
+    size_t text_len;
+
+    gettimeofday(&tv, NULL);
+    text_len = snprintf(text, sizeof(text), "%u log lines dropped\n", dropped);
+    len += format_line(buf + len, ZGW_LOG_RING_WRN, &tv, text, text_len, NULL);
+  }
+
+  if (len)
+  {
+    fwrite(buf, 1, len, stdout);
+  }
+  return n;
+}
+
+/**
+ * A forked child has no writer thread, so it writes its lines directly.
+ */
+static void
+fork_child(void)
+{
+  running = 0;
+}
+
+static void *
+writer_thread(void *arg)
+{
+  struct timespec idle = { 0, WRITER_IDLE_NS };
+  struct timespec now;
+  time_t second = 0;
+  int lines = 0;
+
+  (void) arg;
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec != second)
+    {
+      second = now.tv_sec;
+      lines = 0;
+    }
+    if (lines >= ZGW_LOG_RING_RATE)
+    {
+      /* Rate limited, wait for the next second */
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    int n = ring_drain(ZGW_LOG_RING_RATE - lines);
+    lines += n;
+    if (n == 0)
+    {
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+int
+zgw_log_ring_start(void)
+{
+  static int atexit_done = 0;
+  uint32_t i;
+
+  if (running)
+  {
+    return 0;
+  }
+  for (i = 0; i < ZGW_LOG_RING_RECORDS; i++)
+  {
+    ring[i].seq = i;
+  }
+  ring_head = 0;
+  ring_tail = 0;
+  stopping = 0;
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+  if (pthread_create(&writer, NULL, writer_thread, NULL))
+  {
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    return -1;
+  }
+  if (!atexit_done)
+  {
+    atexit(zgw_log_ring_stop);
+    pthread_atfork(NULL, NULL, fork_child);
+    atexit_done = 1;
+  }
+  return 0;
+}
+
+void
+zgw_log_ring_stop(void)
+{
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    return;
+  }
+  /* New lines are written directly from now on */
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+
+  while (ring_drain(ZGW_LOG_RING_RECORDS))
+    ;
+}
+
+/**
+ * Write a line directly, when the writer thread is not running.
+ */
+static void
+write_direct(zgw_log_ring_level_t level, const uint8_t *frame, size_t frame_len,
+             int frame_cut, const char *fmt, va_list ap)
+{
+  struct timeval tv;
+  char ts[LINE_PREFIX_SZ];
+  char hex[FRAME_MAX_SZ];
+
+  flockfile(stdout);
+  if (level != ZGW_LOG_RING_RAW)
+  {
+    gettimeofday(&tv, NULL);
+    format_time(ts, sizeof(ts), &tv);
+    fprintf(stdout, "%s%s ", level_color[level], ts);
+  }
+  vfprintf(stdout, fmt, ap);
+  if (frame)
+  {
+    fwrite(hex, 1, format_frame(hex, frame, frame_len, frame_cut), stdout);
+  }
+  if (level != ZGW_LOG_RING_RAW)
+  {
+    fputs(color_reset, stdout);
+  }
+  funlockfile(stdout);
+}
+
+/**
+ * Claim the next free record of the ring.
+ *
+ * \param pos Returns the position of the record, to be passed to ring_commit.
+ * \return The record, or NULL if the ring is full.
+ */
+static log_record_t *
+ring_claim(uint32_t *pos)
+{
+  log_record_t *r;
+  uint32_t seq;
+
+  *pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+  for (;;)
+  {
+    r = &ring[*pos & RING_MASK];
+    seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+    if (seq == *pos)
+    {
+      if (__atomic_compare_exchange_n(&ring_head, pos, *pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        return r;
+      }
+    }
+    else if ((int32_t) (seq - *pos) < 0)
+    {
+      /* Full */
+      __atomic_fetch_add(&dropped_total, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&dropped_unreported, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    else
+    {
+      *pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * Format the text of a record.
+ *
+ * \param room Room for the text in the record.
+ * \param line_break Keep a line break at the end of a truncated text.
+ */
+static void
+ring_format(log_record_t *r, size_t room, int line_break, const char *fmt, va_list ap)
+{
+  int len;
+
+  gettimeofday(&r->tv, NULL);
+  len = vsnprintf(r->text, room, fmt, ap);
+  if (len < 0)
+  {
+    len = 0;
+  }
+  else if (len >= room)
+  {
+    /* Truncated */
+    len = room - 1;
+    if (line_break)
+    {
+      r->text[len - 1] = '\n';
+    }
+  }
+  r->len = len;
+}
+
+/** Hand a record over to the writer. */
+static void
+ring_commit(log_record_t *r, uint32_t pos)
+{
+  __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void
+zgw_log_ring_printf(zgw_log_ring_level_t level, const char *fmt, ...)
+{
+  va_list ap;
+  log_record_t *r;
+  uint32_t pos;
+
+  va_start(ap, fmt);
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    write_direct(level, NULL, 0, 0, fmt, ap);
+  }
+  else if ((r = ring_claim(&pos)))
+  {
+    r->level = level;
+    r->has_frame = 0;
+    ring_format(r, sizeof(r->text), level != ZGW_LOG_RING_RAW, fmt, ap);
+    ring_commit(r, pos);
+  }
+  va_end(ap);
+}
+
+void
+zgw_log_ring_frame(zgw_log_ring_level_t level, const void *frame,
+                   unsigned int len, const char *fmt, ...)
+{
+  va_list ap;
+  log_record_t *r;
+  uint32_t pos;
+  int cut = 0;
+
+  if (len > ZGW_LOG_RING_FRAME)
+  {
+    len = ZGW_LOG_RING_FRAME;
+    cut = 1;
+  }
+
+  va_start(ap, fmt);
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    write_direct(level, frame, len, cut, fmt, ap);
+  }
+  else if ((r = ring_claim(&pos)))
+  {
+    r->level = level;
+    ring_format(r, sizeof(r->text) - ZGW_LOG_RING_FRAME, 0, fmt, ap);
+    memcpy(r->text + r->len, frame, len);
+    r->has_frame = 1;
+    r->frame_cut = cut;
+    r->frame_len = len;
+    ring_commit(r, pos);
+  }
+  va_end(ap);
+}
+
+unsigned long
+zgw_log_ring_dropped(void)
+{
+  return __atomic_load_n(&dropped_total, __ATOMIC_RELAXED);
+}
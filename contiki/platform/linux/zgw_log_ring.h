@@ -0,0 +1,100 @@
+/* © 2020 Silicon Laboratories Inc. */
+#ifndef _ZGW_LOG_RING_H_
+#define _ZGW_LOG_RING_H_
+
+/** \ingroup zgw_log
+ * \defgroup zgw_log_ring Asynchronous log output
+ *
+ * Log lines of \ref ERR_PRINTF and friends are put in a preallocated ring
+ * of records and written to stdout by a separate thread.
+ *
+ * The caller only formats the message and takes a timestamp. Formatting the
+ * time of day and writing to the console is done by the writer thread, so a
+ * slow console does not stall the event loop.
+ *
+ * If the ring is full, the line is dropped and counted. The writer reports
+ * the number of dropped lines when there is room again. The writer writes at
+ * most \ref ZGW_LOG_RING_RATE lines per second, so a log storm fills the ring
+ * and is dropped instead of keeping the console busy.
+ *
+ * Frames are put in the ring as binary, see \ref zgw_log_ring_frame. The
+ * writer thread formats them in hex.
+ *
+ * In the gateway sources, printf is routed through the ring as well, see
+ * ZIP_Router_logging.h, so it is written in order with the log lines. Output
+ * of code which does not include that header, e.g. Contiki debug output, is
+ * still written directly and can come out ahead of lines in the ring.
+ *
+ * Before \ref zgw_log_ring_start and after \ref zgw_log_ring_stop, lines are
+ * written directly, like without the ring.
+ * @{
+ */
+
+/** Number of records in the ring. Must be a power of 2. */
+#define ZGW_LOG_RING_RECORDS 512
+
+/** Longest message of a record. Longer messages are truncated. */
+#define ZGW_LOG_RING_TEXT 1000
+
+/** Longest frame of a record. Longer frames are cut. */
+#define ZGW_LOG_RING_FRAME 256
+
+/** Largest number of lines written per second. */
+#define ZGW_LOG_RING_RATE 2000
+
+/** Log levels of the ring, one for each of the log macros. */
+typedef enum {
+  ZGW_LOG_RING_ERR,
+  ZGW_LOG_RING_WRN,
+  ZGW_LOG_RING_LOG,
+  ZGW_LOG_RING_DBG,
+  /** Written as is, without timestamp, used for printf. */
+  ZGW_LOG_RING_RAW,
+} zgw_log_ring_level_t;
+
+/**
+ * Start the writer thread.
+ * \return 0 on success, -1 if the thread could not be started.
+ */
+int zgw_log_ring_start(void);
+
+/**
+ * Write out all lines in the ring and stop the writer thread.
+ */
+void zgw_log_ring_stop(void);
+
+/**
+ * Put a log line in the ring.
+ *
+ * Can be called from any thread.
+ *
+ * \param level Level of the line.
+ * \param fmt printf style format of the line.
+ */
+void zgw_log_ring_printf(zgw_log_ring_level_t level, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/**
+ * Put a log line followed by a frame in the ring.
+ *
+ * The frame is copied to the ring as is and written in hex by the writer,
+ * like "<line> [01 02 03]".
+ *
+ * \param level Level of the line.
+ * \param frame The frame.
+ * \param len Length of the frame.
+ * \param fmt printf style format of the line, without line break.
+ */
+void zgw_log_ring_frame(zgw_log_ring_level_t level, const void *frame,
+                        unsigned int len, const char *fmt, ...)
+  __attribute__((format(printf, 4, 5)));
+
+/**
+ * Number of lines dropped because the ring was full, since start.
+ */
+unsigned long zgw_log_ring_dropped(void);
+
+/**
+ * @}
+ */
+#endif
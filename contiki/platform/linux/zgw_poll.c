@@ -0,0 +1,209 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+/** @file zgw_poll.c
+ *
+ * \addtogroup zgw_poll
+ *
+ * The callbacks are looked up in the registry when the events are
+ * dispatched, so a callback may remove any descriptor, including the ones
+ * which are still to be dispatched in the same wait.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
+#include "zgw_poll.h"
+#include "ZIP_Router_logging.h"
+
+typedef struct poll_entry {
+  int fd;
+  int flags;
+  zgw_poll_callback_t cb;
+  void *user;
+} poll_entry_t;
+
+static poll_entry_t entries[ZGW_POLL_MAX_FDS];
+static int entry_count;
+
+#ifdef __linux__
+static int epoll_fd = -1;
+#endif
+
+static poll_entry_t *
+entry_of(int fd)
+{
+  int i;
+
+  for (i = 0; i < entry_count; i++)
+  {
+    if (entries[i].fd == fd)
+    {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void
+dispatch(int fd)
+{
+  poll_entry_t *e = entry_of(fd);
+
+  if (e)
+  {
+    e->cb(fd, e->user);
+  }
+}
+
+int
+zgw_poll_init(void)
+{
+  entry_count = 0;
+#ifdef __linux__
+  if (epoll_fd >= 0)
+  {
+    close(epoll_fd);
+  }
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0)
+  {
+    ERR_PRINTF("epoll_create1 failed: %s\n", strerror(errno));
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+int
+zgw_poll_add(int fd, int flags, zgw_poll_callback_t cb, void *user)
+{
+  poll_entry_t *e = entry_of(fd);
+#ifdef __linux__
+  struct epoll_event ev;
+  int op = e ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+#endif
+
+  if (fd < 0 || !cb)
+  {
+    return -1;
+  }
+  if (!e)
+  {
+    if (entry_count == ZGW_POLL_MAX_FDS)
+    {
+      ERR_PRINTF("No room for descriptor %d in the poll registry\n", fd);
+      return -1;
+    }
+    e = &entries[entry_count];
+  }
+
+#ifdef __linux__
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | ((flags & ZGW_POLL_EDGE) ? EPOLLET : 0);
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd, op, fd, &ev) < 0)
+  {
+    ERR_PRINTF("epoll_ctl of descriptor %d failed: %s\n", fd, strerror(errno));
+    return -1;
+  }
+#endif
+
+  if (e == &entries[entry_count])
+  {
+    entry_count++;
+  }
+  e->fd = fd;
+  e->flags = flags;
+  e->cb = cb;
+  e->user = user;
+  return 0;
+}
+
+void
+zgw_poll_remove(int fd)
+{
+  poll_entry_t *e = entry_of(fd);
+
+  if (!e)
+  {
+    return;
+  }
+#ifdef __linux__
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+  *e = entries[--entry_count];
+}
+
+int
+zgw_poll_watched(int fd)
+{
+  return entry_of(fd) != NULL;
+}
+
+#ifdef __linux__
+int
+zgw_poll_wait(clock_time_t timeout)
+{
+  struct epoll_event events[ZGW_POLL_MAX_FDS];
+  int n;
+  int i;
+
+  n = epoll_wait(epoll_fd, events, ZGW_POLL_MAX_FDS,
+                 (int) (timeout * 1000 / CLOCK_SECOND));
+  if (n < 0)
+  {
+    return (errno == EINTR) ? 0 : -1;
+  }
+  for (i = 0; i < n; i++)
+  {
+    dispatch(events[i].data.fd);
+  }
+  return n;
+}
+#else
+int
+zgw_poll_wait(clock_time_t timeout)
+{
+  fd_set fds;
+  struct timeval tv;
+  int fd[ZGW_POLL_MAX_FDS];
+  int count = entry_count;
+  int max_fd = -1;
+  int n;
+  int i;
+
+  /* Edge triggering is not available, the callbacks are just called
+   * as long as there is something to read */
+  FD_ZERO(&fds);
+  for (i = 0; i < count; i++)
+  {
+    fd[i] = entries[i].fd;
+    FD_SET(fd[i], &fds);
+    if (fd[i] > max_fd)
+    {
+      max_fd = fd[i];
+    }
+  }
+  tv.tv_sec = timeout / CLOCK_SECOND;
+  tv.tv_usec = (timeout % CLOCK_SECOND) * (1000000 / CLOCK_SECOND);
+
+  n = select(max_fd + 1, &fds, NULL, NULL, &tv);
+  if (n < 0)
+  {
+    return (errno == EINTR) ? 0 : -1;
+  }
+  for (i = 0; i < count; i++)
+  {
+    if (FD_ISSET(fd[i], &fds))
+    {
+      dispatch(fd[i]);
+    }
+  }
+  return n;
+}
+#endif
@@ -0,0 +1,77 @@
+/* © 2020 Silicon Laboratories Inc. */
+#ifndef _ZGW_POLL_H_
+#define _ZGW_POLL_H_
+
+#include "sys/clock.h"
+
+/**
+ * \defgroup zgw_poll File descriptor registry of the main loop
+ *
+ * Subsystems register the file descriptors they read from, each with a
+ * callback which is called from the main loop when the descriptor is
+ * readable. The main loop waits for all of them and for the next etimer in
+ * one call.
+ *
+ * On Linux the descriptors are kept in an epoll set, so the set is not
+ * rebuilt for every wait. Other platforms use select().
+ *
+ * A descriptor is level triggered by default: the callback is called as long
+ * as there is something to read. With \ref ZGW_POLL_EDGE the callback is only
+ * called when new data arrives, and must read until the descriptor would
+ * block.
+ * @{
+ */
+
+/** Largest number of descriptors in the registry. */
+#define ZGW_POLL_MAX_FDS 16
+
+/** Flag of \ref zgw_poll_add for edge triggered descriptors. */
+#define ZGW_POLL_EDGE 0x01
+
+/**
+ * Called from \ref zgw_poll_wait when fd is readable.
+ */
+typedef void (*zgw_poll_callback_t)(int fd, void *user);
+
+/**
+ * Set up the registry.
+ * \return 0 on success, -1 on failure.
+ */
+int zgw_poll_init(void);
+
+/**
+ * Add a descriptor to the registry, or change the callback of a descriptor
+ * which is already there.
+ *
+ * \param fd The descriptor.
+ * \param flags 0 or \ref ZGW_POLL_EDGE.
+ * \param cb Called when fd is readable.
+ * \param user Passed to cb.
+ * \return 0 on success, -1 on failure.
+ */
+int zgw_poll_add(int fd, int flags, zgw_poll_callback_t cb, void *user);
+
+/**
+ * Remove a descriptor from the registry. Must be called before the
+ * descriptor is closed.
+ */
+void zgw_poll_remove(int fd);
+
+/**
+ * Check if a descriptor is in the registry.
+ */
+int zgw_poll_watched(int fd);
+
+/**
+ * Wait until a descriptor is readable or the timeout expires, and call the
+ * callbacks of the readable descriptors.
+ *
+ * \param timeout Longest time to wait, in clock ticks.
+ * \return Number of descriptors which were readable, 0 on timeout, -1 on error.
+ */
+int zgw_poll_wait(clock_time_t timeout);
+
+/**
+ * @}
+ */
+#endif
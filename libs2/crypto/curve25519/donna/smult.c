@@ -0,0 +1,403 @@
+/* © 2020 Silicon Laboratories Inc.
+ */
+/*
+ * X25519 with 64 bit limbs, radix 2^51.
+ *
+ * Derived from curve25519-donna-c64 by Adam Langley, which is in turn
+ * derived from public domain code by D. J. Bernstein.
+ *
+ * This is a drop-in replacement for generic/smult.c on 64 bit targets.
+ * The field elements are five 51 bit limbs and products are formed in
+ * 128 bit integers, so a multiplication is 25 machine multiplications
+ * instead of the 1024 byte multiplications of the reference code.
+ *
+ * The ladder is constant time: every bit of the scalar goes through the
+ * same sequence of operations, and the points are swapped with masks.
+ */
+
+#ifndef ZWAVE_PSA_SECURE_VAULT
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __SIZEOF_INT128__
+#error "The donna X25519 backend needs a compiler with 128 bit integers"
+#endif
+
+typedef uint64_t limb;
+typedef limb felem[5];
+typedef unsigned __int128 uint128_t;
+
+#define LIMB_MASK 0x7ffffffffffffULL
+
+/* output += in */
+static inline void fsum(felem output, const felem in)
+{
+  output[0] += in[0];
+  output[1] += in[1];
+  output[2] += in[2];
+  output[3] += in[3];
+  output[4] += in[4];
+}
+
+/* out = in - out. Assumes that out[i] < 2^52 and in[i] < 2^52.
+ * 8 * p is added to keep the limbs positive. */
+static inline void fdifference_backwards(felem out, const felem in)
+{
+  static const limb two54m152 = (((limb) 1) << 54) - 152;
+  static const limb two54m8 = (((limb) 1) << 54) - 8;
+
+  out[0] = in[0] + two54m152 - out[0];
+  out[1] = in[1] + two54m8 - out[1];
+  out[2] = in[2] + two54m8 - out[2];
+  out[3] = in[3] + two54m8 - out[3];
+  out[4] = in[4] + two54m8 - out[4];
+}
+
+/* output = in * scalar */
+static inline void fscalar_product(felem output, const felem in, const limb scalar)
+{
+  uint128_t a;
+
+  a = ((uint128_t) in[0]) * scalar;
+  output[0] = ((limb) a) & LIMB_MASK;
+
+  a = ((uint128_t) in[1]) * scalar + ((limb) (a >> 51));
+  output[1] = ((limb) a) & LIMB_MASK;
+
+  a = ((uint128_t) in[2]) * scalar + ((limb) (a >> 51));
+  output[2] = ((limb) a) & LIMB_MASK;
+
+  a = ((uint128_t) in[3]) * scalar + ((limb) (a >> 51));
+  output[3] = ((limb) a) & LIMB_MASK;
+
+  a = ((uint128_t) in[4]) * scalar + ((limb) (a >> 51));
+  output[4] = ((limb) a) & LIMB_MASK;
+
+  output[0] += (limb) (a >> 51) * 19;
+}
+
+/* output = in2 * in. output may alias the inputs.
+ * Assumes that in[i] < 2^55 and likewise for in2. On return, output[i] < 2^52. */
+static inline void fmul(felem output, const felem in2, const felem in)
+{
+  uint128_t t[5];
+  limb r0, r1, r2, r3, r4, s0, s1, s2, s3, s4, c;
+
+  r0 = in[0];
+  r1 = in[1];
+  r2 = in[2];
+  r3 = in[3];
+  r4 = in[4];
+
+  s0 = in2[0];
+  s1 = in2[1];
+  s2 = in2[2];
+  s3 = in2[3];
+  s4 = in2[4];
+
+  t[0] = ((uint128_t) r0) * s0;
+  t[1] = ((uint128_t) r0) * s1 + ((uint128_t) r1) * s0;
+  t[2] = ((uint128_t) r0) * s2 + ((uint128_t) r2) * s0 + ((uint128_t) r1) * s1;
+  t[3] = ((uint128_t) r0) * s3 + ((uint128_t) r3) * s0 + ((uint128_t) r1) * s2
+         + ((uint128_t) r2) * s1;
+  t[4] = ((uint128_t) r0) * s4 + ((uint128_t) r4) * s0 + ((uint128_t) r3) * s1
+         + ((uint128_t) r1) * s3 + ((uint128_t) r2) * s2;
+
+  /* 2^255 = 19 mod p */
+  r4 *= 19;
+  r1 *= 19;
+  r2 *= 19;
+  r3 *= 19;
+
+  t[0] += ((uint128_t) r4) * s1 + ((uint128_t) r1) * s4 + ((uint128_t) r2) * s3
+          + ((uint128_t) r3) * s2;
+  t[1] += ((uint128_t) r4) * s2 + ((uint128_t) r2) * s4 + ((uint128_t) r3) * s3;
+  t[2] += ((uint128_t) r4) * s3 + ((uint128_t) r3) * s4;
+  t[3] += ((uint128_t) r4) * s4;
+
+  r0 = (limb) t[0] & LIMB_MASK; c = (limb) (t[0] >> 51);
+  t[1] += c; r1 = (limb) t[1] & LIMB_MASK; c = (limb) (t[1] >> 51);
+  t[2] += c; r2 = (limb) t[2] & LIMB_MASK; c = (limb) (t[2] >> 51);
+  t[3] += c; r3 = (limb) t[3] & LIMB_MASK; c = (limb) (t[3] >> 51);
+  t[4] += c; r4 = (limb) t[4] & LIMB_MASK; c = (limb) (t[4] >> 51);
+  r0 += c * 19; c = r0 >> 51; r0 = r0 & LIMB_MASK;
+  r1 += c; c = r1 >> 51; r1 = r1 & LIMB_MASK;
+  r2 += c;
+
+  output[0] = r0;
+  output[1] = r1;
+  output[2] = r2;
+  output[3] = r3;
+  output[4] = r4;
+}
+
+/* output = in^(2^count). output may alias in. Same bounds as fmul(). */
+static inline void fsquare_times(felem output, const felem in, limb count)
+{
+  uint128_t t[5];
+  limb r0, r1, r2, r3, r4, c;
+  limb d0, d1, d2, d4, d419;
+
+  r0 = in[0];
+  r1 = in[1];
+  r2 = in[2];
+  r3 = in[3];
+  r4 = in[4];
+
+  do {
+    d0 = r0 * 2;
+    d1 = r1 * 2;
+    d2 = r2 * 2 * 19;
+    d419 = r4 * 19;
+    d4 = d419 * 2;
+
+    t[0] = ((uint128_t) r0) * r0 + ((uint128_t) d4) * r1 + ((uint128_t) d2) * r3;
+    t[1] = ((uint128_t) d0) * r1 + ((uint128_t) d4) * r2 + ((uint128_t) r3) * (r3 * 19);
+    t[2] = ((uint128_t) d0) * r2 + ((uint128_t) r1) * r1 + ((uint128_t) d4) * r3;
+    t[3] = ((uint128_t) d0) * r3 + ((uint128_t) d1) * r2 + ((uint128_t) r4) * d419;
+    t[4] = ((uint128_t) d0) * r4 + ((uint128_t) d1) * r3 + ((uint128_t) r2) * r2;
+
+    r0 = (limb) t[0] & LIMB_MASK; c = (limb) (t[0] >> 51);
+    t[1] += c; r1 = (limb) t[1] & LIMB_MASK; c = (limb) (t[1] >> 51);
+    t[2] += c; r2 = (limb) t[2] & LIMB_MASK; c = (limb) (t[2] >> 51);
+    t[3] += c; r3 = (limb) t[3] & LIMB_MASK; c = (limb) (t[3] >> 51);
+    t[4] += c; r4 = (limb) t[4] & LIMB_MASK; c = (limb) (t[4] >> 51);
+    r0 += c * 19; c = r0 >> 51; r0 = r0 & LIMB_MASK;
+    r1 += c; c = r1 >> 51; r1 = r1 & LIMB_MASK;
+    r2 += c;
+  } while (--count);
+
+  output[0] = r0;
+  output[1] = r1;
+  output[2] = r2;
+  output[3] = r3;
+  output[4] = r4;
+}
+
+static limb load_limb(const uint8_t *in)
+{
+  return ((limb) in[0])
+         | (((limb) in[1]) << 8)
+         | (((limb) in[2]) << 16)
+         | (((limb) in[3]) << 24)
+         | (((limb) in[4]) << 32)
+         | (((limb) in[5]) << 40)
+         | (((limb) in[6]) << 48)
+         | (((limb) in[7]) << 56);
+}
+
+static void store_limb(uint8_t *out, limb in)
+{
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    out[i] = in & 0xff;
+    in >>= 8;
+  }
+}
+
+/* Expand a little endian, 32 byte number to limbs.
+ *
+ * The reference implementation reads all 256 bits, so bit 255 is not
+ * dropped as in RFC 7748, but added as 2^255 = 19 mod p. This keeps the
+ * results identical to generic/smult.c for every input. */
+static void fexpand(felem output, const uint8_t *in)
+{
+  output[0] = load_limb(in) & LIMB_MASK;
+  output[1] = (load_limb(in + 6) >> 3) & LIMB_MASK;
+  output[2] = (load_limb(in + 12) >> 6) & LIMB_MASK;
+  output[3] = (load_limb(in + 19) >> 1) & LIMB_MASK;
+  output[4] = (load_limb(in + 24) >> 12) & LIMB_MASK;
+  output[0] += 19 * (limb) (in[31] >> 7);
+}
+
+/* Store the fully reduced value of input as a little endian, 32 byte number. */
+static void fcontract(uint8_t *output, const felem input)
+{
+  uint128_t t[5];
+
+  t[0] = input[0];
+  t[1] = input[1];
+  t[2] = input[2];
+  t[3] = input[3];
+  t[4] = input[4];
+
+  t[1] += t[0] >> 51; t[0] &= LIMB_MASK;
+  t[2] += t[1] >> 51; t[1] &= LIMB_MASK;
+  t[3] += t[2] >> 51; t[2] &= LIMB_MASK;
+  t[4] += t[3] >> 51; t[3] &= LIMB_MASK;
+  t[0] += 19 * (t[4] >> 51); t[4] &= LIMB_MASK;
+
+  t[1] += t[0] >> 51; t[0] &= LIMB_MASK;
+  t[2] += t[1] >> 51; t[1] &= LIMB_MASK;
+  t[3] += t[2] >> 51; t[2] &= LIMB_MASK;
+  t[4] += t[3] >> 51; t[3] &= LIMB_MASK;
+  t[0] += 19 * (t[4] >> 51); t[4] &= LIMB_MASK;
+
+  /* t is now between 0 and 2^255-1. Add 19 so that values of p and above
+   * carry out of bit 255 */
+  t[0] += 19;
+
+  t[1] += t[0] >> 51; t[0] &= LIMB_MASK;
+  t[2] += t[1] >> 51; t[1] &= LIMB_MASK;
+  t[3] += t[2] >> 51; t[2] &= LIMB_MASK;
+  t[4] += t[3] >> 51; t[3] &= LIMB_MASK;
+  t[0] += 19 * (t[4] >> 51); t[4] &= LIMB_MASK;
+
+  /* t is now between 19 and 2^255-1, offset by 19. Add 2^255 - 19 and
+   * drop bit 255 to remove the offset. */
+  t[0] += 0x8000000000000ULL - 19;
+  t[1] += 0x8000000000000ULL - 1;
+  t[2] += 0x8000000000000ULL - 1;
+  t[3] += 0x8000000000000ULL - 1;
+  t[4] += 0x8000000000000ULL - 1;
+
+  t[1] += t[0] >> 51; t[0] &= LIMB_MASK;
+  t[2] += t[1] >> 51; t[1] &= LIMB_MASK;
+  t[3] += t[2] >> 51; t[2] &= LIMB_MASK;
+  t[4] += t[3] >> 51; t[3] &= LIMB_MASK;
+  t[4] &= LIMB_MASK;
+
+  store_limb(output, (limb) (t[0] | (t[1] << 51)));
+  store_limb(output + 8, (limb) ((t[1] >> 13) | (t[2] << 38)));
+  store_limb(output + 16, (limb) ((t[2] >> 26) | (t[3] << 25)));
+  store_limb(output + 24, (limb) ((t[3] >> 39) | (t[4] << 12)));
+}
+
+/* One step of the Montgomery ladder.
+ *
+ * x2, z2: output 2Q
+ * x3, z3: output Q + Q'
+ * x, z: input Q, destroyed
+ * xprime, zprime: input Q', destroyed
+ * qmqp: input Q - Q'
+ */
+static void fmonty(felem x2, felem z2, felem x3, felem z3,
+                   felem x, felem z, felem xprime, felem zprime,
+                   const felem qmqp)
+{
+  felem origx, origxprime, zzz, xx, zz, xxprime, zzprime, zzzprime;
+
+  memcpy(origx, x, sizeof(felem));
+  fsum(x, z);
+  fdifference_backwards(z, origx);
+
+  memcpy(origxprime, xprime, sizeof(felem));
+  fsum(xprime, zprime);
+  fdifference_backwards(zprime, origxprime);
+  fmul(xxprime, xprime, z);
+  fmul(zzprime, x, zprime);
+  memcpy(origxprime, xxprime, sizeof(felem));
+  fsum(xxprime, zzprime);
+  fdifference_backwards(zzprime, origxprime);
+  fsquare_times(x3, xxprime, 1);
+  fsquare_times(zzzprime, zzprime, 1);
+  fmul(z3, zzzprime, qmqp);
+
+  fsquare_times(xx, x, 1);
+  fsquare_times(zz, z, 1);
+  fmul(x2, xx, zz);
+  fdifference_backwards(zz, xx);
+  fscalar_product(zzz, zz, 121665);
+  fsum(zzz, xx);
+  fmul(z2, zz, zzz);
+}
+
+/* Swap a and b if iswap is 1, leave them if iswap is 0, in constant time. */
+static void swap_conditional(felem a, felem b, limb iswap)
+{
+  const limb swap = -iswap;
+  unsigned i;
+
+  for (i = 0; i < 5; ++i) {
+    const limb x = swap & (a[i] ^ b[i]);
+    a[i] ^= x;
+    b[i] ^= x;
+  }
+}
+
+/* resultx/resultz = n * q */
+static void cmult(felem resultx, felem resultz, const uint8_t *n, const felem q)
+{
+  felem a = {0}, b = {1}, c = {1}, d = {0};
+  felem e = {0}, f = {1}, g = {0}, h = {1};
+  limb *nqpqx = a, *nqpqz = b, *nqx = c, *nqz = d, *t;
+  limb *nqpqx2 = e, *nqpqz2 = f, *nqx2 = g, *nqz2 = h;
+  unsigned i, j;
+
+  memcpy(nqpqx, q, sizeof(felem));
+
+  for (i = 0; i < 32; ++i) {
+    uint8_t byte = n[31 - i];
+    for (j = 0; j < 8; ++j) {
+      const limb bit = byte >> 7;
+
+      swap_conditional(nqx, nqpqx, bit);
+      swap_conditional(nqz, nqpqz, bit);
+      fmonty(nqx2, nqz2, nqpqx2, nqpqz2, nqx, nqz, nqpqx, nqpqz, q);
+      swap_conditional(nqx2, nqpqx2, bit);
+      swap_conditional(nqz2, nqpqz2, bit);
+
+      t = nqx; nqx = nqx2; nqx2 = t;
+      t = nqz; nqz = nqz2; nqz2 = t;
+      t = nqpqx; nqpqx = nqpqx2; nqpqx2 = t;
+      t = nqpqz; nqpqz = nqpqz2; nqpqz2 = t;
+
+      byte <<= 1;
+    }
+  }
+
+  memcpy(resultx, nqx, sizeof(felem));
+  memcpy(resultz, nqz, sizeof(felem));
+}
+
+/* out = z^(p-2) = 1/z */
+static void crecip(felem out, const felem z)
+{
+  felem a, t0, b, c;
+
+  /* 2 */ fsquare_times(a, z, 1);
+  /* 8 */ fsquare_times(t0, a, 2);
+  /* 9 */ fmul(b, t0, z);
+  /* 11 */ fmul(a, b, a);
+  /* 22 */ fsquare_times(t0, a, 1);
+  /* 2^5 - 2^0 = 31 */ fmul(b, t0, b);
+  /* 2^10 - 2^5 */ fsquare_times(t0, b, 5);
+  /* 2^10 - 2^0 */ fmul(b, t0, b);
+  /* 2^20 - 2^10 */ fsquare_times(t0, b, 10);
+  /* 2^20 - 2^0 */ fmul(c, t0, b);
+  /* 2^40 - 2^20 */ fsquare_times(t0, c, 20);
+  /* 2^40 - 2^0 */ fmul(t0, t0, c);
+  /* 2^50 - 2^10 */ fsquare_times(t0, t0, 10);
+  /* 2^50 - 2^0 */ fmul(b, t0, b);
+  /* 2^100 - 2^50 */ fsquare_times(t0, b, 50);
+  /* 2^100 - 2^0 */ fmul(c, t0, b);
+  /* 2^200 - 2^100 */ fsquare_times(t0, c, 100);
+  /* 2^200 - 2^0 */ fmul(t0, t0, c);
+  /* 2^250 - 2^50 */ fsquare_times(t0, t0, 50);
+  /* 2^250 - 2^0 */ fmul(t0, t0, b);
+  /* 2^255 - 2^5 */ fsquare_times(t0, t0, 5);
+  /* 2^255 - 21 */ fmul(out, t0, a);
+}
+
+int crypto_scalarmult_curve25519(unsigned char *q,
+  const unsigned char *n,
+  const unsigned char *p)
+{
+  felem bp, x, z, zmone;
+  unsigned char e[32];
+  unsigned int i;
+
+  for (i = 0;i < 32;++i) e[i] = n[i];
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+
+  fexpand(bp, p);
+  cmult(x, z, e, bp);
+  crecip(zmone, z);
+  fmul(z, x, zmone);
+  fcontract(q, z);
+  return 0;
+}
+#endif
@@ -0,0 +1,350 @@
+/* © 2020 Silicon Laboratories Inc.
+ */
+/*
+ * X25519 with 32 bit limbs, radix 2^25.5.
+ *
+ * Derived from curve25519-donna by Adam Langley, which is in turn derived
+ * from public domain code by D. J. Bernstein.
+ *
+ * This is a drop-in replacement for generic/smult.c on 32 bit targets,
+ * where donna/smult.c is not available. The field elements are ten limbs
+ * of alternately 26 and 25 bits, limb i holding bits ceil(25.5 * i) and
+ * up. Limbs are kept unsigned: subtraction adds 2 * p first. Every
+ * product is a 32 x 32 -> 64 bit multiplication, so a field multiplication
+ * is 100 machine multiplications.
+ *
+ * Bounds: the limbs of the inputs of fmul() are below 2^27.6, so each of
+ * the ten terms of an output coefficient is below 38 * 2^55.2 and their
+ * sum fits in 64 bits. The outputs of fmul() and fscalar_product() have
+ * limbs below 2^26 + 2^18.
+ *
+ * The ladder is constant time: every bit of the scalar goes through the
+ * same sequence of operations, and the points are swapped with masks.
+ */
+
+#ifndef ZWAVE_PSA_SECURE_VAULT
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t limb;
+typedef limb felem[10];
+
+#define MASK26 0x3ffffffU
+#define MASK25 0x1ffffffU
+
+/* Width and mask of limb i */
+#define LIMB_BITS(i) (((i) & 1) ? 25 : 26)
+#define LIMB_MASK(i) (((i) & 1) ? MASK25 : MASK26)
+
+/* output += in */
+static inline void fsum(felem output, const felem in)
+{
+  unsigned i;
+
+  for (i = 0; i < 10; i++) {
+    output[i] += in[i];
+  }
+}
+
+/* out = in - out. Assumes that the limbs of out are below 2^26 + 2^18.
+ * 2 * p is added to keep the limbs positive. */
+static inline void fdifference_backwards(felem out, const felem in)
+{
+  unsigned i;
+
+  out[0] = in[0] + ((MASK26 - 18) << 1) - out[0];
+  for (i = 1; i < 10; i++) {
+    out[i] = in[i] + (LIMB_MASK(i) << 1) - out[i];
+  }
+}
+
+/* Carry the 64 bit coefficients t into the limbs of output, and reduce the
+ * carry out of the top limb with 2^255 = 19 mod p. */
+static inline void freduce(felem output, uint64_t t[10])
+{
+  uint64_t c;
+  unsigned i;
+
+  for (i = 0; i < 9; i++) {
+    t[i + 1] += t[i] >> LIMB_BITS(i);
+    t[i] &= LIMB_MASK(i);
+  }
+  c = t[9] >> 25;
+  t[9] &= MASK25;
+  t[0] += c * 19;
+  t[1] += t[0] >> 26;
+  t[0] &= MASK26;
+
+  for (i = 0; i < 10; i++) {
+    output[i] = (limb) t[i];
+  }
+}
+
+/* output = in * scalar */
+static inline void fscalar_product(felem output, const felem in, const limb scalar)
+{
+  uint64_t t[10];
+  unsigned i;
+
+  for (i = 0; i < 10; i++) {
+    t[i] = ((uint64_t) in[i]) * scalar;
+  }
+  freduce(output, t);
+}
+
+/* output = in2 * in. output may alias the inputs.
+ * Assumes that the limbs of the inputs are below 2^27.6. */
+static void fmul(felem output, const felem in2, const felem in)
+{
+  uint64_t t[10] = {0};
+  limb a2[10], b19[10];
+  unsigned i, j;
+
+  for (i = 0; i < 10; i++) {
+    a2[i] = in2[i] << 1;
+    b19[i] = in[i] * 19;
+  }
+
+  /* Two odd limbs multiply to one bit above the even limb they land in,
+   * so their product is doubled. Products at limb 10 and above wrap
+   * around to limb 0 times 2^255 = 19. */
+  for (i = 0; i < 10; i++) {
+    const limb a = (i & 1) ? a2[i] : in2[i];
+
+    for (j = 0; j < 10 - i; j++) {
+      t[i + j] += ((uint64_t) ((i & j & 1) ? a : in2[i])) * in[j];
+    }
+    for (; j < 10; j++) {
+      t[i + j - 10] += ((uint64_t) ((i & j & 1) ? a : in2[i])) * b19[j];
+    }
+  }
+  freduce(output, t);
+}
+
+/* output = in^(2^count). output may alias in. Same bounds as fmul(). */
+static void fsquare_times(felem output, const felem in, unsigned count)
+{
+  memcpy(output, in, sizeof(felem));
+  do {
+    fmul(output, output, output);
+  } while (--count);
+}
+
+static limb load_4(const uint8_t *in)
+{
+  return ((limb) in[0])
+         | (((limb) in[1]) << 8)
+         | (((limb) in[2]) << 16)
+         | (((limb) in[3]) << 24);
+}
+
+/* Expand a little endian, 32 byte number to limbs.
+ *
+ * The reference implementation reads all 256 bits, so bit 255 is not
+ * dropped as in RFC 7748, but added as 2^255 = 19 mod p. This keeps the
+ * results identical to generic/smult.c for every input. */
+static void fexpand(felem output, const uint8_t *in)
+{
+  output[0] = load_4(in) & MASK26;
+  output[1] = (load_4(in + 3) >> 2) & MASK25;
+  output[2] = (load_4(in + 6) >> 3) & MASK26;
+  output[3] = (load_4(in + 9) >> 5) & MASK25;
+  output[4] = (load_4(in + 12) >> 6) & MASK26;
+  output[5] = load_4(in + 16) & MASK25;
+  output[6] = (load_4(in + 19) >> 1) & MASK26;
+  output[7] = (load_4(in + 22) >> 3) & MASK25;
+  output[8] = (load_4(in + 25) >> 4) & MASK26;
+  output[9] = (load_4(in + 28) >> 6) & MASK25;
+  output[0] += 19 * (limb) (in[31] >> 7);
+}
+
+/* One carry pass over t. If wrap is set, the carry out of the top limb is
+ * added to limb 0 as 2^255 = 19 mod p, otherwise it is dropped. */
+static void fcarry(limb t[10], int wrap)
+{
+  unsigned i;
+
+  for (i = 0; i < 9; i++) {
+    t[i + 1] += t[i] >> LIMB_BITS(i);
+    t[i] &= LIMB_MASK(i);
+  }
+  if (wrap) {
+    t[0] += 19 * (t[9] >> 25);
+  }
+  t[9] &= MASK25;
+}
+
+/* Store the fully reduced value of input as a little endian, 32 byte number. */
+static void fcontract(uint8_t *output, const felem input)
+{
+  limb t[10];
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  unsigned i;
+
+  memcpy(t, input, sizeof(t));
+  fcarry(t, 1);
+  fcarry(t, 1);
+
+  /* t is now between 0 and 2^255-1. Add 19 so that values of p and above
+   * carry out of bit 255 */
+  t[0] += 19;
+  fcarry(t, 1);
+
+  /* t is now between 19 and 2^255-1, offset by 19. Add 2^255 - 19 and
+   * drop bit 255 to remove the offset. */
+  t[0] += MASK26 + 1 - 19;
+  for (i = 1; i < 10; i++) {
+    t[i] += LIMB_MASK(i);
+  }
+  fcarry(t, 0);
+
+  for (i = 0; i < 10; i++) {
+    acc |= ((uint64_t) t[i]) << bits;
+    bits += LIMB_BITS(i);
+    while (bits >= 8) {
+      *output++ = (uint8_t) acc;
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+  *output = (uint8_t) acc;
+}
+
+/* One step of the Montgomery ladder.
+ *
+ * x2, z2: output 2Q
+ * x3, z3: output Q + Q'
+ * x, z: input Q, destroyed
+ * xprime, zprime: input Q', destroyed
+ * qmqp: input Q - Q'
+ */
+static void fmonty(felem x2, felem z2, felem x3, felem z3,
+                   felem x, felem z, felem xprime, felem zprime,
+                   const felem qmqp)
+{
+  felem origx, origxprime, zzz, xx, zz, xxprime, zzprime, zzzprime;
+
+  memcpy(origx, x, sizeof(felem));
+  fsum(x, z);
+  fdifference_backwards(z, origx);
+
+  memcpy(origxprime, xprime, sizeof(felem));
+  fsum(xprime, zprime);
+  fdifference_backwards(zprime, origxprime);
+  fmul(xxprime, xprime, z);
+  fmul(zzprime, x, zprime);
+  memcpy(origxprime, xxprime, sizeof(felem));
+  fsum(xxprime, zzprime);
+  fdifference_backwards(zzprime, origxprime);
+  fsquare_times(x3, xxprime, 1);
+  fsquare_times(zzzprime, zzprime, 1);
+  fmul(z3, zzzprime, qmqp);
+
+  fsquare_times(xx, x, 1);
+  fsquare_times(zz, z, 1);
+  fmul(x2, xx, zz);
+  fdifference_backwards(zz, xx);
+  fscalar_product(zzz, zz, 121665);
+  fsum(zzz, xx);
+  fmul(z2, zz, zzz);
+}
+
+/* Swap a and b if iswap is 1, leave them if iswap is 0, in constant time. */
+static void swap_conditional(felem a, felem b, limb iswap)
+{
+  const limb swap = -iswap;
+  unsigned i;
+
+  for (i = 0; i < 10; ++i) {
+    const limb x = swap & (a[i] ^ b[i]);
+    a[i] ^= x;
+    b[i] ^= x;
+  }
+}
+
+/* resultx/resultz = n * q */
+static void cmult(felem resultx, felem resultz, const uint8_t *n, const felem q)
+{
+  felem a = {0}, b = {1}, c = {1}, d = {0};
+  felem e = {0}, f = {1}, g = {0}, h = {1};
+  limb *nqpqx = a, *nqpqz = b, *nqx = c, *nqz = d, *t;
+  limb *nqpqx2 = e, *nqpqz2 = f, *nqx2 = g, *nqz2 = h;
+  unsigned i, j;
+
+  memcpy(nqpqx, q, sizeof(felem));
+
+  for (i = 0; i < 32; ++i) {
+    uint8_t byte = n[31 - i];
+    for (j = 0; j < 8; ++j) {
+      const limb bit = byte >> 7;
+
+      swap_conditional(nqx, nqpqx, bit);
+      swap_conditional(nqz, nqpqz, bit);
+      fmonty(nqx2, nqz2, nqpqx2, nqpqz2, nqx, nqz, nqpqx, nqpqz, q);
+      swap_conditional(nqx2, nqpqx2, bit);
+      swap_conditional(nqz2, nqpqz2, bit);
+
+      t = nqx; nqx = nqx2; nqx2 = t;
+      t = nqz; nqz = nqz2; nqz2 = t;
+      t = nqpqx; nqpqx = nqpqx2; nqpqx2 = t;
+      t = nqpqz; nqpqz = nqpqz2; nqpqz2 = t;
+
+      byte <<= 1;
+    }
+  }
+
+  memcpy(resultx, nqx, sizeof(felem));
+  memcpy(resultz, nqz, sizeof(felem));
+}
+
+/* out = z^(p-2) = 1/z */
+static void crecip(felem out, const felem z)
+{
+  felem a, t0, b, c;
+
+  /* 2 */ fsquare_times(a, z, 1);
+  /* 8 */ fsquare_times(t0, a, 2);
+  /* 9 */ fmul(b, t0, z);
+  /* 11 */ fmul(a, b, a);
+  /* 22 */ fsquare_times(t0, a, 1);
+  /* 2^5 - 2^0 = 31 */ fmul(b, t0, b);
+  /* 2^10 - 2^5 */ fsquare_times(t0, b, 5);
+  /* 2^10 - 2^0 */ fmul(b, t0, b);
+  /* 2^20 - 2^10 */ fsquare_times(t0, b, 10);
+  /* 2^20 - 2^0 */ fmul(c, t0, b);
+  /* 2^40 - 2^20 */ fsquare_times(t0, c, 20);
+  /* 2^40 - 2^0 */ fmul(t0, t0, c);
+  /* 2^50 - 2^10 */ fsquare_times(t0, t0, 10);
+  /* 2^50 - 2^0 */ fmul(b, t0, b);
+  /* 2^100 - 2^50 */ fsquare_times(t0, b, 50);
+  /* 2^100 - 2^0 */ fmul(c, t0, b);
+  /* 2^200 - 2^100 */ fsquare_times(t0, c, 100);
+  /* 2^200 - 2^0 */ fmul(t0, t0, c);
+  /* 2^250 - 2^50 */ fsquare_times(t0, t0, 50);
+  /* 2^250 - 2^0 */ fmul(t0, t0, b);
+  /* 2^255 - 2^5 */ fsquare_times(t0, t0, 5);
+  /* 2^255 - 21 */ fmul(out, t0, a);
+}
+
+int crypto_scalarmult_curve25519(unsigned char *q,
+  const unsigned char *n,
+  const unsigned char *p)
+{
+  felem bp, x, z, zmone;
+  unsigned char e[32];
+  unsigned int i;
+
+  for (i = 0;i < 32;++i) e[i] = n[i];
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+
+  fexpand(bp, p);
+  cmult(x, z, e, bp);
+  crecip(zmone, z);
+  fmul(z, x, zmone);
+  fcontract(q, z);
+  return 0;
+}
+#endif
@@ -200,7 +200,8 @@ typedef uint8_t network_key_t[16];
 
 /**
  * Send singlecast security s2 encrypted frame. Upon completion this call will call \ref S2_send_done_event. Only one transmission
- * may be active at a time. If this function is called twice without waiting to the S2_send_done_event it will return false
+ * may be active at a time to a destination, and no more than S2_TX_SESSIONS in total. If this function is called twice for the
+ * same destination without waiting to the S2_send_done_event it will return false
  *
  * \param ctxt   the security context.
  * \param peer   transmit parameters, destination node, ack req etc. see \ref s2_connection_t
@@ -215,7 +216,9 @@ uint8_t S2_send_data(struct S2* ctxt, s2_connection_t* peer ,const uint8_t* buf,
 /**
 * Check if S2 is ready to receive a new frame for transmission
 *
-* Use to ensure S2_send_data will accept a frame before calling it.
+* Use to ensure S2_send_data will accept a frame before calling it. When libs2
+* has more than one transmit session, the frame is accepted if there is no
+* transmission in progress to the same destination, see \ref S2_tx_session_find.
 * \param[in] ctxt The S2 context
 * \return False if the S2_send_data method will accept a new frame for transmission
 */
@@ -350,6 +353,71 @@ void S2_timeout_notify(struct S2* ctxt);
  */
 void S2_send_frame_done_notify(struct S2* ctxt, s2_tx_status_t status,uint16_t tx_time);
 
+/** Returned by \ref S2_tx_session_find when no session can take a frame. */
+#define S2_TX_SESSION_NONE 0xFF
+
+/**
+ * Transmit session which the current call into the glue layer is made for.
+ *
+ * Transmissions to different destinations may be in progress at the same time,
+ * each in its own transmit session. The glue layer must keep a timer for each
+ * session, and it must tell which session a frame was sent for when it
+ * notifies that the frame is done. Calls to \ref S2_send_frame, \ref S2_set_timeout,
+ * \ref S2_stop_timeout and \ref S2_send_done_event are made for the session
+ * returned by this function. It is always 0 if libs2 has been compiled with
+ * one session.
+ *
+ * With more than one session the frames passed to \ref S2_send_frame share a
+ * buffer, so S2_send_frame must copy the frame.
+ *
+ * \param ctxt the S2 context
+ */
+uint8_t S2_tx_session(struct S2* ctxt);
+
+/**
+ * Find the transmit session which \ref S2_send_data would use for a frame.
+ *
+ * \param ctxt the S2 context
+ * \param peer transmit parameters of the frame.
+ * \return The session, or \ref S2_TX_SESSION_NONE if a transmission to the
+ * same destination is in progress or all sessions are busy.
+ */
+uint8_t S2_tx_session_find(struct S2* ctxt, const s2_connection_t* peer);
+
+/**
+ * This must be called when the timer of a transmit session has expired.
+ * \param ctxt the S2 context
+ * \param session the session the timer was set for, see \ref S2_tx_session
+ */
+void S2_tx_session_timeout_notify(struct S2* ctxt, uint8_t session);
+
+/**
+ * Notify the security stack that a frame sent with \ref S2_send_frame for a
+ * transmit session has completed.
+ * \param ctxt the S2 context
+ * \param session the session the frame was sent for, see \ref S2_tx_session
+ * \param status  status code of the transmission
+ * \param tx_time the time used for this transmission i milliseconds.
+ */
+void S2_tx_session_send_frame_done_notify(struct S2* ctxt, uint8_t session, s2_tx_status_t status, uint16_t tx_time);
+
+/**
+ * Synchronize the SPAN with a peer ahead of the first frame to it.
+ *
+ * If there is no usable SPAN for the peer, a Nonce Get is sent in an idle
+ * transmit session. Once the Nonce Report has been registered, the next
+ * \ref S2_send_data to the peer is sent without a nonce exchange first.
+ *
+ * The outcome is reported with \ref S2_send_done_event like for
+ * \ref S2_send_data, S2_TRANSMIT_COMPLETE_OK meaning that the SPAN is ready.
+ *
+ * \param ctxt the S2 context
+ * \param peer the node to synchronize with and the key class to use.
+ * \return 1 if the Nonce Get is being sent, 0 if the SPAN is already usable,
+ * a transmission to the peer is in progress or all sessions are busy.
+ */
+uint8_t S2_span_presync(struct S2* ctxt, s2_connection_t* peer);
+
 /**
 * Check if the S2 FSM or inclusion FSM are busy.
 *
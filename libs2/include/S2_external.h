@@ -71,6 +71,8 @@ uint8_t S2_send_frame_no_cb(struct S2* ctxt,const s2_connection_t* peer, uint8_t
 /**
  * This must send a broadcast frame.
  * \ref S2_send_frame_done_notify must be called when transmisison is done.
+ * With more than one transmit session this must copy the frame, as
+ * \ref S2_send_frame.
  *
  * \param ctxt the S2 context
  * \param peer Transaction parameters.
@@ -80,8 +82,10 @@ uint8_t S2_send_frame_no_cb(struct S2* ctxt,const s2_connection_t* peer, uint8_t
 uint8_t S2_send_frame_multi(struct S2* ctxt,s2_connection_t* peer, uint8_t* buf, uint16_t len);
 
 /**
- * Must be implemented elsewhere maps to ZW_TimerStart. Note that this must start the same timer every time.
- * Ie. two calls to this function must reset the timer to a new value. On timeout \ref S2_timeout_notify must be called.
+ * Must be implemented elsewhere maps to ZW_TimerStart. Note that this must start the same timer every time
+ * for a transmit session, see \ref S2_tx_session. Ie. two calls to this function must reset the timer to a
+ * new value. On timeout \ref S2_timeout_notify, or \ref S2_tx_session_timeout_notify with the session,
+ * must be called.
  *
  * \param ctxt the S2 context
  * \param interval Timeout in milliseconds.
@@ -24,16 +24,21 @@
 #define S2_SEQ_DUPL_WINDOW_SIZE ((uint8_t)2)
 
 #define UNENCRYPTED_CLASS 0xFF
+/* S2_TX_SESSIONS is the number of transmissions which can be in progress at
+ * the same time, to different destinations. */
 #ifdef __C51__
 #define SPAN_TABLE_SIZE 5
 #define MPAN_TABLE_SIZE 5
+#define S2_TX_SESSIONS 1
 #elif defined(ZW_CONTROLLER)
 /* Largest size that fits in uint8_t (minus 1). */
 #define SPAN_TABLE_SIZE 254
 #define MPAN_TABLE_SIZE 254
+#define S2_TX_SESSIONS 4
 #else
 #define SPAN_TABLE_SIZE 10
 #define MPAN_TABLE_SIZE 10
+#define S2_TX_SESSIONS 1
 #endif
 #define MOS_LIST_LENGTH 3
 #ifdef ZW050x
@@ -219,6 +224,19 @@ struct S2
 #endif
   states_t fsm;
   uint8_t retry;
+#if S2_TX_SESSIONS > 1
+  /* The transmit session the state machine works on is held in peer, buf,
+   * length, fsm and retry. The other sessions are parked here. The keys and
+   * the SPAN and MPAN tables are shared by all sessions. */
+  struct S2_tx_session {
+    s2_connection_t peer;
+    const uint8_t * buf;
+    uint16_t length;
+    states_t fsm;
+    uint8_t retry;
+  } tx_session[S2_TX_SESSIONS];
+  uint8_t tx_current; //The session held in the fields above
+#endif
   s2_inclusion_state_t inclusion_state;
   enum {INCLUSION_MODE_CSA, INCLUSION_MODE_SSA} inclusion_mode;
   uint8_t kex_fail_code;
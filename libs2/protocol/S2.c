@@ -95,6 +95,16 @@ static uint8_t
 S2_is_mos(struct S2* p_context, node_t node_id, uint8_t clear);
 static void convert_normal_to_lr_keyclass(s2_connection_t *con);
 static void convert_lr_to_normal_keyclass(s2_connection_t *con);
+static states_t
+S2_tx_session_state(struct S2* ctxt, uint8_t session);
+static void
+S2_tx_session_select(struct S2* ctxt, uint8_t session);
+static uint8_t
+S2_tx_session_select_idle(struct S2* ctxt);
+static uint8_t
+S2_tx_sessions_idle(struct S2* ctxt);
+static uint8_t
+S2_workbuf_busy(struct S2* ctxt);
 
 /**
  * Send function for both singlecast and multicast.
@@ -655,25 +665,44 @@ S2_encrypt_and_send_multi(struct S2* p_context)
 
 void
 S2_send_frame_done_notify(struct S2* p_context, s2_tx_status_t status, uint16_t tx_time)
+{
+  S2_tx_session_send_frame_done_notify(p_context, S2_tx_session(p_context), status, tx_time);
+}
+
+void
+S2_tx_session_send_frame_done_notify(struct S2* p_context, uint8_t session, s2_tx_status_t status, uint16_t tx_time)
 {
   CTX_DEF
   event_data_t e;
+
+  if (session >= S2_TX_SESSIONS)
+  {
+    return;
+  }
   e.d.tx.status = status;
   e.d.tx.time = tx_time;
+  S2_tx_session_select(ctxt, session);
   S2_fsm_post_event(ctxt, SEND_DONE, &e);
 }
 
 uint8_t S2_is_busy(struct S2* p_context)
 {
   CTX_DEF
+  uint8_t i;
+  states_t st;
+
   if(ctxt->inclusion_state != S2_INC_IDLE)
   {
     return 1;
   }
 
-  if( (ctxt->fsm != IDLE) && (ctxt->fsm != IS_MOS_WAIT_REPLY) )
+  for (i = 0; i < S2_TX_SESSIONS; i++)
   {
-    return 1;
+    st = S2_tx_session_state(ctxt, i);
+    if( (st != IDLE) && (st != IS_MOS_WAIT_REPLY) )
+    {
+      return 1;
+    }
   }
 
   return 0;
@@ -1020,8 +1049,8 @@ S2_decrypt_msg(struct S2* p_context, s2_connection_t* conn,
     /*In this state we don't know which class_id was used to encrypt the frame, so
      * we will try de-crypting with all our classes */
 
-    /*Check the fsm before using the workbuf */
-    if (ctxt->fsm == IDLE && span->state == SPAN_INSTANTIATE)
+    /*Check that no frame is sent from the workbuf before using it */
+    if (!S2_workbuf_busy(ctxt) && span->state == SPAN_INSTANTIATE)
     {
       memcpy(ctxt->workbuf, ciphertext, ciphertext_len);
     }
@@ -1094,7 +1123,7 @@ S2_decrypt_msg(struct S2* p_context, s2_connection_t* conn,
         }
       }
 
-      if (ctxt->fsm != IDLE || span->state == SPAN_NEGOTIATED)
+      if (S2_workbuf_busy(ctxt) || span->state == SPAN_NEGOTIATED)
       {
         /*We were not able to backup the cipher-text so we will not be able to decrypt the message*/
         goto auth_fail;
@@ -1248,6 +1277,149 @@ S2_is_peernode(struct S2* p_context, const s2_connection_t* peer)
   return peer->l_node == ctxt->peer.l_node && peer->r_node == ctxt->peer.r_node;
 }
 
+/*
+ * State of a transmit session. The current session is held in the context itself.
+ */
+static states_t
+S2_tx_session_state(struct S2* ctxt, uint8_t session)
+{
+#if S2_TX_SESSIONS > 1
+  if (session != ctxt->tx_current)
+  {
+    return ctxt->tx_session[session].fsm;
+  }
+#endif
+  return ctxt->fsm;
+}
+
+/*Return true if a transmit session is handling the node*/
+static int
+S2_tx_session_is_peer(struct S2* ctxt, uint8_t session, const s2_connection_t* peer)
+{
+#if S2_TX_SESSIONS > 1
+  if (session != ctxt->tx_current)
+  {
+    return peer->l_node == ctxt->tx_session[session].peer.l_node
+        && peer->r_node == ctxt->tx_session[session].peer.r_node;
+  }
+#endif
+  return S2_is_peernode(ctxt, peer);
+}
+
+/*
+ * Make a session the current transmit session, ie. the one the state machine works on.
+ */
+static void
+S2_tx_session_select(struct S2* ctxt, uint8_t session)
+{
+#if S2_TX_SESSIONS > 1
+  struct S2_tx_session *s;
+
+  if (session == ctxt->tx_current)
+  {
+    return;
+  }
+  s = &ctxt->tx_session[ctxt->tx_current];
+  s->peer = ctxt->peer;
+  s->buf = ctxt->buf;
+  s->length = ctxt->length;
+  s->fsm = ctxt->fsm;
+  s->retry = ctxt->retry;
+
+  s = &ctxt->tx_session[session];
+  ctxt->peer = s->peer;
+  ctxt->buf = s->buf;
+  ctxt->length = s->length;
+  ctxt->fsm = s->fsm;
+  ctxt->retry = s->retry;
+  ctxt->tx_current = session;
+#endif
+}
+
+/*
+ * Select an idle session, preferring the current one.
+ * Return true if the current session is idle.
+ */
+static uint8_t
+S2_tx_session_select_idle(struct S2* ctxt)
+{
+  uint8_t i;
+
+  if (ctxt->fsm == IDLE)
+  {
+    return 1;
+  }
+  for (i = 0; i < S2_TX_SESSIONS; i++)
+  {
+    if (S2_tx_session_state(ctxt, i) == IDLE)
+    {
+      S2_tx_session_select(ctxt, i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Select the session which handles frames from a node, ie. the session which is
+ * transmitting to it, or else an idle session. If there is neither, the current
+ * session is kept.
+ */
+static void
+S2_tx_session_select_peer(struct S2* ctxt, const s2_connection_t* peer)
+{
+  uint8_t i;
+
+  for (i = 0; i < S2_TX_SESSIONS; i++)
+  {
+    if (S2_tx_session_state(ctxt, i) != IDLE && S2_tx_session_is_peer(ctxt, i, peer))
+    {
+      S2_tx_session_select(ctxt, i);
+      return;
+    }
+  }
+  S2_tx_session_select_idle(ctxt);
+}
+
+/*Return true if no session is transmitting or waiting for a MOS reply*/
+static uint8_t
+S2_tx_sessions_idle(struct S2* ctxt)
+{
+  uint8_t i;
+
+  for (i = 0; i < S2_TX_SESSIONS; i++)
+  {
+    if (S2_tx_session_state(ctxt, i) != IDLE)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Check if the workbuf may hold a frame which is being sent, so that it
+ * cannot be used to back up a ciphertext while trying the security classes.
+ *
+ * With one transmit session, S2_send_frame may send straight from the
+ * workbuf, which is then in use until the session is idle again. With more
+ * sessions the frames of all sessions are encrypted into the workbuf, so
+ * S2_send_frame and S2_send_frame_multi must copy the frame, and the workbuf
+ * is free as soon as they return. Refusing the backup while any session is
+ * busy would fail the first frame from a node whose SPAN is not yet
+ * negotiated whenever the gateway is sending to another node.
+ */
+static uint8_t
+S2_workbuf_busy(struct S2* ctxt)
+{
+#if S2_TX_SESSIONS > 1
+  (void)ctxt;
+  return 0;
+#else
+  return !S2_tx_sessions_idle(ctxt);
+#endif
+}
+
 /*
  * Set the peer and message data
  */
@@ -1277,12 +1449,95 @@ S2_send_data(struct S2* p_context, s2_connection_t* dst, const uint8_t* buf, uin
   return S2_send_data_all_cast(ctxt, dst, buf, len, SEND_MSG);
 }
 
+uint8_t
+S2_span_presync(struct S2* p_context, s2_connection_t* peer)
+{
+  CTX_DEF
+  uint8_t session;
+
+  #ifdef ZW_CONTROLLER
+  if (IS_LR_NODE(peer->r_node)) {
+    convert_normal_to_lr_keyclass(peer);
+  }
+  #endif
+  if (S2_span_ok(ctxt, peer))
+  {
+    return 0;
+  }
+  session = S2_tx_session_find(ctxt, peer);
+  if (session == S2_TX_SESSION_NONE || S2_tx_session_state(ctxt, session) != IDLE)
+  {
+    return 0;
+  }
+  S2_tx_session_select(ctxt, session);
+
+  DPRINTF("S2 SPAN presync %i->%i class %i\n", peer->l_node, peer->r_node, peer->class_id);
+  /* A session without a frame, see WAIT_NONCE_RAPORT */
+  S2_set_peer(ctxt, peer, 0, 0);
+  ctxt->fsm = WAIT_NONCE_RAPORT;
+  ctxt->retry = 2;
+  S2_send_nonce_get(ctxt);
+  S2_set_timeout(ctxt, SEND_DATA_TIMEOUT);
+  return 1;
+}
+
 uint8_t
 S2_is_send_data_busy(struct S2* p_context)
 {
   CTX_DEF
+  uint8_t i;
+  states_t st;
+
+  for (i = 0; i < S2_TX_SESSIONS; i++)
+  {
+    st = S2_tx_session_state(ctxt, i);
+    if ((st == IDLE) || (st == IS_MOS_WAIT_REPLY))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint8_t
+S2_tx_session(struct S2* p_context)
+{
+#if S2_TX_SESSIONS > 1
+  return p_context->tx_current;
+#else
+  return 0;
+#endif
+}
+
+uint8_t
+S2_tx_session_find(struct S2* p_context, const s2_connection_t* peer)
+{
+  CTX_DEF
+  uint8_t i;
+  uint8_t idle = S2_TX_SESSION_NONE;
+  uint8_t mos = S2_TX_SESSION_NONE;
+  states_t st;
 
-  return (ctxt->fsm != IDLE) && (ctxt->fsm != IS_MOS_WAIT_REPLY);
+  for (i = 0; i < S2_TX_SESSIONS; i++)
+  {
+    st = S2_tx_session_state(ctxt, i);
+    if (st != IDLE && S2_tx_session_is_peer(ctxt, i, peer))
+    {
+      /* One transmission at a time to a node. A reply to a MOS
+       * frame is sent by the session waiting for it. */
+      return (st == IS_MOS_WAIT_REPLY) ? i : S2_TX_SESSION_NONE;
+    }
+    if (st == IDLE && idle == S2_TX_SESSION_NONE)
+    {
+      idle = i;
+    }
+    else if (st == IS_MOS_WAIT_REPLY && mos == S2_TX_SESSION_NONE)
+    {
+      mos = i;
+    }
+  }
+  /* A session waiting for a MOS reply is only taken over if there is no other */
+  return (idle != S2_TX_SESSION_NONE) ? idle : mos;
 }
 
 void
@@ -1315,7 +1570,7 @@ S2_init_ctx(uint32_t home)
   ctx->my_home_id = home;
   ctx->loaded_keys = 0;
 
-  ctx->fsm = IDLE;
+  ctx->fsm = IDLE; //All sessions are IDLE after the memset
   s2_restore_keys(ctx);
 
   return ctx;
@@ -1391,11 +1646,13 @@ S2_application_command_handler(struct S2* p_context, s2_connection_t* src, uint8
     }
     break;
   case SECURITY_2_NONCE_REPORT:
+    S2_tx_session_select_peer(ctxt, src);
     DPRINTF("Got NONCE Report %u\r\n", ctxt->fsm);
     S2_fsm_post_event(ctxt, GOT_NONCE_RAPORT, &d);
     ;
     break;
   case SECURITY_2_MESSAGE_ENCAPSULATION:
+    S2_tx_session_select_peer(ctxt, src);
     rc = S2_decrypt_msg(ctxt, src, buf, len, &plain_text, &plain_text_len);
     if (rc == AUTH_OK)
     {
@@ -1426,12 +1683,14 @@ S2_application_command_handler(struct S2* p_context, s2_connection_t* src, uint8
               return;
             }
             memcpy(&ctxt->u.commands_sup_report_buf[2], classes, n_commands_supported);
-            /*TODO If ctxt->fsm is busy the report is not going to be sent*/
+            /*TODO If a transmission to src is in progress the report is not going to be sent*/
             S2_send_data(ctxt, src, ctxt->u.commands_sup_report_buf, n_commands_supported + 2);
           }
           /* Don't validate inclusion_peer.l_node as it may not be initialized yet due to early start */
           else
           {
+            /* Keep the buffer of a transmission in progress if possible */
+            S2_tx_session_select_idle(ctxt);
             ctxt->buf = plain_text;
             ctxt->length = plain_text_len;
             //Default just send the command to the inclusion fsm
@@ -1468,7 +1727,8 @@ S2_application_command_handler(struct S2* p_context, s2_connection_t* src, uint8
      * If S2 is busy, ctxt->buf may be in use for sending an encrypted message.
      * KEX_FAIL is an exception. Must be passed to the inclusion fsm to abort all S2 action.
      */
-    if((ctxt->fsm != IDLE) && (buf[1] != KEX_FAIL)) return;
+    if(!S2_tx_sessions_idle(ctxt) && (buf[1] != KEX_FAIL)) return;
+    S2_tx_session_select_idle(ctxt);
 
     if ((src->rx_options & S2_RXOPTION_MULTICAST) != S2_RXOPTION_MULTICAST)
     {
@@ -1483,8 +1743,20 @@ S2_application_command_handler(struct S2* p_context, s2_connection_t* src, uint8
 
 void
 S2_timeout_notify(struct S2* p_context)
+{
+  S2_tx_session_timeout_notify(p_context, S2_tx_session(p_context));
+}
+
+void
+S2_tx_session_timeout_notify(struct S2* p_context, uint8_t session)
 {
   CTX_DEF
+
+  if (session >= S2_TX_SESSIONS)
+  {
+    return;
+  }
+  S2_tx_session_select(ctxt, session);
   S2_fsm_post_event(ctxt, TIMEOUT, 0);
 }
 
@@ -1492,9 +1764,12 @@ static void
 S2_post_send_done_event(struct S2* p_context, s2_tx_status_t status)
 {
   CTX_DEF
+  uint8_t session = S2_tx_session(ctxt);
 
   s2_inclusion_send_done(ctxt, (status == S2_TRANSMIT_COMPLETE_OK) || (status == S2_TRANSMIT_COMPLETE_VERIFIED));
   S2_send_done_event(ctxt, status);
+  /* The callbacks may have started a transmission in another session */
+  S2_tx_session_select(ctxt, session);
 }
 
 static void emit_S2_synchronization_event(sos_event_reason_t reason, event_data_t* d)
@@ -1594,6 +1869,14 @@ DPRINTF("S2_fsm_post_event event: %s, state %s\n", s2_event_name(e), s2_state_na
       DPRINT("GOT_NONCE_RAPORT\r\n");
       if (S2_register_nonce(ctxt, d->d.buf.buffer, d->d.buf.len) & SECURITY_2_NONCE_REPORT_PROPERTIES1_SOS_BIT_MASK)
       {
+        if (ctxt->buf == 0)
+        {
+          /* SPAN presync, there is no frame to send */
+          ctxt->fsm = IDLE;
+          S2_stop_timeout(ctxt);
+          S2_post_send_done_event(ctxt, S2_TRANSMIT_COMPLETE_OK);
+          break;
+        }
         goto send_msg_state_enter;
       }
     }
@@ -1846,11 +2129,13 @@ S2_send_data_all_cast(struct S2* p_context, const s2_connection_t* con, const ui
 {
   CTX_DEF
   event_data_t e;
+  uint8_t session = S2_tx_session_find(ctxt, con);
 
-  if (len == 0 || len > 1280 || buf == 0 || S2_is_send_data_busy(ctxt))
+  if (len == 0 || len > 1280 || buf == 0 || session == S2_TX_SESSION_NONE)
   {
     return 0;
   }
+  S2_tx_session_select(ctxt, session);
 
   e.d.buf.buffer = buf;
   e.d.buf.len = len;
@@ -1887,5 +2172,5 @@ uint8_t
 S2_is_send_data_multicast_busy(struct S2* p_context)
 {
   CTX_DEF
-  return ctxt->fsm != IDLE;
+  return !S2_tx_sessions_idle(ctxt);
 }
@@ -0,0 +1,145 @@
+/* © 2020 Silicon Laboratories Inc.
+ */
+/*
+ * Compare the X25519 backends in crypto/curve25519.
+ *
+ * The backends are linked in under their own names, see
+ * test/CMakeLists.txt. The 64 bit limb backend is only there on 64 bit
+ * targets. The results of the backends are compared with the reference
+ * implementation for random keys, and the time of a scalar multiplication
+ * is printed for each. With --check only the results are compared, which
+ * is how ctest runs it.
+ *
+ * Usage: bench_curve25519 [--check] [iterations]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY_SIZE (32)
+
+int crypto_scalarmult_curve25519_generic(unsigned char *q,
+                                         const unsigned char *n,
+                                         const unsigned char *p);
+int crypto_scalarmult_curve25519_donna32(unsigned char *q,
+                                         const unsigned char *n,
+                                         const unsigned char *p);
+#if BENCH_CURVE25519_DONNA
+int crypto_scalarmult_curve25519_donna(unsigned char *q,
+                                       const unsigned char *n,
+                                       const unsigned char *p);
+#endif
+
+typedef int (*scalarmult_t)(unsigned char *q, const unsigned char *n,
+                            const unsigned char *p);
+
+static const struct {
+  const char *name;
+  scalarmult_t mult;
+} backends[] = {
+  { "generic", crypto_scalarmult_curve25519_generic },
+  { "donna32", crypto_scalarmult_curve25519_donna32 },
+#if BENCH_CURVE25519_DONNA
+  { "donna", crypto_scalarmult_curve25519_donna },
+#endif
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static uint64_t rnd_state = 0x2545F4914F6CDD1DULL;
+
+/* xorshift64, the keys only have to differ */
+static void random_bytes(uint8_t *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    buf[i] = (uint8_t) rnd_state;
+  }
+}
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Run iterations of Diffie-Hellman in a chain, so that every step uses
+ * the result of the previous one. */
+static double bench(const char *name, scalarmult_t mult, int iterations)
+{
+  uint8_t secret[KEY_SIZE];
+  uint8_t point[KEY_SIZE] = {9};
+  double start;
+  double us;
+  int i;
+
+  random_bytes(secret, sizeof(secret));
+  start = now_us();
+  for (i = 0; i < iterations; i++) {
+    mult(point, secret, point);
+  }
+  us = (now_us() - start) / iterations;
+  printf("%-8s %10.1f us/op\n", name, us);
+  return us;
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t secret[KEY_SIZE];
+  uint8_t point[KEY_SIZE];
+  uint8_t q_generic[KEY_SIZE];
+  uint8_t q[KEY_SIZE];
+  double us_generic;
+  double us;
+  int iterations = 200;
+  int check_only = 0;
+  int i;
+  size_t b;
+
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+    check_only = 1;
+    argc--;
+    argv++;
+  }
+  if (argc > 1) {
+    iterations = atoi(argv[1]);
+    if (iterations <= 0) {
+      fprintf(stderr, "Usage: bench_curve25519 [--check] [iterations]\n");
+      return 2;
+    }
+  }
+
+  /* Compare the backends on random points, including points with bit
+   * 255 set and points which are not reduced modulo p */
+  for (i = 0; i < iterations; i++) {
+    random_bytes(secret, sizeof(secret));
+    random_bytes(point, sizeof(point));
+    crypto_scalarmult_curve25519_generic(q_generic, secret, point);
+    for (b = 1; b < NUM_BACKENDS; b++) {
+      backends[b].mult(q, secret, point);
+      if (memcmp(q_generic, q, KEY_SIZE) != 0) {
+        printf("%s differs from generic in iteration %d\n", backends[b].name, i);
+        return 1;
+      }
+    }
+  }
+  printf("Backends agree on %d random keys\n", iterations);
+  if (check_only) {
+    return 0;
+  }
+
+  us_generic = bench(backends[0].name, backends[0].mult, iterations);
+  for (b = 1; b < NUM_BACKENDS; b++) {
+    us = bench(backends[b].name, backends[b].mult, iterations);
+    printf("%s is %.1f times faster\n", backends[b].name, us_generic / us);
+  }
+  return 0;
+}
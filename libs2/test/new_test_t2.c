@@ -574,7 +574,8 @@ int test_frag_wait_fn()
     ask_TS_to_receive(test_subseq_frag2, sizeof(test_subseq_frag2)); /* Send subseq frag from different source node */
     p.snode = 0xff;
 
-    ret = memcmp(output, test_frag_wait_three_pending, sizeof(test_frag_wait_two_pending));
+    /* The other node has a session of its own, so it is told to restart right away */
+    ret = memcmp(output, test_frag_wait_zero_pending, sizeof(test_frag_wait_zero_pending));
     ret = print_failed_if_nonzero(ret, "test_frag_wait receive check ");
     fail_if_nonzero(ret);
 
@@ -1161,31 +1162,31 @@ int three_node_test()
     ret = print_failed_if_nonzero(ret, "first fragment");
     fail_if_nonzero(ret);
 
+    /* The third node gets a session of its own, and its datagram is received
+     * while we are sending */
     p.snode = 0xf1;
     ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1));
 
-    fire_timer_btwn_2_frags(0);
-    ret = memcmp(output, test_frag_wait_two_pending, sizeof(test_frag_wait_two_pending)); /* Check if we get fragment wait */
-    ret = print_failed_if_nonzero(ret, "received fragment_wait check");
-    fail_if_nonzero(ret);
-
     fire_timer_btwn_2_frags(0);
     ret = memcmp(output, test_subseq_frag2, sizeof(test_subseq_frag2));
     ret = print_failed_if_nonzero(ret, "first subseq fragment");
     fail_if_nonzero(ret);
 
-    ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1));
-
-    fire_timer_btwn_2_frags(0);
-    ret = memcmp(output, test_frag_wait, sizeof(test_frag_wait)); /* Check if we get fragment wait */
-    ret = print_failed_if_nonzero(ret, "received fragment_wait again check");
-    fail_if_nonzero(ret);
+    ask_TS_to_receive(test_subseq_frag2, sizeof(test_subseq_frag2));
 
     fire_timer_btwn_2_frags(0);
     ret = memcmp(output, test_subseq_frag3, sizeof(test_subseq_frag3));
     ret = print_failed_if_nonzero(ret, "second subseq fragment");
     fail_if_nonzero(ret);
 
+    ask_TS_to_receive(test_subseq_frag3, sizeof(test_subseq_frag3));
+    ret = memcmp(output, test_frag_compl, sizeof(test_frag_compl));
+    ret = print_failed_if_nonzero(ret, "fragment complete");
+    fail_if_nonzero(ret);
+    ret = print_failed_if_nonzero(compare_received_datagram(test_complete_datagram, sizeof(test_complete_datagram)),
+                                  "received datagram");
+    fail_if_nonzero(ret);
+
     p.snode = 0xfe;
     p.dnode = 0xff;
     ask_TS_to_receive(test_frag_compl, sizeof(test_frag_compl));
@@ -1193,16 +1194,62 @@ int three_node_test()
     fail_if_nonzero(ret);
     p.snode = 0xf1;
 
-    ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1)); /* <-- ask to receive*/
-    ask_TS_to_receive(test_subseq_frag2, sizeof(test_subseq_frag2));/* <-- ask to receive*/
-    ask_TS_to_receive(test_subseq_frag3, sizeof(test_subseq_frag3));/* <-- ask to receive*/
-//    fire_rx_timer();
+    return 0;
+fail:
+    return 1;
+}
+
+/* Purpose of this test is to check that a node is asked to wait when all
+   sessions are busy with other nodes
+steps:
+1. Start a datagram from TRANSPORT_SERVICE_SESSIONS nodes
+2. Start one more from another node and check that it receives FRAG_WAIT
+3. Complete the datagrams and check that the node can start over
+*/
+int all_sessions_busy_test()
+{
+    int ret = 0;
+    int i;
+    memset(output, 0, sizeof(output));
+
+    printf("all_sessions_busy_test\n");
+    p.dnode = 0xfe;
+    for (i = 0; i < TRANSPORT_SERVICE_SESSIONS; i++) {
+        p.snode = 0xe0 + i;
+        ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1));
+    }
+
+    p.snode = 0xef;
+    ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1));
+    ret = memcmp(output, test_frag_wait_three_pending, sizeof(test_frag_wait_three_pending));
+    ret = print_failed_if_nonzero(ret, "all sessions busy fragment_wait check");
+    fail_if_nonzero(ret);
+
+    for (i = 0; i < TRANSPORT_SERVICE_SESSIONS; i++) {
+        p.snode = 0xe0 + i;
+        memset(output, 0, sizeof(output));
+        ask_TS_to_receive(test_subseq_frag2, sizeof(test_subseq_frag2));
+        ask_TS_to_receive(test_subseq_frag3, sizeof(test_subseq_frag3));
+        ret = memcmp(output, test_frag_compl, sizeof(test_frag_compl));
+        ret = print_failed_if_nonzero(ret, "all sessions busy fragment complete");
+        fail_if_nonzero(ret);
+    }
+
+    p.snode = 0xef;
+    memset(output, 0, sizeof(output));
+    ask_TS_to_receive(test_first_frag1, sizeof(test_first_frag1));
+    ask_TS_to_receive(test_subseq_frag2, sizeof(test_subseq_frag2));
+    ask_TS_to_receive(test_subseq_frag3, sizeof(test_subseq_frag3));
     ret = memcmp(output, test_frag_compl, sizeof(test_frag_compl));
-    ret = print_failed_if_nonzero(ret, "fragment complete");
+    ret = print_failed_if_nonzero(ret, "fragment complete after wait");
     fail_if_nonzero(ret);
 
+    p.snode = 0xff;
+    p.dnode = 0xfe;
+    printf("passed\n");
     return 0;
 fail:
+    printf("failed\n");
     return 1;
 }
 
@@ -1428,6 +1475,7 @@ int main()
     fail_if_nonzero(test_frag_wait_for_completed_session());
 
     fail_if_nonzero(three_node_test());
+    fail_if_nonzero(all_sessions_busy_test());
     fail_if_nonzero(send_big_datagram());
     fail_if_nonzero(send_first_frag_with_big_size());
     fail_if_nonzero(call_ask_TS_to_receive_with_large_size());
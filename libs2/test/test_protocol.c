@@ -2389,6 +2389,154 @@ void test_sos_recsync_event_3() {
   }
 }
 
+/**
+ * Check that a transmission to node 3 can be completed while the nonce
+ * exchange with node 2 is pending, and that the transmission to node 2
+ * completes afterwards.
+ */
+void test_concurrent_tx_sessions()
+{
+  s2_connection_t c12 = { 1, 2 };
+  s2_connection_t c13 = { 1, 3 };
+  s2_connection_t c21 = { 2, 1 };
+  uint8_t nonce_get12[3];
+  uint8_t session12;
+  uint8_t session13;
+
+  my_setup();
+
+  /* Start the transmission to node 2 and hold back its nonce get */
+  TEST_ASSERT_TRUE(S2_send_data(ctx1, &c12, (uint8_t*) hello, sizeof(hello)));
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_get, ts.frame, 2);
+  memcpy(nonce_get12, ts.frame, sizeof(nonce_get12));
+  session12 = S2_tx_session(ctx1);
+  S2_tx_session_send_frame_done_notify(ctx1, session12, S2_TRANSMIT_COMPLETE_OK, 0x42);
+
+  /* Only one transmission at a time to node 2 */
+  TEST_ASSERT_EQUAL(S2_TX_SESSION_NONE, S2_tx_session_find(ctx1, &c12));
+  TEST_ASSERT_FALSE(S2_send_data(ctx1, &c12, (uint8_t*) hello, sizeof(hello)));
+
+  /* Node 3 gets a session of its own */
+  TEST_ASSERT_TRUE(S2_send_data(ctx1, &c13, (uint8_t*) hello, sizeof(hello)));
+  session13 = S2_tx_session(ctx1);
+  TEST_ASSERT_NOT_EQUAL(session12, session13);
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_get, ts.frame, 2);
+  S2_tx_session_send_frame_done_notify(ctx1, session13, S2_TRANSMIT_COMPLETE_OK, 0x42);
+
+  S2_application_command_handler(ctx3, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_report, ts.frame, 2);
+  S2_application_command_handler(ctx1, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(SECURITY_2_MESSAGE_ENCAPSULATION, ts.frame[1]);
+  TEST_ASSERT_EQUAL(3, ts.last_trans.l_node);
+  TEST_ASSERT_EQUAL(session13, S2_tx_session(ctx1));
+  S2_tx_session_send_frame_done_notify(ctx1, session13, S2_TRANSMIT_COMPLETE_OK, 0x42);
+  TEST_ASSERT_EQUAL(1, ts.s2_send_done);
+  TEST_ASSERT_EQUAL(S2_TRANSMIT_COMPLETE_OK, ts.s2_send_status);
+
+  S2_application_command_handler(ctx3, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(sizeof(hello), ts.rx_frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(hello, ts.rx_frame, sizeof(hello));
+  TEST_ASSERT_TRUE(S2_is_busy(ctx1));
+
+  /* Now node 2 answers */
+  ts.rx_frame_len = 0;
+  S2_application_command_handler(ctx2, &c21, nonce_get12, sizeof(nonce_get12));
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_report, ts.frame, 2);
+  S2_application_command_handler(ctx1, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(SECURITY_2_MESSAGE_ENCAPSULATION, ts.frame[1]);
+  TEST_ASSERT_EQUAL(2, ts.last_trans.l_node);
+  S2_tx_session_send_frame_done_notify(ctx1, session12, S2_TRANSMIT_COMPLETE_OK, 0x42);
+  TEST_ASSERT_EQUAL(2, ts.s2_send_done);
+  TEST_ASSERT_EQUAL(S2_TRANSMIT_COMPLETE_OK, ts.s2_send_status);
+
+  S2_application_command_handler(ctx2, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(sizeof(hello), ts.rx_frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(hello, ts.rx_frame, sizeof(hello));
+  TEST_ASSERT_FALSE(S2_is_busy(ctx1));
+  TEST_ASSERT_EQUAL(0, ts.sync_ev.count);
+}
+
+/**
+ * Check that the first frame from node 2, encrypted with another security
+ * class than the one tried first, is decrypted while the transmission to
+ * node 3 is waiting for its nonce report. Decrypting it needs the ciphertext
+ * backup in the workbuf, which all sessions share.
+ */
+void test_decrypt_class_search_during_tx()
+{
+  s2_connection_t c13 = { 1, 3 };
+  s2_connection_t c21 = { 2, 1 };
+  uint8_t session13;
+
+  my_setup();
+
+  /* Start the transmission to node 3 and hold back its nonce get */
+  TEST_ASSERT_TRUE(S2_send_data(ctx1, &c13, (uint8_t*) hello, sizeof(hello)));
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_get, ts.frame, 2);
+  session13 = S2_tx_session(ctx1);
+  S2_tx_session_send_frame_done_notify(ctx1, session13, S2_TRANSMIT_COMPLETE_OK, 0x42);
+  TEST_ASSERT_TRUE(S2_is_busy(ctx1));
+
+  /* Node 2 sends with class 2, node 1 tries class 0 first */
+  c21.class_id = 2;
+  TEST_ASSERT_TRUE(S2_send_data(ctx2, &c21, (uint8_t*) hello, sizeof(hello)));
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_get, ts.frame, 2);
+  S2_send_frame_done_notify(ctx2, S2_TRANSMIT_COMPLETE_OK, 0x42);
+
+  S2_application_command_handler(ctx1, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_report, ts.frame, 2);
+  TEST_ASSERT_EQUAL(SECURITY_2_NONCE_REPORT_PROPERTIES1_SOS_BIT_MASK, ts.frame[3]);
+
+  S2_application_command_handler(ctx2, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(SECURITY_2_MESSAGE_ENCAPSULATION, ts.frame[1]);
+  S2_send_frame_done_notify(ctx2, S2_TRANSMIT_COMPLETE_OK, 0x42);
+
+  ts.rx_frame_len = 0;
+  S2_application_command_handler(ctx1, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(sizeof(hello), ts.rx_frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(hello, ts.rx_frame, sizeof(hello));
+  TEST_ASSERT_EQUAL(0, ts.sync_ev.count);
+
+  /* The transmission to node 3 is still waiting for its nonce report */
+  TEST_ASSERT_TRUE(S2_is_busy(ctx1));
+  TEST_ASSERT_EQUAL(S2_TX_SESSION_NONE, S2_tx_session_find(ctx1, &c13));
+}
+
+void test_span_presync()
+{
+  s2_connection_t c12 = { 1, 2 };
+  s2_connection_t c21 = { 2, 1 };
+  uint8_t session;
+
+  my_setup();
+
+  /* The Nonce Get is sent without a frame */
+  TEST_ASSERT_TRUE(S2_span_presync(ctx1, &c12));
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_get, ts.frame, 2);
+  session = S2_tx_session(ctx1);
+  S2_tx_session_send_frame_done_notify(ctx1, session, S2_TRANSMIT_COMPLETE_OK, 0x42);
+  TEST_ASSERT_FALSE(S2_span_presync(ctx1, &c12));
+
+  S2_application_command_handler(ctx2, &c21, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(nonce_report, ts.frame, 2);
+  S2_application_command_handler(ctx1, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(1, ts.s2_send_done);
+  TEST_ASSERT_EQUAL(S2_TRANSMIT_COMPLETE_OK, ts.s2_send_status);
+  TEST_ASSERT_FALSE(S2_is_busy(ctx1));
+
+  /* The SPAN is usable, so the frame goes out right away */
+  TEST_ASSERT_FALSE(S2_span_presync(ctx1, &c12));
+  TEST_ASSERT_TRUE(S2_send_data(ctx1, &c12, (uint8_t*) hello, sizeof(hello)));
+  TEST_ASSERT_EQUAL(SECURITY_2_MESSAGE_ENCAPSULATION, ts.frame[1]);
+  S2_send_frame_done_notify(ctx1, S2_TRANSMIT_COMPLETE_OK, 0x42);
+  TEST_ASSERT_EQUAL(2, ts.s2_send_done);
+
+  S2_application_command_handler(ctx2, &ts.last_trans, ts.frame, ts.frame_len);
+  TEST_ASSERT_EQUAL(sizeof(hello), ts.rx_frame_len);
+  TEST_ASSERT_EQUAL_STRING_LEN(hello, ts.rx_frame, sizeof(hello));
+  TEST_ASSERT_EQUAL(0, ts.sync_ev.count);
+}
+
 /* Stub function */
 uint8_t s2_inclusion_set_timeout(struct S2* ctxt, uint32_t interval)
 {
@@ -41,7 +41,6 @@ uint16_t zgw_crc16(uint16_t crc16, uint8_t *data, unsigned long data_len);
 #define CRC_FUNC zgw_crc16
 #endif
 
-static uint8_t flag_tie_broken = 0;
 void fc_timer_expired(void *);
 
 static void send_subseq_frag(void *);
@@ -52,6 +51,7 @@ struct rx_timer_expired_data {
 };
 
 static void rx_timer_expired(void *);
+static void rx_timeout(uint8_t state);
 
 
 #if defined(NEW_TEST_T2)
@@ -67,18 +67,16 @@ typedef void (*ZW_CommandHandler_Callback_t)(ts_param_t* p, ZW_APPLICATION_TX_BU
       p.dendpoint = 0; \
       p.sendpoint = 0; \
       p.snode = srcNode; \
-      p.dnode = rcb.cmn.p.dnode; \
+      p.dnode = rcb->cmn.p.dnode; \
       p.rx_flags =0; \
       p.tx_flags = TRANSMIT_OPTION_ACK | TRANSMIT_OPTION_AUTO_ROUTE | TRANSMIT_OPTION_EXPLORE;\
       p.scheme = NO_SCHEME; \
-      TSApplicationCommandHandler(&p,(ZW_APPLICATION_TX_BUFFER*) rcb.datagramData, count); \
+      TSApplicationCommandHandler(&p,(ZW_APPLICATION_TX_BUFFER*) rcb->datagramData, count); \
     }
 #endif
 
 void test_rx_timer_expired(uint8_t state) { /* For NEW_TEST_T2 */
-   struct rx_timer_expired_data rdata;
-   rdata.state = state;
-   rx_timer_expired(&rdata);
+   rx_timeout(state);
 }
 
 #else // if defined(NEW_TEST_T2)
@@ -95,11 +93,11 @@ typedef void (*ZW_CommandHandler_Callback_t)(ts_param_t* p, ZW_APPLICATION_TX_BU
       p.dendpoint = 0; \
       p.sendpoint = 0; \
       p.snode = srcNode; \
-      p.dnode = rcb.cmn.p.dnode; \
+      p.dnode = rcb->cmn.p.dnode; \
       p.rx_flags =0; \
       p.tx_flags = TRANSMIT_OPTION_ACK | TRANSMIT_OPTION_AUTO_ROUTE | TRANSMIT_OPTION_EXPLORE;\
       p.scheme = NO_SCHEME; \
-      TSApplicationCommandHandler(&p,(ZW_APPLICATION_TX_BUFFER*) rcb.datagramData, count); \
+      TSApplicationCommandHandler(&p,(ZW_APPLICATION_TX_BUFFER*) rcb->datagramData, count); \
     }
 
 #define TS_SEND_RAW(src, dst, buf, buflen, txopt, cb) ZW_SendData_Bridge(src, dst, buf, buflen, txopt, cb)
@@ -112,8 +110,6 @@ extern uint8_t ZW_SendData_Bridge(uint8_t, uint8_t, uint8_t *, uint8_t, uint8_t,
 
 #endif
 
-static uint8_t flag_initialize_once = 1; // to initialize the receive session stuff once
-
 extern const char *T2_EVENTS_STRING[];
 extern const char *T2_STATES_STRING[];
 
@@ -153,14 +149,10 @@ ZW_CheckCrc16(uint16_t crc, uint8_t *pDataAddr, uint16_t bDataLen)
  * #define FRAGMENTMAXPAYLOAD  (64 - 10 - 7);
  */
 #define FRAGMENTMAXPAYLOAD 47
-static uint8_t FragmentMaxPayload = 0;
 
 /* ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME has the max size in transport service header
  * subtracting 1 for payload field inside ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME */
-uint8_t t2_txBuf[FRAGMENTMAXPAYLOAD + sizeof(ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME) - 1];
-
-ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME *first_frag = (ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME *)t2_txBuf;
-ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME *subseq_frag = (ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME *)t2_txBuf;
+#define TXBUF_SIZE (FRAGMENTMAXPAYLOAD + sizeof(ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME) - 1)
 
 
 static void send_last_frag(void);
@@ -185,7 +177,7 @@ typedef struct cb {
 }control_block_t;
 
 struct sending_cntrl_blk {
-    uint16_t datalen_to_send; // this is set to FragmentMaxPayload or remaining data less than FragmentMaxPayload
+    uint16_t datalen_to_send; // this is set to max_payload or remaining data less than max_payload
     uint16_t missing_offset; // this is set to missing offset received in FRAMENT_REQUEST command and used to resend that fragment
     uint16_t offset; // this is used in sending side
     uint16_t remaining_data_len; // this records the len of remaining data to be sent
@@ -232,7 +224,16 @@ struct sending_cntrl_blk {
      * or send_subseq_frag()/reply_frag_req */
     uint8_t does_not_fit_in_first_frag;
 
-} scb;
+    /* Largest payload of a fragment with the transmit options of this datagram */
+    uint8_t max_payload;
+
+    /* Set when a fragment from the receiving node made us give up this session, see tie break */
+    uint8_t flag_tie_broken;
+
+    /* The fragment being sent. The last fragment is sent again from here if the
+     * fragment complete does not arrive */
+    uint8_t txBuf[TXBUF_SIZE];
+};
 
 #if !defined(ZIPGW) && !defined(NEW_TEST_T2)
 /* Used for ZW_SendDataEx calls throughout this module */
@@ -275,7 +276,54 @@ struct receiving_cntrl_blk {
 
     uint16_t datagram_size;
 
-} rcb;
+};
+
+/**
+ * A transport service session. There is a session for each node we are
+ * exchanging datagrams with, so datagrams to and from different nodes do
+ * not have to wait for each other. Within a session, the session IDs of
+ * the fragments tell the datagrams apart, as they always did.
+ */
+typedef struct ts2_session {
+    /* Set when the session has been opened for a node */
+    uint8_t in_use;
+    /* Node the datagrams of this session are sent to and received from */
+    node_t peer;
+    /* State of the session while it is not the current one */
+    TRANSPORT2_ST_T state;
+    struct sending_cntrl_blk scb;
+    struct receiving_cntrl_blk rcb;
+
+    /* A fragment waiting for its turn to be sent, see ts2_send_raw() */
+    uint8_t tx_wait;
+    uint8_t tx_wait_len;
+    node_t tx_wait_snode;
+    node_t tx_wait_dnode;
+    uint8_t tx_wait_flags;
+    VOID_CALLBACKFUNC(tx_wait_cb)(uint8_t, TX_STATUS_TYPE*);
+    uint8_t tx_wait_buf[TXBUF_SIZE];
+} ts2_session_t;
+
+static ts2_session_t sessions[TRANSPORT_SERVICE_SESSIONS];
+
+/* The session being processed. scb, rcb and current_state belong to it */
+static ts2_session_t *ts2_cur = &sessions[0];
+static struct sending_cntrl_blk *scb = &sessions[0].scb;
+static struct receiving_cntrl_blk *rcb = &sessions[0].rcb;
+
+/* Session whose fragment is being sent by the lower layer, which only has room
+ * for one frame with a callback at a time */
+static ts2_session_t *tx_owner;
+/* Session which was sending last, the next turn goes to the one after it */
+static uint8_t tx_last;
+/* Hands the turn to the next waiting session outside of the callback of the last one */
+static struct ctimer tx_turn_timer;
+
+/* Both point to the txBuf of the current session */
+static ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME *first_frag =
+    (ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME *)sessions[0].scb.txBuf;
+static ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME *subseq_frag =
+    (ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME *)sessions[0].scb.txBuf;
 
 uint16_t offset_to_request = 0;
 
@@ -284,48 +332,259 @@ uint16_t offset_to_request = 0;
 int call_with_large_value = 0; /* For NEW_TEST_T2 */
 int check_flag_tie_broken() /* For NEW_TEST_T2 */
 {
-    return flag_tie_broken;
+    return scb->flag_tie_broken;
 }
 
 int get_current_scb_cmnd_session_id() /* For NEW_TEST_T2 */
 {
-    return scb.cmn.session_id;
+    return scb->cmn.session_id;
 }
 
 int check_scb_current_dnode() /* For NEW_TEST_T2 */
 {
-    return scb.current_dnode;
+    return scb->current_dnode;
 }
 
 int check_flag_fc_timer_expired_once() /* For NEW_TEST_T2 */
 {
-    return scb.flag_fc_timer_expired_once;
+    return scb->flag_fc_timer_expired_once;
 }
 
 int compare_received_datagram(const uint8_t *cmp_data, uint16_t len)
 {
-    if (len == rcb.datagram_size)
+    if (len == rcb->datagram_size)
     {
-        return memcmp(rcb.datagramData, cmp_data, len);
+        return memcmp(rcb->datagramData, cmp_data, len);
     }
     return -1;
 }
 #endif
 
+static uint8_t recv_or_send(TRANSPORT2_ST_T state);
+static void ts2_tx_done(void);
+static ts2_session_t *ts2_tx_holder(void);
+
+/* Make s the current session */
+static void session_select(ts2_session_t *s)
+{
+    if (s == ts2_cur) {
+        return;
+    }
+    ts2_cur->state = current_state;
+    ts2_cur = s;
+    current_state = s->state;
+    scb = &s->scb;
+    rcb = &s->rcb;
+    first_frag = (ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME *)scb->txBuf;
+    subseq_frag = (ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME *)scb->txBuf;
+}
+
+static TRANSPORT2_ST_T session_state(ts2_session_t *s)
+{
+    return (s == ts2_cur) ? current_state : s->state;
+}
+
+/* A session is busy until its datagrams are done in both directions */
+static bool session_busy(ts2_session_t *s)
+{
+    return (session_state(s) != ST_IDLE) || s->scb.current_dnode || s->rcb.current_snode
+            || s->tx_wait || (ts2_tx_holder() == s);
+}
+
+static void session_open(ts2_session_t *s, node_t peer)
+{
+    ctimer_stop(&s->scb.reset_timer);
+    ctimer_stop(&s->scb.wait_restart_timer);
+    ctimer_stop(&s->scb.timer_btwn_2_frags);
+    ctimer_stop(&s->rcb.fc_timer);
+    ctimer_stop(&s->rcb.rx_timer);
+    memset((uint8_t*)&s->scb, 0, sizeof(s->scb));
+    memset((uint8_t*)&s->rcb, 0, sizeof(s->rcb));
+    s->scb.transmission_aborted = 0x11; /*Initializing to out of range session id */
+    s->rcb.cmn.session_id = 0x10;
+    s->rcb.flag_retry_frag_req_once = 1;
+    s->peer = peer;
+    s->in_use = 1;
+}
+
+/* Find the session of a node, or open one if there is a session which is not busy */
+static ts2_session_t *session_claim(node_t peer)
+{
+    ts2_session_t *s;
+    ts2_session_t *free_s = NULL;
+
+    for (s = sessions; s < sessions + TRANSPORT_SERVICE_SESSIONS; s++) {
+        if (s->in_use && (s->peer == peer)) {
+            return s;
+        }
+        /* Prefer a session which has never been used, so the recently used ones keep
+         * their list of completed session IDs */
+        if (!s->in_use && (!free_s || free_s->in_use)) {
+            free_s = s;
+        } else if (!free_s && !session_busy(s)) {
+            free_s = s;
+        }
+    }
+    if (free_s) {
+        T2_DBG("Opening session %d for node %d", (int)(free_s - sessions), (int)peer);
+        session_open(free_s, peer);
+    }
+    return free_s;
+}
+
+/* The busy session which is expected to be done first */
+static ts2_session_t *session_soonest_done(void)
+{
+    ts2_session_t *s;
+    ts2_session_t *best = sessions;
+    uint8_t pending;
+    uint8_t best_pending = 0xff;
+
+    for (s = sessions; s < sessions + TRANSPORT_SERVICE_SESSIONS; s++) {
+        pending = (recv_or_send(session_state(s)) == 0) ? s->scb.cmn.pending_segments
+                                                         : s->rcb.cmn.pending_segments;
+        if (pending < best_pending) {
+            best = s;
+            best_pending = pending;
+        }
+    }
+    return best;
+}
+
+/* Report the result of the datagram being sent in the current session to the application */
+static void session_completed(uint8_t status)
+{
+    ts2_session_t *s = ts2_cur;
+
+    scb->current_dnode = 0;
+    if (!scb->cmn.completedFunc) {
+        return;
+    }
+#if defined(ZIPGW) || defined(__C51__)
+    scb->cmn.completedFunc(status, &scb->cmn.tx_status);
+#else
+    scb->cmn.completedFunc(status, 0);
+#endif
+    /* The application may have started a datagram to another node */
+    session_select(s);
+}
+
+/* Send the waiting fragment of the next session in turn */
+static void ts2_tx_turn(void *nthing)
+{
+    ts2_session_t *s;
+    uint8_t i;
+
+    UNUSED(nthing);
+    for (i = 1; (i <= TRANSPORT_SERVICE_SESSIONS) && !tx_owner; i++) {
+        s = &sessions[(tx_last + i) % TRANSPORT_SERVICE_SESSIONS];
+        if (!s->tx_wait) {
+            continue;
+        }
+        session_select(s);
+        s->tx_wait = false;
+        if (TS_SEND_RAW(s->tx_wait_snode, s->tx_wait_dnode, s->tx_wait_buf, s->tx_wait_len,
+                        s->tx_wait_flags, s->tx_wait_cb)) {
+            tx_owner = s;
+            tx_last = s - sessions;
+        } else {
+            T2_ERR("send_data failed\n");
+        }
+    }
+}
+
+/* Give the turn to the next session with a waiting frame */
+static void ts2_tx_next(void)
+{
+    ts2_session_t *s;
+
+    for (s = sessions; s < sessions + TRANSPORT_SERVICE_SESSIONS; s++) {
+        if (s->tx_wait) {
+            ctimer_set(&tx_turn_timer, 0, ts2_tx_turn, NULL);
+            break;
+        }
+    }
+}
+
+/* Session which has a frame with a callback at the lower layer. A session only
+ * goes back to idle once its peer has answered, which is after the callback of
+ * its last frame, so an idle session does not hold the turn. */
+static ts2_session_t *ts2_tx_holder(void)
+{
+    if (tx_owner && (session_state(tx_owner) == ST_IDLE)) {
+        tx_owner = NULL;
+        ts2_tx_next();
+    }
+    return tx_owner;
+}
+
+/*
+ * Send a frame of the current session.
+ *
+ * The lower layer takes one frame with a callback at a time, so the sessions
+ * take turns in sending their fragments. If another session is sending, the
+ * frame waits in the session and is sent when that session is done. The turn
+ * then goes round the sessions, so one large datagram does not hold the others
+ * back. Frames without a callback are sent right away.
+ */
+static uint8_t ts2_send_raw(node_t snode, node_t dnode, uint8_t *buf, uint8_t len, uint8_t flags,
+                            VOID_CALLBACKFUNC(cb)(uint8_t, TX_STATUS_TYPE*))
+{
+    uint8_t ret;
+
+    if (cb && ts2_tx_holder() && (tx_owner != ts2_cur)) {
+        T2_DBG("Session %d is sending, waiting for the turn", (int)(tx_owner - sessions));
+        if (len > sizeof(ts2_cur->tx_wait_buf)) {
+            return false;
+        }
+        memcpy(ts2_cur->tx_wait_buf, buf, len);
+        ts2_cur->tx_wait_len = len;
+        ts2_cur->tx_wait_snode = snode;
+        ts2_cur->tx_wait_dnode = dnode;
+        ts2_cur->tx_wait_flags = flags;
+        ts2_cur->tx_wait_cb = cb;
+        ts2_cur->tx_wait = true;
+        return true;
+    }
+    ret = TS_SEND_RAW(snode, dnode, buf, len, flags, cb);
+    if (ret && cb) {
+        tx_owner = ts2_cur;
+        tx_last = ts2_cur - sessions;
+    }
+    return ret;
+}
+
+/* The lower layer is done with the frame of tx_owner. Select its session and
+ * let the next session have its turn */
+static void ts2_tx_done(void)
+{
+    if (tx_owner) {
+        session_select(tx_owner);
+        tx_owner = NULL;
+    }
+    ts2_tx_next();
+}
+
 /* IF there is no reception of sending for 1000ms we go back to IDLE state */
 /* Helps if transprot service is stuck somewhere */
 #ifdef __C51__
 VOID_CALLBACKFUNC_PVOID(ZCB_reset_transport_service, puser)
 {
-  UNUSED(puser);
+  session_select(puser);
 #else
 static void reset_transport_service(void *ss)
 {
-  UNUSED(ss);
+  session_select(ss);
 #endif
   T2_ERR("reset_timer expired going back to ST_IDLE state ");
-  ctimer_stop(&scb.reset_timer);
+  ctimer_stop(&scb->reset_timer);
   current_state = ST_IDLE;
+  scb->current_dnode = 0;
+  ts2_cur->tx_wait = false;
+  if (tx_owner == ts2_cur) {
+    /* The callback of the lower layer is not coming */
+    ts2_tx_done();
+  }
   discard_all_received_fragments();
 }
 #ifdef __C51__
@@ -333,10 +592,10 @@ static void reset_transport_service(void *ss)
 #else
 #define FUNC(STR) STR
 #endif
-static uint8_t recv_or_send()
+static uint8_t recv_or_send(TRANSPORT2_ST_T state)
 {
-    T2_DBG("sending 1: %s", scb.sending? "true": "false");
-    switch (current_state) {
+    T2_DBG("sending 1: %s", scb->sending? "true": "false");
+    switch (state) {
     case ST_IDLE:
         return 2; /*Neither sending nor receiving */
 
@@ -356,19 +615,43 @@ static uint8_t recv_or_send()
         T2_DBG("Sending 2: true")
             return 0;
     default:
-        T2_ERR("Unkonwn current_state: %s\n", T2_STATES_STRING[current_state]);
+        T2_ERR("Unkonwn state: %s\n", T2_STATES_STRING[state]);
         break;
     }
     return -1;
 }
+static bool session_is_receiving(void)
+{
+    return (recv_or_send(current_state) == 1)? true: false;
+}
+
+static bool session_is_sending(void)
+{
+    return (recv_or_send(current_state) == 0)? true: false;
+}
+
 bool ZW_TransportService_Is_Receving()
 {
-    return (recv_or_send() == 1)? true: false;
+    ts2_session_t *s;
+
+    for (s = sessions; s < sessions + TRANSPORT_SERVICE_SESSIONS; s++) {
+        if (recv_or_send(session_state(s)) == 1) {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool ZW_TransportService_Is_Sending()
 {
-    return (recv_or_send() == 0)? true: false;
+    ts2_session_t *s;
+
+    for (s = sessions; s < sessions + TRANSPORT_SERVICE_SESSIONS; s++) {
+        if (recv_or_send(session_state(s)) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -392,11 +675,24 @@ bool ZW_TransportService_SendData(ts_param_t* p, uint8_t *pData,
     TX_STATUS_TYPE t;
     memset(&t, 0, sizeof(TX_STATUS_TYPE));
 #endif
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
+    ts2_session_t *s;
+
+    s = session_claim(p->dnode);
+    if (!s) {
+        T2_ERR("All %d sessions are busy with other nodes", TRANSPORT_SERVICE_SESSIONS);
+#if defined(ZIPGW) || defined(__C51__)
+        completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &t);
+#else
+        completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0);
+#endif
+        return false;
+    }
+    session_select(s);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
     T2_DBG("Request for Sending data: dataLength: %d, MyNodeid: %d Source node:%d, Destination node: %d", dataLength, (int)MyNodeID, (int)p->snode, (int)p->dnode);
-    if (ZW_TransportService_Is_Sending()) {
-        T2_ERR("Another TX session is in progress. session id: %d", scb.cmn.session_id);
-        T2_ERR("Sending buffer %p, while new request to send of buffer: %p", scb.datagram, pData);
+    if (session_is_sending()) {
+        T2_ERR("Another TX session is in progress. session id: %d", scb->cmn.session_id);
+        T2_ERR("Sending buffer %p, while new request to send of buffer: %p", scb->datagram, pData);
 #if defined(ZIPGW) || defined(__C51__)
         completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &t);
 #else
@@ -405,9 +701,9 @@ bool ZW_TransportService_SendData(ts_param_t* p, uint8_t *pData,
 #endif
         return false;
     }
-    if (ZW_TransportService_Is_Receving()) {
-        T2_ERR("Another RX session is in progress. session id: %d", rcb.cmn.session_id);
-        T2_ERR("Sending buffer %p, while new request to send of buffer: %p", scb.datagram, pData);
+    if (session_is_receiving()) {
+        T2_ERR("Another RX session is in progress. session id: %d", rcb->cmn.session_id);
+        T2_ERR("Sending buffer %p, while new request to send of buffer: %p", scb->datagram, pData);
 #if defined(ZIPGW) || defined(__C51__)
         completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &t);
 #else
@@ -417,25 +713,25 @@ bool ZW_TransportService_SendData(ts_param_t* p, uint8_t *pData,
         return false;
     }
 
-    scb.datagram = pData;
-    memcpy((uint8_t*)&scb.cmn.p, (uint8_t*)p, sizeof(ts_param_t));
-    scb.datagram_len = dataLength;
-    scb.cmn.completedFunc = completedFunc;
+    scb->datagram = pData;
+    memcpy((uint8_t*)&scb->cmn.p, (uint8_t*)p, sizeof(ts_param_t));
+    scb->datagram_len = dataLength;
+    scb->cmn.completedFunc = completedFunc;
 #if defined(ZIPGW) || defined(__C51__)
-    memset((uint8_t*)&scb.cmn.tx_status, 0, sizeof(TX_STATUS_TYPE));
-#endif
-    scb.sending = false;
-    scb.flag_replied_frag_req = 0;
-    scb.transmission_aborted = 0x11; /*Initializing to out of range session id */
-    scb.flag_send_frag_wait = false;
-    scb.flag_reply_frag_req = false;
-    scb.round_trip_first_frag = 0;
-    scb.flag_fc_timer_expired_once = 0;
-    scb.remaining_data_len = 0;
-    scb.current_dnode = 0;
+    memset((uint8_t*)&scb->cmn.tx_status, 0, sizeof(TX_STATUS_TYPE));
+#endif
+    scb->sending = false;
+    scb->flag_replied_frag_req = 0;
+    scb->transmission_aborted = 0x11; /*Initializing to out of range session id */
+    scb->flag_send_frag_wait = false;
+    scb->flag_reply_frag_req = false;
+    scb->round_trip_first_frag = 0;
+    scb->flag_fc_timer_expired_once = 0;
+    scb->remaining_data_len = 0;
+    scb->current_dnode = 0;
 
     T2_DBG("MyNodeid: %d Source node:%d, Destination node: %d", (int)MyNodeID, (int)p->snode, (int)p->dnode);
-    scb.current_dnode = p->dnode;
+    scb->current_dnode = p->dnode;
     switch (current_state) {
         case ST_IDLE:
             T2_DBG("Current state: ST_IDLE");
@@ -450,7 +746,7 @@ bool ZW_TransportService_SendData(ts_param_t* p, uint8_t *pData,
         default:
             T2_ERR("Trying to send fragment from wrong state: %d", current_state);
 #if 0
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0); /*FIXME: Need to decide what to do if we are trying to send while receiving */
+            scb->cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0); /*FIXME: Need to decide what to do if we are trying to send while receiving */
             return false;
 #endif
             break;
@@ -474,26 +770,24 @@ static uint16_t get_next_missing_offset();
 #ifdef __C51__
 VOID_CALLBACKFUNC_PVOID(ZCB_fc_timer_expired, puser)
 {
-  UNUSED(puser);
+  if (puser) {
+    session_select(puser);
+  }
 #else
 void fc_timer_expired(void *nthing)
 {
-  UNUSED(nthing);
+  if (nthing) {
+    session_select(nthing);
+  }
 #endif
-    if (scb.flag_replied_frag_req) {
-        scb.transmission_aborted = scb.cmn.session_id;
-        scb.flag_replied_frag_req = 0;
-        scb.current_dnode = 0;
+    if (scb->flag_replied_frag_req) {
+        scb->transmission_aborted = scb->cmn.session_id;
+        scb->flag_replied_frag_req = 0;
+        scb->current_dnode = 0;
         T2_ERR("FC timer expired after reply_frag_req()");
         T2_ERR("Sending failure to application");
         t2_sm_post_event(EV_FRAG_COMPL_TIMER_REQ);
-        if (scb.cmn.completedFunc) {
-#if defined(ZIPGW) || defined(__C51__)
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &scb.cmn.tx_status);
-#else
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0);
-#endif
-        }
+        session_completed(S2_TRANSMIT_COMPLETE_FAIL);
         return;
     }
 
@@ -501,38 +795,26 @@ void fc_timer_expired(void *nthing)
         event happens. Need to ignore it to make sure we dont send the last fragment again
         and make the state machine end up in weird state */
     /* Tested in test_fc_timer_after_frag_compl_of_aborted_transmission() */
-    if (scb.transmission_aborted == scb.cmn.session_id) {
+    if (scb->transmission_aborted == scb->cmn.session_id) {
         T2_ERR("FC timer expired for aborted transmission. Ignoring the timer event");
         T2_ERR("Sending failure to application");
-        if (scb.cmn.completedFunc) {
-#if defined(ZIPGW) || defined(__C51__)
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &scb.cmn.tx_status);
-#else
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0);
-#endif
-        }
+        session_completed(S2_TRANSMIT_COMPLETE_FAIL);
         return;
     }
 
     /* Tested in test_fc_timer_after_last_frag_twice() */
-    if (scb.flag_fc_timer_expired_once) {
+    if (scb->flag_fc_timer_expired_once) {
         T2_ERR("Frag completion timer event happened twice \n");
         T2_ERR("Sending failure to application");
-        scb.flag_fc_timer_expired_once = 0;
-        scb.current_dnode = 0;
-        if (scb.cmn.completedFunc) {
-#if defined(ZIPGW) || defined(__C51__)
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &scb.cmn.tx_status);
-#else
-            scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0);
-#endif
-        }
+        scb->flag_fc_timer_expired_once = 0;
+        scb->current_dnode = 0;
+        session_completed(S2_TRANSMIT_COMPLETE_FAIL);
         t2_sm_post_event(EV_FRAG_COMPL_TIMER2);
         return;
     }
     T2_DBG("fc_timer_expired once. Sending last fragment again")
     t2_sm_post_event(EV_FRAG_COMPL_TIMER); /*send_last_frag() */
-    scb.flag_fc_timer_expired_once++;
+    scb->flag_fc_timer_expired_once++;
     send_last_frag();
 }
 
@@ -549,8 +831,9 @@ static void ZCB_temp_callback_last_frag(unsigned char status, TX_STATUS_TYPE* ts
 #endif
 {
   //    UNUSED(user);
+    ts2_tx_done();
 #if defined(ZIPGW) || defined(__C51__)
-    memcpy((uint8_t*)&scb.cmn.tx_status, ts, sizeof(TX_STATUS_TYPE));
+    memcpy((uint8_t*)&scb->cmn.tx_status, ts, sizeof(TX_STATUS_TYPE));
 #else
     UNUSED(ts);
 #endif
@@ -566,65 +849,50 @@ static void send_last_frag(void)
 #ifndef __C51__
 retry:
 #endif
-    ctimer_stop(&rcb.fc_timer); /* FIXME this is called twice. First in send_subseq_frag() ? */
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    scb.sending = false;
+    ctimer_stop(&rcb->fc_timer); /* FIXME this is called twice. First in send_subseq_frag() ? */
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    scb->sending = false;
     /* this is last fragment being sent, so pending_segments are 0 now */
-    scb.cmn.pending_segments = 0 ;
-    if (scb.does_not_fit_in_first_frag) {
-        ret = TS_SEND_RAW(scb.cmn.p.snode,scb.cmn.p.dnode, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1,
-                          scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_last_frag);
+    scb->cmn.pending_segments = 0 ;
+    if (scb->does_not_fit_in_first_frag) {
+        ret = ts2_send_raw(scb->cmn.p.snode,scb->cmn.p.dnode, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1,
+                          scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_last_frag);
     } else {
-        ret = TS_SEND_RAW(scb.cmn.p.snode,scb.cmn.p.dnode, t2_txBuf, sizeof(*first_frag) + scb.datalen_to_send - 1,
-                          scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_last_frag);
+        ret = ts2_send_raw(scb->cmn.p.snode,scb->cmn.p.dnode, scb->txBuf, sizeof(*first_frag) + scb->datalen_to_send - 1,
+                          scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_last_frag);
     }
 
     if (ret == 0) {
 #ifndef __C51__
         goto retry;
         T2_ERR("ZW_SendData failed\n")
-        if (scb.flag_fc_timer_expired_once) {
+        if (scb->flag_fc_timer_expired_once) {
 #endif
-            if (scb.cmn.completedFunc) {
-#if defined(ZIPGW) || defined(__C51__)
-                scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, &scb.cmn.tx_status);
-#else
-                scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_FAIL, 0);
-#endif
-            }
+            session_completed(S2_TRANSMIT_COMPLETE_FAIL);
             t2_sm_post_event(EV_FAILURE_LAST_FRAG2);
             return;
 #ifndef __C51__
         } else {
-            scb.flag_fc_timer_expired_once++; /* FIXME: Assuming transmit queue overflow as expired timer */
+            scb->flag_fc_timer_expired_once++; /* FIXME: Assuming transmit queue overflow as expired timer */
             goto retry;
         }
 #endif
     }
 #ifdef TIMER
-    if ((scb.cmn.p.tx_flags == RECEIVE_STATUS_TYPE_BROAD) ||
-        (scb.cmn.p.dnode == 0xff)) {
+    if ((scb->cmn.p.tx_flags == RECEIVE_STATUS_TYPE_BROAD) ||
+        (scb->cmn.p.dnode == 0xff)) {
         T2_ERR("Fragments being sent were broadcast. Not waiting for fragment complete");
         t2_sm_post_event(EV_MISSING_FRAG_BCAST);
     } else {
-        ctimer_set(&rcb.fc_timer, FRAGMENT_FC_TIMEOUT, FUNC(fc_timer_expired), 0);
+        ctimer_set(&rcb->fc_timer, FRAGMENT_FC_TIMEOUT, FUNC(fc_timer_expired), ts2_cur);
         t2_sm_post_event(EV_SUCCESS); /* Go to ST_WAIT_ACK state */
     }
 #endif
     return;
 }
 
-#ifdef __C51__
-void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus);
-code const void (code * ZCB_ts_senddata_cb_p)(void* puser) = &ZCB_ts_senddata_cb;
-void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
-#else
-#ifdef ZIPGW
-void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
-#else
-void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
-#endif
-#endif
+/* A fragment of the current session has been sent, or sending has been stopped by a fragment wait */
+static void ts_senddata_done(unsigned char status_send, TX_STATUS_TYPE* txStatus)
 {
     /* FIXME: May be, this should be part of the specs
 
@@ -633,19 +901,19 @@ void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
     node wants to send FRAG_WAIT, this will give the receiving node little
     time to breath - Anders Esbensen*/
 #if defined(__C51__) || defined(ZIPGW)
-  memcpy((uint8_t*)&scb.cmn.tx_status, (uint8_t*)txStatus, sizeof(TX_STATUS_TYPE));
+  memcpy((uint8_t*)&scb->cmn.tx_status, (uint8_t*)txStatus, sizeof(TX_STATUS_TYPE));
 #else
   UNUSED(txStatus);
 #endif
 #ifndef ZIPGW
   ZW_DEBUG_SEND_STR("1!\r\n");
 #endif
-  if (scb.round_trip_first_frag) {
-      scb.round_trip_first_frag = clock_time() - scb.round_trip_first_frag;
+  if (scb->round_trip_first_frag) {
+      scb->round_trip_first_frag = clock_time() - scb->round_trip_first_frag;
 
       /* FIXME 500 below is added to ease the receiving side to send fragment wait if it wants to */
-      scb.round_trip_first_frag += 300;
-      T2_DBG("Adding delay of scb.round_trip_first_frag: %d ms before sending second fragment", scb.round_trip_first_frag);
+      scb->round_trip_first_frag += 300;
+      T2_DBG("Adding delay of scb->round_trip_first_frag: %d ms before sending second fragment", scb->round_trip_first_frag);
     }
 
 #ifndef ZIPGW
@@ -654,14 +922,14 @@ void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
     if (status_send != S2_TRANSMIT_COMPLETE_OK) {
             T2_ERR("Transmission status is not TRANSMIT_COMPLETE_OK");
     }
-    if (scb.flag_reply_frag_req) {
-        scb.flag_reply_frag_req = false;
+    if (scb->flag_reply_frag_req) {
+        scb->flag_reply_frag_req = false;
         reply_frag_req(NULL);
         return;
     }
 
-    if(scb.flag_send_frag_wait) {
-        scb.flag_send_frag_wait = false;
+    if(scb->flag_send_frag_wait) {
+        scb->flag_send_frag_wait = false;
         T2_DBG("Send Frag_wait now");
         send_frag_wait_cmd();
         return;
@@ -676,75 +944,94 @@ void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
      40 kbit/s: At least 35 ms if sending more than 2 frames back-to-back
      100 kbit/s: At least 15 ms if sending more than 2 frames back-to-back
     */
-    if (scb.transmission_aborted == scb.cmn.session_id) {
-        T2_DBG("stopping tranmission for session: %d", scb.transmission_aborted)
-        ctimer_stop(&scb.timer_btwn_2_frags);
+    if (scb->transmission_aborted == scb->cmn.session_id) {
+        T2_DBG("stopping tranmission for session: %d", scb->transmission_aborted)
+        ctimer_stop(&scb->timer_btwn_2_frags);
     } else {
         T2_DBG("Calling send_subseq_frag");
-        ctimer_set(&scb.timer_btwn_2_frags, 15 + (scb.round_trip_first_frag), FUNC(send_subseq_frag), 0);
+        ctimer_set(&scb->timer_btwn_2_frags, 15 + (scb->round_trip_first_frag), FUNC(send_subseq_frag), ts2_cur);
 #ifdef NEW_TEST_T2
     send_subseq_frag(NULL);
 #endif
 
     }
-    scb.round_trip_first_frag = 0;
+    scb->round_trip_first_frag = 0;
 #ifndef ZIPGW
     ZW_DEBUG_SEND_STR("3!\r\n");
 #endif
 }
 
+#ifdef __C51__
+void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus);
+code const void (code * ZCB_ts_senddata_cb_p)(void* puser) = &ZCB_ts_senddata_cb;
+void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
+#else
+#ifdef ZIPGW
+void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
+#else
+void ZCB_ts_senddata_cb(unsigned char status_send, TX_STATUS_TYPE* txStatus)
+#endif
+#endif
+{
+    ts2_tx_done();
+    ts_senddata_done(status_send, txStatus);
+}
+
 static void send_subseq_frag(void *nthing)
 {
-    UNUSED(nthing);
     uint8_t ret = 0;
 
-    ctimer_stop(&rcb.fc_timer);
-    if (scb.remaining_data_len == 0)
-        scb.remaining_data_len = scb.datagram_len;
+    if (nthing) {
+        session_select(nthing);
+    }
+
+    ctimer_stop(&rcb->fc_timer);
+    if (scb->remaining_data_len == 0)
+        scb->remaining_data_len = scb->datagram_len;
 
-    if (scb.remaining_data_len >= FragmentMaxPayload) {
-        scb.datalen_to_send = FragmentMaxPayload;
+    if (scb->remaining_data_len >= scb->max_payload) {
+        scb->datalen_to_send = scb->max_payload;
     } else {
-        scb.datalen_to_send = scb.remaining_data_len;
+        scb->datalen_to_send = scb->remaining_data_len;
     }
 
-    if (scb.frag_compl_list[scb.cmn.session_id] == true)
+    if (scb->frag_compl_list[scb->cmn.session_id] == true)
     {
         T2_ERR("Already received frag complete command for this session. Aborting any more fragment sending");
         return; /*FIXME just return?*/
     }
-    scb.offset = scb.datagram_len - scb.remaining_data_len;
-    T2_DBG("Sending Subsequent Fragment scb.offset: %d", scb.offset);
+    scb->offset = scb->datagram_len - scb->remaining_data_len;
+    T2_DBG("Sending Subsequent Fragment scb->offset: %d", scb->offset);
     subseq_frag->cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
-    subseq_frag->cmd_datagramSize1 = (COMMAND_SUBSEQUENT_FRAGMENT)|((scb.datagram_len>>8)&0x07);
-    subseq_frag->datagramSize2 = scb.datagram_len & 0xff;
+    subseq_frag->cmd_datagramSize1 = (COMMAND_SUBSEQUENT_FRAGMENT)|((scb->datagram_len>>8)&0x07);
+    subseq_frag->datagramSize2 = scb->datagram_len & 0xff;
 #if 0//t
 
     if (frag_wait_once) {
-        subseq_frag->properties2  = ((scb.cmn.session_id+1) << 3) | ((scb.offset>>8)&0x07);
+        subseq_frag->properties2  = ((scb->cmn.session_id+1) << 3) | ((scb->offset>>8)&0x07);
             frag_wait_once = 0;
     } else
 #endif
-    /* properties2 4 MSBs are session id 4th LSB is reserved and 3 LSBs are 3 MSBs of scb.offset */
-    subseq_frag->properties2  = (scb.cmn.session_id << 4) | ((scb.offset>>8) & 0x07);
-    /* datagramOffset2 is 8 LSBs of scb.offset */
-    subseq_frag->datagramOffset2 = scb.offset & 0xff;
+    /* properties2 4 MSBs are session id 4th LSB is reserved and 3 LSBs are 3 MSBs of scb->offset */
+    subseq_frag->properties2  = (scb->cmn.session_id << 4) | ((scb->offset>>8) & 0x07);
+    /* datagramOffset2 is 8 LSBs of scb->offset */
+    subseq_frag->datagramOffset2 = scb->offset & 0xff;
 
-    memcpy((uint8_t *)&subseq_frag->payload1, (scb.datagram + scb.offset), scb.datalen_to_send);
+    memcpy((uint8_t *)&subseq_frag->payload1, (scb->datagram + scb->offset), scb->datalen_to_send);
 
     /*5 is size of ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME till payload field */
-    add_crc((uint8_t *)&subseq_frag->cmdClass, scb.datalen_to_send + 5);
+    add_crc((uint8_t *)&subseq_frag->cmdClass, scb->datalen_to_send + 5);
 
-    if (scb.remaining_data_len <= FragmentMaxPayload) {
-        scb.does_not_fit_in_first_frag = true;
+    if (scb->remaining_data_len <= scb->max_payload) {
+        scb->does_not_fit_in_first_frag = true;
         t2_sm_post_event(EV_SEND_LAST_FRAG); /* send_last_frag() */
         send_last_frag();
         return;
     }
-//        ret = send_data(&scb.cmn.p, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1, ZCB_ts_senddata_cb, NULL);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    ret = TS_SEND_RAW(scb.cmn.p.snode,scb.cmn.p.dnode, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1,
-                              scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
+//        ret = send_data(&scb->cmn.p, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1, ZCB_ts_senddata_cb, NULL);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    ret = ts2_send_raw(scb->cmn.p.snode,scb->cmn.p.dnode, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1,
+                              scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
     if (ret == 0) {
         T2_ERR("ZW_SendData failed\n");
     }
@@ -752,13 +1039,13 @@ static void send_subseq_frag(void *nthing)
     else
     {
 #endif
-      if (scb.remaining_data_len >= FragmentMaxPayload) {
-          scb.remaining_data_len = scb.remaining_data_len - FragmentMaxPayload;
+      if (scb->remaining_data_len >= scb->max_payload) {
+          scb->remaining_data_len = scb->remaining_data_len - scb->max_payload;
       }
 
-      scb.cmn.pending_segments = scb.remaining_data_len / scb.datalen_to_send;
-      if (scb.remaining_data_len % scb.datalen_to_send) {
-          scb.cmn.pending_segments++;
+      scb->cmn.pending_segments = scb->remaining_data_len / scb->datalen_to_send;
+      if (scb->remaining_data_len % scb->datalen_to_send) {
+          scb->cmn.pending_segments++;
       }
 #ifndef __C51__
     }
@@ -775,9 +1062,9 @@ static void wait_restart_from_first(void *nthing)
 #endif
 {
 #ifdef __C51__
-  UNUSED(puser);
+  session_select(puser);
 #else
-  UNUSED(nthing);
+  session_select(nthing);
 #endif
     send_first_frag();
     return;
@@ -809,91 +1096,91 @@ static void send_first_frag()
     srand(iseed);
 #endif
 #ifdef NEW_TEST_T2 /* session id is fixed: 0 in tests */
-        scb.cmn.session_id = 0;
+        scb->cmn.session_id = 0;
 #else
-    if (!scb.cmn.session_id) {
+    if (!scb->cmn.session_id) {
         /* Session id begins with random number and then keeps incrementing */
         /* Only 4 bits for session id, so max session id can be 0xf */
         #ifdef EFR32ZG
-            scb.cmn.session_id = (GetRandom(g_ZwRandomSeed) % 0xf);
+            scb->cmn.session_id = (GetRandom(g_ZwRandomSeed) % 0xf);
         #else
-            scb.cmn.session_id = (rand() % 0xf);
+            scb->cmn.session_id = (rand() % 0xf);
         #endif
     }
     else {
-        scb.cmn.session_id++;
+        scb->cmn.session_id++;
     }
 
     T2_DBG("Sending First Fragment");
-    if (scb.cmn.session_id > 0xf) /*scb.cmn.session_id has only 4 bits for it */
-        scb.cmn.session_id = 0; /* Being back from 0 */
+    if (scb->cmn.session_id > 0xf) /*scb->cmn.session_id has only 4 bits for it */
+        scb->cmn.session_id = 0; /* Being back from 0 */
 #endif
 
-    scb.frag_compl_list[scb.cmn.session_id] = false;
-    FragmentMaxPayload = FRAGMENTMAXPAYLOAD;
+    scb->frag_compl_list[scb->cmn.session_id] = false;
+    scb->max_payload = FRAGMENTMAXPAYLOAD;
 #ifndef NEW_TEST_T2
-    if(scb.cmn.p.tx_flags & TRANSMIT_OPTION_EXPLORE) {
+    if(scb->cmn.p.tx_flags & TRANSMIT_OPTION_EXPLORE) {
         T2_DBG("TRANSMIT_OPTION_EXPLORE is on");
-        FragmentMaxPayload-=8;
-    } else if(!(scb.cmn.p.tx_flags & TRANSMIT_OPTION_NO_ROUTE)) {
+        scb->max_payload-=8;
+    } else if(!(scb->cmn.p.tx_flags & TRANSMIT_OPTION_NO_ROUTE)) {
         T2_DBG("TRANSMIT_OPTION_NO_ROUTE is on");
-        FragmentMaxPayload-=8;
+        scb->max_payload-=8;
     }
 #endif
-    T2_DBG("FragmentMaxPayload: %d", FragmentMaxPayload);
+    T2_DBG("scb->max_payload: %d", scb->max_payload);
 
-    if (scb.remaining_data_len == 0)
-        scb.remaining_data_len = scb.datagram_len;
+    if (scb->remaining_data_len == 0)
+        scb->remaining_data_len = scb->datagram_len;
 
-    if (scb.datagram_len > FragmentMaxPayload) {
-        scb.remaining_data_len = scb.datagram_len - FragmentMaxPayload;
-        scb.datalen_to_send = FragmentMaxPayload;
+    if (scb->datagram_len > scb->max_payload) {
+        scb->remaining_data_len = scb->datagram_len - scb->max_payload;
+        scb->datalen_to_send = scb->max_payload;
     } else {
-        scb.remaining_data_len = scb.datagram_len;
-        scb.datalen_to_send = scb.datagram_len;
+        scb->remaining_data_len = scb->datagram_len;
+        scb->datalen_to_send = scb->datagram_len;
     }
 
     first_frag->cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
 
-    /* Take 8th, 9th and 10th bit of scb.datagram_len */
-    first_frag->cmd_datagramSize1 = (COMMAND_FIRST_FRAGMENT) | ((scb.datagram_len >> 8) & 0x07);
+    /* Take 8th, 9th and 10th bit of scb->datagram_len */
+    first_frag->cmd_datagramSize1 = (COMMAND_FIRST_FRAGMENT) | ((scb->datagram_len >> 8) & 0x07);
 
-    /* Take 0th-7th bit of scb.datagram_len */
-    first_frag->datagramSize2 = scb.datagram_len & 0xff;
-    first_frag->properties2 = scb.cmn.session_id << 4; /*FIXME need to check EXT and Reserved section */
+    /* Take 0th-7th bit of scb->datagram_len */
+    first_frag->datagramSize2 = scb->datagram_len & 0xff;
+    first_frag->properties2 = scb->cmn.session_id << 4; /*FIXME need to check EXT and Reserved section */
     T2_DBG("packing session id %d", first_frag->properties2 >> 4);
 
-    memcpy((uint8_t*)&first_frag->payload1, scb.datagram, scb.datalen_to_send);
+    memcpy((uint8_t*)&first_frag->payload1, scb->datagram, scb->datalen_to_send);
     //printf("Copied following data:");
-    //print_data((uint8_t*)&first_frag->payload1, scb.datalen_to_send);
+    //print_data((uint8_t*)&first_frag->payload1, scb->datalen_to_send);
 
      /*4 is size of ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME till payload field */
-    add_crc((uint8_t *)&subseq_frag->cmdClass, scb.datalen_to_send + 4);
+    add_crc((uint8_t *)&subseq_frag->cmdClass, scb->datalen_to_send + 4);
 
-    scb.cmn.pending_segments = scb.remaining_data_len / scb.datalen_to_send;
-    if (scb.remaining_data_len % scb.datalen_to_send)
-        scb.cmn.pending_segments++;
+    scb->cmn.pending_segments = scb->remaining_data_len / scb->datalen_to_send;
+    if (scb->remaining_data_len % scb->datalen_to_send)
+        scb->cmn.pending_segments++;
 
-    if (scb.datagram_len <= FragmentMaxPayload) { /* If it was only one fragment */
-        scb.does_not_fit_in_first_frag = false;
+    if (scb->datagram_len <= scb->max_payload) { /* If it was only one fragment */
+        scb->does_not_fit_in_first_frag = false;
         t2_sm_post_event(EV_SEND_LAST_FRAG); /* send_last_frag() */
         send_last_frag();
         return;
     }
 
-    //print_data(t2_txBuf, sizeof(*first_frag) + scb.datalen_to_send - 1);
-//        ret = send_data(&scb.cmn.p, t2_txBuf, sizeof(*first_frag) + scb.datalen_to_send - 1, ZCB_ts_senddata_cb, NULL);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    ret = TS_SEND_RAW(scb.cmn.p.snode, scb.cmn.p.dnode, t2_txBuf, sizeof(*first_frag) + scb.datalen_to_send - 1,
-                              scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
+    //print_data(scb->txBuf, sizeof(*first_frag) + scb->datalen_to_send - 1);
+//        ret = send_data(&scb->cmn.p, scb->txBuf, sizeof(*first_frag) + scb->datalen_to_send - 1, ZCB_ts_senddata_cb, NULL);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    ret = ts2_send_raw(scb->cmn.p.snode, scb->cmn.p.dnode, scb->txBuf, sizeof(*first_frag) + scb->datalen_to_send - 1,
+                              scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
     if (ret == 0) {
         T2_ERR("send_data failed\n");
         return;
     }
 
-    scb.round_trip_first_frag = clock_time();
+    scb->round_trip_first_frag = clock_time();
 
-    scb.sending = true;
+    scb->sending = true;
     t2_sm_post_event(EV_SEND_NEW_FRAG); /*ZCB_send_subseq_frag*/
 }
 
@@ -910,20 +1197,14 @@ void ZCB_temp_callback_reply_frag_req(unsigned char status, TX_STATUS_TYPE* ts)
 #endif
 {
   //    UNUSED(user);
+    ts2_tx_done();
 #if defined(ZIPGW) || defined(__C51__)
-    memcpy((uint8_t*)&scb.cmn.tx_status, ts, sizeof(TX_STATUS_TYPE));
+    memcpy((uint8_t*)&scb->cmn.tx_status, ts, sizeof(TX_STATUS_TYPE));
 #else
     UNUSED(ts);
 #endif
     if (status != S2_TRANSMIT_COMPLETE_OK) {
-        if (scb.cmn.completedFunc) {
-#if defined(ZIPGW) || defined(__C51__)
-            scb.cmn.completedFunc(status, ts);
-#else
-            scb.cmn.completedFunc(status, 0);
-#endif
-
-        }
+        session_completed(status);
     }
     t2_sm_post_event(EV_SENT_MISS_FRAG);
 
@@ -936,56 +1217,56 @@ static void reply_frag_req(void* nthing)
 #if !defined(ZIPGW)
     UNUSED(nthing);
 #endif
-    if (scb.frag_compl_list[scb.cmn.session_id] == true) {
+    if (scb->frag_compl_list[scb->cmn.session_id] == true) {
         T2_ERR("Already received frag complete command for this session. Aborting any more fragment sending");
         return;
     }
-    scb.datalen_to_send = FragmentMaxPayload;
-    T2_DBG("Resending offset: %d", scb.missing_offset);
+    scb->datalen_to_send = scb->max_payload;
+    T2_DBG("Resending offset: %d", scb->missing_offset);
 
     subseq_frag->cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
 
-    if ((scb.missing_offset + scb.datalen_to_send) > scb.datagram_len) { /*last fragment */
-        scb.datalen_to_send = scb.datagram_len - scb.missing_offset;
+    if ((scb->missing_offset + scb->datalen_to_send) > scb->datagram_len) { /*last fragment */
+        scb->datalen_to_send = scb->datagram_len - scb->missing_offset;
     }
 
     subseq_frag->cmd_datagramSize1 = (COMMAND_SUBSEQUENT_FRAGMENT) |
-                                            ((scb.datagram_len>>8)&0x07);
-    subseq_frag->datagramSize2 = scb.datagram_len & 0xff;
-    subseq_frag->properties2  = (scb.cmn.session_id << 4) | ((scb.missing_offset>>8)&0x07);
-    subseq_frag->datagramOffset2 = scb.missing_offset & 0xff;
-    memcpy((uint8_t *)&subseq_frag->payload1, (scb.datagram + scb.missing_offset),
-           scb.datalen_to_send);
+                                            ((scb->datagram_len>>8)&0x07);
+    subseq_frag->datagramSize2 = scb->datagram_len & 0xff;
+    subseq_frag->properties2  = (scb->cmn.session_id << 4) | ((scb->missing_offset>>8)&0x07);
+    subseq_frag->datagramOffset2 = scb->missing_offset & 0xff;
+    memcpy((uint8_t *)&subseq_frag->payload1, (scb->datagram + scb->missing_offset),
+           scb->datalen_to_send);
 
     /* 5 is size of ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME till payload
      * field */
-    add_crc((uint8_t *)&subseq_frag->cmdClass, scb.datalen_to_send + 5);
-    if ((scb.missing_offset + scb.datalen_to_send) == scb.datagram_len) { /*last fragment */
+    add_crc((uint8_t *)&subseq_frag->cmdClass, scb->datalen_to_send + 5);
+    if ((scb->missing_offset + scb->datalen_to_send) == scb->datagram_len) { /*last fragment */
         T2_DBG("Resending last fragmnet");
-        scb.does_not_fit_in_first_frag = true;
+        scb->does_not_fit_in_first_frag = true;
         t2_sm_post_event(EV_SEND_LAST_MISS_FRAG); /* send_last_frag() */
-        scb.flag_replied_frag_req = 1;
+        scb->flag_replied_frag_req = 1;
         send_last_frag();
         return;
     }
 
-//  ret = send_data(&scb.cmn.p, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1, ZCB_temp_callback_reply_frag_req, NULL);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    if (scb.sending) {
-        ret = TS_SEND_RAW(scb.cmn.p.snode, scb.cmn.p.dnode, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1,
-                              scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
+//  ret = send_data(&scb->cmn.p, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1, ZCB_temp_callback_reply_frag_req, NULL);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    if (scb->sending) {
+        ret = ts2_send_raw(scb->cmn.p.snode, scb->cmn.p.dnode, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1,
+                              scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
     } else {
-        ret = TS_SEND_RAW(scb.cmn.p.snode, scb.cmn.p.dnode, t2_txBuf, sizeof(*subseq_frag) + scb.datalen_to_send - 1,
-                              scb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_reply_frag_req);
+        ret = ts2_send_raw(scb->cmn.p.snode, scb->cmn.p.dnode, scb->txBuf, sizeof(*subseq_frag) + scb->datalen_to_send - 1,
+                              scb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_temp_callback_reply_frag_req);
     }
     if (ret == 0) {
         T2_ERR("send_data failed\n");
     }
-    scb.flag_replied_frag_req = 1;
+    scb->flag_replied_frag_req = 1;
     /*FIXME: After replying to fragment request, the code wait for fragment complete or another fragment request.
         But on receive side decision of another fragment request or fragment complete is taken when rx timer expires after 800ms
         this makes the FC timer here on sending side expire so adding 500ms more here */
-    ctimer_set(&rcb.fc_timer, (FRAGMENT_FC_TIMEOUT + 500), FUNC(fc_timer_expired), 0);
+    ctimer_set(&rcb->fc_timer, (FRAGMENT_FC_TIMEOUT + 500), FUNC(fc_timer_expired), ts2_cur);
 
 }
 
@@ -1019,6 +1300,7 @@ void TransportService_ApplicationCommandHandler(ts_CommandHandler_t *pCmdHandler
     uint8_t cmdLength;
     uint8_t cmd_type;
     uint8_t datagram_size_tmp;
+    ts2_session_t *s;
 
     p = pCmdHandlerStruct->pParam;
     pCmd = (uint8_t*)pCmdHandlerStruct->pCmd;
@@ -1030,31 +1312,10 @@ void TransportService_ApplicationCommandHandler(ts_param_t* p,
 {
     uint8_t cmd_type;
     uint16_t datagram_size_tmp;
+    ts2_session_t *s;
 #endif
 
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
     T2_DBG("Received data: Source node:%d, Destination node: %d", (int)p->snode, (int)p->dnode);
-    /* Tie break check */
-    /* 1. The receiving node is currently transmitting a datagram.
-     * 2. The recipient of the datagram being transmitted is also the
-            originator of the received fragment
-     * 3. The receiving node has a lower NodeID than the originator */
-    if (ZW_TransportService_Is_Sending() && /* 1st condition */
-       (scb.cmn.p.dnode == p->snode) && /* 2nd condition */
-       (MyNodeID < p->snode)) { /* 3rd condition */
-        T2_ERR("Tie breaking. Failing the send session. Ready to receive");
-        T2_DBG("ZW_TransportService_Is_Sending() is true. scb.cmn.p.dnode: %d, p->snode: %d, MyNodeID: %d", scb.cmn.p.dnode, p->snode, MyNodeID);
-        t2_sm_post_event(EV_TIE_BREAK);
-        flag_tie_broken = 1;
-        /*FIXME: Can not FAIL the transmission because of following reason:
-            When GW is sending to some node. On receiving frag compl for a
-            transmision from that node, if we have following line GW will fail the
-            transmission just because of tie break logic
-        scb.cmn.completedFunc(TRANSMIT_COMPLETE_FAIL, 0);
-        */
-    }
-
-    T2_DBG("Mynodeid: %d, Source node:%d, Destination node: %d", MyNodeID, (int)p->snode, (int)p->dnode);
 
     /* There are some garbage retranmissions where the source and destination ids are messed up */
     if (p->snode == p->dnode) {
@@ -1071,23 +1332,23 @@ void TransportService_ApplicationCommandHandler(ts_param_t* p,
         return;
     }
 
-    /* incase FRAG_WAIT has to be sent backup the ts_param_t received */
-    memcpy((uint8_t*)&scb.frag_wait_p, (uint8_t*)p, sizeof(ts_param_t));
-
-    if (((p->snode != rcb.current_snode) && (rcb.current_snode)) || /* received frame from third node while receiving from second node */
-            ((p->snode != scb.current_dnode) && (scb.current_dnode))) { /* received frame from third node while sending to second node */
+    s = session_claim(p->snode);
+    if (!s) {
+        /* All sessions are busy with other nodes. Ask the node to wait for
+         * the session which is expected to be done first. */
+        session_select(session_soonest_done());
+        memcpy((uint8_t*)&scb->frag_wait_p, (uint8_t*)p, sizeof(ts_param_t));
         if (p->rx_flags == RECEIVE_STATUS_TYPE_SINGLE) {
-            T2_DBG("Current source node is %d but received source node id is %d, session_id: %d", rcb.current_snode, p->snode,  ((*((uint8_t *)(pCmd + 3))& 0xf0) >> 4));
-            T2_DBG("Current dest node is %d but received source node id is %d, session_id : %d", scb.current_dnode, p->snode, ((*((uint8_t *)(pCmd + 3))& 0xf0) >> 4));
+            T2_DBG("No session for source node %d, session_id: %d", p->snode, ((*((uint8_t *)(pCmd + 3))& 0xf0) >> 4));
 
             /*FIXME workaround to ignore further singlecast frames from different node */
             if (current_state == ST_SEND_FRAG_WAIT) {
                 return;
             }
             t2_sm_post_event(EV_SCAST_DIFF_NODE); /*send_frag_wait_cmd */
-            if (scb.sending) {
+            if (scb->sending) {
                 T2_DBG("Next fragment sent will be FRAG_WAIT to %d", p->snode)
-                scb.flag_send_frag_wait = true;
+                scb->flag_send_frag_wait = true;
             } else {
                 send_frag_wait_cmd();
             }
@@ -1096,14 +1357,41 @@ void TransportService_ApplicationCommandHandler(ts_param_t* p,
 
         if (p->rx_flags == RECEIVE_STATUS_TYPE_BROAD) {
             t2_sm_post_event(EV_BCAST_DIFF_NODE); /*drop_fragment */
-            return;
         }
+        return;
     }
+    session_select(s);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+
+    /* Tie break check */
+    /* 1. The receiving node is currently transmitting a datagram.
+     * 2. The recipient of the datagram being transmitted is also the
+            originator of the received fragment
+     * 3. The receiving node has a lower NodeID than the originator */
+    if (session_is_sending() && /* 1st condition */
+       (scb->cmn.p.dnode == p->snode) && /* 2nd condition */
+       (MyNodeID < p->snode)) { /* 3rd condition */
+        T2_ERR("Tie breaking. Failing the send session. Ready to receive");
+        T2_DBG("session_is_sending() is true. scb->cmn.p.dnode: %d, p->snode: %d, MyNodeID: %d", scb->cmn.p.dnode, p->snode, MyNodeID);
+        t2_sm_post_event(EV_TIE_BREAK);
+        scb->flag_tie_broken = 1;
+        /*FIXME: Can not FAIL the transmission because of following reason:
+            When GW is sending to some node. On receiving frag compl for a
+            transmision from that node, if we have following line GW will fail the
+            transmission just because of tie break logic
+        scb->cmn.completedFunc(TRANSMIT_COMPLETE_FAIL, 0);
+        */
+    }
+
+    T2_DBG("Mynodeid: %d, Source node:%d, Destination node: %d", MyNodeID, (int)p->snode, (int)p->dnode);
+
+    /* incase FRAG_WAIT has to be sent backup the ts_param_t received */
+    memcpy((uint8_t*)&scb->frag_wait_p, (uint8_t*)p, sizeof(ts_param_t));
 
     cmd_type = *((uint8_t *)pCmd + 1);
     cmd_type = cmd_type & 0xf8;
 
-    if ((rcb.cmn.session_id == 0x10) && ( cmd_type == COMMAND_SUBSEQUENT_FRAGMENT)) {
+    if ((rcb->cmn.session_id == 0x10) && ( cmd_type == COMMAND_SUBSEQUENT_FRAGMENT)) {
         datagram_size_tmp  = (*((uint8_t *)pCmd + 1)) & 0x07;
         datagram_size_tmp = (datagram_size_tmp << 8) + (*((uint8_t *)pCmd + 2));
 
@@ -1115,8 +1403,8 @@ void TransportService_ApplicationCommandHandler(ts_param_t* p,
         }
         T2_ERR("Received subseq fragment without first fragment. session_id:%d",  ((*((uint8_t *)(pCmd + 3))& 0xf0) >> 4));
         t2_sm_post_event(EV_SUBSEQ_DIFF_SESSION);
-        if (scb.sending) {
-            scb.flag_send_frag_wait = true;
+        if (scb->sending) {
+            scb->flag_send_frag_wait = true;
         } else {
             send_frag_wait_cmd();
         }
@@ -1141,22 +1429,11 @@ void TransportService_ApplicationCommandHandler(ts_param_t* p,
             break;
     }
 
-    if (flag_initialize_once) {
-        T2_DBG("Initializing rcb.cmn.session_id to 0x10");
-        flag_initialize_once = 0;
-        memset((uint8_t*)&rcb.cmn, 0, sizeof(control_block_t));
-        rcb.cmn.session_id = 0x10;
-        rcb.flag_retry_frag_req_once = 1;
-        rcb.cur_recvd_data_size = 0;
-        rcb.current_snode = 0;
-        memset(rcb.datagramData, 0, DATAGRAM_SIZE_MAX);
-        memset(rcb.bytes_recvd_bitmask, 0, sizeof(rcb.bytes_recvd_bitmask));
-    }
-    rcb.fragment = pCmd;
+    rcb->fragment = pCmd;
     /*need to memcpy because the (ts_param_t*)p pointer is not valid when
      the rx_timer_expired is called by the timer*/
-    memcpy((uint8_t*)&rcb.cmn.p, (uint8_t*)p, sizeof(ts_param_t));
-    rcb.fragment_len = cmdLength;
+    memcpy((uint8_t*)&rcb->cmn.p, (uint8_t*)p, sizeof(ts_param_t));
+    rcb->fragment_len = cmdLength;
 
     receive();
     return;
@@ -1168,11 +1445,11 @@ static uint8_t mark_frag_received(uint16_t offset, uint8_t size)
 
     T2_DBG("Received offset: %d", (int)offset);
 
-    if ((offset != 0) && !(rcb.bytes_recvd_bitmask[0] & 1)) {
+    if ((offset != 0) && !(rcb->bytes_recvd_bitmask[0] & 1)) {
         T2_ERR("Received subseq fragment without first fragment.");
         t2_sm_post_event(EV_SUBSEQ_DIFF_SESSION);
-        if (scb.sending) {
-            scb.flag_send_frag_wait = true;
+        if (scb->sending) {
+            scb->flag_send_frag_wait = true;
         } else {
             send_frag_wait_cmd();
         }
@@ -1183,11 +1460,11 @@ static uint8_t mark_frag_received(uint16_t offset, uint8_t size)
         // set the (i%8)th bit in (i/8)th byte in bitmask, where i is the byte received
 
         // if 9th byte is received following formula becomes 
-        //                rcb.bytes_recvd_bitmask[1] |= ( 1 << 1)
-        // if 11th byte is received following formula becomes rcb.bytes_recvd_bitmask[1] |= 4
-        //                rcb.bytes_recvd_bitmask[1] |= ( 1 << 3)
+        //                rcb->bytes_recvd_bitmask[1] |= ( 1 << 1)
+        // if 11th byte is received following formula becomes rcb->bytes_recvd_bitmask[1] |= 4
+        //                rcb->bytes_recvd_bitmask[1] |= ( 1 << 3)
 
-        rcb.bytes_recvd_bitmask[ i / 8 ] |= (1 << (i%8));
+        rcb->bytes_recvd_bitmask[ i / 8 ] |= (1 << (i%8));
         if ( i > DATAGRAM_SIZE_MAX) { // Prevent the array over run
             break;
         } 
@@ -1207,13 +1484,13 @@ static uint8_t get_num_missing_frag()
 
     int missing_frag = 0;
 
-    for ( i = 0; i < (sizeof(rcb.bytes_recvd_bitmask)); i++) { //iterate through all bytes
+    for ( i = 0; i < (sizeof(rcb->bytes_recvd_bitmask)); i++) { //iterate through all bytes
         for ( j = 0; j < 8; j++) {                              // iterate through each bit
-            if ( ((i * 8) + j) == rcb.datagram_size) { //Check if we reached bit mask size of datagram size
+            if ( ((i * 8) + j) == rcb->datagram_size) { //Check if we reached bit mask size of datagram size
                 goto exit;
             }
 
-            if ((rcb.bytes_recvd_bitmask[i] & ( 1 << j)) == 0) { //check if the byte is missing
+            if ((rcb->bytes_recvd_bitmask[i] & ( 1 << j)) == 0) { //check if the byte is missing
                 if (previous) { //If the previous is 1 that means its new hole if previous is 0 its continuation of the hole
                     missing_frag++;
                     previous = 0;
@@ -1223,7 +1500,7 @@ static uint8_t get_num_missing_frag()
             }
         }
     }
-    if(missing_frag >= rcb.datagram_size) {
+    if(missing_frag >= rcb->datagram_size) {
         missing_frag = 0;
     }
 exit:
@@ -1241,14 +1518,18 @@ static void rx_timer_expired(void *ss)
 #endif
 {
 #ifdef __C51__
-    struct rx_timer_expired_data *rdata = puser;
+    session_select(puser);
 #else
-    struct rx_timer_expired_data *rdata = ss;
+    session_select(ss);
+#endif
+    rx_timeout(rcb->rx_data.state);
+}
 #endif
-    uint8_t state = rdata->state;
 
+static void rx_timeout(uint8_t state)
+{
 #ifdef TIMER
-    ctimer_stop(&rcb.rx_timer);
+    ctimer_stop(&rcb->rx_timer);
 #endif
 
 #if 0 /* Following code is just for information purpose */
@@ -1262,7 +1543,7 @@ static void rx_timer_expired(void *ss)
     /* There could be two functions called after this depending on current
      * state. See code above */
     t2_sm_post_event(EV_FRAG_RX_TIMER);
-    if (state && (get_next_missing_offset(/*rcb.datagram_size*/))) {
+    if (state && (get_next_missing_offset(/*rcb->datagram_size*/))) {
         T2_ERR("rx timer expired after sending Fragment Request");
         T2_ERR("Discarding all fragments");
         discard_all_received_fragments();
@@ -1270,11 +1551,10 @@ static void rx_timer_expired(void *ss)
         find_missing();
     }
 /*
-    T2_DBG("ctimer_set rcb.rx_timer");
-    ctimer_set(&rcb.rx_timer, FRAGMENT_RX_TIMEOUT, ZCB_rx_timer_expired, 0);
+    T2_DBG("ctimer_set rcb->rx_timer");
+    ctimer_set(&rcb->rx_timer, FRAGMENT_RX_TIMEOUT, ZCB_rx_timer_expired, ts2_cur);
 */
 }
-#endif
 
 static void find_missing()
 {
@@ -1283,7 +1563,7 @@ static void find_missing()
     missing_frag = get_next_missing_offset();
 
     if (missing_frag) {
-        if (rcb.cmn.p.rx_flags == RECEIVE_STATUS_TYPE_BROAD) {
+        if (rcb->cmn.p.rx_flags == RECEIVE_STATUS_TYPE_BROAD) {
             T2_DBG("There are missing fragments, but in broadcast datagram. Not sending fragment request command to sender");
             discard_all_received_fragments();
             return;
@@ -1292,7 +1572,7 @@ static void find_missing()
         send_frag_req_cmd();
     } else {
         /* No need to send Fragment complete in case of Broadcast */
-        if (rcb.cmn.p.rx_flags == RECEIVE_STATUS_TYPE_BROAD) {
+        if (rcb->cmn.p.rx_flags == RECEIVE_STATUS_TYPE_BROAD) {
             T2_DBG("Fragment transfer has compoleted, but in broadcast datagram. Not sending fragment complete command to sender");
             return;
         }
@@ -1307,17 +1587,17 @@ static void receive(void)
     TX_STATUS_TYPE t;
 #endif
 
-    uint8_t byte1 = *((uint8_t *)rcb.fragment + 1);
-    uint8_t byte2 = *((uint8_t *)rcb.fragment + 2);
-    uint8_t byte3 = *((uint8_t *)rcb.fragment + 3);
-    uint8_t byte4 = *((uint8_t *)rcb.fragment + 4);
+    uint8_t byte1 = *((uint8_t *)rcb->fragment + 1);
+    uint8_t byte2 = *((uint8_t *)rcb->fragment + 2);
+    uint8_t byte3 = *((uint8_t *)rcb->fragment + 3);
+    uint8_t byte4 = *((uint8_t *)rcb->fragment + 4);
 
     uint16_t datagram_offset = 0; /*It has to fit 11 bits so need to be two uint8_t */
     uint8_t *curr_datagramData;
     uint8_t recvd_session_id = 0;
     uint16_t datagram_size_tmp;
 
-    if (*((uint8_t *)rcb.fragment) != COMMAND_CLASS_TRANSPORT_SERVICE) {
+    if (*((uint8_t *)rcb->fragment) != COMMAND_CLASS_TRANSPORT_SERVICE) {
         T2_ERR("Command class is not COMMAND_CLASS_TRANSPORT_SERVICE");
         return;
     }
@@ -1325,14 +1605,14 @@ static void receive(void)
     switch (byte1 & 0xf8) {
     case COMMAND_FIRST_FRAGMENT:
         T2_DBG("Received First Fragment");
-        if (flag_tie_broken) {
-            scb.transmission_aborted = scb.cmn.session_id;
+        if (scb->flag_tie_broken) {
+            scb->transmission_aborted = scb->cmn.session_id;
         }
-        //print_data((uint8_t*)rcb.fragment, rcb.fragment_len);
+        //print_data((uint8_t*)rcb->fragment, rcb->fragment_len);
 #define FIRST_FRAG_NONPAYLOAD_LENGTH (sizeof(ZW_COMMAND_FIRST_FRAGMENT_1BYTE_FRAME) - 1)
 #define SUBSEQ_FRAG_NONPAYLOAD_LENGTH (sizeof(ZW_COMMAND_SUBSEQUENT_FRAGMENT_1BYTE_FRAME) - 1)
 
-        if (rcb.fragment_len <= FIRST_FRAG_NONPAYLOAD_LENGTH) {
+        if (rcb->fragment_len <= FIRST_FRAG_NONPAYLOAD_LENGTH) {
 #ifdef __C51__
             T2_ERR("Length of received fragment is less than %d", FIRST_FRAG_NONPAYLOAD_LENGTH)
 #else
@@ -1343,7 +1623,7 @@ static void receive(void)
         }
 
         /* If first fragment received is corrupt send fragment wait command */
-        if (CRC_FUNC(0x1D0F, (uint8_t*) rcb.fragment, rcb.fragment_len) != 0) {
+        if (CRC_FUNC(0x1D0F, (uint8_t*) rcb->fragment, rcb->fragment_len) != 0) {
             T2_ERR("CRC error. Discarding fragment");
             /*FIXME: Do we need to send FRAG_WAIT here? */
             t2_sm_post_event(EV_RECV_NEW_FRAG);
@@ -1352,8 +1632,8 @@ static void receive(void)
 
         recvd_session_id = (byte3 & 0xf0) >> 4;
         T2_DBG("recvd_sesion_id is %d", recvd_session_id);
-        if ((recvd_session_id != rcb.cmn.session_id) && (rcb.cmn.session_id != 0x10)) { /*Refer 10.1.3.1.5 */
-        T2_DBG("Current session is %d but received session id is %d. Ignoring the fragment", rcb.cmn.session_id, recvd_session_id);
+        if ((recvd_session_id != rcb->cmn.session_id) && (rcb->cmn.session_id != 0x10)) { /*Refer 10.1.3.1.5 */
+        T2_DBG("Current session is %d but received session id is %d. Ignoring the fragment", rcb->cmn.session_id, recvd_session_id);
             t2_sm_post_event(EV_DIFF_SESSION);
             return;
         }
@@ -1367,27 +1647,27 @@ static void receive(void)
             return;
         }
 #ifdef TIMER
-        ctimer_set(&rcb.rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), &rcb.rx_data);
+        ctimer_set(&rcb->rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), ts2_cur);
 #endif
-        rcb.cmn.session_id = recvd_session_id;
-        rcb.recv_frag_compl_list[recvd_session_id] = false; /* Setting this session id as "havent received FRAG_COMPLETE for it"*/
+        rcb->cmn.session_id = recvd_session_id;
+        rcb->recv_frag_compl_list[recvd_session_id] = false; /* Setting this session id as "havent received FRAG_COMPLETE for it"*/
 
-        rcb.cur_recvd_data_size = rcb.fragment_len - FIRST_FRAG_NONPAYLOAD_LENGTH;
+        rcb->cur_recvd_data_size = rcb->fragment_len - FIRST_FRAG_NONPAYLOAD_LENGTH;
 
-        rcb.datagram_size = datagram_size_tmp;
-        memset(rcb.bytes_recvd_bitmask, 0, sizeof(rcb.bytes_recvd_bitmask));
+        rcb->datagram_size = datagram_size_tmp;
+        memset(rcb->bytes_recvd_bitmask, 0, sizeof(rcb->bytes_recvd_bitmask));
 
-        rcb.current_snode = rcb.cmn.p.snode;
+        rcb->current_snode = rcb->cmn.p.snode;
 
 #define FIRST_HDR_LEN 4 /* Cmd class, cmd, size, seqno */
 #define SUBSEQ_HDR_LEN 5 /* Cmd class, cmd, size, seqno + offset 1, offset 2*/
-        memcpy(rcb.datagramData, rcb.fragment + FIRST_HDR_LEN,
-               rcb.cur_recvd_data_size);
-        if(mark_frag_received(0, rcb.cur_recvd_data_size))
+        memcpy(rcb->datagramData, rcb->fragment + FIRST_HDR_LEN,
+               rcb->cur_recvd_data_size);
+        if(mark_frag_received(0, rcb->cur_recvd_data_size))
             return;
 
         /* The current fragment had all the data needed for the datagram */
-        if (rcb.cur_recvd_data_size == rcb.datagram_size) {
+        if (rcb->cur_recvd_data_size == rcb->datagram_size) {
             t2_sm_post_event(EV_SEND_FRAG_COMPLETE); /* send_frag_complete_cmd */
             send_frag_complete_cmd();
             return;
@@ -1395,21 +1675,21 @@ static void receive(void)
 
         /* The current fragment had more data than the size of
            whole datagram. TODO: Something wrong?*/
-        if (rcb.cur_recvd_data_size > rcb.datagram_size) {
+        if (rcb->cur_recvd_data_size > rcb->datagram_size) {
             T2_ERR("Something went wrong. Current fragment has more data than needed in this datagram");
             //t2_sm_post_event(EV_ERROR);
         }
-        rcb.rx_data.state = 0; /*not after sending req cmd */
+        rcb->rx_data.state = 0; /*not after sending req cmd */
         break;
 
     case COMMAND_SUBSEQUENT_FRAGMENT:
         /* Stay in the same function and handle fragment */
         T2_DBG("Received Subsequent Fragment");
-        if (flag_tie_broken) {
-            scb.transmission_aborted = scb.cmn.session_id;
+        if (scb->flag_tie_broken) {
+            scb->transmission_aborted = scb->cmn.session_id;
         }
 
-        if (rcb.fragment_len <= SUBSEQ_FRAG_NONPAYLOAD_LENGTH) {
+        if (rcb->fragment_len <= SUBSEQ_FRAG_NONPAYLOAD_LENGTH) {
 #ifdef __C51__
             T2_ERR("Length of received subseq fragment is less than %d. Ignoring the fragment", SUBSEQ_FRAG_NONPAYLOAD_LENGTH)
 #else
@@ -1420,7 +1700,7 @@ static void receive(void)
             return;
         }
         /* If subseq fragment received is corrupt just ignore it */
-        if (CRC_FUNC(0x1D0F, (uint8_t*) rcb.fragment, rcb.fragment_len) != 0) {
+        if (CRC_FUNC(0x1D0F, (uint8_t*) rcb->fragment, rcb->fragment_len) != 0) {
             T2_ERR("CRC error. Ignoring");
             /*FIXME: Do we need to send FRAG_WAIT here? */
             t2_sm_post_event(EV_RECV_NEW_FRAG);
@@ -1429,7 +1709,7 @@ static void receive(void)
 
         recvd_session_id = (byte3 & 0xf0) >> 4;
 
-        if (rcb.recv_frag_compl_list[recvd_session_id] == true) {
+        if (rcb->recv_frag_compl_list[recvd_session_id] == true) {
             T2_ERR("Already received Fragment Complete command for this session: %d. Looks like duplicate frame", recvd_session_id);
             if (current_state == ST_RECEIVING) {
                 t2_sm_post_event(EV_DUPL_FRAME);
@@ -1439,8 +1719,8 @@ static void receive(void)
             return;
         }
         /* session ID of new received fragment is different from the one being assembled */
-        if ((recvd_session_id != rcb.cmn.session_id) && (rcb.cmn.session_id != 0x10)) {
-            T2_DBG("Current session is %d but recived session id is %d. Ignoring fragment", rcb.cmn.session_id, recvd_session_id);
+        if ((recvd_session_id != rcb->cmn.session_id) && (rcb->cmn.session_id != 0x10)) {
+            T2_DBG("Current session is %d but recived session id is %d. Ignoring fragment", rcb->cmn.session_id, recvd_session_id);
             t2_sm_post_event(EV_DIFF_SESSION);
             return;
         }
@@ -1452,9 +1732,9 @@ static void receive(void)
         // Sends FRAG_WAIT as well
 
         T2_DBG("offset: %d", datagram_offset);
-        rcb.cur_recvd_data_size = rcb.fragment_len - SUBSEQ_FRAG_NONPAYLOAD_LENGTH;
+        rcb->cur_recvd_data_size = rcb->fragment_len - SUBSEQ_FRAG_NONPAYLOAD_LENGTH;
 
-        if ((datagram_offset + rcb.cur_recvd_data_size) > DATAGRAM_SIZE_MAX) {
+        if ((datagram_offset + rcb->cur_recvd_data_size) > DATAGRAM_SIZE_MAX) {
             T2_ERR("Offset of fragment received is more than DATAGRAM_SIZE_MAX. Ignoring fragment");
             if (current_state == ST_RECEIVING) {
                 t2_sm_post_event(EV_DUPL_FRAME);
@@ -1470,24 +1750,24 @@ static void receive(void)
             return;
         }
 #ifdef TIMER
-        ctimer_set(&rcb.rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), &rcb.rx_data);
+        ctimer_set(&rcb->rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), ts2_cur);
 #endif
-        if (mark_frag_received(datagram_offset, rcb.cur_recvd_data_size))
+        if (mark_frag_received(datagram_offset, rcb->cur_recvd_data_size))
                 break;
 
-        T2_DBG("Pending Segments: %d", rcb.cmn.pending_segments);
-        rcb.datagram_size = datagram_size_tmp;
-        curr_datagramData = rcb.datagramData; /* Should not change the global buffer address */
+        T2_DBG("Pending Segments: %d", rcb->cmn.pending_segments);
+        rcb->datagram_size = datagram_size_tmp;
+        curr_datagramData = rcb->datagramData; /* Should not change the global buffer address */
         curr_datagramData = curr_datagramData + datagram_offset;
 
-        memcpy(curr_datagramData, rcb.fragment + SUBSEQ_HDR_LEN, rcb.cur_recvd_data_size);
+        memcpy(curr_datagramData, rcb->fragment + SUBSEQ_HDR_LEN, rcb->cur_recvd_data_size);
 
-        if (((datagram_offset + rcb.cur_recvd_data_size) >= rcb.datagram_size)) { /*last fragment? */
+        if (((datagram_offset + rcb->cur_recvd_data_size) >= rcb->datagram_size)) { /*last fragment? */
             t2_sm_post_event(EV_RECV_LAST_FRAG); /*find_missing()*/
             find_missing();
             return;
         }
-        rcb.rx_data.state = 0; /*not after sending req cmd */
+        rcb->rx_data.state = 0; /*not after sending req cmd */
         break;
 
    case COMMAND_SEGMENT_REQUEST_V2:
@@ -1497,32 +1777,32 @@ static void receive(void)
         recvd_session_id = (byte2 & 0xf0) >> 4;
         /*Fragment request is not from the same session in which we were sending */
 
-        if (recvd_session_id == scb.transmission_aborted) {
+        if (recvd_session_id == scb->transmission_aborted) {
             T2_DBG("COMMAND_FRAGMENT_REQUEST: for aborted transmionss session:%d. Igoring... ", recvd_session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_SESSION);
             return;
         }
-        if (recvd_session_id != scb.cmn.session_id) {
-            T2_DBG("Current session is %d but recived session id is %d. Ignoring...", scb.cmn.session_id, recvd_session_id);
+        if (recvd_session_id != scb->cmn.session_id) {
+            T2_DBG("Current session is %d but recived session id is %d. Ignoring...", scb->cmn.session_id, recvd_session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_SESSION);
             return;
         }
-        if ((rcb.cmn.p.snode != scb.current_dnode) && (rcb.current_snode != 0)) { /* Check if the FRAG REQ is from the destination node where we were sending data to */
-            T2_ERR("Session id of Fragment request received is not same as session_id of fragment being sent, recvd_session_id: %d, scb.cmn.session_id: %d. Ignoring the Frag request command", recvd_session_id, scb.cmn.session_id);
+        if ((rcb->cmn.p.snode != scb->current_dnode) && (rcb->current_snode != 0)) { /* Check if the FRAG REQ is from the destination node where we were sending data to */
+            T2_ERR("Session id of Fragment request received is not same as session_id of fragment being sent, recvd_session_id: %d, scb->cmn.session_id: %d. Ignoring the Frag request command", recvd_session_id, scb->cmn.session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_NODE);
             return;
         }
 
 #ifdef TIMER
-        ctimer_stop(&rcb.fc_timer);
+        ctimer_stop(&rcb->fc_timer);
 #endif
-        scb.missing_offset = ((byte2 & 0x7) << 8);
-        scb.missing_offset |= byte3;
-        //T2_DBG("Frag req cmd for %d missing fragment", (int)scb.missing_offset);
+        scb->missing_offset = ((byte2 & 0x7) << 8);
+        scb->missing_offset |= byte3;
+        //T2_DBG("Frag req cmd for %d missing fragment", (int)scb->missing_offset);
 
         t2_sm_post_event(EV_RECV_FRAG_REQ); /* reply_frag_req(); */
-        if (scb.sending) {
-            scb.flag_reply_frag_req = true;
+        if (scb->sending) {
+            scb->flag_reply_frag_req = true;
         } else {
             reply_frag_req(NULL);
         }
@@ -1532,39 +1812,33 @@ static void receive(void)
         t2_sm_post_event(EV_FRAG_REQ_OR_COMPL);
         T2_DBG("Received Fragment Complete Command");
         recvd_session_id = (byte2 & 0xf0) >> 4;
-        if (recvd_session_id == scb.transmission_aborted) {
+        if (recvd_session_id == scb->transmission_aborted) {
             T2_DBG("COMMAND_FRAGMENT_COMPLETE: for aborted transmionss session:%d. Igoring... ", recvd_session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_SESSION);
             return;
         }
         /*Fragment complete is not from the same session in which we were sending */
-        if (recvd_session_id != scb.cmn.session_id) {
-            T2_ERR("Current session is %d but recived session id is %d", recvd_session_id, rcb.cmn.session_id);
+        if (recvd_session_id != scb->cmn.session_id) {
+            T2_ERR("Current session is %d but recived session id is %d", recvd_session_id, rcb->cmn.session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_SESSION);
             return;
         }
-        if ((rcb.cmn.p.snode != scb.current_dnode) && (rcb.current_snode != 0)) { /* Check if the FRAG complete is from the destination node where we were sending data to */
-            T2_ERR("Session id of Fragment request received is not same as session_id of fragment being sent, recvd_session_id: %d, scb.cmn.session_id: %d. Ignoring the Frag request command", recvd_session_id, scb.cmn.session_id);
+        if ((rcb->cmn.p.snode != scb->current_dnode) && (rcb->current_snode != 0)) { /* Check if the FRAG complete is from the destination node where we were sending data to */
+            T2_ERR("Session id of Fragment request received is not same as session_id of fragment being sent, recvd_session_id: %d, scb->cmn.session_id: %d. Ignoring the Frag request command", recvd_session_id, scb->cmn.session_id);
             t2_sm_post_event(EV_FRAG_REQ_COMPL_WAIT_DIFF_NODE);
             return;
         }
 #ifdef TIMER
-        ctimer_stop(&rcb.fc_timer);
-#endif
-        T2_DBG("recvd_session_id : %d, scb.cmn.completedFunc: %p", recvd_session_id, scb.cmn.completedFunc);
-        if (scb.cmn.session_id == recvd_session_id) {
-            scb.frag_compl_list[recvd_session_id] = true;
-            scb.current_dnode = 0;
-            if (scb.cmn.completedFunc) {
-                T2_DBG("Sending back TRANSMIT_COMPLETE_OK to client");
-#if defined(ZIPGW) || defined(__C51__)
-                scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_OK, &scb.cmn.tx_status);
-#else
-                scb.cmn.completedFunc(S2_TRANSMIT_COMPLETE_OK, 0);
-#endif
-            }
+        ctimer_stop(&rcb->fc_timer);
+#endif
+        T2_DBG("recvd_session_id : %d, scb->cmn.completedFunc: %p", recvd_session_id, scb->cmn.completedFunc);
+        if (scb->cmn.session_id == recvd_session_id) {
+            scb->frag_compl_list[recvd_session_id] = true;
+            scb->current_dnode = 0;
+            T2_DBG("Sending back TRANSMIT_COMPLETE_OK to client");
+            session_completed(S2_TRANSMIT_COMPLETE_OK);
         } else {
-            T2_ERR("Fragment complete session id is %d while current session id is %d", recvd_session_id, scb.cmn.session_id);
+            T2_ERR("Fragment complete session id is %d while current session id is %d", recvd_session_id, scb->cmn.session_id);
         }
 
         t2_sm_post_event(EV_RECV_FRAG_COMPL); /* Go back to ST_IDLE state */
@@ -1573,30 +1847,30 @@ static void receive(void)
    case COMMAND_SEGMENT_WAIT_V2:
        /* Though the code flow is in receive() function. Current state is still be ST_SEND_FRAG */
        T2_DBG("Received Fragment wait Command");
-        if (scb.frag_compl_list[scb.cmn.session_id] == true) {
-            T2_ERR("Already received Fragment Complete command for this session: %d", scb.cmn.session_id);
+        if (scb->frag_compl_list[scb->cmn.session_id] == true) {
+            T2_ERR("Already received Fragment Complete command for this session: %d", scb->cmn.session_id);
             t2_sm_post_event(EV_DUPL_FRAME);
             return;
         }
         t2_sm_post_event(EV_RECV_FRAG_WAIT);
-        scb.transmission_aborted = scb.cmn.session_id;
+        scb->transmission_aborted = scb->cmn.session_id;
         /* call ZCB_ts_senddata_cb() here that will halt the next fragment send function called from ZCB_ts_senddata_cb() */
 #if defined(ZIPGW) || defined(__C51__)
         memset(&t, 0, sizeof(TX_STATUS_TYPE));
-        ZCB_ts_senddata_cb(S2_TRANSMIT_COMPLETE_FAIL, &t);
+        ts_senddata_done(S2_TRANSMIT_COMPLETE_FAIL, &t);
 #else
-        ZCB_ts_senddata_cb(S2_TRANSMIT_COMPLETE_FAIL, 0);
+        ts_senddata_done(S2_TRANSMIT_COMPLETE_FAIL, 0);
 #endif
         /* Refer 10.1.3.5.3 */
-        rcb.cmn.pending_segments = byte2;
-        T2_DBG("Pending fragments: %d", rcb.cmn.pending_segments);
-        /*FIXME: Shall we increment the scb.sending session id here or should we send it in same session id */
+        rcb->cmn.pending_segments = byte2;
+        T2_DBG("Pending fragments: %d", rcb->cmn.pending_segments);
+        /*FIXME: Shall we increment the scb->sending session id here or should we send it in same session id */
         /* If the pending segments are 0 then the sending side is going to bombard the receiving side with new fragments
             so added a delay of 100ms regardless of number of pending segments */
-        ctimer_set(&scb.wait_restart_timer, (100 + 100 * rcb.cmn.pending_segments), FUNC(wait_restart_from_first), NULL);
+        ctimer_set(&scb->wait_restart_timer, (100 + 100 * rcb->cmn.pending_segments), FUNC(wait_restart_from_first), ts2_cur);
         break;
     default:
-        T2_ERR("Unknown command type: %d", *((uint8_t *)rcb.fragment + 1));
+        T2_ERR("Unknown command type: %d", *((uint8_t *)rcb->fragment + 1));
         break;
     }
     return;
@@ -1614,30 +1888,30 @@ static uint8_t send_frag_wait_cmd()
 
     frag_wait.cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
     frag_wait.cmd_reserved = (COMMAND_SEGMENT_WAIT_V2 & 0xf8);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    if (scb.sending) { /* If there is a sending session going on FRAG_WAIT will be queed for next callback*/
-        T2_DBG("Sending fragment wait command. Pending segments: %d", scb.cmn.pending_segments);
-        frag_wait.pendingFragments = scb.cmn.pending_segments;
-        T2_DBG("Sending FRAG_WAIT from sending session snode: %d dnode: %d", scb.frag_wait_p.dnode,  scb.frag_wait_p.snode);
-        ret = TS_SEND_RAW(scb.frag_wait_p.dnode, scb.frag_wait_p.snode, (uint8_t *)&frag_wait, sizeof(frag_wait),
-                                 scb.frag_wait_p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    if (scb->sending) { /* If there is a sending session going on FRAG_WAIT will be queed for next callback*/
+        T2_DBG("Sending fragment wait command. Pending segments: %d", scb->cmn.pending_segments);
+        frag_wait.pendingFragments = scb->cmn.pending_segments;
+        T2_DBG("Sending FRAG_WAIT from sending session snode: %d dnode: %d", scb->frag_wait_p.dnode,  scb->frag_wait_p.snode);
+        ret = ts2_send_raw(scb->frag_wait_p.dnode, scb->frag_wait_p.snode, (uint8_t *)&frag_wait, sizeof(frag_wait),
+                                 scb->frag_wait_p.tx_flags | TRANSMIT_OPTION_ACK, ZCB_ts_senddata_cb);
         t2_sm_post_event(EV_SUCCESS2); /* Go back to ST_SEND_FRAG state in */
     } else {
-        if (rcb.cmn.session_id == 0x10) {
-            rcb.cmn.pending_segments = 0;
+        if (rcb->cmn.session_id == 0x10) {
+            rcb->cmn.pending_segments = 0;
         } else {
             // TODO? this is approximate. If we have variable frame size
-            rcb.cmn.pending_segments = rcb.datagram_size / rcb.cur_recvd_data_size;
-            (rcb.datagram_size % rcb.cur_recvd_data_size) ? rcb.cmn.pending_segments++:0;
-            T2_DBG("datagram size: %d, cur recv size: %d\n", rcb.datagram_size, rcb.cur_recvd_data_size);
+            rcb->cmn.pending_segments = rcb->datagram_size / rcb->cur_recvd_data_size;
+            (rcb->datagram_size % rcb->cur_recvd_data_size) ? rcb->cmn.pending_segments++:0;
+            T2_DBG("datagram size: %d, cur recv size: %d\n", rcb->datagram_size, rcb->cur_recvd_data_size);
         }
 
 
-        T2_DBG("Sending fragment wait command. Pending segments: %d", rcb.cmn.pending_segments);
-        frag_wait.pendingFragments = rcb.cmn.pending_segments;
-        T2_DBG("Sending FRAG_WAIT from receiving session snode: %d dnode: %d", scb.frag_wait_p.dnode,  scb.frag_wait_p.snode);
-        ret = TS_SEND_RAW(scb.frag_wait_p.dnode, scb.frag_wait_p.snode, (uint8_t *)&frag_wait, sizeof(frag_wait),
-                                 scb.frag_wait_p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
+        T2_DBG("Sending fragment wait command. Pending segments: %d", rcb->cmn.pending_segments);
+        frag_wait.pendingFragments = rcb->cmn.pending_segments;
+        T2_DBG("Sending FRAG_WAIT from receiving session snode: %d dnode: %d", scb->frag_wait_p.dnode,  scb->frag_wait_p.snode);
+        ret = ts2_send_raw(scb->frag_wait_p.dnode, scb->frag_wait_p.snode, (uint8_t *)&frag_wait, sizeof(frag_wait),
+                                 scb->frag_wait_p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
         t2_sm_post_event(EV_SUCCESS); /* Go back to ST_RECEIVING state in receive() funciton */
     }
 
@@ -1655,8 +1929,11 @@ static uint8_t send_frag_complete_cmd()
 
     T2_DBG("Sending COMMAND_FRAGMENT_COMPLETE\n");
     ZW_COMMAND_SEGMENT_COMPLETE_V2_FRAME frag_compl;
+#ifdef ZIPGW
+    ts2_session_t *s = ts2_cur;
+#endif
 
-    if (rcb.cmn.session_id > 0x0f) { /* Session ID has only 4 bits for it.*/
+    if (rcb->cmn.session_id > 0x0f) { /* Session ID has only 4 bits for it.*/
         T2_ERR("Session id is more than 15");
         return 0;
     }
@@ -1664,10 +1941,10 @@ static uint8_t send_frag_complete_cmd()
     frag_compl.cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
     frag_compl.cmd_reserved = (COMMAND_SEGMENT_COMPLETE_V2 & 0xf8);
 
-    frag_compl.properties2 = (rcb.cmn.session_id << 4);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    ret = TS_SEND_RAW(rcb.cmn.p.dnode, rcb.cmn.p.snode, (uint8_t *)&frag_compl, sizeof(frag_compl),
-                              rcb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
+    frag_compl.properties2 = (rcb->cmn.session_id << 4);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    ret = ts2_send_raw(rcb->cmn.p.dnode, rcb->cmn.p.snode, (uint8_t *)&frag_compl, sizeof(frag_compl),
+                              rcb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
     if (ret == 0) {
         T2_ERR("send_data failed\n"); /* TODO What to do of sending Frag Compl fails */
     }
@@ -1679,20 +1956,22 @@ static uint8_t send_frag_complete_cmd()
     }
     printf("\nrcb.datagramData: \n");
     for (i = test_pData_len -1 ; i > 0; --i) {
-         printf("%x ", rcb.datagramData[i]);
+         printf("%x ", rcb->datagramData[i]);
     }
 #endif
 #ifdef ZIPGW
-    ZIPCommandHandler(rcb.cmn.p.snode, rcb.datagram_size); /**/
+    ZIPCommandHandler(rcb->cmn.p.snode, rcb->datagram_size); /**/
+    /* The application may have started a datagram to another node */
+    session_select(s);
 #endif /* ifdef ZIPGW */
 
     /* Resetting for next session */
-    rcb.recv_frag_compl_list[rcb.cmn.session_id] = true;
-    rcb.cmn.session_id = 0x10;
-    rcb.current_snode = 0;
+    rcb->recv_frag_compl_list[rcb->cmn.session_id] = true;
+    rcb->cmn.session_id = 0x10;
+    rcb->current_snode = 0;
   
 #ifdef TIMER
-    ctimer_stop(&rcb.rx_timer);
+    ctimer_stop(&rcb->rx_timer);
 #endif
     /* FIXME: should this be in the call back? */
     t2_sm_post_event(EV_SUCCESS); /* just change the state to ST_RECEIVING */
@@ -1700,7 +1979,7 @@ static uint8_t send_frag_complete_cmd()
 #if DATAGRAM_SIZE_MAX > 250
 #error Datagram size does not fit in uin8_t.
 #endif
-    TransportService_msg_received_event((uint8_t*) rcb.datagramData, (uint8_t)rcb.datagram_size,  rcb.cmn.p.snode);
+    TransportService_msg_received_event((uint8_t*) rcb->datagramData, (uint8_t)rcb->datagram_size,  rcb->cmn.p.snode);
 #endif /* __C51 __*/
     return 0;
 }
@@ -1711,15 +1990,15 @@ static uint16_t get_next_missing_offset()
     int j = 0;
     int missing_offset = 0;
 
-    for ( i = 0; i < (sizeof(rcb.bytes_recvd_bitmask)); i++) {
+    for ( i = 0; i < (sizeof(rcb->bytes_recvd_bitmask)); i++) {
         for ( j = 0; j < 8; j++) {
-            if ((rcb.bytes_recvd_bitmask[i] & ( 1 << j)) == 0) {
+            if ((rcb->bytes_recvd_bitmask[i] & ( 1 << j)) == 0) {
                 missing_offset = ((i * 8)+j);
                 if (missing_offset == 0) {
                     continue;
                 }
                 T2_DBG("missing_offset: %d", missing_offset);
-                if(missing_offset >= rcb.datagram_size) {
+                if(missing_offset >= rcb->datagram_size) {
                    return 0;
                 }
                 return missing_offset; 
@@ -1731,8 +2010,7 @@ static uint16_t get_next_missing_offset()
 
 static uint8_t send_frag_req_cmd()
 {
-  ZW_COMMAND_SEGMENT_REQUEST_V2_FRAME *frag_req =
-                    (ZW_COMMAND_SEGMENT_REQUEST_V2_FRAME *) t2_txBuf;
+    ZW_COMMAND_SEGMENT_REQUEST_V2_FRAME frag_req;
     uint8_t ret1 = 0;
 
 
@@ -1743,34 +2021,31 @@ static uint8_t send_frag_req_cmd()
         return 0;
     }
 
-    if (rcb.cmn.session_id > 0x0f) {/* Session ID has only 4 bits for it.*/
+    if (rcb->cmn.session_id > 0x0f) {/* Session ID has only 4 bits for it.*/
         T2_ERR("Session id is more than %d", 0x0f);
         return 0;
     }
 
-    frag_req->cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
-    frag_req->cmd_reserved =  (COMMAND_SEGMENT_REQUEST_V2) & 0xf8;
-    frag_req->properties2 = rcb.cmn.session_id << 4;
-    frag_req->properties2 |= ((offset_to_request & 0x700) >> 8); /* Get 9th, 10th and 11th MSB */
-    frag_req->datagramOffset2 = (offset_to_request & 0xff);
+    frag_req.cmdClass = COMMAND_CLASS_TRANSPORT_SERVICE;
+    frag_req.cmd_reserved =  (COMMAND_SEGMENT_REQUEST_V2) & 0xf8;
+    frag_req.properties2 = rcb->cmn.session_id << 4;
+    frag_req.properties2 |= ((offset_to_request & 0x700) >> 8); /* Get 9th, 10th and 11th MSB */
+    frag_req.datagramOffset2 = (offset_to_request & 0xff);
 
 #ifndef __C51__
 retry:
 #endif
-    T2_DBG("Sending fragment request command for offset: %d in session id: %d", offset_to_request, rcb.cmn.session_id);
+    T2_DBG("Sending fragment request command for offset: %d in session id: %d", offset_to_request, rcb->cmn.session_id);
 
-    /* At receiver t2_txBuf is only needed in sending frag request.
-     * max size = 21 _to_reqoffsets * 2bytes + size of frag req cmd header
-     * uint8_t t2_txBuf[(21 * 2) + sizeof(ZW_COMMAND_FRAGMENT_REQUEST_1BYTE_FRAME)]; */
-    //ret1 = send_data(&rcb.cmn.p, t2_txBuf, sizeof(*frag_req), NULL, NULL);
-    ctimer_set(&scb.reset_timer, RESET_TIME, FUNC(reset_transport_service), 0);
-    ret1 = TS_SEND_RAW(rcb.cmn.p.dnode, rcb.cmn.p.snode, t2_txBuf, sizeof(*frag_req),
-                              rcb.cmn.p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
+    //ret1 = send_data(&rcb->cmn.p, (uint8_t *)&frag_req, sizeof(frag_req), NULL, NULL);
+    ctimer_set(&scb->reset_timer, RESET_TIME, FUNC(reset_transport_service), ts2_cur);
+    ret1 = ts2_send_raw(rcb->cmn.p.dnode, rcb->cmn.p.snode, (uint8_t *)&frag_req, sizeof(frag_req),
+                              rcb->cmn.p.tx_flags | TRANSMIT_OPTION_ACK, NULL);
     if (ret1 == false) {
         /* TODO SPEC: what to do if frag req cmd fails */
         T2_ERR("send_data failed ");
-        if (rcb.flag_retry_frag_req_once) {
-            rcb.flag_retry_frag_req_once--;
+        if (rcb->flag_retry_frag_req_once) {
+            rcb->flag_retry_frag_req_once--;
 #ifndef __C51__
             goto retry;
 #endif
@@ -1778,23 +2053,23 @@ retry:
     }
 
     /*TODO Got to wait here some time or wait for ACK */
-    rcb.rx_data.state = 1; /*after sending frag req, as we need to discard fragments in rx_timer_expired */
+    rcb->rx_data.state = 1; /*after sending frag req, as we need to discard fragments in rx_timer_expired */
 #ifdef TIMER
 
     t2_sm_post_event(EV_SUCCESS); /* FIXME: should this be in the call back? Just change the state to ST_RECEIVING */
-    ctimer_set(&rcb.rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), &rcb.rx_data);
+    ctimer_set(&rcb->rx_timer, FRAGMENT_RX_TIMEOUT, FUNC(rx_timer_expired), ts2_cur);
 #endif
     return 0;
 }
 
 static uint8_t discard_all_received_fragments(void)
 {
-    memset(rcb.datagramData, 0, sizeof(rcb.datagramData));
+    memset(rcb->datagramData, 0, sizeof(rcb->datagramData));
 
-    memset((uint8_t*)&rcb.cmn, 0, sizeof(control_block_t));
-    rcb.cmn.session_id = 0x10;
-    rcb.current_snode = 0;
-    memset(rcb.bytes_recvd_bitmask,  0, sizeof(rcb.bytes_recvd_bitmask));
+    memset((uint8_t*)&rcb->cmn, 0, sizeof(control_block_t));
+    rcb->cmn.session_id = 0x10;
+    rcb->current_snode = 0;
+    memset(rcb->bytes_recvd_bitmask,  0, sizeof(rcb->bytes_recvd_bitmask));
     return 0;
 }
 
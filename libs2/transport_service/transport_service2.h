@@ -34,6 +34,11 @@ extern TRANSPORT2_ST_T current_state;
 //#define DATAGRAM_SIZE_MAX       (UIP_BUFSIZE - UIP_LLH_LEN) /*1280*/
 #define DATAGRAM_SIZE_MAX       (200) /*1280*/
 
+/* Number of nodes the module can exchange datagrams with at the same time */
+#ifndef TRANSPORT_SERVICE_SESSIONS
+#define TRANSPORT_SERVICE_SESSIONS 4
+#endif
+
 #ifdef __C51__
 #ifndef slash
 #define slash /
@@ -46,7 +51,7 @@ extern TRANSPORT2_ST_T current_state;
 //#define DBG 1
 #ifdef DBG
 #define T2_DBG(...) \
-        printf("T2: %s sid: %d rid: %d, %s():%d: ",T2_STATES_STRING[current_state],scb.cmn.session_id, rcb.cmn.session_id,__func__, __LINE__);\
+        printf("T2: %s sid: %d rid: %d, %s():%d: ",T2_STATES_STRING[current_state],scb->cmn.session_id, rcb->cmn.session_id,__func__, __LINE__);\
         printf(__VA_ARGS__); \
         printf("\n");
 #else
@@ -59,7 +64,7 @@ extern TRANSPORT2_ST_T current_state;
 #else
 #if defined(ZIPGW) || defined(DBG)
 #define T2_ERR(...) \
-        printf("T2: %s sid: %d rid: %d, %s():%d: ", T2_STATES_STRING[current_state],scb.cmn.session_id, rcb.cmn.session_id,__func__, __LINE__);\
+        printf("T2: %s sid: %d rid: %d, %s():%d: ", T2_STATES_STRING[current_state],scb->cmn.session_id, rcb->cmn.session_id,__func__, __LINE__);\
         printf(__VA_ARGS__); \
         printf("\n");
 #else
@@ -98,14 +103,20 @@ uint16_t cmdLength));
  * \{
  *
  * This module handles the Z-Wave Transport Service command class version 2.
- * The module is able handle a single TX session to a node, and able to handle
- * a number of RX session for some nodes.
+ * The module keeps a session for each node it exchanges datagrams with, for up
+ * to \ref TRANSPORT_SERVICE_SESSIONS nodes at the same time. A session handles
+ * one datagram to and one datagram from its node. Fragments of the sessions
+ * are sent one at a time, taking turns, so a long datagram to one node does
+ * not hold back the others.
+ *
+ * When all sessions are busy, a node which starts a new datagram is asked to
+ * wait with a Segment Wait command.
  */
 
 
 /**
  * Send a large frame from srcNodeID to dstNodeID using TRANSPORT_SERVICE V2. Only one
- * transmit session is allowed at any time.
+ * transmit session to each node is allowed at any time.
  *
  * \param p structure containing the parameters of the transmission, like source node and destination node.
  * \param pData pointer to the data being sent. The contents of this buffer must not change
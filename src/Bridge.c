@@ -29,7 +29,7 @@
 bridge_state_t bridge_state;
 
 /** Bitmask reflecting the virtual nodes in the controller */
-uint8_t virtual_nodes_mask[MAX_CLASSIC_NODEMASK_LENGTH];
+nodemask_t virtual_nodes_mask;
 
 /* Documented in Bridge.h */
 BOOL is_assoc_create_in_progress(void)
@@ -99,8 +99,8 @@ BOOL is_virtual_node(nodeid_t nid)
    * so we have to do special handling here. As the plan is to abandon the virtual nodes
    * feature, this hack for the moment is acceptable.
    */
-  if ((is_classic_node(nid) && BIT8_TST(nid - 1, virtual_nodes_mask)) ||
-      ((nid <= 4005) && (nid >= 4002))) {
+  if ((is_classic_node(nid) && nodemask_test_node(nid, virtual_nodes_mask)) ||
+      ((nid <= LR_VIRTUAL_NODE_LAST) && (nid >= LR_VIRTUAL_NODE_FIRST))) {
     return true;
   }
   return false;
@@ -243,13 +243,13 @@ void print_bridge_status(void)
 
   {
     // Each bitmask byte is printed with two hex characters and a space (len=3)
-    char nodemask_str[(sizeof(virtual_nodes_mask) * 3) + 1] = {0};
+    char nodemask_str[(MAX_CLASSIC_NODEMASK_LENGTH * 3) + 1] = {0};
 
     int pos = 0;
-    for (int i = 0; i < sizeof(virtual_nodes_mask); ++i)
+    for (int i = 0; i < MAX_CLASSIC_NODEMASK_LENGTH; ++i)
     {
       // Print MSB first (to the left) and LSB last (to the right)
-      pos += sprintf(nodemask_str + pos, "%02x ", virtual_nodes_mask[sizeof(virtual_nodes_mask) - i - 1]);
+      pos += sprintf(nodemask_str + pos, "%02x ", virtual_nodes_mask[MAX_CLASSIC_NODEMASK_LENGTH - i - 1]);
     }
 
     LOG_PRINTF("\nvirtual_nodes_mask (hex): %s\n", nodemask_str);
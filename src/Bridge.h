@@ -8,6 +8,7 @@
 #include "ZW_zip_classcmd.h"
 #include "ZW_classcmd.h" /* ZW_APPLICATION_TX_BUFFER, etc */
 #include "RD_types.h"
+#include "zgw_nodemask.h"
 #include <stdbool.h>
 
 /**
@@ -27,7 +28,13 @@ typedef enum {
 
 extern bridge_state_t bridge_state;
 
-extern uint8_t virtual_nodes_mask[MAX_CLASSIC_NODEMASK_LENGTH];
+/** The virtual nodes of the controller. Only classic node ids can be virtual
+ * nodes in the mask, see is_virtual_node(). */
+extern nodemask_t virtual_nodes_mask;
+
+/** The Long Range virtual nodes are always these, see is_virtual_node(). */
+#define LR_VIRTUAL_NODE_FIRST 4002
+#define LR_VIRTUAL_NODE_LAST  4005
 
 /**
  *  Initialize the bridge.
@@ -735,7 +735,7 @@ ip_assoc_virtual_add_callback(uint8_t bStatus, nodeid_t orgID, nodeid_t newID)
     }
 
     DBG_PRINTF("Successfully preallocated a virtual node %d for permanent association\n", newID);
-    BIT8_SET(newID - 1, virtual_nodes_mask);
+    nodemask_add_node(newID, virtual_nodes_mask);
     /* We have a virtual node, process an IP Association Set from txQueue
      * Note: This does not have to be the same IP Assoc Set that triggered virtual node
      * creation. */
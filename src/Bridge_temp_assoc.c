@@ -314,7 +314,7 @@ temp_assoc_virtual_add_callback(uint8_t bStatus, nodeid_t orgID, nodeid_t newID)
     {
       temp_assoc_virtual_nodeids[temp_assoc_virtual_nodeid_count] = newID;
       temp_assoc_virtual_nodeid_count++;
-      BIT8_SET(newID - 1, virtual_nodes_mask);
+      nodemask_add_node(newID, virtual_nodes_mask);
       temp_assoc_persist_virtual_nodeids();
     }
 
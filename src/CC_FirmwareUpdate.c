@@ -31,16 +31,15 @@
 #include "ZIP_Router_logging.h"
 #include "zgw_crc.h"
 #include "Serialapi.h"
+#ifndef AXTLS
+#include <openssl/md5.h>
+#endif
 
 #define UPGRADE_ZWAVE_TIMEOUT  500   //5 seconds
 #define UPGRADE_UDP_TIMEOUT    300   //3 seconds
 #define UPGRADE_START_TIMEOUT  300
 #define UPGRADE_TIMER_REPEATS  3
 
-#define NON_BLOCK_MODE	0x0;
-#define BLOCK_MODE	0x1
-
-static u8_t updatemode = BLOCK_MODE;
 static u16_t upgradeTimeout = UPGRADE_UDP_TIMEOUT;
 
 void
@@ -123,10 +122,38 @@ FwUpdateActivationReport_SendTo(zwave_connection_t *c, BYTE status);
 static void send_firmware_prepare_report(zwave_connection_t *c, u8_t status);
 
 
-#define BLOCK_REQ_NO  255
+/** Largest number of fragments requested with one Get. Fragments received
+ * after a lost one are kept until it has been received again, so this is also
+ * the number of fragments that can be buffered. */
+#define FW_UPDATE_WINDOW_MAX 64
+/** Largest window when the image is sent over the Z-Wave network. */
+#define FW_UPDATE_WINDOW_MAX_PAN 8
+/** Window of the first Get of a transfer. */
+#define FW_UPDATE_WINDOW_INITIAL 4
 
+/** Next fragment to be written to the image. */
 static u16_t blockno = 0;
-static u16_t reqno = 0;
+/** Fragments to request in the next window. */
+static u8_t window = 0;
+/** First fragment after the current window, 0 before the first Get. */
+static u16_t window_end = 0;
+/** First fragment after the fragments requested by the last Get. */
+static u16_t req_end = 0;
+/** Set if fragments of the current window had to be requested again. */
+static u8_t window_loss = FALSE;
+
+/** A fragment received ahead of \ref blockno. */
+struct fw_fragment {
+  /** Fragment number, 0 if the slot is free. */
+  u16_t number;
+  u16_t len;
+  u8_t last;
+  u8_t data[FW_UPDATE_MAX_SEGMENT_SIZE];
+};
+
+/** Fragments received ahead of \ref blockno, fragment n is in slot
+ * n % FW_UPDATE_WINDOW_MAX. */
+static struct fw_fragment fw_ahead[FW_UPDATE_WINDOW_MAX];
 
 static u8_t upgradeTimer = 0xFF;
 static u8_t statusTimer = 0xFF;
@@ -160,18 +187,51 @@ ZW_FIRMWARE_MD_REPORT_1ID_V5_FRAME gfwMdReportV5;
 ZW_FIRMWARE_UPDATE_MD_GET_V3_FRAME gupdateMdGet;
 ZW_FIRMWARE_UPDATE_MD_STATUS_REPORT_V3_FRAME gstatusReport;
 
-/** Create a temporary file for a 700 series fw image.
+/** Length of the MD5 digest stored after the 500 series image. */
+#define FW_MD5_DIGEST_LEN 16
+
+/**
+ * The firmware image being received.
+ *
+ * The temporary file is kept open from the first fragment until the image is
+ * complete. The checksums of the image are computed as the fragments are
+ * written, so the image does not have to be read back from the file once it
+ * has been received.
+ */
+static struct fw_image_sink {
+  /** Descriptor of \ref fw_curr_filename, -1 if it is not open. */
+  int fd;
+  /** Bytes written to the file. */
+  uint32_t len;
+  /** CRC16 of all bytes written to the file. */
+  uint16_t crc;
+  /** Set when the image is complete and the fields describe the file. */
+  bool complete;
+  /** First bytes of the image, the \ref zw_fw_header_st_t of a 500 series image. */
+  uint8_t header[sizeof(zw_fw_header_st_t)];
+#ifndef AXTLS
+  /** Set if the MD5 digest of a 500 series image is computed. */
+  bool md5_enabled;
+  MD5_CTX md5;
+  /** Bytes of the image included in md5. */
+  uint32_t md5_len;
+  /** The digest stored in the image after the first FileLen bytes. */
+  uint8_t md5_stored[FW_MD5_DIGEST_LEN];
+  uint8_t md5_stored_len;
+#endif
+} fw_sink = { .fd = -1 };
+
+/** Create a temporary file for a fw image and open it for writing.
  * The file name is based on \ref fw_filename will be put in \ref
  * fw_curr_filename.
  *
- * \return Open file pointer or NULL if something failed. */
-static bool fw_tmp_file_create(void);
-
-/* TODO: we may want to store the image in memory instead of using a
-   file.  In that case, we probably want to use the index
-   parameter. */
-/** Append a block to \ref fw_file.
- * If fw_file is NULL, the function writes nothing and returns FALSE.
+ * \param md5 Compute the MD5 digest of a 500 series image while it is received.
+ * \return TRUE if the file was created. */
+static bool fw_tmp_file_create(bool md5);
+
+/** Append a block to the image file.
+ * The CRC16 and the MD5 digest of the image are updated with the block.
+ * If the file is not open, the function writes nothing and returns FALSE.
  *
  * \param buf Pointer to the data to append.
  * \param len The number of bytes to append.
@@ -180,24 +240,45 @@ static bool fw_tmp_file_create(void);
 static bool fw_tmp_file_append(uint8_t *buf, uint16_t len);
 
 /**
- * Write a block to specified offset to \ref fw_file
- * \param offset Position, measured in bytes, to be written with respect to whence
- * \param whence SEEK_SET, SEEK_CUR, SEEK_END indicates the offset is relative to the start of the file, the current position indicator, or end-of-file, respectively.
- * \param buf pointer to the data to write
- * \param len the number of bytes to write.
- * \return bytes get written
+ * Close the image file.
+ * \param complete TRUE if the whole image has been written. Otherwise the
+ * checksums computed so far are dropped.
  */
-static size_t fw_tmp_file_write(long offset, int whence, uint8_t *buf, uint16_t len);
+static void fw_tmp_file_close(bool complete);
 
 /**
- * Get the size of \ref fw_file
- * \return file size of fw_file
+ * Compute the CRC16 of the image file by reading it back. Used when the
+ * checksum computed while receiving is not available, e.g., after a restart.
+ * \param crc Returns the CRC16 of the file.
+ * \return TRUE if the file could be read.
  */
-static long fw_tmp_file_size();
+static bool fw_tmp_file_crc(uint16_t *crc);
 
 
 #ifndef AXTLS
-#include <openssl/md5.h>
+/**
+ * Get the MD5 digest computed while the image was received.
+ *
+ * \param len Length of the image covered by the digest.
+ * \param digest Returns the computed digest.
+ * \param stored Returns the digest stored in the image.
+ * \return FALSE if the digest of the first len bytes was not computed.
+ */
+static bool
+fw_tmp_file_md5(uint32_t len, uint8_t *digest, uint8_t *stored)
+{
+  if (!fw_sink.complete || !fw_sink.md5_enabled
+      || fw_sink.md5_len != len || fw_sink.md5_stored_len != FW_MD5_DIGEST_LEN)
+  {
+    return FALSE;
+  }
+  MD5_Final(digest, &fw_sink.md5);
+  memcpy(stored, fw_sink.md5_stored, FW_MD5_DIGEST_LEN);
+  /* The context is spent */
+  fw_sink.md5_enabled = FALSE;
+  return TRUE;
+}
+
 uint8_t
 MD5_ValidatFwImg(uint32_t len) REENTRANT
 {
@@ -206,7 +287,19 @@ MD5_ValidatFwImg(uint32_t len) REENTRANT
     { 0 };
   uint8_t digest[16] =
     { 0 };
+
+  if (fw_tmp_file_md5(len, digest, buf))
+  {
+    DBG_PRINTF("Using MD5 digest computed during download\n");
+    goto compare;
+  }
+
   fw_file = fopen(fw_curr_filename, "r");
+  if (fw_file == NULL)
+  {
+    ERR_PRINTF("Firmware temporary file open failed\n");
+    return FALSE;
+  }
 
   MD5_CTX context;
 
@@ -243,7 +336,9 @@ MD5_ValidatFwImg(uint32_t len) REENTRANT
 
   //read md5 checksum
   fread(buf, 16, 1, fw_file);
+  fclose(fw_file);
 
+compare:
   //printf("baseaddr = 0x%lx,  len = 0x%lx index = 0x%lx\r\n", baseaddr, len, index);
 
   printf("calculated checksum : \r\n");
@@ -261,7 +356,6 @@ MD5_ValidatFwImg(uint32_t len) REENTRANT
   }
   printf("\r\n");
 #endif
-  fclose(fw_file);
   if (!memcmp(digest, buf, 16))
   {
     printf("MD5 checksum passed.\r\n");
@@ -280,9 +374,21 @@ gconfig_ValidatZwFwImg(u32_t downloadlen, u32_t maxlen)
 {
   zw_fw_header_st_t zwfw_header;
 
-  fw_file = fopen(fw_curr_filename, "r");
-  fread((void *)&zwfw_header, sizeof(zwfw_header), 1, fw_file);
-  fclose(fw_file);
+  if (fw_sink.complete && fw_sink.len >= sizeof(zwfw_header))
+  {
+    memcpy(&zwfw_header, fw_sink.header, sizeof(zwfw_header));
+  }
+  else
+  {
+    fw_file = fopen(fw_curr_filename, "r");
+    if (fw_file == NULL)
+    {
+      ERR_PRINTF("Firmware temporary file open failed\n");
+      return FALSE;
+    }
+    fread((void *)&zwfw_header, sizeof(zwfw_header), 1, fw_file);
+    fclose(fw_file);
+  }
 
   /*Convert to network byte order*/
   zwfw_header.FileLen = UIP_HTONL(zwfw_header.FileLen);
@@ -664,23 +770,16 @@ send_firmware_prepare_report(zwave_connection_t *c, u8_t status)
   f.cmd = FIRMWARE_UPDATE_MD_PREPARE_REPORT;
 
   if(INITIATE_FWUPDATE == status) {
-    uint8_t* buf;
-    uint16_t crc;
-    unsigned long size = 0;
-    fw_file = fopen(fw_curr_filename, "r");
-    if (fw_file == NULL) {
-      ERR_PRINTF("Firmware temporary file open failed\n");
-    }
-    size = fw_tmp_file_size();
+    uint16_t crc = 0;
 
-    buf = (uint8_t*) malloc(size);
-    size_t read_count = fread(buf, size, 1, fw_file);
-    if (read_count != size) {
-      ERR_PRINTF("Firmware read size is not expected\n");
+    if (fw_sink.complete)
+    {
+      crc = fw_sink.crc;
+    }
+    else if (!fw_tmp_file_crc(&crc))
+    {
+      ERR_PRINTF("Firmware temporary file read failed\n");
     }
-    fclose(fw_file);
-    crc = zgw_crc16(CRC_INIT_VALUE, buf, size);
-    free(buf);
 
     f.firmwareChecksum1 = (crc>>8) & 0xFF;
     f.firmwareChecksum2 = (crc>>0) & 0xFF;
@@ -728,6 +827,7 @@ FwUpdate_Timeout(void)
   else
   {
     DBG_PRINTF("FwUpdate_Timeout: calling re-request blockno = %u\r\n", blockno);
+    window_loss = TRUE;
     FwUpdateDataGet_Send();
     retrycnt++;
   }
@@ -735,29 +835,91 @@ FwUpdate_Timeout(void)
   return;
 }
 
+/**
+ * Largest window for the link the image is received on.
+ *
+ * Frames sent over the Z-Wave network take long to send and are more often
+ * lost, so only a few fragments are requested at a time there.
+ */
+static u8_t
+fw_update_window_max(void)
+{
+  u8_t w = cfg.fw_update_window;
+
+  if (w == 0)
+  {
+    w = 1;
+  }
+  if (w > FW_UPDATE_WINDOW_MAX)
+  {
+    w = FW_UPDATE_WINDOW_MAX;
+  }
+  if ((nodeOfIP(&ups.ripaddr) || ZW_IsZWAddr(&ups.ripaddr)) && w > FW_UPDATE_WINDOW_MAX_PAN)
+  {
+    w = FW_UPDATE_WINDOW_MAX_PAN;
+  }
+  return w;
+}
+
+static struct fw_fragment *
+fw_ahead_get(u16_t n)
+{
+  struct fw_fragment *f = &fw_ahead[n % FW_UPDATE_WINDOW_MAX];
+
+  return (f->number == n) ? f : NULL;
+}
+
 /*
  * Send Firmware update meta data get request to peer/requested node
+ *
+ * Requests the fragments from blockno up to the next fragment which has
+ * already been received, within the current window. Once all fragments of a
+ * window have been written, a new window is started. The window is doubled
+ * if no fragments of the previous one were lost, and halved otherwise.
  */
 static void
 FwUpdateDataGet_Send(void)
 {
   ZW_FIRMWARE_UPDATE_MD_GET_V3_FRAME *updateMdGet = &gupdateMdGet;
+  u16_t count;
 
-  DBG_PRINTF("FwUpdateDataGet_Send  blockno = %u\r\n", blockno);
-
-  updateMdGet->cmdClass = COMMAND_CLASS_FIRMWARE_UPDATE_MD_V3;
-  updateMdGet->cmd = FIRMWARE_UPDATE_MD_GET_V3;
-
-  if (updatemode == BLOCK_MODE)
-  {
-    updateMdGet->numberOfReports = BLOCK_REQ_NO; //Block request
-    reqno = blockno;
-  }
-  else
+  if (blockno >= window_end)
   {
-    updateMdGet->numberOfReports = 1; //we will send ACK for each report
+    u8_t max = fw_update_window_max();
+
+    if (window_end == 0)
+    {
+      window = FW_UPDATE_WINDOW_INITIAL;
+    }
+    else if (window_loss)
+    {
+      window = window / 2;
+    }
+    else
+    {
+      window = (window > max / 2) ? max : window * 2;
+    }
+    if (window == 0)
+    {
+      window = 1;
+    }
+    if (window > max)
+    {
+      window = max;
+    }
+    window_end = blockno + window;
+    window_loss = FALSE;
   }
 
+  for (count = 1; (blockno + count < window_end) && !fw_ahead_get(blockno + count); count++)
+    ;
+  req_end = blockno + count;
+
+  DBG_PRINTF("FwUpdateDataGet_Send  blockno = %u count = %u\r\n", blockno, count);
+
+  updateMdGet->cmdClass = COMMAND_CLASS_FIRMWARE_UPDATE_MD_V3;
+  updateMdGet->cmd = FIRMWARE_UPDATE_MD_GET_V3;
+  updateMdGet->numberOfReports = count;
   updateMdGet->properties1 = (blockno >> 8) & 0x7F;
   updateMdGet->reportNumber2 = blockno & 0xFF;
 
@@ -838,6 +1000,8 @@ FwUpdate_StatusReport_Send(BYTE status, WORD waitTimeSec)
 static void
 FwUpdate_Reset_Var(void)
 {
+  int i;
+
   retrycnt = 0;
   status_retrycnt = 0;
   upgradeTimer = 0xFF;
@@ -845,140 +1009,189 @@ FwUpdate_Reset_Var(void)
   blockno = 0;
   fw_desc.firmware_id = 0xFFFF;
   fwmss = 0;
-  reqno = 0;
+  window = 0;
+  window_end = 0;
+  req_end = 0;
+  window_loss = FALSE;
+  for (i = 0; i < FW_UPDATE_WINDOW_MAX; i++)
+  {
+    fw_ahead[i].number = 0;
+  }
+  if (fw_sink.fd >= 0)
+  {
+    fw_tmp_file_close(FALSE);
+  }
 }
 
-static bool fw_tmp_file_create() {
+static bool fw_tmp_file_create(bool md5) {
    int fd;
 
+   if (fw_sink.fd >= 0) {
+      fw_tmp_file_close(FALSE);
+   }
    if (strlen(fw_curr_filename) == 0) {
       /* TODO: delete the old file, if it exists? */
    }
-   memcpy(fw_curr_filename, fw_filename, strlen(fw_filename));
+   memset(&fw_sink, 0, sizeof(fw_sink));
+   fw_sink.fd = -1;
+   fw_sink.crc = CRC_INIT_VALUE;
+
+   strcpy(fw_curr_filename, fw_filename);
    fd = mkstemp(fw_curr_filename);
    if (fd == -1) {
       ERR_PRINTF("Could not create temp file (%s) for firmware image: Error: %s\n",
                  fw_filename, strerror(errno));
       return false;
    } else {
-      DBG_PRINTF("Created temp file %s for firmware image\n", fw_filename);
+      DBG_PRINTF("Created temp file %s for firmware image\n", fw_curr_filename);
    }
-   fw_file = fdopen(fd, "w");
-   if (!fw_file) {
-      ERR_PRINTF("Could not open temp file (%s) for firmware update: Error: %s\n",
-                 fw_filename, strerror(errno));
-      close(fd);
-      return false;
+   fw_sink.fd = fd;
+#ifndef AXTLS
+   if (md5) {
+      MD5_Init(&fw_sink.md5);
+      fw_sink.md5_enabled = TRUE;
    }
-   fclose(fw_file);
+#endif
    return true;
 }
 
+#ifndef AXTLS
+/** Feed the part of a block that is covered by the MD5 digest of a 500
+ * series image to the digest, and capture the digest stored after it. */
+static void fw_tmp_file_md5_update(const uint8_t *buf, uint16_t len) {
+   uint32_t offset = fw_sink.len;
+   uint32_t file_len;
+   uint32_t n;
+   zw_fw_header_st_t header;
+
+   if (offset < sizeof(header)) {
+      /* The header is not complete yet, so the length is not known. It is
+       * always covered by the digest. */
+      n = sizeof(header) - offset;
+      if (n > len) {
+         n = len;
+      }
+      MD5_Update(&fw_sink.md5, buf, n);
+      fw_sink.md5_len += n;
+      buf += n;
+      len -= n;
+      offset += n;
+   }
+   if (len == 0) {
+      return;
+   }
+
+   memcpy(&header, fw_sink.header, sizeof(header));
+   file_len = UIP_HTONL(header.FileLen);
+   if (file_len < sizeof(header)) {
+      /* Invalid image, the validation will reject it */
+      fw_sink.md5_enabled = FALSE;
+      return;
+   }
+
+   if (offset < file_len) {
+      n = file_len - offset;
+      if (n > len) {
+         n = len;
+      }
+      MD5_Update(&fw_sink.md5, buf, n);
+      fw_sink.md5_len += n;
+      buf += n;
+      len -= n;
+      offset += n;
+   }
+   if (len && offset < file_len + FW_MD5_DIGEST_LEN) {
+      n = file_len + FW_MD5_DIGEST_LEN - offset;
+      if (n > len) {
+         n = len;
+      }
+      memcpy(fw_sink.md5_stored + fw_sink.md5_stored_len, buf, n);
+      fw_sink.md5_stored_len += n;
+   }
+}
+#endif
+
 /** Gecko and 500 series file writer. */
 static bool fw_tmp_file_append(uint8_t *buf, uint16_t len) {
-   size_t written = 0;
-   int file_error = FALSE;
+   uint16_t done = 0;
+   ssize_t n;
 
-   fw_file = fopen(fw_curr_filename, "a");
-   if (fw_file) {
-      DBG_PRINTF("fw_file opened\n");
+   if (fw_sink.fd < 0) {
+      DBG_PRINTF("No file\n");
+      return FALSE;
    }
-   if (fw_file) {
-      written = fwrite(buf, len, 1, fw_file);
-      file_error = fclose(fw_file);
-      fw_file = NULL;
-      if (written != 1) {
+
+   while (done < len) {
+      n = write(fw_sink.fd, buf + done, len - done);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
          ERR_PRINTF("Could not write to temp file (%s) for firmware update: Error: %s\n",
                     fw_curr_filename, strerror(errno));
          return FALSE;
       }
-      if (file_error) {
-         ERR_PRINTF("Could not close temp file (%s) for firmware update: Error: %s\n",
-                    fw_filename, strerror(errno));
-         return FALSE;
-      }
-      return TRUE;
-   } else {
-      DBG_PRINTF("No file\n");
-      return FALSE;
+      done += n;
+   }
+
+   if (fw_sink.len < sizeof(fw_sink.header)) {
+      uint32_t n_hdr = sizeof(fw_sink.header) - fw_sink.len;
+      memcpy(fw_sink.header + fw_sink.len, buf, n_hdr < len ? n_hdr : len);
+   }
+#ifndef AXTLS
+   if (fw_sink.md5_enabled) {
+      fw_tmp_file_md5_update(buf, len);
    }
+#endif
+   fw_sink.crc = zgw_crc16(fw_sink.crc, buf, len);
+   fw_sink.len += len;
+   return TRUE;
 }
 
-static size_t fw_tmp_file_write(long offset, int whence, uint8_t *buf, uint16_t len) {
-  fw_file = fopen(fw_curr_filename, "w");
-  if (fw_file == NULL) {
-    ERR_PRINTF("Firmware temporary file open failed\n");
-    return 0;
-  }
-  fseek(fw_file, offset, whence);
-  size_t written = fwrite(buf, len, 1, fw_file);
-  fclose(fw_file);
-  return written;
+static void fw_tmp_file_close(bool complete) {
+   if (fw_sink.fd >= 0 && close(fw_sink.fd) != 0) {
+      ERR_PRINTF("Could not close temp file (%s) for firmware update: Error: %s\n",
+                 fw_curr_filename, strerror(errno));
+      complete = FALSE;
+   }
+   fw_sink.fd = -1;
+   fw_sink.complete = complete;
 }
 
-static long fw_tmp_file_size() {
+static bool fw_tmp_file_crc(uint16_t *crc) {
+  uint8_t buf[512];
+  size_t n;
+
   fw_file = fopen(fw_curr_filename, "r");
-  if (fw_file) {
-    fseek(fw_file, 0, SEEK_END);
-    return ftell(fw_file);
+  if (fw_file == NULL) {
+    return FALSE;
   }
-  return 0;
+  *crc = CRC_INIT_VALUE;
+  while ((n = fread(buf, 1, sizeof(buf), fw_file)) > 0) {
+    *crc = zgw_crc16(*crc, buf, n);
+  }
+  fclose(fw_file);
+  return TRUE;
 }
 
-/*
- * ZIPR Firmware and Z-wave FW meta data reports handler
+/**
+ * Write the fragment \ref blockno to the image.
+ *
+ * \param data Payload of the fragment.
+ * \param dat_len Length of the payload.
+ * \param last Set if this is the last fragment of the image.
+ * \return TRUE if more fragments are expected. FALSE if the image is complete
+ * or the transfer has failed.
  */
-void
-FwUpdate_Handler(BYTE* pData, WORD bDatalen)
+static bool
+fw_fragment_write(BYTE* data, uint32_t dat_len, u8_t last)
 {
-  ZW_APPLICATION_TX_BUFFER* pCmd = (ZW_APPLICATION_TX_BUFFER*) pData;
-#ifdef __ASIX__
-  uint16_t payload_len = 0;
-#endif
-  uint32_t index = 0, dat_len = 0, downloadlen = 0;
-  uint16_t calcrc = CRC_INIT_VALUE;
-  int status = 0;
-  //uint8_t buf[410] = {0};
-
-  if (blockno
-      != (((pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x7F) << 8)
-          | (pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.reportNumber2)))
-  {
-    DBG_PRINTF("Invalid/Duplicate block no = %u\r\n",
-        (unsigned )(((pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x7F) << 8)
-            | (pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.reportNumber2)));
-    return;
-  }
-
-  if ((bDatalen - (sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1)) == 0)
-  {
-    DBG_PRINTF("Firmware packet with zero len received.\r\n");
-    return;
-  }
-
-  //Stop the timer
-  ZW_LTimerCancel(upgradeTimer);
-  upgradeTimer = 0xFF;
-
-  //it is the last block
-  if (pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x80)
-  {
-    DBG_PRINTF("Last byte received. \n");
-    dat_len = bDatalen - (sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1);
-    if (dat_len > fwmss)
-    {
-      dat_len = fwmss;
-    }
-  }
-  else
-  {
-    dat_len = fwmss;
-  }
+  uint32_t index = 0, downloadlen = 0;
 
   if (blockno == 1)
   {
     uint8_t block_ok = 0;
-    BYTE* p = &(pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.data1);
+    BYTE* p = data;
     DBG_PRINTF("First byte received.\n");
 
     if (ZW_GECKO_CHIP_TYPE(chip_desc.my_chip_type)) {
@@ -998,26 +1211,8 @@ FwUpdate_Handler(BYTE* pData, WORD bDatalen)
     {
       DBG_PRINTF("Wrong FW file received..\r\n");
       FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
-      return;
-    }
-  }
-
-  //Verify the received block
-  //includes the command header data and 2 byte crc
-  if (zgw_crc16(calcrc, (BYTE *) pData, dat_len + sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1))
-  {
-    DBG_PRINTF("Checksum verify failed for the blockno = %u\r\n", blockno);
-    if (retrycnt >= MAX_RETRY)
-    {
-      FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
-    }
-    else
-    {
-      retrycnt++;
-      DBG_PRINTF("Retrying block no = %u\r\n", blockno);
-      FwUpdateDataGet_Send();
+      return FALSE;
     }
-    return;
   }
 
   index = (uint32_t) fwmss * (blockno - 1);
@@ -1038,83 +1233,182 @@ FwUpdate_Handler(BYTE* pData, WORD bDatalen)
                max_len);
     FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL,
                                WAIT_TIME_ZERO);
-    return;
+    return FALSE;
   }
 
   bool res = false;
 
   if (index == 0) {
-     res = fw_tmp_file_create();
+     res = fw_tmp_file_create(chip_desc.my_chip_type == ZW_CHIP_TYPE);
      if (res == false) {
        ERR_PRINTF("Firmware update temporary creation failed.\n");
      }
   }
   /* Write the payload to a temporary file */
-  res = fw_tmp_file_append(&pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.data1, dat_len);
+  res = fw_tmp_file_append(data, dat_len);
   if (!res) {
      FwUpdate_StatusReport_Send(FIRMWARE_UPDATE_MD_STATUS_REPORT_INSUFFICIENT_MEMORY_V4,
                                 WAIT_TIME_ZERO);
-     return;
+     return FALSE;
   }
 
-  build_crc = zgw_crc16(build_crc, &pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.data1, dat_len);
+  build_crc = zgw_crc16(build_crc, data, dat_len);
 
   blockno++;
-  retrycnt = 1;
 
-  /* Last frame */
-  if (pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x80)
+  if (!last)
   {
-    if (build_crc != fw_desc.crc)
+    return TRUE;
+  }
+
+  if (build_crc != fw_desc.crc)
+  {
+    DBG_PRINTF("Invalid checksum: Download failed.\r\n");
+    FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
+    return FALSE;
+  }
+
+  //Append image description to the end of temp file
+  downloadlen = (index + dat_len);
+  fw_desc.firmware_len = downloadlen;
+  if (chip_desc.my_chip_type == ZW_CHIP_TYPE) {
+    fw_tmp_file_append((u8_t*) &fw_desc, sizeof(struct image_descriptor));
+  }
+  fw_tmp_file_close(TRUE);
+
+  if (bActivationRequest)
+  {
+    FwUpdate_StatusReport_Send(
+    FIRMWARE_UPDATE_MD_STATUS_REPORT_SUCCESSFULLY_WAITING_FOR_ACTIVATION_V4, WAIT_TIME_ZERO);
+  }
+  else
+  {
+    activate_image(fw_desc.firmware_id, fw_desc.target, fw_desc.crc, fw_desc.firmware_len, 0);
+  }
+  return FALSE;
+}
+
+/*
+ * ZIPR Firmware and Z-wave FW meta data reports handler
+ *
+ * Fragments are written to the image in order. Fragments received after a
+ * lost one are kept in \ref fw_ahead. Once the sender has sent all fragments
+ * of a Get, only the missing ones are requested again.
+ */
+void
+FwUpdate_Handler(BYTE* pData, WORD bDatalen)
+{
+  ZW_APPLICATION_TX_BUFFER* pCmd = (ZW_APPLICATION_TX_BUFFER*) pData;
+  uint32_t dat_len = 0;
+  uint16_t calcrc = CRC_INIT_VALUE;
+  BYTE* data = &pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.data1;
+  u8_t last = pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x80;
+  u16_t n = ((pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.properties1 & 0x7F) << 8)
+      | pCmd->ZW_FirmwareUpdateMdReport1byteV3Frame.reportNumber2;
+  struct fw_fragment *f;
+
+  if ((n < blockno) || (n >= window_end) || (n != blockno && fw_ahead_get(n)))
+  {
+    DBG_PRINTF("Invalid/Duplicate block no = %u\r\n", (unsigned) n);
+    return;
+  }
+
+  if ((bDatalen - (sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1)) == 0)
+  {
+    DBG_PRINTF("Firmware packet with zero len received.\r\n");
+    return;
+  }
+
+  //it is the last block
+  if (last)
+  {
+    DBG_PRINTF("Last byte received. \n");
+    dat_len = bDatalen - (sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1);
+    if (dat_len > fwmss)
     {
-      DBG_PRINTF("Invalid checksum: Download failed.\r\n");
-      FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
-      return;
+      dat_len = fwmss;
     }
+  }
+  else
+  {
+    dat_len = fwmss;
+  }
 
-    //Append image description to the end of temp file
-    downloadlen = (index + dat_len);
-    fw_desc.firmware_len = downloadlen;
-    if (chip_desc.my_chip_type == ZW_CHIP_TYPE) {
-      fw_tmp_file_append((u8_t*) &fw_desc, sizeof(struct image_descriptor));
+  //Verify the received block
+  //includes the command header data and 2 byte crc
+  if (zgw_crc16(calcrc, (BYTE *) pData, dat_len + sizeof(ZW_FIRMWARE_UPDATE_MD_REPORT_1BYTE_V3_FRAME) - 1))
+  {
+    DBG_PRINTF("Checksum verify failed for the blockno = %u\r\n", (unsigned) n);
+    if (n != blockno)
+    {
+      /* Requested again with the other missing fragments */
+      window_loss = TRUE;
+      return;
     }
-
-    if (bActivationRequest)
+    ZW_LTimerCancel(upgradeTimer);
+    upgradeTimer = 0xFF;
+    if (retrycnt >= MAX_RETRY)
     {
-      FwUpdate_StatusReport_Send(
-      FIRMWARE_UPDATE_MD_STATUS_REPORT_SUCCESSFULLY_WAITING_FOR_ACTIVATION_V4, WAIT_TIME_ZERO);
+      FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
     }
     else
     {
-      activate_image(fw_desc.firmware_id, fw_desc.target, fw_desc.crc, fw_desc.firmware_len, 0);
+      retrycnt++;
+      window_loss = TRUE;
+      DBG_PRINTF("Retrying block no = %u\r\n", blockno);
+      FwUpdateDataGet_Send();
     }
+    return;
+  }
+
+  //Stop the timer
+  ZW_LTimerCancel(upgradeTimer);
+  upgradeTimer = 0xFF;
+
+  if (last)
+  {
+    /* Nothing is sent after the last fragment */
+    window_end = n + 1;
+  }
+
+  if (n != blockno)
+  {
+    DBG_PRINTF("Fragment %u received ahead of %u\r\n", (unsigned) n, (unsigned) blockno);
+    f = &fw_ahead[n % FW_UPDATE_WINDOW_MAX];
+    f->number = n;
+    f->len = dat_len;
+    f->last = last;
+    memcpy(f->data, data, dat_len);
+    window_loss = TRUE;
   }
   else
   {
-    /* Expecting more frames */
-    if (updatemode == BLOCK_MODE)
+    if (!fw_fragment_write(data, dat_len, last))
     {
-      if (((reqno + blockno - 1) % BLOCK_REQ_NO) == 1)
-      {
-        //DBG_PRINTF("FwUpdateDataGet_Send: called  blockno = %u\r\n", blockno);
-        FwUpdateDataGet_Send();
-      }
-      else if (upgradeTimer == 0xFF)
-      {
-        upgradeTimer = ZW_LTimerStart(FwUpdate_Timeout, upgradeTimeout,
-        UPGRADE_TIMER_REPEATS);
-      }
+      return;
     }
-    else
+    /* Write the fragments which were waiting for this one */
+    while ((f = fw_ahead_get(blockno)))
     {
-      FwUpdateDataGet_Send();
+      f->number = 0;
+      if (!fw_fragment_write(f->data, f->len, f->last))
+      {
+        return;
+      }
     }
+    retrycnt = 1;
   }
 
-  return;
-error:
-  FwUpdate_StatusReport_Send(ERROR_INVALID_CHECKSUM_FATAL, WAIT_TIME_ZERO);
-  return;
+  if ((blockno >= req_end) || (n + 1 >= req_end) || last)
+  {
+    /* The sender is done with the last Get */
+    FwUpdateDataGet_Send();
+  }
+  else if (upgradeTimer == 0xFF)
+  {
+    upgradeTimer = ZW_LTimerStart(FwUpdate_Timeout, upgradeTimeout,
+    UPGRADE_TIMER_REPEATS);
+  }
 }
 
 static void
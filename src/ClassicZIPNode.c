@@ -674,7 +674,7 @@ int ClassicZIPUDP_input(struct uip_udp_conn* c, u8_t* pktdata, u16_t len, BOOL s
   ZW_COMMAND_ZIP_PACKET* zip_ptk = (ZW_COMMAND_ZIP_PACKET*)pktdata;
   BYTE* payload;
 
-  DBG_PRINTF("ClassicZIPUDP_input len: %d secure: %d [%s]\n", len, secure, print_frame(pktdata, len));
+  DBG_PRINTF_FRAME(pktdata, len, "ClassicZIPUDP_input len: %d secure: %d", len, secure);
 
   if ((bridge_state != initialized)  && ((NetworkManagement_getState() != NM_WAIT_FOR_PROBE_BY_SIS)))
   {
@@ -899,7 +899,7 @@ int ClassicZIPNode_dec_input(void * pktdata, int len)
 {
   uint8_t *cc = (uint8_t *) pktdata;
  
-  DBG_PRINTF("Decrypted pkt: len: %d [%s]\n", len, print_frame(pktdata, len));
+  DBG_PRINTF_FRAME(pktdata, len, "Decrypted pkt: len: %d", len);
   /* Copy decrypted payload into uip_buf, leaving the ip header intact */
   uip_appdata = &uip_buf[UIP_LLH_LEN + UIP_IPUDPH_LEN];
   memcpy(uip_appdata,pktdata,len);
@@ -1217,8 +1217,10 @@ CreateLogicalUDP(ts_param_t* p, unsigned char *pCmd, uint8_t cmdLength)
     ipOfNode(&c.lipaddr, p->snode);
     uip_ipaddr_copy(&c.ripaddr, &a->resource_ip);
 
-    DBG_PRINTF("Packet [%s] from nodeid: %d to port: %d IP addr: ", print_frame((const char *)pCmd, cmdLength), p->snode, UIP_HTONS(c.rport));
-    uip_debug_ipaddr_print(&c.ripaddr);
+    char addr[sizeof("ffff:") * 8];
+    uip_ipaddr_sprint(addr, &c.ripaddr);
+    DBG_PRINTF_FRAME(pCmd, cmdLength, "Packet from nodeid: %d to port: %d IP addr: %s",
+                     p->snode, UIP_HTONS(c.rport), addr);
 
     ZW_SendData_UDP(&c, pCmd, cmdLength, NULL, FALSE);
   }
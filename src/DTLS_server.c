@@ -17,6 +17,7 @@
 #include "ZW_udp_server.h"
 #include "ClassicZIPNode.h"
 #include "ZIP_Router_logging.h"
+#include "zgw_metrics.h"
 
 #define UIP_IP_BUF ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 #define UIP_UDP_BUF ((struct uip_udp_hdr *)&uip_buf[UIP_LLIPH_LEN])
@@ -50,6 +51,8 @@ struct dtls_session
 #endif
   struct uip_packetqueue_handle queue; //Queue used to buffer packages while handshake is in progress
   clock_t timeout;
+  /** Time the session was created, to measure the handshake */
+  clock_time_t created;
   void (*cbFunc)(uint8_t b, void* user);
   void *user;
 };
@@ -68,6 +71,11 @@ MEMB(sessions_memb, struct dtls_session, 10);
 LIST(session_list);
 static struct etimer timer;
 
+ZGW_HISTOGRAM(dtls_handshake_ms, "zgw_dtls_handshake_milliseconds",
+              "Duration of completed DTLS handshakes");
+ZGW_COUNTER(dtls_alerts, "zgw_dtls_alerts_total",
+            "DTLS alerts which closed a session");
+
 #ifdef USE_CYASSL
 
 #include <ctaocrypt/sha.h>
@@ -208,10 +216,13 @@ client_info_callback(const SSL* ssl, int where, int ret)
    * dont do this, we are polling the state in the main event loop*/
   if (where & SSL_CB_ALERT)
   {
+    zgw_metric_add(&dtls_alerts, 1);
     process_post(&dtls_server_process, DTLS_CONNECTION_CLOSE_EVENT, s);
   }
   else if (where == SSL_CB_HANDSHAKE_DONE)
   {
+    zgw_histogram_record(&dtls_handshake_ms,
+                         (clock_time() - s->created) * 1000 / CLOCK_SECOND);
     process_post(&dtls_server_process, DLTS_CONNECTION_INIT_DONE_EVENT, s);
 
   }
@@ -244,6 +255,7 @@ dtls_new_session(struct uip_udp_conn* conn, u8_t client)
   SSL_set_info_callback(s->ssl, client_info_callback);
 
   s->timeout = clock_seconds() + DTLS_HANDSHAKE_TIMEOUT;
+  s->created = clock_time();
   uip_packetqueue_new(&s->queue);
   if (!s->ssl)
   {
@@ -461,6 +473,8 @@ PROCESS_THREAD(dtls_server_process, ev, data)
       memb_init(&sessions_memb);
 #endif
       list_init(session_list);
+      zgw_metrics_register(&dtls_handshake_ms.m);
+      zgw_metrics_register(&dtls_alerts);
 
       SSL_library_init();
       //OpenSSL_add_ssl_algorithms();
@@ -24,11 +24,20 @@
 #include "zip_router_config.h"
 #include "router_events.h"
 #include "zgw_nodemask.h"
+#include "mb_journal.h"
+#include "zw_node_latency.h"
+#include "zgw_metrics.h"
+#include <time.h>
 
 #define MAX_MAIL_BOX_PAYLOAD UIP_BUFSIZE
 #define PING_TIMEOUT_SEC 600
 #define WAITING_TIMEOUT 60
 #define NO_MORE_TIMEOUT 3
+/** Longest delay of Wake Up No More Information for a slow node */
+#define NO_MORE_TIMEOUT_MAX 10
+/** Appends to the journal are flushed in batches, at most this long after
+ * the first append. */
+#define JOURNAL_FLUSH_TIMEOUT_MS 1000
 
 #include "uip-debug.h"
 
@@ -46,6 +55,7 @@ typedef struct mailbox
   uint8_t waiting_enabled;
   struct ctimer waiting_timer;
   unsigned long queued_time;
+  uint32_t journal_id; /* 0 if the entry is not in the journal */
 } mailbox_t;
 LIST(mb_list);
 MEMB(mb_memb, struct mailbox, MAX_MAILBOX_ENTRIES);
@@ -138,6 +148,10 @@ static mb_state_t mb_state;
 
 static struct ctimer ping_timer;
 static struct ctimer no_more_timer;
+static struct ctimer journal_timer;
+
+/** Path of the mailbox journal, NULL if the mailbox is not persisted. */
+extern const char* linux_conf_mb_journal_file;
 
 
 /**
@@ -165,6 +179,9 @@ mb_state_transition(mb_event_t event);
 static void
 mb_send_done(uint8_t status, void* user, TX_STATUS_TYPE *t);
 
+static void
+send_waiting_timeout(void* data);
+
 
 /**
  * Check to see if the more information flag is set.
@@ -211,11 +228,137 @@ zwave_connection_t* get_zw_conn() {
   return &zw;
 }
 
+/**
+ * Write the entries in mb_list to a new journal file, dropping the records of
+ * entries that have been delivered or purged.
+ */
+static void
+mb_journal_compact(void)
+{
+  mailbox_t* m;
+  mb_journal_entry_t e;
+  unsigned long now = clock_seconds();
+
+  if (!mb_journal_compact_begin())
+  {
+    return;
+  }
+  for (m = list_head(mb_list); m; m = list_item_next(m))
+  {
+    if (!m->journal_id)
+    {
+      continue;
+    }
+    e.id = m->journal_id;
+    e.queued_time = time(NULL) - (now - m->queued_time);
+    memcpy(e.proxy, &m->proxy, sizeof(e.proxy));
+    e.handle = m->handle;
+    e.waiting_enabled = m->waiting_enabled;
+    e.data_len = m->data_len;
+    e.data = m->data;
+    if (!mb_journal_compact_add(&e))
+    {
+      break;
+    }
+  }
+  mb_journal_compact_commit();
+}
+
+static void
+mb_journal_timeout(void* data)
+{
+  mb_journal_flush();
+  if (!mb_journal_compact_poll() && mb_journal_should_compact())
+  {
+    mb_journal_compact();
+  }
+  if (mb_journal_compact_poll())
+  {
+    /* Check again for the end of the compaction */
+    ctimer_set(&journal_timer, JOURNAL_FLUSH_TIMEOUT_MS * CLOCK_SECOND / 1000,
+        mb_journal_timeout, 0);
+  }
+}
+
+/**
+ * Flush the journal when the current batch of appends is complete.
+ */
+static void
+mb_journal_changed(void)
+{
+  if (mb_journal_is_dirty() && ctimer_expired(&journal_timer))
+  {
+    ctimer_set(&journal_timer, JOURNAL_FLUSH_TIMEOUT_MS * CLOCK_SECOND / 1000,
+        mb_journal_timeout, 0);
+  }
+}
+
+static void
+mb_journal_add_entry(mailbox_t* m)
+{
+  mb_journal_entry_t e;
+
+  if (!mb_journal_is_open())
+  {
+    return;
+  }
+  e.queued_time = time(NULL);
+  memcpy(e.proxy, &m->proxy, sizeof(e.proxy));
+  e.handle = m->handle;
+  e.waiting_enabled = m->waiting_enabled;
+  e.data_len = m->data_len;
+  e.data = m->data;
+  m->journal_id = mb_journal_append_add(&e);
+  mb_journal_changed();
+}
+
+/**
+ * Put a journaled entry back in the mailbox queue.
+ */
+static void
+mb_journal_restore_entry(const mb_journal_entry_t* e, void* user)
+{
+  mailbox_t* m;
+  unsigned long age;
+  uint32_t now = time(NULL);
+
+  if (e->data_len == 0 || e->data_len > MAX_MAIL_BOX_PAYLOAD)
+  {
+    return;
+  }
+  m = memb_alloc(&mb_memb);
+  if (!m)
+  {
+    ERR_PRINTF("Mailbox is full, journaled entry %u dropped\n", e->id);
+    mb_journal_append_del(e->id);
+    return;
+  }
+  memset(m, 0, sizeof(mailbox_t));
+  memcpy(m->data, e->data, e->data_len);
+  m->data_len = e->data_len;
+  memcpy(&m->proxy, e->proxy, sizeof(m->proxy));
+  m->handle = e->handle;
+  m->waiting_enabled = e->waiting_enabled;
+  m->journal_id = e->id;
+
+  /* Keep the age of the entry, so it expires as if we had not restarted. */
+  age = now > e->queued_time ? now - e->queued_time : 0;
+  m->queued_time = age < clock_seconds() ? clock_seconds() - age : 0;
+
+  ctimer_set(&m->waiting_timer, 200, send_waiting_timeout, m);
+  list_add(mb_list, m);
+}
+
 static void
 mb_free_entry(mailbox_t* m)
 {
   ctimer_stop(&m->waiting_timer);
   list_remove(mb_list, m);
+  if (m->journal_id)
+  {
+    mb_journal_append_del(m->journal_id);
+    mb_journal_changed();
+  }
   memb_free(&mb_memb, m);
 }
 
@@ -622,6 +765,7 @@ mb_post_uipbuf(uip_ip6addr_t* proxy, uint8_t handle)
   ASSERT(uip_len);
   m->data_len = uip_len;
   m->waiting_enabled = waiting;
+  m->journal_id = 0;
   memcpy(m->data, uip_buf + UIP_LLH_LEN, m->data_len);
   DBG_PRINTF("-------------queued\n");
   m->queued_time = clock_seconds();
@@ -651,6 +795,7 @@ mb_post_uipbuf(uip_ip6addr_t* proxy, uint8_t handle)
     }
 
   list_add(mb_list, m);
+  mb_journal_add_entry(m);
 
   if (rd_get_node_state(dnode) == STATUS_FAILING)
     {
@@ -726,15 +871,55 @@ mb_send_no_more_information(nodeid_t node)
 
 
 
+static int64_t mailbox_length(void)
+{
+  return list_length(mb_list);
+}
+
+ZGW_SAMPLED_GAUGE(mailbox_gauge, "zgw_mailbox_length",
+                  "Frames waiting in the mailbox for sleeping nodes",
+                  mailbox_length);
+
 void
 mb_init()
 {
+  mailbox_t* m;
+
+  /* Stop the timers of entries from a previous run before the pool is reset */
+  while ((m = list_pop(mb_list)))
+  {
+    ctimer_stop(&m->waiting_timer);
+  }
+  ctimer_stop(&journal_timer);
+
   memb_init(&mb_memb);
   list_init(mb_list);
   memset(black_list_crc16, 0, sizeof(black_list_crc16));
 
+  if (linux_conf_mb_journal_file && *linux_conf_mb_journal_file)
+  {
+    if (!mb_journal_open(linux_conf_mb_journal_file, homeID,
+        mb_journal_restore_entry, 0))
+    {
+      ERR_PRINTF("Mailbox entries will not be persisted\n");
+    }
+    else if (list_length(mb_list))
+    {
+      process_post(&zip_process, ZIP_EVENT_QUEUE_UPDATED, 0);
+    }
+    mb_journal_changed();
+  }
+
   /* Start the ping timer */
   ctimer_set(&ping_timer, 60 * CLOCK_SECOND, send_ping_timeout, 0);
+  zgw_metrics_register(&mailbox_gauge);
+}
+
+void
+mb_exit(void)
+{
+  ctimer_stop(&journal_timer);
+  mb_journal_close();
 }
 
 static void
@@ -828,11 +1013,21 @@ static void no_more_timeout(void* user) {
   mb_state_transition(MB_EVENT_TIMEOUT);
 }
 
+/**
+ * Time to give the client to follow up on the frames delivered to a node,
+ * before the node is put back to sleep. Nodes which are slow to answer
+ * delay the follow up, so they are given longer.
+ */
+static clock_time_t no_more_delay(nodeid_t node) {
+  return zw_node_latency_reply_timeout(node, NO_MORE_TIMEOUT * CLOCK_SECOND,
+                                       NO_MORE_TIMEOUT_MAX * CLOCK_SECOND);
+}
+
 
 void mb_put_node_to_sleep_later(nodeid_t node) {
 
   if(mb_state.state == MB_STATE_IDLE) {
-    ctimer_set(&no_more_timer, NO_MORE_TIMEOUT * CLOCK_SECOND, no_more_timeout, 0);
+    ctimer_set(&no_more_timer, no_more_delay(node), no_more_timeout, 0);
     mb_state.state = MB_STATE_SEND_NO_MORE_INFO_DELAYED;
     mb_state.node = node;
   }
@@ -1137,7 +1332,7 @@ mb_state_transition(mb_event_t event)
       else
       {
         mb_state.state = MB_STATE_SEND_NO_MORE_INFO_DELAYED;
-        ctimer_set(&no_more_timer, NO_MORE_TIMEOUT * CLOCK_SECOND, no_more_timeout, 0);
+        ctimer_set(&no_more_timer, no_more_delay(mb_state.node), no_more_timeout, 0);
         process_post(&zip_process, ZIP_EVENT_QUEUE_UPDATED, 0);
       }
     }
@@ -1146,13 +1341,13 @@ mb_state_transition(mb_event_t event)
     if(event == MB_EVENT_TIMEOUT) {
       if (rd_node_in_probe(mb_state.node) || sleeping_node_is_in_firmware_upgrade(mb_state.node)) {
         DBG_PRINTF("Node: %d is still in probe or firmware upgrade. Delaying Wake up No more info\n", mb_state.node);
-        ctimer_set(&no_more_timer, NO_MORE_TIMEOUT * CLOCK_SECOND, no_more_timeout, 0);
+        ctimer_set(&no_more_timer, no_more_delay(mb_state.node), no_more_timeout, 0);
       } else {
         mb_state.state = MB_STATE_SEND_NO_MORE_INFO;
         mb_send_no_more_information(mb_state.node);
       }
     } else if(event == MB_EVENT_FRAME_SENT_TO_NODE) {
-      ctimer_set(&no_more_timer, NO_MORE_TIMEOUT * CLOCK_SECOND, no_more_timeout, 0);
+      ctimer_set(&no_more_timer, no_more_delay(mb_state.node), no_more_timeout, 0);
     }
   break;
   case MB_STATE_SEND_NO_MORE_INFO:
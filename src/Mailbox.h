@@ -106,6 +106,11 @@ void mb_purge_messages(nodeid_t node);
 void
 mb_init();
 
+/**
+ * Flush and close the mailbox journal when the gateway exits.
+ */
+void mb_exit(void);
+
 /**
  * Call when a Wake Up Notification (WUN) is received from the Z-Wave interface.
  * \param node NodeID sending the WUN
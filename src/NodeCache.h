@@ -77,6 +77,19 @@ int SupportsCmdClassSecure(nodeid_t nodeid, WORD class)CC_REENTRANT_ARG;
  */
 BYTE SetCacheEntryFlagMasked(nodeid_t nodeid,BYTE value, BYTE mask)CC_REENTRANT_ARG;
 
+/**
+ * Get the nodes which have a security flag set.
+ *
+ * The mask is kept up to date by the resource directory, so this is
+ * cheaper than calling GetCacheEntryFlag() for every node of a large
+ * node list. Virtual nodes are not in the masks, they have the flags of
+ * the gateway, see GetCacheEntryFlag().
+ *
+ * @param flag One of the NODE_FLAG_* flags.
+ * @return A \ref nodemask_t owned by the resource directory.
+ */
+const uint8_t* rd_security_nodemask(BYTE flag);
+
 /**
  * Used to indicate that node info was received or timed out from protocol side.
  */
@@ -95,6 +95,47 @@ void rd_store_mem_free_ep(rd_ep_database_entry_t* ep);
 void* rd_data_mem_alloc(uint8_t size);
 void rd_data_mem_free(void* p);
 
+/**
+ * Identifies a node model in the probe template cache.
+ *
+ * Nodes of the same model, running the same firmware with the same
+ * security keys and node info, report the same command class versions.
+ */
+typedef struct rd_probe_template_key {
+  uint16_t manufacturerID;
+  uint16_t productType;
+  uint16_t productID;
+  /** Application version and sub version from the Version Report. */
+  uint16_t firmware_version;
+  /** Security keys granted to the node, \ref NODE_FLAGS_SECURITY. */
+  uint8_t security_flags;
+  /** CRC16 of the node info of the root device. */
+  uint16_t nif_crc;
+} rd_probe_template_key_t;
+
+/**
+ * Read a probe template into a node.
+ *
+ * Fills in the command class versions, the version capabilities and the
+ * Z-Wave software report status of n.  Templates are kept across
+ * networks, they are not cleared by rd_data_store_invalidate().
+ *
+ * @param key The model of the node.
+ * @param n The node to fill in.
+ * @return true if a template was found for the key.
+ */
+bool rd_data_store_probe_template_read(const rd_probe_template_key_t *key,
+                                       rd_node_database_entry_t *n);
+
+/**
+ * Store the probe results of a node as the template of its model.
+ *
+ * @param key The model of the node.
+ * @param n A node which has been probed successfully.
+ */
+void rd_data_store_probe_template_write(const rd_probe_template_key_t *key,
+                                        const rd_node_database_entry_t *n);
+
 /**
  * Corrupt the magic field of EEPROM to make sure EEPROM will be reformatted.
  */
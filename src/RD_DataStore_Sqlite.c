@@ -18,6 +18,8 @@ static sqlite3_stmt *node_select_stmt = NULL;
 static sqlite3_stmt *ep_select_stmt = NULL;
 static sqlite3_stmt *node_insert_stmt = NULL;
 static sqlite3_stmt *ep_insert_stmt = NULL;
+static sqlite3_stmt *template_select_stmt = NULL;
+static sqlite3_stmt *template_insert_stmt = NULL;
 extern const char *linux_conf_database_file;
 
 #define DATA_BASE_SCHEMA_VERSION_MAJOR 1
@@ -124,6 +126,20 @@ enum
   span_col_state
 };
 
+// Probe template columns
+enum
+{
+  pt_col_manufacturerID,
+  pt_col_productType,
+  pt_col_productID,
+  pt_col_firmware_version,
+  pt_col_security_flags,
+  pt_col_nif_crc,
+  pt_col_cc_versions,
+  pt_col_node_version_cap_and_zwave_sw,
+  pt_col_node_is_zws_probed,
+};
+
 /**
  * @brief  Helper function to execute SQL statement and check for errors
  *
@@ -199,6 +215,21 @@ bool prepare_statements()
     goto fail;
   }
 
+  sql = "SELECT * FROM probe_templates WHERE manufacturerID = ? AND productType = ? AND productID = ?"
+        " AND firmware_version = ? AND security_flags = ? AND nif_crc = ?";
+  rc = sqlite3_prepare_v2(db, sql, -1, &template_select_stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    goto fail;
+  }
+
+  sql = "INSERT OR REPLACE INTO probe_templates VALUES(?,?,?,?,?,?,?,?,?)";
+  rc = sqlite3_prepare_v2(db, sql, -1, &template_insert_stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    goto fail;
+  }
+
   return true;
 fail:
   ERR_PRINTF("prepare failed: %s\n", sqlite3_errmsg(db));
@@ -359,6 +390,24 @@ bool data_store_init(void)
       goto fail;
     }
 
+    rc = datastore_exec_sql("CREATE TABLE IF NOT EXISTS probe_templates ("
+                            "manufacturerID INTEGER,"
+                            "productType INTEGER,"
+                            "productID INTEGER,"
+                            "firmware_version INTEGER,"
+                            "security_flags INTEGER,"
+                            "nif_crc INTEGER,"
+                            "cc_versions BLOB,"
+                            "node_version_cap_and_zwave_sw INTEGER,"
+                            "node_is_zws_probed INTEGER,"
+                            "PRIMARY KEY (manufacturerID, productType, productID,"
+                            " firmware_version, security_flags, nif_crc)"
+                            ");");
+    if (rc != SQLITE_OK)
+    {
+      goto fail;
+    }
+
     //  rc = datastore_exec_sql(
     //      "CREATE TRIGGER network_no_insert BEFORE INSERT ON network WHEN (SELECT COUNT(*) FROM network) >= 1 BEGIN SELECT RAISE(FAIL, 'only one row!'); END;");
     //  if (rc != SQLITE_OK)
@@ -409,6 +458,10 @@ void data_store_exit(void)
   node_insert_stmt = NULL;
   sqlite3_finalize(ep_insert_stmt);
   ep_insert_stmt = NULL;
+  sqlite3_finalize(template_select_stmt);
+  template_select_stmt = NULL;
+  sqlite3_finalize(template_insert_stmt);
+  template_insert_stmt = NULL;
   int rc = sqlite3_close(db);
   if (rc != SQLITE_OK) {
     ERR_PRINTF("Cannot close database: %s\n", sqlite3_errmsg(db));
@@ -604,6 +657,66 @@ void rd_data_store_update(rd_node_database_entry_t *n)
   rd_data_store_nvm_write(n);
 }
 
+/****************** Probe templates **********************/
+
+static void bind_template_key(sqlite3_stmt *stmt, const rd_probe_template_key_t *key)
+{
+  sqlite3_bind_ex_int(stmt, pt_col_manufacturerID, key->manufacturerID);
+  sqlite3_bind_ex_int(stmt, pt_col_productType, key->productType);
+  sqlite3_bind_ex_int(stmt, pt_col_productID, key->productID);
+  sqlite3_bind_ex_int(stmt, pt_col_firmware_version, key->firmware_version);
+  sqlite3_bind_ex_int(stmt, pt_col_security_flags, key->security_flags);
+  sqlite3_bind_ex_int(stmt, pt_col_nif_crc, key->nif_crc);
+}
+
+bool rd_data_store_probe_template_read(const rd_probe_template_key_t *key,
+                                       rd_node_database_entry_t *n)
+{
+  bool found = false;
+
+  sqlite3_reset(template_select_stmt);
+  bind_template_key(template_select_stmt, key);
+  if (sqlite3_step(template_select_stmt) == SQLITE_ROW)
+  {
+    /* The template is of no use if the gateway controls another set of
+     * command classes than when it was stored. */
+    if (n->node_cc_versions
+        && sqlite3_column_bytes(template_select_stmt, pt_col_cc_versions) == n->node_cc_versions_len)
+    {
+      memcpy(n->node_cc_versions,
+             sqlite3_column_blob(template_select_stmt, pt_col_cc_versions),
+             n->node_cc_versions_len);
+      n->node_version_cap_and_zwave_sw =
+          sqlite3_column_int(template_select_stmt, pt_col_node_version_cap_and_zwave_sw);
+      n->node_is_zws_probed = sqlite3_column_int(template_select_stmt, pt_col_node_is_zws_probed);
+      found = true;
+    }
+  }
+  sqlite3_reset(template_select_stmt);
+  return found;
+}
+
+void rd_data_store_probe_template_write(const rd_probe_template_key_t *key,
+                                        const rd_node_database_entry_t *n)
+{
+  int rc;
+
+  sqlite3_reset(template_insert_stmt);
+  bind_template_key(template_insert_stmt, key);
+  sqlite3_bind_ex_blob(template_insert_stmt, pt_col_cc_versions, n->node_cc_versions,
+                       n->node_cc_versions_len, SQLITE_STATIC);
+  sqlite3_bind_ex_int(template_insert_stmt, pt_col_node_version_cap_and_zwave_sw,
+                      n->node_version_cap_and_zwave_sw);
+  sqlite3_bind_ex_int(template_insert_stmt, pt_col_node_is_zws_probed, n->node_is_zws_probed);
+
+  rc = sqlite3_step(template_insert_stmt);
+  if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+  {
+    ERR_PRINTF("execution failed: %s\n", sqlite3_errmsg(db));
+  }
+  sqlite3_reset(template_insert_stmt);
+}
+
 /****************** IP associations **********************/
 
 void rd_data_store_persist_associations(list_t ip_association_table)
@@ -968,10 +1081,13 @@ void rd_datastore_persist_s2_span_table(const struct SPAN *span_table, size_t sp
 {
   sqlite3_stmt *stmt;
   LOG_PRINTF("Persisting S2 SPAN table\n");
+  /* The table is also checkpointed while running, so write it in one go */
+  datastore_exec_sql("BEGIN TRANSACTION;");
   datastore_exec_sql("DELETE FROM s2_span;");
   int rc = sqlite3_prepare_v2(db, "INSERT INTO s2_span VALUES(?,?,?,?,?,?,?);", -1, &stmt, 0);
   if (rc != SQLITE_OK) {
     WRN_PRINTF("Failed to persist S2 SPAN table, Sqlite prepare failed: %d\n", rc);
+    datastore_exec_sql("ROLLBACK;");
     return;
   }
   for (size_t i = 0; i < span_table_size; i++) {
@@ -990,6 +1106,7 @@ void rd_datastore_persist_s2_span_table(const struct SPAN *span_table, size_t sp
     }
   }
   sqlite3_finalize(stmt);
+  datastore_exec_sql("COMMIT;");
 }
 
 void rd_datastore_unpersist_s2_span_table(struct SPAN *span_table, size_t span_table_size)
@@ -9,7 +9,9 @@
 #include "ZIP_Router_logging.h"
 #include "provisioning_list.h"
 #include "zgw_str.h"
+#include "zgw_nodemask.h"
 #include "zwdb.h"
+#include "NodeCache.h"
 
 #include <string.h>
 #include <assert.h>
@@ -33,6 +35,15 @@ const cc_version_pair_t controlled_cc_v[] = {{COMMAND_CLASS_VERSION, 0x0},
  */
 static rd_node_database_entry_t* ndb[ZW_MAX_NODES];
 
+/** The nodes which are in \ref node_db */
+static nodemask_t node_nodemask;
+
+/**
+ * The nodes which have each of the security flags (NODE_FLAG_*) set,
+ * indexed by the bit number of the flag.
+ */
+static nodemask_t security_nodemask[8];
+
 uint8_t controlled_cc_v_size()
 {
   return sizeof(controlled_cc_v);
@@ -142,6 +153,8 @@ rd_node_database_entry_t* rd_node_entry_alloc(nodeid_t nodeid)
       nd->node_properties_flags = 0x0000;
 
       LIST_STRUCT_INIT(nd, endpoints);
+      nodemask_add_node(nodeid, node_nodemask);
+      rd_node_security_flags_update(nd);
    }
 
    return nd;
@@ -150,17 +163,46 @@ rd_node_database_entry_t* rd_node_entry_alloc(nodeid_t nodeid)
 rd_node_database_entry_t* rd_node_entry_import(nodeid_t nodeid)
 {
    ndb[nodeid-1] = rd_data_store_read(nodeid);
+   if (ndb[nodeid-1]) {
+      nodemask_add_node(nodeid, node_nodemask);
+      rd_node_security_flags_update(ndb[nodeid-1]);
+   }
    return ndb[nodeid-1];
 }
 
 void rd_node_entry_free(nodeid_t nodeid)
 {
    rd_node_database_entry_t* nd = ndb[nodeid - 1];
+   int i;
+
+   nodemask_remove_node(nodeid, node_nodemask);
+   for (i = 0; i < 8; i++) {
+      nodemask_remove_node(nodeid, security_nodemask[i]);
+   }
    rd_data_store_nvm_free(nd);
    rd_data_store_mem_free(nd);
    ndb[nodeid - 1] = NULL;
 }
 
+void rd_node_security_flags_update(rd_node_database_entry_t *n)
+{
+   int i;
+
+   for (i = 0; i < 8; i++) {
+      if (n->security_flags & (1 << i)) {
+         nodemask_add_node(n->nodeid, security_nodemask[i]);
+      } else {
+         nodemask_remove_node(n->nodeid, security_nodemask[i]);
+      }
+   }
+}
+
+const uint8_t* rd_security_nodemask(BYTE flag)
+{
+   assert(flag != 0);
+   return security_nodemask[__builtin_ctz(flag)];
+}
+
 rd_node_database_entry_t* rd_node_get_raw(nodeid_t nodeid)
 {
    return ndb[nodeid - 1];
@@ -181,6 +223,13 @@ rd_destroy()
       ndb[i] = 0;
     }
   }
+  nodemask_clear(node_nodemask);
+  memset(security_nodemask, 0, sizeof(security_nodemask));
+}
+
+const uint8_t* rd_node_nodemask(void)
+{
+  return node_nodemask;
 }
 
 u8_t rd_node_exists(nodeid_t node)
@@ -151,6 +151,16 @@ typedef enum {
 /** The probe of this node has completed at least once. */
 #define RD_NODE_FLAG_PROBE_HAS_COMPLETED 0x03
 
+/* Flags for the probe template of a node, see \ref rd_probe_template_key. */
+/** The manufacturer info has been read during the current probe. */
+#define RD_TEMPLATE_FLAG_PRODUCT_ID 0x01
+/** The firmware version has been read during the current probe. */
+#define RD_TEMPLATE_FLAG_FIRMWARE 0x02
+/** The versions of the node were filled in from a stored template. */
+#define RD_TEMPLATE_FLAG_APPLIED 0x04
+/** The probe results of the node must not be stored as a template. */
+#define RD_TEMPLATE_FLAG_INVALID 0x08
+
 /** Node information.
  *
  * \ingroup node_db
@@ -234,6 +244,12 @@ typedef struct rd_node_database_entry {
   /* This is not persisted in eeprom */
   ProbeCCVersionState_t *pcvs;
 
+  /** Application firmware version (Version Report) of the node, as
+   * read during the current probe.  Not persisted. */
+  uint16_t firmware_version;
+  /** RD_TEMPLATE_FLAG_xxx for the current probe.  Not persisted. */
+  uint8_t template_flags;
+
 } rd_node_database_entry_t;
 
 typedef struct rd_node_database_entry_legacy {
@@ -479,6 +495,18 @@ void rd_node_entry_free(nodeid_t nodeid);
 
 rd_node_database_entry_t* rd_node_get_raw(nodeid_t nodeid);
 
+/**
+ * Update the security nodemasks after the security flags of a node have changed.
+ *
+ * \ingroup node_db
+ *
+ * Must be called whenever rd_node_database_entry_t::security_flags is
+ * written, see rd_security_nodemask().
+ *
+ * \param n The node entry.
+ */
+void rd_node_security_flags_update(rd_node_database_entry_t *n);
+
 /** Set the DSK of a node.
  *
  * \ingroup node_db
@@ -13,7 +13,6 @@
 #include <stdlib.h>
 
 extern cc_version_pair_t controlled_cc_v[];
-static ZW_VERSION_COMMAND_CLASS_GET_FRAME v;
 void pcv_fsm_post_event(rd_ep_database_entry_t *ep, pcv_event_t ev);
 
 #ifndef TEST_PROBE_CC_VERSION
@@ -27,10 +26,13 @@ int cc_version_callback(BYTE txStatus, BYTE rxStatus,
   if (!ep) return 0;
   rd_node_database_entry_t* n = ep->node;
   if (!n) return 0;
+  /* Several nodes can be probed at a time, so the requested command class is
+   * taken from the probe state of this node. */
+  uint8_t requested_cc = controlled_cc_v[n->pcvs->probe_cc_idx].command_class;
   if(txStatus == TRANSMIT_COMPLETE_OK) {
-    if(pCmd->ZW_VersionCommandClassReportFrame.requestedCommandClass == v.requestedCommandClass) {
+    if(pCmd->ZW_VersionCommandClassReportFrame.requestedCommandClass == requested_cc) {
       if(pCmd->ZW_VersionCommandClassReportFrame.commandClassVersion >= 0x01) {
-        rd_node_cc_version_set(n, v.requestedCommandClass, pCmd->ZW_VersionCommandClassReportFrame.commandClassVersion);
+        rd_node_cc_version_set(n, requested_cc, pCmd->ZW_VersionCommandClassReportFrame.commandClassVersion);
         n->pcvs->probe_cc_idx++;
         n->pcvs->state = PCV_LAST_REPORT;
         pcv_fsm_post_event(ep, PCV_EV_VERSION_CC_REPORT_RECV);
@@ -41,7 +43,7 @@ int cc_version_callback(BYTE txStatus, BYTE rxStatus,
       }
     } else {
       WRN_PRINTF("Version report(%02x) is not the requested command class: %02x.\n",
-          pCmd->ZW_VersionCommandClassReportFrame.requestedCommandClass, v.requestedCommandClass);
+          pCmd->ZW_VersionCommandClassReportFrame.requestedCommandClass, requested_cc);
       n->probe_flags = RD_NODE_FLAG_PROBE_FAILED;
     }
   } else {
@@ -129,6 +131,7 @@ void pcv_fsm_post_event(rd_ep_database_entry_t *ep, pcv_event_t ev)
   rd_node_database_entry_t *n = ep->node;
   if (!n) return;
   ts_param_t p;
+  ZW_VERSION_COMMAND_CLASS_GET_FRAME v;
   ProbeCCVersionState_t *pcvs = n->pcvs;
 
   switch(pcvs->state) {
@@ -13,6 +13,7 @@
 #include "Bridge.h" /* is_virtual_node */
 #include "S2.h"
 #include "ZW_SendRequest.h"
+#include "zw_node_latency.h"
 #include "CommandAnalyzer.h" /* for rd_check_security_for_unsolicited_dest() */
 #include "ZW_SendDataAppl.h"
 #include "CC_Gateway.h" /* IsCCInNodeInfoSetList for rd_check_security_for_unsolicited_dest() */
@@ -31,6 +32,8 @@
 #include "RD_probe_cc_version.h"
 
 #include "zgw_str.h"
+#include "zgw_metrics.h"
+#include "lib/crc16.h"
 
 //This is 2000ms
 #define REQUEST_TIMEOUT 200
@@ -40,14 +43,11 @@
 
 typedef char rd_name_t[64];
 int dont_set_cache_flush_bit = 0;
-struct ctimer rd_node_probe_update_timer;
-struct ctimer ep_probe_update_timer;
 extern int tie_braking_won;
 extern int conflict_when_not_in_qs;
 /* RD probe lock. If this lock is set then the probe machine is locked. */
 static uint8_t probe_lock = 0;
 uint8_t denied_conflict_probes = 0;
-static uint8_t identical_endpoints = 0;
 /* This global, when set to 1, indicates that the ZIP GW has entered an existing network
  * and has assigned itself the SUC/SIS role. The ZGW must proceed to inform all existing
  * nodes about the presence of itself as SUC/SIS and will then clear this flag. */
@@ -75,7 +75,266 @@ SupportsCmdClassFlags(nodeid_t nodeid, WORD class);
 
 static struct ctimer dead_node_timer;
 static struct ctimer nif_request_timer;
-static struct ctimer find_report_timer;
+
+/** Upper limit of the number of nodes probed in parallel. The actual number
+ * is set with the configuration parameter ZipMaxParallelProbes. */
+#define RD_MAX_PARALLEL_PROBES 8
+
+/* Resources shared by all node probes. Each of them can only be used by one
+ * probe at a time, the other probes wait in their current state until it is
+ * released. */
+/** ZW_RequestNodeInfo(), owned by #nif_request_ep. */
+#define RD_PROBE_WAIT_NIF 0x01
+/** ZW_AssignReturnRoute(), owned by #return_route_node. */
+#define RD_PROBE_WAIT_RETURN_ROUTE 0x02
+/** The mDNS name probe session, owned by #mdns_probe_node. */
+#define RD_PROBE_WAIT_MDNS 0x04
+
+/**
+ * State of a node probe in progress.
+ *
+ * Each node probe runs its own state machine, so a node never has more than
+ * one outstanding request.
+ */
+typedef struct rd_probe_slot
+{
+  /** The node being probed, NULL if the slot is free. */
+  rd_node_database_entry_t* node;
+  /** The node has reported that all its endpoints are identical. */
+  uint8_t identical_endpoints;
+  /** The RD_PROBE_WAIT_xxx resource the probe is waiting for. */
+  uint8_t waiting;
+  /** Endpoint to resume when the resource is released. If NULL, the node is
+   * resumed. */
+  rd_ep_database_entry_t* wait_ep;
+  /** Timeout of the multi channel end point find reports. */
+  struct ctimer find_report_timer;
+  /** Delays the node probe after an mDNS name conflict. */
+  struct ctimer node_timer;
+  /** Delays the endpoint probe after an mDNS name conflict. */
+  struct ctimer ep_timer;
+  /** Time the probe started. */
+  clock_time_t started;
+} rd_probe_slot_t;
+
+static rd_probe_slot_t probe_slots[RD_MAX_PARALLEL_PROBES];
+
+/*Used when a get node info is pending */
+static rd_ep_database_entry_t* nif_request_ep = 0;
+
+/** Node waiting for the callback of ZW_AssignReturnRoute(). */
+static rd_node_database_entry_t* return_route_node = 0;
+
+/** Node which has started an mDNS name probe. */
+static rd_node_database_entry_t* mdns_probe_node = 0;
+
+/** Resumes the probes waiting for a released resource. */
+static struct ctimer probe_kick_timer;
+
+ZGW_HISTOGRAM(probe_ms, "zgw_rd_probe_milliseconds",
+              "Time from the start to the end of a node probe");
+
+static void rd_probe_start_next(void);
+
+static uint8_t rd_max_parallel_probes(void)
+{
+  if (cfg.max_parallel_probes == 0)
+  {
+    return 1;
+  }
+  if (cfg.max_parallel_probes > RD_MAX_PARALLEL_PROBES)
+  {
+    return RD_MAX_PARALLEL_PROBES;
+  }
+  return cfg.max_parallel_probes;
+}
+
+/**
+ * Get the probe slot of a node.
+ *
+ * \return The slot, or NULL if the node is not being probed.
+ */
+static rd_probe_slot_t* rd_probe_slot_get(rd_node_database_entry_t* n)
+{
+  uint8_t i;
+
+  if (!n)
+  {
+    return NULL;
+  }
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    if (probe_slots[i].node == n)
+    {
+      return &probe_slots[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Get a probe slot for a node, allocating one if the node is not already
+ * being probed.
+ *
+ * FLiRS nodes are reached with wake up beams, which occupy the channel for
+ * up to a second. Only one of them is probed at a time, so that they do not
+ * starve the other probes.
+ *
+ * \return The slot, or NULL if the node has to wait for another probe to
+ * complete.
+ */
+static rd_probe_slot_t* rd_probe_slot_claim(rd_node_database_entry_t* n)
+{
+  rd_probe_slot_t* free_slot = NULL;
+  uint8_t i;
+  uint8_t in_use = 0;
+  uint8_t is_flirs = ((n->mode & 0xff) == MODE_FREQUENTLYLISTENING);
+
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    if (probe_slots[i].node == n)
+    {
+      return &probe_slots[i];
+    }
+    if (probe_slots[i].node)
+    {
+      in_use++;
+      if (is_flirs && (probe_slots[i].node->mode & 0xff) == MODE_FREQUENTLYLISTENING)
+      {
+        return NULL;
+      }
+    }
+    else if (!free_slot)
+    {
+      free_slot = &probe_slots[i];
+    }
+  }
+
+  if (!free_slot || in_use >= rd_max_parallel_probes())
+  {
+    return NULL;
+  }
+  free_slot->node = n;
+  free_slot->identical_endpoints = 0;
+  free_slot->waiting = 0;
+  free_slot->wait_ep = NULL;
+  free_slot->started = clock_time();
+  return free_slot;
+}
+
+/**
+ * Schedule a resume of the probes waiting for a released resource.
+ *
+ * This is done from a timer, so that a probe releasing a resource does not
+ * run the state machine of another node from within its own.
+ */
+static void rd_probe_kick(void);
+
+/**
+ * Stop the probe of a node and free its slot.
+ *
+ * Resources used by the probe are released, except the assign return route
+ * which is owned until its callback.
+ */
+static void rd_probe_slot_release(rd_node_database_entry_t* n)
+{
+  rd_probe_slot_t* s = rd_probe_slot_get(n);
+
+  if (!s)
+  {
+    return;
+  }
+  ctimer_stop(&s->find_report_timer);
+  ctimer_stop(&s->node_timer);
+  ctimer_stop(&s->ep_timer);
+  zgw_histogram_record(&probe_ms, (clock_time() - s->started) * 1000 / CLOCK_SECOND);
+  s->node = NULL;
+  s->waiting = 0;
+  s->wait_ep = NULL;
+  s->identical_endpoints = 0;
+
+  if (nif_request_ep && nif_request_ep->node == n)
+  {
+    nif_request_ep = 0;
+    ctimer_stop(&nif_request_timer);
+    rd_probe_kick();
+  }
+  if (mdns_probe_node == n)
+  {
+    mdns_probe_node = 0;
+    rd_probe_kick();
+  }
+}
+
+/**
+ * Let the probe of node n wait for the resource, in endpoint ep or in the node
+ * itself if ep is NULL.
+ */
+static void rd_probe_wait(rd_node_database_entry_t* n, rd_ep_database_entry_t* ep,
+    uint8_t resource)
+{
+  rd_probe_slot_t* s = rd_probe_slot_get(n);
+
+  if (s)
+  {
+    DBG_PRINTF("Probe of node %u is waiting for resource 0x%02x\n", n->nodeid, resource);
+    s->waiting = resource;
+    s->wait_ep = ep;
+  }
+}
+
+static void rd_probe_kick_timeout(void* d)
+{
+  rd_probe_slot_t* s;
+  rd_ep_database_entry_t* ep;
+  uint8_t free_resources;
+  uint8_t i;
+
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    free_resources = (nif_request_ep ? 0 : RD_PROBE_WAIT_NIF)
+        | (return_route_node ? 0 : RD_PROBE_WAIT_RETURN_ROUTE)
+        | (mdns_probe_node ? 0 : RD_PROBE_WAIT_MDNS);
+    s = &probe_slots[i];
+    if (s->node && (s->waiting & free_resources))
+    {
+      ep = s->wait_ep;
+      s->waiting = 0;
+      s->wait_ep = NULL;
+      if (ep)
+      {
+        rd_ep_probe_update(ep);
+      }
+      else
+      {
+        rd_node_probe_update(s->node);
+      }
+    }
+  }
+}
+
+static void rd_probe_kick(void)
+{
+  ctimer_set(&probe_kick_timer, 0, rd_probe_kick_timeout, 0);
+}
+
+/** Stop all probes in progress. */
+static void rd_probe_slots_reset(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    ctimer_stop(&probe_slots[i].find_report_timer);
+    ctimer_stop(&probe_slots[i].node_timer);
+    ctimer_stop(&probe_slots[i].ep_timer);
+  }
+  ctimer_stop(&probe_kick_timer);
+  ctimer_stop(&nif_request_timer);
+  memset(probe_slots, 0, sizeof(probe_slots));
+  nif_request_ep = 0;
+  mdns_probe_node = 0;
+}
 
 
 typedef struct node_probe_done_notifier
@@ -470,6 +729,7 @@ rd_ep_find_callback(BYTE txStatus, BYTE rxStatus,
     ZW_APPLICATION_TX_BUFFER *pCmd, WORD cmdLength, void* user)
 {
   rd_node_database_entry_t* n = (rd_node_database_entry_t*) user;
+  rd_probe_slot_t* s = rd_probe_slot_get(n);
   uint8_t *cmd = (uint8_t *)pCmd;
   int endpoint_offset =
     offsetof(ZW_MULTI_CHANNEL_END_POINT_FIND_REPORT_1BYTE_V4_FRAME,
@@ -478,7 +738,10 @@ rd_ep_find_callback(BYTE txStatus, BYTE rxStatus,
   int i = 0;
   int epid;
 
-  ctimer_stop(&find_report_timer);
+  if (s)
+  {
+    ctimer_stop(&s->find_report_timer);
+  }
   if (txStatus == TRANSMIT_COMPLETE_OK
       && n->state == STATUS_FIND_ENDPOINTS)
   {
@@ -506,9 +769,9 @@ rd_ep_find_callback(BYTE txStatus, BYTE rxStatus,
  
     }
     
-    if (pCmd->ZW_MultiChannelEndPointFindReport1byteV4Frame.reportsToFollow !=
+    if (s && pCmd->ZW_MultiChannelEndPointFindReport1byteV4Frame.reportsToFollow !=
         0) {
-      ctimer_set(&find_report_timer, 100, find_report_timed_out, n);
+      ctimer_set(&s->find_report_timer, 100, find_report_timed_out, n);
       return 1; // Tell ZW_SendRequest to wait for more reports 
     }
   } else {
@@ -528,6 +791,7 @@ rd_ep_get_callback(BYTE txStatus, BYTE rxStatus, ZW_APPLICATION_TX_BUFFER *pCmd,
   int n_aggregated_endpoints;
   int epid;
   rd_node_database_entry_t* n = (rd_node_database_entry_t*) user;
+  rd_probe_slot_t* s = rd_probe_slot_get(n);
   rd_ep_database_entry_t* ep;
 
   if (txStatus == TRANSMIT_COMPLETE_OK
@@ -536,7 +800,10 @@ rd_ep_get_callback(BYTE txStatus, BYTE rxStatus, ZW_APPLICATION_TX_BUFFER *pCmd,
     n_end_points = pCmd->ZW_MultiChannelEndPointReportV4Frame.properties2
         & 0x7f;
 
-    identical_endpoints = pCmd->ZW_MultiChannelEndPointReportV4Frame.properties1 & 0x40;
+    if (s)
+    {
+      s->identical_endpoints = pCmd->ZW_MultiChannelEndPointReportV4Frame.properties1 & 0x40;
+    }
     if(cmdLength >=5) {
       n_aggregated_endpoints = pCmd->ZW_MultiChannelEndPointReportV4Frame.properties3 & 0x7f;
       n_end_points+=n_aggregated_endpoints;
@@ -736,12 +1003,162 @@ static int rd_ep_zwave_plus_info_callback(BYTE txStatus, BYTE rxStatus,
 
 static void rd_ep_probe_cc_version_callback(void *user, uint8_t status_code) {
   rd_ep_database_entry_t *ep = (rd_ep_database_entry_t*)user;
-  if(status_code != 0)
+  if(status_code != 0) {
     WRN_PRINTF("Version probing is not completedly done.\n");
+    ep->node->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+  }
   ep->state = EP_STATE_PROBE_ZWAVE_PLUS;
   rd_ep_probe_update(ep);
 }
 
+/**
+ * Build the probe template key of a node, whose identity has been read
+ * during the current probe.
+ *
+ * \return false if the identity of the node is not known.
+ */
+static bool rd_probe_template_key_get(rd_node_database_entry_t* n,
+    rd_probe_template_key_t* key)
+{
+  rd_ep_database_entry_t* ep0 = list_head(n->endpoints);
+  const uint8_t identified = RD_TEMPLATE_FLAG_PRODUCT_ID | RD_TEMPLATE_FLAG_FIRMWARE;
+
+  if ((n->template_flags & identified) != identified || !ep0 || !ep0->endpoint_info)
+  {
+    return false;
+  }
+  key->manufacturerID = n->manufacturerID;
+  key->productType = n->productType;
+  key->productID = n->productID;
+  key->firmware_version = n->firmware_version;
+  key->security_flags = n->security_flags & NODE_FLAGS_SECURITY;
+  key->nif_crc = crc16_data(ep0->endpoint_info, ep0->endpoint_info_len, 0);
+  return true;
+}
+
+static void rd_ep_probe_identity(rd_ep_database_entry_t* ep);
+
+static int
+rd_identity_vendor_callback(BYTE txStatus, BYTE rxStatus,
+    ZW_APPLICATION_TX_BUFFER *pCmd, WORD cmdLength, void* user)
+{
+  rd_ep_database_entry_t* ep = (rd_ep_database_entry_t*) user;
+  rd_node_database_entry_t* n = ep->node;
+
+  if (ep->state != EP_STATE_PROBE_VERSION)
+  {
+    return 0;
+  }
+  if (txStatus == TRANSMIT_COMPLETE_OK)
+  {
+    n->manufacturerID = pCmd->ZW_ManufacturerSpecificReportFrame.manufacturerId1
+        << 8 | pCmd->ZW_ManufacturerSpecificReportFrame.manufacturerId2;
+    n->productID = pCmd->ZW_ManufacturerSpecificReportFrame.productId1 << 8
+        | pCmd->ZW_ManufacturerSpecificReportFrame.productId2;
+    n->productType = pCmd->ZW_ManufacturerSpecificReportFrame.productTypeId1
+        << 8 | pCmd->ZW_ManufacturerSpecificReportFrame.productTypeId2;
+    n->template_flags |= RD_TEMPLATE_FLAG_PRODUCT_ID;
+  }
+  else
+  {
+    /* STATUS_PROBE_PRODUCT_ID will try again. */
+    n->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+  }
+  rd_ep_probe_identity(ep);
+  return 0;
+}
+
+static int
+rd_identity_version_callback(BYTE txStatus, BYTE rxStatus,
+    ZW_APPLICATION_TX_BUFFER *pCmd, WORD cmdLength, void* user)
+{
+  rd_ep_database_entry_t* ep = (rd_ep_database_entry_t*) user;
+  rd_node_database_entry_t* n = ep->node;
+
+  if (ep->state != EP_STATE_PROBE_VERSION)
+  {
+    return 0;
+  }
+  if (txStatus == TRANSMIT_COMPLETE_OK)
+  {
+    n->firmware_version = pCmd->ZW_VersionReportFrame.applicationVersion << 8
+        | pCmd->ZW_VersionReportFrame.applicationSubVersion;
+    n->template_flags |= RD_TEMPLATE_FLAG_FIRMWARE;
+  }
+  else
+  {
+    n->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+  }
+  rd_ep_probe_identity(ep);
+  return 0;
+}
+
+/**
+ * Read the manufacturer info and firmware version of the root device
+ * before its version probe.  If a probe template is stored for this
+ * model, the command class versions are filled in from it and the
+ * version probe has nothing left to ask for.
+ *
+ * Since the manufacturer info is read here, it is not read again in
+ * #STATUS_PROBE_PRODUCT_ID.
+ */
+static void rd_ep_probe_identity(rd_ep_database_entry_t* ep)
+{
+  const uint8_t manufacturer_specific_get[] = {COMMAND_CLASS_MANUFACTURER_SPECIFIC, MANUFACTURER_SPECIFIC_GET};
+  const uint8_t version_get[] = {COMMAND_CLASS_VERSION, VERSION_GET};
+  rd_node_database_entry_t* n = ep->node;
+  rd_probe_template_key_t key;
+  ts_param_t p;
+
+  if (n->template_flags & RD_TEMPLATE_FLAG_INVALID)
+  {
+    goto probe_versions;
+  }
+
+  if (!(n->template_flags & RD_TEMPLATE_FLAG_PRODUCT_ID))
+  {
+    if ((SupportsCmdClassFlags(n->nodeid, COMMAND_CLASS_MANUFACTURER_SPECIFIC) & SUPPORTED) == 0
+        || (SupportsCmdClassFlags(n->nodeid, COMMAND_CLASS_VERSION) & SUPPORTED) == 0)
+    {
+      n->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+      goto probe_versions;
+    }
+    ts_set_std(&p, n->nodeid);
+    p.scheme = SupportsCmdClassSecure(n->nodeid, COMMAND_CLASS_MANUFACTURER_SPECIFIC) ? AUTO_SCHEME : NO_SCHEME;
+    if (!ZW_SendRequest(&p, manufacturer_specific_get, sizeof(manufacturer_specific_get),
+        MANUFACTURER_SPECIFIC_REPORT, REQUEST_TIMEOUT, ep, rd_identity_vendor_callback))
+    {
+      n->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+      goto probe_versions;
+    }
+    return;
+  }
+
+  if (!(n->template_flags & RD_TEMPLATE_FLAG_FIRMWARE))
+  {
+    ts_set_std(&p, n->nodeid);
+    p.scheme = SupportsCmdClassSecure(n->nodeid, COMMAND_CLASS_VERSION) ? AUTO_SCHEME : NO_SCHEME;
+    if (!ZW_SendRequest(&p, version_get, sizeof(version_get),
+        VERSION_REPORT, REQUEST_TIMEOUT, ep, rd_identity_version_callback))
+    {
+      n->template_flags |= RD_TEMPLATE_FLAG_INVALID;
+      goto probe_versions;
+    }
+    return;
+  }
+
+  if (rd_probe_template_key_get(n, &key) && rd_data_store_probe_template_read(&key, n))
+  {
+    LOG_PRINTF("Using probe template of %04x:%04x:%04x firmware %u.%u for node %d\n",
+               key.manufacturerID, key.productType, key.productID,
+               key.firmware_version >> 8, key.firmware_version & 0xff, n->nodeid);
+    n->template_flags |= RD_TEMPLATE_FLAG_APPLIED;
+  }
+
+probe_versions:
+  rd_ep_probe_cc_version(ep, rd_ep_probe_cc_version_callback);
+}
+
 static int
 rd_ep_secure_commands_get_callback(BYTE txStatus, BYTE rxStatus,
     ZW_APPLICATION_TX_BUFFER *pCmd, WORD cmdLength, void* user)
@@ -788,6 +1205,7 @@ rd_ep_secure_commands_get_callback(BYTE txStatus, BYTE rxStatus,
         DBG_PRINTF("Clearing flag 0x%02x\n", flag);
      }
      ep->node->security_flags &= ~flag;
+     rd_node_security_flags_update(ep->node);
   }
 
   //LOG_PRINTF("%s",__FUNCTION__);
@@ -820,6 +1238,7 @@ rd_ep_secure_commands_get_callback(BYTE txStatus, BYTE rxStatus,
     if (ep->endpoint_id == 0) {
         DBG_PRINTF("Setting flag 0x%02x\n", flag);
         ep->node->security_flags |= flag;
+        rd_node_security_flags_update(ep->node);
     }
   }
   if (ep->endpoint_id > 0 || (ep->endpoint_id == 0 && ep->state == EP_STATE_PROBE_SEC0_INFO)) {
@@ -839,22 +1258,6 @@ rd_ep_secure_commands_get_callback(BYTE txStatus, BYTE rxStatus,
   return 0;
 }
 
-/*Used when a get node info is pending */
-static rd_ep_database_entry_t* nif_request_ep = 0;
-
-/** The node currently being probed (pan side or mdns).
- *
- * Used to determine if the probe machine is busy.  I.e., it should
- * not be cleared before all nodes are in one of the terminal states.
- *
- * Used by assign return route, node_info_request_timeout(),
- * rd_endpoint_name_probe_done() to determine which node the callback
- * concerns.  I.e., a node must not be removed (rd_remove_node())
- * while these operations are in progress.
- *
- */
-static rd_node_database_entry_t* current_probe_entry = 0;
-
 /*IN  Node id of the node that send node info */
 /*IN  Pointer to Application Node information */
 /*IN  Node info length                        */
@@ -865,6 +1268,7 @@ void rd_nif_request_notify(uint8_t bStatus, nodeid_t bNodeID, uint8_t* nif, uint
   {
     nif_request_ep = 0;
     ctimer_stop(&nif_request_timer);
+    rd_probe_kick();
 
     ASSERT(ep->node);
     if (bStatus && ep->node->nodeid == bNodeID)
@@ -895,6 +1299,7 @@ void rd_nif_request_notify(uint8_t bStatus, nodeid_t bNodeID, uint8_t* nif, uint
            if (!rd_ep_supports_cmd_class_nonsec(ep, COMMAND_CLASS_SECURITY)) {
               ep->node->security_flags &= ~NODE_FLAG_SECURITY0;
            }
+           rd_node_security_flags_update(ep->node);
         }
         if(ep->endpoint_id == 0) {
           /* The version knowledge GW has is related to which set of command class
@@ -925,30 +1330,37 @@ void rd_nif_request_notify(uint8_t bStatus, nodeid_t bNodeID, uint8_t* nif, uint
 void
 AssignReturnRouteCallback(uint8_t status)
 {
-  if (current_probe_entry)
+  rd_node_database_entry_t* n = return_route_node;
+
+  return_route_node = 0;
+  rd_probe_kick();
+
+  /* The node may have been removed while the route was assigned */
+  if (rd_probe_slot_get(n))
   {
     if (status != TRANSMIT_COMPLETE_OK)
     {
       ERR_PRINTF("AssignReturnRouteCallback: assign return route fail\n");
     }
-    current_probe_entry->state = STATUS_PROBE_WAKE_UP_INTERVAL;
-    rd_node_probe_update(current_probe_entry);
+    n->state = STATUS_PROBE_WAKE_UP_INTERVAL;
+    rd_node_probe_update(n);
   }
   else
   {
-    ASSERT(0);
+    WRN_PRINTF("AssignReturnRouteCallback: node is no longer probed\n");
   }
 }
 
 static void
 node_info_request_timeout(void* d)
 {
-  if(!current_probe_entry) return;
-
   rd_ep_database_entry_t* ep = (rd_ep_database_entry_t*) d;
 
-  ep->state = EP_STATE_PROBE_FAIL;
   nif_request_ep = 0;
+  rd_probe_kick();
+  if(!rd_probe_slot_get(ep->node)) return;
+
+  ep->state = EP_STATE_PROBE_FAIL;
   rd_ep_probe_update(ep);
 }
 
@@ -958,11 +1370,19 @@ rd_endpoint_name_probe_done(int bStatus, void* ctx)
   char buf[64];
   int timer_value = 0;
   rd_ep_database_entry_t *ep = (rd_ep_database_entry_t*) ctx;
+  rd_probe_slot_t* s;
   u8_t k;
   ASSERT(ep);
-  if(!current_probe_entry) return;
   if(!ep) return;
 
+  if (mdns_probe_node && mdns_probe_node == ep->node)
+  {
+    mdns_probe_node = 0;
+    rd_probe_kick();
+  }
+  s = rd_probe_slot_get(ep->node);
+  if(!s) return;
+
   if (ep->state == EP_STATE_MDNS_PROBE_IN_PROGRESS)
   {
     if (bStatus)
@@ -990,7 +1410,7 @@ rd_endpoint_name_probe_done(int bStatus, void* ctx)
 
     if (timer_value) {
         ep->state = EP_STATE_MDNS_PROBE;
-        ctimer_set(&ep_probe_update_timer, timer_value, (void (*)(void *)) rd_ep_probe_update, ep);
+        ctimer_set(&s->ep_timer, timer_value, (void (*)(void *)) rd_ep_probe_update, ep);
         timer_value = 0;
         denied_conflict_probes++;
     } else {
@@ -1021,15 +1441,16 @@ rd_ep_probe_update(rd_ep_database_entry_t* ep)
   const uint8_t secure_commands_supported_get2[] = {COMMAND_CLASS_SECURITY_2,SECURITY_2_COMMANDS_SUPPORTED_GET};
   ts_param_t p;
 
-  ASSERT(current_probe_entry);
-  if(!current_probe_entry) return;
-
   static ZW_MULTI_CHANNEL_CAPABILITY_GET_V2_FRAME cap_get_frame =
     { COMMAND_CLASS_MULTI_CHANNEL_V2, MULTI_CHANNEL_CAPABILITY_GET_V2, 0 };
 
   if(ep->node == 0) {
     return;
   }
+  if (!rd_probe_slot_get(ep->node)) {
+    DBG_PRINTF("Node %u is not being probed\n", ep->node->nodeid);
+    return;
+  }
   DBG_PRINTF("EP probe nd=%i (flags 0x%02x) ep =%d state=%s\n",
              ep->node->nodeid, ep->node->security_flags,
              ep->endpoint_id, ep_state_name(ep->state));
@@ -1139,10 +1560,14 @@ rd_ep_probe_update(rd_ep_database_entry_t* ep)
         }
         else
         { /* ep->node->nodeid == MyNodeID */
-          //ASSERT(nif_request_ep == 0);
-          /*This might just be a session resume */
           if (nif_request_ep)
           {
+            /* Wait for the node info request of another probe to complete.
+             * If it is our own, this is just a session resume. */
+            if (nif_request_ep != ep)
+            {
+              rd_probe_wait(ep->node, ep, RD_PROBE_WAIT_NIF);
+            }
             return;
           }
 
@@ -1159,6 +1584,7 @@ rd_ep_probe_update(rd_ep_database_entry_t* ep)
           else
           {
             nif_request_ep = 0;
+            rd_probe_kick();
             ERR_PRINTF("Nodeinfo fail\n");
             goto fail_state;
             return;
@@ -1320,7 +1746,14 @@ rd_ep_probe_update(rd_ep_database_entry_t* ep)
 
       break;
     case EP_STATE_PROBE_VERSION:
-      rd_ep_probe_cc_version(ep, rd_ep_probe_cc_version_callback);
+      if (ep->endpoint_id == 0 && ep->node->nodeid != MyNodeID)
+      {
+        rd_ep_probe_identity(ep);
+      }
+      else
+      {
+        rd_ep_probe_cc_version(ep, rd_ep_probe_cc_version_callback);
+      }
       return;
       break;
     case EP_STATE_PROBE_ZWAVE_PLUS:
@@ -1341,9 +1774,17 @@ rd_ep_probe_update(rd_ep_database_entry_t* ep)
       }
       break;
     case EP_STATE_MDNS_PROBE:
+      if (mdns_probe_node && mdns_probe_node != ep->node)
+      {
+        rd_probe_wait(ep->node, ep, RD_PROBE_WAIT_MDNS);
+        return;
+      }
+      mdns_probe_node = ep->node;
       ep->state = EP_STATE_MDNS_PROBE_IN_PROGRESS;
       if (!mdns_endpoint_name_probe(ep, rd_endpoint_name_probe_done, ep))
       {
+        mdns_probe_node = 0;
+        rd_probe_kick();
         goto next_state;
       }
       break;
@@ -1474,35 +1915,52 @@ exit:
     return;
 }
 
-void rd_probe_resume()
+/**
+ * Start probing the nodes which are not in one of the final states, as long
+ * as there are free probe slots.
+ *
+ * Post #ZIP_EVENT_ALL_NODES_PROBED when all nodes are in a final state and the
+ * probe machine is unlocked.
+ */
+static void rd_probe_start_next(void)
 {
+  static uint8_t running = 0;
+  static uint8_t again = 0;
   nodeid_t i;
   rd_node_database_entry_t* nd;
 
-  if (current_probe_entry)
+  /* A probe started here may complete right away and call this again. */
+  if (running)
   {
-     DBG_PRINTF("Resume probe of %u\n", current_probe_entry->nodeid);
-    rd_node_probe_update(current_probe_entry);
+    again = 1;
     return;
   }
+  running = 1;
 
-  for (i = 1; i <= ZW_MAX_NODES; i++)
+  do
   {
-    nd = rd_node_get_raw(i);
-    if (nd
-        && (nd->state != STATUS_DONE && nd->state != STATUS_PROBE_FAIL
-            && nd->state != STATUS_FAILING))
+    again = 0;
+    for (i = 1; i <= ZW_MAX_NODES; i++)
     {
-      current_probe_entry = nd;
-      rd_node_probe_update(nd);
-      break;
+      nd = rd_node_get_raw(i);
+      if (nd
+          && (nd->state != STATUS_DONE && nd->state != STATUS_PROBE_FAIL
+              && nd->state != STATUS_FAILING)
+          && !rd_probe_slot_get(nd))
+      {
+        if (!rd_probe_slot_claim(nd))
+        {
+          continue;
+        }
+        rd_node_probe_update(nd);
+      }
     }
-  }
+  } while (again);
 
-  if ((i == (ZW_MAX_NODES+1)) && (probe_lock==0))
-  {
-    rd_node_database_entry_t* nd;
+  running = 0;
 
+  if (!rd_probe_in_progress() && (probe_lock==0))
+  {
     if (suc_changed) {
       suc_changed = 0;
       DBG_PRINTF("Suc changed, Sending new SUC Id to network \n");
@@ -1513,16 +1971,45 @@ void rd_probe_resume()
   }
 }
 
+void rd_probe_resume()
+{
+  rd_node_database_entry_t* in_progress[RD_MAX_PARALLEL_PROBES];
+  uint8_t i;
+
+  /* Resuming one probe may complete it and start others, so take a copy
+   * of the probes to resume first. */
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    in_progress[i] = probe_slots[i].node;
+  }
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    if (in_progress[i] && rd_probe_slot_get(in_progress[i]))
+    {
+      DBG_PRINTF("Resume probe of %u\n", in_progress[i]->nodeid);
+      rd_node_probe_update(in_progress[i]);
+    }
+  }
+
+  rd_probe_start_next();
+}
+
 static void
 rd_node_name_probe_done(int bStatus, void* ctx)
 {
   char buf[255];
   rd_node_database_entry_t *n = (rd_node_database_entry_t*) ctx;
+  rd_probe_slot_t* s;
   u8_t k;
   ASSERT(n);
   int timer_value = 0;
 
   DBG_PRINTF("rd_node_name_probe_done status: %d\n", bStatus);
+  if (mdns_probe_node == n)
+  {
+    mdns_probe_node = 0;
+    rd_probe_kick();
+  }
   if (n->state == STATUS_MDNS_PROBE)
   {
     if (bStatus)
@@ -1567,8 +2054,9 @@ rd_node_name_probe_done(int bStatus, void* ctx)
       DBG_PRINTF("Delaying rd_node_probe_update by %d ms\n", timer_value);
     }
 exit:
-    if (timer_value) {
-     ctimer_set(&rd_node_probe_update_timer, timer_value, (void (*)(void *)) rd_node_probe_update, n);
+    s = rd_probe_slot_get(n);
+    if (timer_value && s) {
+     ctimer_set(&s->node_timer, timer_value, (void (*)(void *)) rd_node_probe_update, n);
      timer_value = 0;
      denied_conflict_probes++;
     } else {
@@ -1599,20 +2087,32 @@ void rd_probe_lock(uint8_t enable)
  * probed because it is a self-destructing smart start node, this
  * function resets the probe lock.
  *
- * When removal of the node succeeds, \ref current_probe_entry will be
- * reset when the node is deleted.  We also clear \ref
- * current_probe_entry here so that this function can be used in the
- * "removal failed" scenarios.
+ * When removal of the node succeeds, its probe is stopped when the
+ * node is deleted.  We also stop the probes in progress here so that
+ * this function can be used in the "removal failed" scenarios.
  */
 void rd_probe_cancel(void) {
+   uint8_t i;
+
    probe_lock = FALSE;
-   current_probe_entry = NULL;
+   for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++) {
+      rd_probe_slot_release(probe_slots[i].node);
+   }
 }
 
 u8_t
 rd_probe_in_progress()
 {
-  return (current_probe_entry != 0);
+  uint8_t i;
+
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++)
+  {
+    if (probe_slots[i].node)
+    {
+      return 1;
+    }
+  }
+  return 0;
 }
 
 u8_t rd_node_in_probe(nodeid_t node)
@@ -1668,6 +2168,7 @@ void
 rd_node_probe_update(rd_node_database_entry_t* n)
 {
   rd_ep_database_entry_t* ep;
+  rd_probe_slot_t* slot = NULL;
   ts_param_t p;
 
   static const ZW_MANUFACTURER_SPECIFIC_GET_FRAME man_spec_get =
@@ -1712,6 +2213,18 @@ rd_node_probe_update(rd_node_database_entry_t* n)
     ASSERT(0);
     return;
   }
+  if (n->state != STATUS_DONE && n->state != STATUS_PROBE_FAIL
+      && n->state != STATUS_FAILING)
+  {
+    slot = rd_probe_slot_claim(n);
+    if (!slot)
+    {
+      DBG_PRINTF("%u probes in progress, node %u is waiting\n",
+                 rd_max_parallel_probes(), n->nodeid);
+      return;
+    }
+  }
+
   DBG_PRINTF("rd_node_probe_update state %s node =%d\n", rd_node_probe_state_name(n->state), n->nodeid);
   switch (n->state)
   {
@@ -1719,13 +2232,9 @@ rd_node_probe_update(rd_node_database_entry_t* n)
      update_protocol_info(n); //We do this here because the security layer needs to know if this is node is a controller
      break;*/
     case STATUS_CREATED:
-      if (current_probe_entry && current_probe_entry != n)
-      {
-        DBG_PRINTF("another probe is in progress waiting\n");
-        return;
-      }
-      current_probe_entry = n;
       n->probe_flags = RD_NODE_FLAG_PROBE_STARTED;
+      n->template_flags = 0;
+      n->firmware_version = 0;
       goto next_state;
       break;
     case STATUS_PROBE_NODE_INFO:
@@ -1735,8 +2244,8 @@ rd_node_probe_update(rd_node_database_entry_t* n)
       if (!ep)
       { // Abort the probe the node might have been removed
          DBG_PRINTF("Abort probe\n");
-        current_probe_entry = NULL;
-        rd_probe_resume();
+        rd_probe_slot_release(n);
+        rd_probe_start_next();
         return;
       }
 
@@ -1770,6 +2279,11 @@ rd_node_probe_update(rd_node_database_entry_t* n)
       break;
     case STATUS_PROBE_PRODUCT_ID:
 
+      if (n->template_flags & RD_TEMPLATE_FLAG_PRODUCT_ID) {
+        /* Already read before the version probe */
+        goto next_state;
+      }
+
       if(n->nodeid == MyNodeID) {
         n->productID = cfg.product_id;
         n->manufacturerID = cfg.manufacturer_id;
@@ -1845,10 +2359,10 @@ rd_node_probe_update(rd_node_database_entry_t* n)
           rd_ep_probe_update(ep);
           return;
         }
-        if (identical_endpoints && (ep->node->nodeid != MyNodeID) && (ep->endpoint_id > 0)) {
+        if (slot->identical_endpoints && (ep->node->nodeid != MyNodeID) && (ep->endpoint_id > 0)) {
             DBG_PRINTF("Endpoints are identical. Not probing more endpoints\n");
             copy_endpoints(ep, n); // We still need to fill ep structure for all endpoints
-            identical_endpoints = 0;
+            slot->identical_endpoints = 0;
             goto next_state;
         }
       }
@@ -1947,8 +2461,21 @@ rd_node_probe_update(rd_node_database_entry_t* n)
           }
       break;
     case STATUS_ASSIGN_RETURN_ROUTE:
+      if (return_route_node)
+      {
+        /* The callback of ZW_AssignReturnRoute() does not tell which node
+         * it concerns, so only one route is assigned at a time. */
+        if (return_route_node != n)
+        {
+          rd_probe_wait(n, NULL, RD_PROBE_WAIT_RETURN_ROUTE);
+        }
+        return;
+      }
+      return_route_node = n;
       if (!ZW_AssignReturnRoute(n->nodeid, MyNodeID, AssignReturnRouteCallback))
       {
+        return_route_node = 0;
+        rd_probe_kick();
         goto fail_state;
       }
       break;
@@ -1962,8 +2489,16 @@ rd_node_probe_update(rd_node_database_entry_t* n)
       }
       break;
     case STATUS_MDNS_PROBE:
+      if (mdns_probe_node && mdns_probe_node != n)
+      {
+        rd_probe_wait(n, NULL, RD_PROBE_WAIT_MDNS);
+        return;
+      }
+      mdns_probe_node = n;
       if (!mdns_node_name_probe(n, rd_node_name_probe_done, n))
       {
+        mdns_probe_node = 0;
+        rd_probe_kick();
         goto next_state;
       }
       break;
@@ -1989,6 +2524,16 @@ rd_node_probe_update(rd_node_database_entry_t* n)
       n->lastAwake = clock_seconds();
       n->node_properties_flags &= ~RD_NODE_FLAG_JUST_ADDED;
       n->probe_flags = RD_NODE_FLAG_PROBE_HAS_COMPLETED;
+      if (!(n->template_flags & (RD_TEMPLATE_FLAG_APPLIED | RD_TEMPLATE_FLAG_INVALID)))
+      {
+        rd_probe_template_key_t key;
+
+        if (rd_probe_template_key_get(n, &key))
+        {
+          DBG_PRINTF("Storing probe template of node %d\n", n->nodeid);
+          rd_data_store_probe_template_write(&key, n);
+        }
+      }
       goto probe_complete;
       break;
     case STATUS_PROBE_FAIL:
@@ -2011,7 +2556,7 @@ rd_node_probe_update(rd_node_database_entry_t* n)
   /* Store all node data in persistent memory */
   rd_data_store_nvm_free(n);
   rd_data_store_nvm_write(n);
-  current_probe_entry = NULL;
+  rd_probe_slot_release(n);
 
   /*Send out notification for all endpoints */
   for (ep = list_head(n->endpoints); ep != NULL; ep = list_item_next(ep))
@@ -2025,7 +2570,7 @@ rd_node_probe_update(rd_node_database_entry_t* n)
   /* Trigger probe done event */
   process_post(&zip_process, ZIP_EVENT_NODE_PROBED, (void*)n);
 
-  rd_probe_resume();
+  rd_probe_start_next();
 }
 
 static void rd_reset_probe_completed_notifier(void) {
@@ -2117,11 +2662,9 @@ void rd_register_new_node(nodeid_t node, uint8_t node_properties_flags)
     n->state = STATUS_PROBE_FAIL;
     rd_node_probe_update(n);
   } else {
-    /* Since status is CREATED, this node will be set as
-     * current_probe_entry if there is not already a current.  This
-     * ensures that if the probe machine is currently locked, it will
-     * resume probing as soon as it is unlocked and eventually get to
-     * this node.  */
+    /* Since status is CREATED, this node will get a probe slot if
+     * there is a free one.  Otherwise, the probe machine will get to
+     * this node when one of the probes in progress completes.  */
     rd_node_probe_update(n);
   }
 }
@@ -2133,7 +2676,7 @@ void rd_exit()
   nodeid_t i;
 
   ctimer_stop(&dead_node_timer);
-  ctimer_stop(&nif_request_timer);
+  rd_probe_slots_reset();
 
   for (i = 1; i <= ZW_MAX_NODES; i++)
   {
@@ -2157,6 +2700,7 @@ rd_remove_node(nodeid_t node)
   rd_ep_database_entry_t *ep;
 
   ZW_Abort_SendRequest(node);
+  zw_node_latency_reset(node);
   if (node == 0)
     return;
   n = rd_node_get_raw(node);
@@ -2166,9 +2710,7 @@ rd_remove_node(nodeid_t node)
   /*
    * Abort probe if we have one in progress.
    */
-  if(current_probe_entry == n) {
-    current_probe_entry = 0;
-  }
+  rd_probe_slot_release(n);
 
   DBG_PRINTF("Removing node %i %p\n", node, n);
 
@@ -2217,11 +2759,14 @@ int rd_init(uint8_t lock)
   /* Make sure the virtual node mask is up to date */
   copy_virtual_nodes_mask_from_controller();
 
-  nif_request_ep = 0;
-  if (rd_probe_in_progress()) {
-     ERR_PRINTF("RD re-initialized while probing node %u\n", current_probe_entry->nodeid);
+  for (i = 0; i < RD_MAX_PARALLEL_PROBES; i++) {
+     if (probe_slots[i].node) {
+        ERR_PRINTF("RD re-initialized while probing node %u\n", probe_slots[i].node->nodeid);
+     }
   }
-  current_probe_entry = 0;
+  rd_probe_slots_reset();
+  zgw_metrics_register(&probe_ms.m);
+  return_route_node = 0;
   probe_lock = lock;
 
   SerialAPI_GetInitData(&ver, &capabilities, &len, nodelist, &chip_type,
@@ -2317,6 +2862,7 @@ void
 rd_full_network_discovery()
 {
   nodemask_t nodelist = {0};
+  nodemask_t removed;
   uint8_t ver, capabilities, len, chip_type, chip_data;
   nodeid_t i;
   uint16_t lr_nodelist_len = 0;
@@ -2327,16 +2873,29 @@ rd_full_network_discovery()
       &chip_data);
   SerialAPI_GetLRNodeList(&lr_nodelist_len, NODEMASK_GET_LR(nodelist));
 
-  for (i = 1; i <= ZW_LR_MAX_NODE_ID_IN_NVM; i++)
+  /* Nodes which we know of, but which have left the network */
+  nodemask_andnot(removed, rd_node_nodemask(), nodelist);
+  nodemask_for_each_node(i, removed)
   {
-    if (nodemask_test_node(i, nodelist))
-    {
-      rd_register_new_node(i, 0x00);
-    }
-    else
-    {
-      rd_remove_node(i);
-    }
+    rd_remove_node(i);
+  }
+  nodemask_for_each_node(i, nodelist)
+  {
+    rd_register_new_node(i, 0x00);
+  }
+}
+
+void
+rd_new_nodes(nodemask_t new_nodes, const nodemask_t nodelist)
+{
+  nodeid_t i;
+
+  nodemask_andnot(new_nodes, nodelist, rd_node_nodemask());
+  nodemask_andnot(new_nodes, new_nodes, virtual_nodes_mask);
+  /* The LR virtual nodes are not in virtual_nodes_mask. Their ids are
+   * above ZW_LR_MAX_NODE_ID, so clear their bits directly. */
+  for (i = LR_VIRTUAL_NODE_FIRST; i <= LR_VIRTUAL_NODE_LAST; i++) {
+    NODEMASK_REMOVE_NODE(i, new_nodes);
   }
 }
 
@@ -2344,6 +2903,7 @@ u8_t
 rd_probe_new_nodes()
 {
   nodemask_t nodelist = {0};
+  nodemask_t new_nodes;
   uint8_t ver, capabilities, len, chip_type, chip_data;
   nodeid_t i, k;
   uint16_t lr_nodelist_len = 0;
@@ -2353,14 +2913,12 @@ rd_probe_new_nodes()
   SerialAPI_GetInitData(&ver, &capabilities, &len, nodelist, &chip_type,
       &chip_data);
   SerialAPI_GetLRNodeList(&lr_nodelist_len, NODEMASK_GET_LR(nodelist));
+  rd_new_nodes(new_nodes, nodelist);
   k = 0;
-  for (i = 1; i <= ZW_LR_MAX_NODE_ID_IN_NVM; i++)
+  nodemask_for_each_node(i, new_nodes)
   {
-    if (nodemask_test_node(i, nodelist) && !rd_node_exists(i) && !is_virtual_node(i))
-    {
-      rd_register_new_node(i, 0x00);
-      k++;
-    }
+    rd_register_new_node(i, 0x00);
+    k++;
   }
   return k;
 }
@@ -2511,12 +3069,12 @@ rd_update_ep_name_and_location(rd_ep_database_entry_t* ep, char* name,
   ep->node->state = STATUS_MDNS_EP_PROBE;
   DBG_PRINTF("Setting cache-flush bit as its new name\n");
   dont_set_cache_flush_bit = 1;
-  if (current_probe_entry == NULL) {
-     current_probe_entry=ep->node;
+  if (!rd_probe_slot_get(ep->node) && rd_probe_slot_claim(ep->node)) {
      rd_node_probe_update(ep->node);
   }
-  /* If there is a current probe entry, the probe machine will
-   * eventually get around to this node, as well. */
+  /* If the node is already being probed, or all probe slots are in
+   * use, the probe machine will eventually get around to this node,
+   * as well. */
 }
 
 void
@@ -2724,6 +3282,7 @@ SetCacheEntryFlagMasked(nodeid_t nodeid, BYTE value, BYTE mask)
   if (n)
   {
     n->security_flags = (n->security_flags & (~mask)) | value;
+    rd_node_security_flags_update(n);
     rd_data_store_update(n);
 
     rd_free_node_dbe(n);
@@ -177,10 +177,9 @@ void rd_probe_lock(uint8_t enable);
  * probed because it is a self-destructing smart start node, this
  * function resets the probe lock.
  *
- * When removal of the node succeeds, \ref current_probe_entry will be
- * reset when the node is deleted.  We also clear \ref
- * current_probe_entry here so that this function can be used in the
- * "removal failed" scenarios.
+ * When removal of the node succeeds, its probe is stopped when the
+ * node is deleted.  We also stop the probes in progress here so that
+ * this function can be used in the "removal failed" scenarios.
  */
 void rd_probe_cancel(void);
 
@@ -275,6 +274,28 @@ void rd_free_node_dbe(rd_node_database_entry_t* n);
  */
 u8_t rd_node_exists(nodeid_t node);
 
+/**
+ * Get the nodes which are registered in \ref node_db.
+ *
+ * \ingroup node_db
+ *
+ * @return A \ref nodemask_t owned by the resource directory.
+ */
+const uint8_t* rd_node_nodemask(void);
+
+/**
+ * Get the nodes of a node list which are not registered in \ref node_db.
+ *
+ * \ingroup node_db
+ *
+ * Virtual nodes, including the Long Range virtual nodes, are not new
+ * nodes.
+ *
+ * @param[out] new_nodes The new nodes.
+ * @param[in] nodelist Node list of the controller.
+ */
+void rd_new_nodes(nodemask_t new_nodes, const nodemask_t nodelist);
+
 /**
  * Get an endpoint entry in the \ref node_db from nodeid and epid.
  *
@@ -364,29 +385,30 @@ void rd_mark_node_deleted(nodeid_t nodeid);
 /**
  * Check node database to see if there are any more nodes to probe.
  *
- * If a probe is already ongoing (#current_probe_entry is not NULL), resume that probe.
+ * Resume the probes that are already ongoing.
  *
  * Then probe all nodes not in one of the final states: #STATUS_DONE,
- * #STATUS_PROBE_FAIL, or #STATUS_FAILING.
+ * #STATUS_PROBE_FAIL, or #STATUS_FAILING.  Up to ZipMaxParallelProbes
+ * nodes are probed in parallel.
  *
  * Post #ZIP_EVENT_ALL_NODES_PROBED when all nodes are in a final
  * state and the probe machine is unlocked.
  */
 void rd_probe_resume();
 
-/** Start probe of \a n or resume probe of #current_probe_entry.
+/** Start or resume probe of \a n.
  *
  * Do nothing if probe machine is locked, bridge is \ref booting, \ref
- * ZIP_MDNS is not running or another node probe is on/going.
+ * ZIP_MDNS is not running or the maximum number of node probes are
+ * on/going.
  *
- * Set #current_probe_entry to \a n if it is not set.
+ * Allocate a probe slot for \a n if it does not have one.
  *
  * When probe is complete, store node data in eeprom file, send out
  * mDNS notification for all endpoints, and trigger ep probe callback
  * if it exists.
  *
- * Finally call \ref rd_probe_resume(), to trigger probe of the next
- * node.
+ * Finally free the probe slot and trigger probe of the next node.
  *
  * \param n A node to probe.
  */
@@ -24,6 +24,7 @@
 
 #include "multicast_group_manager.h"
 #include "ZW_SendRequest.h"
+#include "zw_node_latency.h"
 #include "ZW_udp_server.h"
 #include "ZW_zip_classcmd.h"
 #include "ZW_SendDataAppl.h"
@@ -254,14 +255,19 @@ static void zgw_component_start(zgw_state_t comp) {
    zgw_state |= comp;
 }
 
+static void zip_router_backup_done(void) {
+   zgw_component_done(ZGW_BU, 0);
+}
+
 /* Something completed, check if we should do backup. */
 void zip_router_check_backup(void *data) {
    
    if (ZGW_COMPONENT_ACTIVE(ZGW_BU)) {
-      if (zgw_idle()) {
+      if (zgw_backup_in_progress()) {
+         /* Backup runs in the background and reports back when done */
+      } else if (zgw_idle()) {
          DBG_PRINTF("Backup can start now\n");
-         zgw_backup_now();
-         zgw_component_done(ZGW_BU, 0);
+         zgw_backup_now(zip_router_backup_done);
          /* Just let the timer run out, zip_process does nothing when BU
           * is not requested */
       } else {
@@ -281,7 +287,8 @@ bool zgw_component_idle(zgw_state_t comp) {
 }
 
 /* We can ignore running timers in mailbox (ping timer) and RD
- * (dead_nodes_worker), since the actual backing up is synchronous. */
+ * (dead_nodes_worker). The database backup restarts if the database is
+ * written, and the NVM read is retried if the NVM is written. */
 /* TODO: remove the debugging */
 bool zgw_idle() {
    if ((!zgw_initing)
@@ -381,8 +388,8 @@ ApplicationCommandHandlerZIP(ts_param_t *p, ZW_APPLICATION_TX_BUFFER *pCmd,
   if (cmdLength == 0)
     return;
 
-  LOG_PRINTF("ApplicationCommandHandler %d->%d [%s] \n",
-      (int )p->snode,(int)p->dnode, print_frame((const char *)pCmd, cmdLength));
+  LOG_PRINTF_FRAME(pCmd, cmdLength, "ApplicationCommandHandler %d->%d",
+      (int )p->snode,(int)p->dnode);
 
 
   ZW_FIRMWARE_UPDATE_MD_REQUEST_REPORT_V3_FRAME
@@ -1034,6 +1041,7 @@ ZIP_Router_Reset() CC_REENTRANT_ARG
 //  ClassicZIPNode_init();
   ZW_TransportService_Init(ApplicationCommandHandlerZIP);
   ZW_SendRequest_init();
+  zw_node_latency_init();
 
   /* init: at this point ZW_Send_* functions can be used */
   if (!data_store_init())
@@ -1644,6 +1652,7 @@ PROCESS_THREAD(zip_process, ev, data)
       } else if(ev == PROCESS_EVENT_EXIT) {
         LOG_PRINTF("Bye bye\n");
         zgw_component_start(ZGW_SHUTTING_DOWN);
+        mb_exit();
 #ifdef NO_ZW_NVM
         zw_appl_nvm_close();
 #endif
@@ -1734,6 +1743,7 @@ PROCESS_THREAD(zip_process, ev, data)
         /* Unpersist S2 SPAN table after ApplicationInitProtocols,
          * as that initialize Resource Directory, which holds the persisted S2 SPAN table*/
         sec2_unpersist_span_table();
+        sec2_span_presync_start();
 
         /* With this IPv6 ready it might be possible to for the NM
          * module to deliver the reply package after a Set default or
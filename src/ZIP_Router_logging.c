@@ -24,10 +24,14 @@ const char *print_frame(const char *cmd, unsigned int len)
       return lf; 
     }; 
 
-    int idx = 0;
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = print_frame_buf;
     for(int i = 0; i < len; i++) {
-        idx += snprintf(print_frame_buf + idx, 4, "%02X ", (uint8_t) cmd[i]);
+        *p++ = hex[(uint8_t) cmd[i] >> 4];
+        *p++ = hex[(uint8_t) cmd[i] & 0xF];
+        *p++ = ' ';
     }
+    *p = '\0';
     return print_frame_buf;
 }
 
@@ -57,12 +61,26 @@ void print_key(uint8_t *buf)
 void
 print_hex(uint8_t* buf, int len)
 {
+  static const char hex[] = "0123456789ABCDEF";
+  char line[2 * 64 + 2];
+  int n = 0;
   int i;
+
+  /* Print the bytes in a few pieces, not one by one */
   for (i = 0; i < len; i++)
   {
-    printf("%02X", buf[i]);
+    line[n++] = hex[buf[i] >> 4];
+    line[n++] = hex[buf[i] & 0xF];
+    if (n == sizeof(line) - 2)
+    {
+      line[n] = '\0';
+      printf("%s", line);
+      n = 0;
+    }
   }
-  printf("\n");
+  line[n++] = '\n';
+  line[n] = '\0';
+  printf("%s", line);
 }
 
 const char *ep_state_name(int state)
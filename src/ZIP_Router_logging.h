@@ -38,6 +38,25 @@
 #define WRN_PRINTF(f, ...) syslog(LOG_WARNING , f , ## __VA_ARGS__ )
 #define DBG_PRINTF(f, ...) syslog(LOG_DEBUG,  f , ## __VA_ARGS__ )
 
+#elif defined(ZGW_LOG_RING)
+#include <stdio.h>
+#include <stdint.h>
+#include "zgw_log_ring.h"
+
+/* The lines are timestamped and written by the log writer thread, see
+ * \ref zgw_log_ring. */
+#define LOG_PRINTF(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_LOG, f , ## __VA_ARGS__ );
+#define ERR_PRINTF(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_ERR, f , ## __VA_ARGS__ );
+#define WRN_PRINTF(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_WRN, f , ## __VA_ARGS__ );
+#define DBG_PRINTF(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_DBG, f , ## __VA_ARGS__ );
+
+/* The frame is formatted in hex by the log writer thread */
+#define LOG_PRINTF_FRAME(frame, len, f, ...) zgw_log_ring_frame(ZGW_LOG_RING_LOG, frame, len, f , ## __VA_ARGS__ );
+#define DBG_PRINTF_FRAME(frame, len, f, ...) zgw_log_ring_frame(ZGW_LOG_RING_DBG, frame, len, f , ## __VA_ARGS__ );
+
+/* Plain printf output goes through the ring too, so it stays in order with
+ * the log lines. */
+#define printf(f, ...) zgw_log_ring_printf(ZGW_LOG_RING_RAW, f , ## __VA_ARGS__ )
 
 #else
 #include <stdio.h>
@@ -87,6 +106,25 @@ struct timeval tv;
 #define DBG_PRINTF(f, ...) TIMESTAMP_PRINT("\033[34;1m%s ", f , ## __VA_ARGS__ );
 #endif
 
+#ifndef LOG_PRINTF_FRAME
+/**
+ * Information level logging of a line followed by a frame in hex, like
+ * "<line> [01 02 03]".
+ * \param frame the frame
+ * \param len length of the frame
+ * \param f argument similar to the one passed to printf, without line break
+ */
+#define LOG_PRINTF_FRAME(frame, len, f, ...) \
+  LOG_PRINTF(f " [%s]\n" , ## __VA_ARGS__ , print_frame((const char *)(frame), len))
+
+/**
+ * Debug level logging of a line followed by a frame in hex.
+ * \see LOG_PRINTF_FRAME
+ */
+#define DBG_PRINTF_FRAME(frame, len, f, ...) \
+  DBG_PRINTF(f " [%s]\n" , ## __VA_ARGS__ , print_frame((const char *)(frame), len))
+#endif
+
 /**
  * Check on the expression.
  */
@@ -114,35 +114,50 @@ typedef enum {
   DHCP_RECV_ACK,
   DHCP_RECV_NAK,
   DHCP_TIME_OUT,
-  DHCP_UDP_POLL,
 } dhcp_session_state_t;
 
 
+/** Number of DHCP sessions which are run at the same time */
+#define DHCPC_SESSIONS 8
+
+/**
+ * A DHCP exchange for one node. Replies are matched to the session by
+ * their XID.
+ */
+typedef struct dhcpc_session {
+  /** Node of the session, 0 if the session is not in use */
+  nodeid_t nodeid;
+  u32_t xid;
+  dhcp_session_state_t state;
+  u8_t send_pending; /* Send the message of the state at the next UDP poll */
+  u8_t session_timeout; /* When this reaches 0 the session times out */
+  u8_t retry;
+  /** Address offered by the server, or the address being renewed */
+  uip_ipaddr_t ipaddr;
+  /** Server which made the offer, the request goes to it */
+  u8_t serverid[4];
+  /* Options of the offer, applied when the ACK arrives */
+  uip_ipaddr_t netmask;
+  uip_ipaddr_t dnsaddr;
+  uip_ipaddr_t default_router;
+} dhcpc_session_t;
+
 typedef struct dhcpc_state {
   u32_t lease_time;
   u32_t ticks;
   u32_t timeout;
 
-
-
-  dhcp_session_state_t state;
   struct uip_udp_conn *conn;
   struct etimer timer;
-  u32_t xid;
-  u8_t last_renew; /* Indicates which session was last renewed, this will be set to 0 when we need to refresh all entries*/
-  u8_t session_timeout; /* When this reaches 0 the current session times out */
-  u8_t retry;
+  u16_t last_renew; /* Index of the next nat table entry to renew. This will be set to 0 when we need to refresh all entries*/
+  u32_t renew_interval; /* Average number of ticks between the start of two renewals */
+  u32_t renew_wait; /* Ticks until the next renewal may start */
+  u32_t renew_age; /* Ticks since the renewal of all entries was started */
   u8_t renew_failed; /*Did the renew fail? */
-  u8_t serverid[4];
+  u8_t serverid[4]; /* Server of the last ACK, renewals and releases go to it */
+  uip_ipaddr_t dnsaddr; /* DNS server of the lease of the gateway */
 
-  /*Thees apply for all sessions */
-  uip_ipaddr_t netmask;
-  uip_ipaddr_t dnsaddr;
-  uip_ipaddr_t default_router;
-  uip_ipaddr_t ipaddr;
-
-  /* The session we are handling at the moment */
-  nat_table_entry_t* session;
+  dhcpc_session_t sessions[DHCPC_SESSIONS];
 } dhcpc_state_t;
 
 dhcpc_state_t dhcpc_state = {0xFFFFFFFF, 0xFFFFFFFF};
@@ -150,7 +165,7 @@ dhcpc_state_t dhcpc_state = {0xFFFFFFFF, 0xFFFFFFFF};
 uip_ipv4addr_t uip_ipv4_net_broadcast_addr;
 
 /*Forward */
-void update_current_dhcp_session(dhcp_session_state_t s);
+static void update_dhcp_session(dhcpc_session_t *s, dhcp_session_state_t new_state);
 
 static const u8_t  magic_cookie[4] =
 { 99, 130, 83, 99 };
@@ -165,29 +180,29 @@ add_msg_type(u8_t *optptr, u8_t type)
 }
 /*---------------------------------------------------------------------------*/
 static u8_t *
-add_server_id(u8_t *optptr)
+add_server_id(u8_t *optptr, const u8_t *serverid)
 {
   *optptr++ = DHCP_OPTION_SERVER_ID;
   *optptr++ = 4;
-  memcpy(optptr, dhcpc_state.serverid, 4);
+  memcpy(optptr, serverid, 4);
   return optptr + 4;
 }
 /*---------------------------------------------------------------------------*/
 
 static u8_t *
-add_client_id(u8_t *optptr)
+add_client_id(u8_t *optptr, nodeid_t nodeid)
 {
   *optptr++ = DHCP_OPTION_CLIENT_ID;
   *optptr++ = 9; // Length field: 1 byte type + 2 byte node ID + 6 byte home ID
   *optptr++ = 0; //Other than ethernet
 
   /*Keep the Z/IP gateway for changing its lan addres when entering a new network as a secondary controller */
-  if(dhcpc_state.session->nodeid == MyNodeID) {
+  if(nodeid == MyNodeID) {
     *optptr++ =0x0;
     *optptr++ =0x0;
   } else {
-    *optptr++ = dhcpc_state.session->nodeid >> 8;
-    *optptr++ = dhcpc_state.session->nodeid & 0xff;
+    *optptr++ = nodeid >> 8;
+    *optptr++ = nodeid & 0xff;
   }
   memcpy(optptr, uip_lladdr.addr, 6);
   return optptr + 6;
@@ -195,11 +210,11 @@ add_client_id(u8_t *optptr)
 /*---------------------------------------------------------------------------*/
 
 static u8_t *
-add_req_ipaddr(u8_t *optptr)
+add_req_ipaddr(u8_t *optptr, const dhcpc_session_t *s)
 {
   *optptr++ = DHCP_OPTION_REQ_IPADDR;
   *optptr++ = 4;
-  memcpy(optptr, dhcpc_state.ipaddr.u16, 4);
+  memcpy(optptr, s->ipaddr.u16, 4);
   return optptr + 4;
 }
 /*---------------------------------------------------------------------------*/
@@ -221,21 +236,23 @@ add_end(u8_t *optptr)
   return optptr;
 }
 /*---------------------------------------------------------------------------*/
-static void create_msg(CC_REGISTER_ARG struct dhcp_msg *m)
+static void create_msg(CC_REGISTER_ARG struct dhcp_msg *m, nodeid_t nodeid, u32_t xid)
 {
+  nat_table_entry_t *e = ipv46nat_entry_of_node(nodeid);
+
   m->op = DHCP_REQUEST;
   m->htype = DHCP_HTYPE_ETHERNET;
   m->hlen = sizeof(uip_lladdr); //MAC address length
   m->hops = 0;
-  memcpy(m->xid, &dhcpc_state.xid, sizeof(m->xid));
+  memcpy(m->xid, &xid, sizeof(m->xid));
   m->secs = 0;
   m->flags = UIP_HTONS(BOOTP_BROADCAST); /*  Broadcast bit. */
 
   /*Assign client IP*/
-  if(dhcpc_state.session->ip_suffix== 0) {
+  if(e == 0 || e->ip_suffix== 0) {
     memset(m->ciaddr, 0, sizeof(m->ciaddr));
   } else {
-    ipv46nat_ipv4addr_of_entry( (uip_ipv4addr_t*)&m->ciaddr,dhcpc_state.session );
+    ipv46nat_ipv4addr_of_entry( (uip_ipv4addr_t*)&m->ciaddr,e );
   }
 
   memset(m->yiaddr, 0, sizeof(m->yiaddr));
@@ -243,7 +260,7 @@ static void create_msg(CC_REGISTER_ARG struct dhcp_msg *m)
   memset(m->giaddr, 0, sizeof(m->giaddr));
 
   memset(m->chaddr,0,sizeof(m->chaddr));
-  macOfNode((uip_lladdr_t*)&m->chaddr, dhcpc_state.session->nodeid);
+  macOfNode((uip_lladdr_t*)&m->chaddr, nodeid);
 
   memset(m->sname,0,sizeof(m->sname));
   memset(m->file,0,sizeof(m->file));
@@ -251,18 +268,9 @@ static void create_msg(CC_REGISTER_ARG struct dhcp_msg *m)
   memcpy(m->options, magic_cookie, sizeof(magic_cookie));
 }
 /*---------------------------------------------------------------------------*/
-static void send_discover(void) CC_REENTRANT_ARG
+static void send_msg(u8_t *end) CC_REENTRANT_ARG
 {
-  u8_t *end;
   uip_ipaddr_t addr_save;
-  struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
-
-  create_msg(m);
-
-  end = add_msg_type(&m->options[4], DHCPDISCOVER);
-  end = add_client_id(end);
-  end = add_req_options(end);
-  end = add_end(end);
 
   addr_save = uip_hostaddr;
   memset(uip_hostaddr.u8,0,sizeof(uip_hostaddr));
@@ -272,51 +280,56 @@ static void send_discover(void) CC_REENTRANT_ARG
   uip_hostaddr = addr_save;
 }
 /*---------------------------------------------------------------------------*/
-static void send_request(void) CC_REENTRANT_ARG
+static void send_discover(const dhcpc_session_t *s) CC_REENTRANT_ARG
 {
   u8_t *end;
   struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
-  uip_ipaddr_t addr_save;
-  create_msg(m);
 
-  end = add_msg_type(&m->options[4], DHCPREQUEST);
-  end = add_server_id(end);
-  end = add_client_id(end);
-  end = add_req_ipaddr(end);
+  create_msg(m, s->nodeid, s->xid);
+
+  end = add_msg_type(&m->options[4], DHCPDISCOVER);
+  end = add_client_id(end, s->nodeid);
+  end = add_req_options(end);
   end = add_end(end);
 
-  addr_save = uip_hostaddr;
-  memset(uip_hostaddr.u8,0,sizeof(uip_hostaddr));
+  send_msg(end);
+}
+/*---------------------------------------------------------------------------*/
+static void send_request(const dhcpc_session_t *s) CC_REENTRANT_ARG
+{
+  u8_t *end;
+  struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
 
-  uip_ipv4_udp_packet_send(dhcpc_state.conn,uip_appdata, (int) (end - (u8_t *) uip_appdata));
+  create_msg(m, s->nodeid, s->xid);
 
-  uip_hostaddr = addr_save;
+  end = add_msg_type(&m->options[4], DHCPREQUEST);
+  end = add_server_id(end, s->serverid);
+  end = add_client_id(end, s->nodeid);
+  end = add_req_ipaddr(end, s);
+  end = add_end(end);
+
+  send_msg(end);
 }
 
 /*---------------------------------------------------------------------------*/
-static void send_release(void) CC_REENTRANT_ARG
+static void send_release(nodeid_t nodeid) CC_REENTRANT_ARG
 {
   u8_t *end;
   struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
-  uip_ipaddr_t addr_save;
-  create_msg(m);
+
+  create_msg(m, nodeid, rand());
 
   end = add_msg_type(&m->options[4], DHCPRELEASE);
-  end = add_server_id(end);
-  end = add_client_id(end);
+  end = add_server_id(end, dhcpc_state.serverid);
+  end = add_client_id(end, nodeid);
   end = add_end(end);
 
-  addr_save = uip_hostaddr;
-  memset(uip_hostaddr.u8,0,sizeof(uip_hostaddr));
-
-  uip_ipv4_udp_packet_send(dhcpc_state.conn,uip_appdata, (int) (end - (u8_t *) uip_appdata));
-
-  uip_hostaddr = addr_save;
+  send_msg(end);
 }
 
 
 /*---------------------------------------------------------------------------*/
-static u8_t parse_options(u8_t *optptr, int len) CC_REENTRANT_ARG
+static u8_t parse_options(dhcpc_session_t *s, u8_t *optptr, int len) CC_REENTRANT_ARG
 {
   u8_t *end = optptr + len;
   u8_t type = 0;
@@ -327,19 +340,19 @@ static u8_t parse_options(u8_t *optptr, int len) CC_REENTRANT_ARG
     switch (*optptr)
     {
     case DHCP_OPTION_SUBNET_MASK:
-      memcpy(dhcpc_state.netmask.u16, optptr + 2, 4);
+      memcpy(s->netmask.u16, optptr + 2, 4);
       break;
     case DHCP_OPTION_ROUTER:
-      memcpy(dhcpc_state.default_router.u16, optptr + 2, 4);
+      memcpy(s->default_router.u16, optptr + 2, 4);
       break;
     case DHCP_OPTION_DNS_SERVER:
-      memcpy(dhcpc_state.dnsaddr.u16, optptr + 2, 4);
+      memcpy(s->dnsaddr.u16, optptr + 2, 4);
       break;
     case DHCP_OPTION_MSG_TYPE:
       type = *(optptr + 2);
       break;
     case DHCP_OPTION_SERVER_ID:
-      memcpy(dhcpc_state.serverid, optptr + 2, 4);
+      memcpy(s->serverid, optptr + 2, 4);
       break;
     case DHCP_OPTION_LEASE_TIME:
       memcpy(&lease_time, optptr + 2, 4);
@@ -361,43 +374,56 @@ static u8_t parse_options(u8_t *optptr, int len) CC_REENTRANT_ARG
   return type;
 }
 /*---------------------------------------------------------------------------*/
-static u8_t parse_msg(void)
+static u8_t parse_msg(dhcpc_session_t *s)
 {
-  uip_lladdr_t mac;
   struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
-  if(dhcpc_state.session == 0 ) {
-	  return 0;
-  }
 
-  macOfNode(&mac,dhcpc_state.session->nodeid);
-  if (m->op == DHCP_REPLY &&
-      memcmp(&m->xid, &dhcpc_state.xid, sizeof(u32_t)) == 0 &&
-      memcmp(m->chaddr, &mac, sizeof(uip_lladdr)) == 0)
-  {
-    memcpy(dhcpc_state.ipaddr.u8, m->yiaddr, 4);
-    return parse_options(&m->options[4], uip_datalen());
+  memcpy(s->ipaddr.u8, m->yiaddr, 4);
+  return parse_options(s, &m->options[4], uip_datalen());
+}
+/*---------------------------------------------------------------------------*/
+static dhcpc_session_t *session_of_node(nodeid_t nodeid)
+{
+  int i;
+
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    if(dhcpc_state.sessions[i].nodeid == nodeid) {
+      return &dhcpc_state.sessions[i];
+    }
   }
   return 0;
 }
 /*---------------------------------------------------------------------------*/
 /*
- * Is this a "fresh" reply for me? If it is, return the type.
+ * Is this a "fresh" reply for one of the sessions? If it is, return the
+ * type, and the session in *s.
  */
-static int msg_for_me(void) CC_REENTRANT_ARG
+static int msg_for_me(dhcpc_session_t **s) CC_REENTRANT_ARG
 {
   uip_lladdr_t mac;
   struct dhcp_msg *m = (struct dhcp_msg *) uip_appdata;
   u8_t *optptr = &m->options[4];
   u8_t *end = (u8_t*) uip_appdata + uip_datalen();
+  int i;
+
+  *s = 0;
+  if (m->op != DHCP_REPLY) {
+    return -1;
+  }
 
-  if(dhcpc_state.session == 0 ) {
-	return -1;
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    if(dhcpc_state.sessions[i].nodeid
+       && memcmp(&m->xid, &dhcpc_state.sessions[i].xid, sizeof(u32_t)) == 0) {
+      *s = &dhcpc_state.sessions[i];
+      break;
+    }
+  }
+  if(*s == 0) {
+    return -1;
   }
 
-  macOfNode(&mac,dhcpc_state.session->nodeid);
-  if (m->op == DHCP_REPLY &&
-      memcmp(&m->xid, &dhcpc_state.xid, sizeof(u32_t)) == 0 &&
-      memcmp(m->chaddr, &mac, sizeof(uip_lladdr)) == 0)
+  macOfNode(&mac,(*s)->nodeid);
+  if (memcmp(m->chaddr, &mac, sizeof(uip_lladdr)) == 0)
   {
     while (optptr < end)
     {
@@ -414,250 +440,337 @@ static int msg_for_me(void) CC_REENTRANT_ARG
   return -1;
 }
 
+/*
+ * Return an XID which is not used by any of the running sessions.
+ */
+static u32_t new_xid() {
+  u32_t xid;
+  int i;
+
+  do {
+    xid = rand();
+    for(i = 0; i < DHCPC_SESSIONS; i++) {
+      if(dhcpc_state.sessions[i].nodeid && dhcpc_state.sessions[i].xid == xid) {
+        break;
+      }
+    }
+  } while(i < DHCPC_SESSIONS);
+  return xid;
+}
+
+static void end_session(dhcpc_session_t *s) {
+  s->nodeid = 0;
+  s->state = DHCP_IDLE;
+  s->send_pending = 0;
+  s->retry = 0;
+  s->session_timeout = 0;
+}
 
-void dhcp_release( nat_table_entry_t *s ) {
-  nat_table_entry_t * tmp = dhcpc_state.session;
+void dhcp_release( nat_table_entry_t *e ) {
+  dhcpc_session_t *s;
 
   if (!(process_is_running(&dhcp_client_process))) {
       return;
   }
-  if(s->ip_suffix) {
-    dhcpc_state.session = s;
-    send_release();
-    dhcpc_state.session = tmp;
+  /* The entry is going away */
+  s = session_of_node(e->nodeid);
+  if(s) {
+    end_session(s);
+  }
+  if(e->ip_suffix) {
+    send_release(e->nodeid);
   }
 }
 
-static void start_discover( nat_table_entry_t *s ) {
-  dhcpc_state.session =s;
-  dhcpc_state.xid=rand();
-
-  DBG_PRINTF("We should send a discover\n");
-  dhcpc_state.retry = 0;
-  dhcpc_state.state = DHCP_SEND_DISCOVER;
+/*
+ * Send the message of state at the next UDP poll. The message cannot be
+ * sent right away, as uip_appdata may hold the message being handled.
+ */
+static void send_at_poll(dhcpc_session_t *s, dhcp_session_state_t state) {
+  s->state = state;
+  s->send_pending = 1;
   tcpip_ipv4_poll_udp(dhcpc_state.conn);
+}
 
+static void start_session(nodeid_t nodeid, dhcp_session_state_t state) {
+  dhcpc_session_t *s = session_of_node(0);
+
+  s->nodeid = nodeid;
+  s->xid = new_xid();
+  s->retry = 0;
+  /* A renewal has no offer, it keeps the options of the last lease */
+  memcpy(s->serverid, dhcpc_state.serverid, 4);
+  s->netmask = uip_netmask;
+  s->default_router = uip_draddr;
+  s->dnsaddr = dhcpc_state.dnsaddr;
+  send_at_poll(s, state);
+}
+
+static void start_discover( nat_table_entry_t *e ) {
+  DBG_PRINTF("We should send a discover for node %i\n", e->nodeid);
+  start_session(e->nodeid, DHCP_SEND_DISCOVER);
+}
+
+static void start_renew( nat_table_entry_t *e ) {
+  DBG_PRINTF("We should send a request for node %i\n", e->nodeid);
+  ipv46nat_ipv4addr_of_entry((uip_ipv4addr_t*)&session_of_node(0)->ipaddr, e);
+  start_session(e->nodeid, DHCP_SEND_REQUEST);
 }
 
 /*
- * Should be called when we are ready for a new DHCP session.
+ * Ticks until the next renewal may start. The renewals are spread over the
+ * renewal period, with some jitter so that gateways which were started
+ * at the same time do not renew at the same time.
+ */
+static u32_t renew_delay() {
+  if(dhcpc_state.renew_interval == 0) {
+    return 0;
+  }
+  return dhcpc_state.renew_interval / 2 + (u32_t)rand() % dhcpc_state.renew_interval;
+}
+
+/*
+ * Should be called when we are ready for new DHCP sessions.
  *
  * Uses uip_hostaddr to determine if we have an address for the
  * gateway itself.
  */
 void dhcp_check_for_new_sessions() {
-  u8_t i;
+  u16_t i;
+  u8_t busy = 0;
+  nat_table_entry_t *e;
 
   if (!(process_is_running(&dhcp_client_process))) {
       return;
   }
   DBG_PRINTF("Checking for new sessions\n");
-  if (dhcpc_state.state != DHCP_IDLE) {
-    return;
-  }
-
-  if(dhcpc_state.last_renew < nat_table_size) {
-    if(nat_table[dhcpc_state.last_renew].ip_suffix) {
-      dhcpc_state.session = &nat_table[dhcpc_state.last_renew];
-      dhcpc_state.xid++;
-      ipv46nat_ipv4addr_of_entry((uip_ipv4addr_t*)&dhcpc_state.ipaddr, dhcpc_state.session  );
-
-      DBG_PRINTF("We should send a request for node %i\n",dhcpc_state.session->nodeid);
-      dhcpc_state.state = DHCP_SEND_REQUEST;
-      tcpip_ipv4_poll_udp(dhcpc_state.conn);
 
-      dhcpc_state.last_renew++;
+  /*First discover the gateway itself*/
+  if(uip_hostaddr.u16[0] == 0 && uip_hostaddr.u16[1] == 0) {
+    e = ipv46nat_entry_of_node(MyNodeID);
+    if(e && e->ip_suffix == 0) {
+      if(!session_of_node(MyNodeID) && session_of_node(0)) {
+        start_discover(e);
+      }
       return;
-    } else {
-      dhcpc_state.last_renew++;
     }
   }
 
-  /*First discover the gateway itself*/
-  if(uip_hostaddr.u16[0] == 0 && uip_hostaddr.u16[1] == 0) {
-    for(i=0; i < nat_table_size; i++) {
-      if(nat_table[i].nodeid == MyNodeID && nat_table[i].ip_suffix ==0) {
-        start_discover(&nat_table[i]);
-        return;
-      }
+  while(dhcpc_state.last_renew < nat_table_size && dhcpc_state.renew_wait == 0
+        && session_of_node(0)) {
+    e = &nat_table[dhcpc_state.last_renew++];
+    if(e->ip_suffix && !session_of_node(e->nodeid)) {
+      start_renew(e);
+      dhcpc_state.renew_wait = renew_delay();
     }
   }
 
-  for(i=0; i < nat_table_size; i++) {
-    if(nat_table[i].ip_suffix ==0) {
+  for(i=0; i < nat_table_size && session_of_node(0); i++) {
+    if(nat_table[i].ip_suffix ==0 && !session_of_node(nat_table[i].nodeid)) {
       start_discover(&nat_table[i]);
-      return;
     }
   }
 
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    busy |= (dhcpc_state.sessions[i].nodeid != 0);
+  }
+  if(busy || dhcpc_state.last_renew < nat_table_size) {
+    return;
+  }
+
   /*We are done with the pass and all renews has succeeded*/
   if(dhcpc_state.renew_failed == 0) {
+    /* The first lease of the pass was renewed renew_age ticks ago */
     dhcpc_state.ticks = dhcpc_state.lease_time;
-    dhcpc_state.timeout = dhcpc_state.lease_time/2;
+    if(dhcpc_state.renew_age < dhcpc_state.ticks) {
+      dhcpc_state.ticks -= dhcpc_state.renew_age;
+    }
+    dhcpc_state.timeout = dhcpc_state.ticks/2;
   }
   process_post(&zip_process,ZIP_EVENT_ALL_IPV4_ASSIGNED,0);
 }
 
 void dhcpc_session_abort() {
-  update_current_dhcp_session(DHCP_IDLE);
+  int i;
+
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    end_session(&dhcpc_state.sessions[i]);
+  }
+  dhcp_check_for_new_sessions();
 }
 
+static void send_session_msg(dhcpc_session_t *s) {
+  if(s->state == DHCP_SEND_DISCOVER && s->nodeid == MyNodeID
+     && uip_hostaddr.u16[0] !=0 && uip_hostaddr.u16[1] !=0) {
+    s->ipaddr=uip_hostaddr;
+    s->netmask=uip_netmask;
+    s->default_router= uip_draddr;
+    s->state = DHCP_SEND_REQUEST;
+  }
 
-/* Should be called when the current session has been updated, but also when the timer expires */
-void update_current_dhcp_session(dhcp_session_state_t new_state) {
-  //PRINTF("New DHCP state %i\n", new_state);
-  if(new_state == DHCP_UDP_POLL) {
-    new_state = dhcpc_state.state;
-    dhcpc_state.state = DHCP_IDLE;
+  if(s->state == DHCP_SEND_DISCOVER) {
+    DBG_PRINTF("Sending DISCOVER for node %i\n", s->nodeid);
+
+    s->retry++;
+    if(s->retry > 4) {
+      s->retry=1;
+    }
+    s->session_timeout = 1<< s->retry;
+
+    send_discover(s);
+  } else if(s->state == DHCP_SEND_REQUEST) {
+    DBG_PRINTF("send REQUEST for node %i\n", s->nodeid);
+    /* TODO: Add exponential backoff */
+    s->session_timeout = 4;
+    send_request(s);
+  }
+}
+
+/*
+ * Send the messages of the sessions waiting for the UDP poll.
+ */
+static void dhcp_udp_poll() {
+  int i;
+  dhcpc_session_t *s;
+
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    s = &dhcpc_state.sessions[i];
+    if(s->nodeid && s->send_pending) {
+      s->send_pending = 0;
+      send_session_msg(s);
+    }
   }
+}
 
-  if(dhcpc_state.session==0) {
+/* Should be called when a session has been updated, but also when the timer expires */
+static void update_dhcp_session(dhcpc_session_t *s, dhcp_session_state_t new_state) {
+  nat_table_entry_t *e;
+
+  //PRINTF("New DHCP state %i\n", new_state);
+  if(s == 0 || s->nodeid==0) {
     return;
   }
 
   switch(new_state) {
   case DHCP_IDLE:
-    dhcpc_state.state = DHCP_IDLE;
-    dhcpc_state.session = 0;
-    dhcpc_state.retry=0;
-    dhcpc_state.session_timeout = 0;
+    end_session(s);
     dhcp_check_for_new_sessions();
     return;
-  case DHCP_SEND_DISCOVER:
-    if(dhcpc_state.state == DHCP_IDLE || dhcpc_state.state == DHCP_SEND_DISCOVER) {
-      if(dhcpc_state.session->nodeid == MyNodeID) {
-        if(uip_hostaddr.u16[0] !=0 && uip_hostaddr.u16[1] !=0) {
-          dhcpc_state.ipaddr=uip_hostaddr;
-          dhcpc_state.netmask=uip_netmask;
-          dhcpc_state.default_router= uip_draddr;
-          update_current_dhcp_session(DHCP_SEND_REQUEST);
-          return;
-        }
-      }
-
-      //uip_hostaddr = dhcpc_state.ipaddr;
-
-      DBG_PRINTF("Sending DISCOVER\n");
-
-      etimer_restart(&dhcpc_state.timer);
-
-      dhcpc_state.retry++;
-      if(dhcpc_state.retry > 4) {
-        dhcpc_state.retry=1;
-      }
-      dhcpc_state.session_timeout = 1<< dhcpc_state.retry;
-
-      send_discover();
-      dhcpc_state.state = DHCP_SEND_DISCOVER;
-    }
-    break;
   case DHCP_RECV_OFFER:
-    if(dhcpc_state.state == DHCP_SEND_DISCOVER) {
+    if(s->state == DHCP_SEND_DISCOVER) {
       DBG_PRINTF("got OFFER\n");
-      parse_msg();
-      dhcpc_state.state = DHCP_SEND_REQUEST;
-      tcpip_ipv4_poll_udp(dhcpc_state.conn); //Make the tcpip process kick the dhcp state*/
-    }
-    break;
-  case DHCP_SEND_REQUEST:
-    if(dhcpc_state.state == DHCP_RECV_OFFER || dhcpc_state.state == DHCP_IDLE) {
-      DBG_PRINTF("send REQUEST\n");
-      /* TODO: Add exponential backoff */
-      dhcpc_state.session_timeout = 4;
-      etimer_restart(&dhcpc_state.timer);
-      send_request();
-      dhcpc_state.state = DHCP_SEND_REQUEST;
+      parse_msg(s);
+      send_at_poll(s, DHCP_SEND_REQUEST);
     }
     break;
   case DHCP_RECV_ACK:
-    if(dhcpc_state.state == DHCP_SEND_REQUEST) {
+    if(s->state == DHCP_SEND_REQUEST) {
       uip_ipaddr_t a;
 
       DBG_PRINTF("got ACK\n");
-      dhcpc_state.session->ip_suffix = dhcpc_state.ipaddr.u16[1] & (~dhcpc_state.netmask.u16[1]);
+      e = ipv46nat_entry_of_node(s->nodeid);
+      if(e == 0) {
+        update_dhcp_session(s, DHCP_IDLE);
+        break;
+      }
+      memcpy(dhcpc_state.serverid, s->serverid, 4);
+      ipv46nat_set_suffix(e, s->ipaddr.u16[1] & (~s->netmask.u16[1]));
 
-      if(dhcpc_state.session->nodeid == MyNodeID) {
-        uip_hostaddr = dhcpc_state.ipaddr;
-        uip_netmask = dhcpc_state.netmask;
-        uip_draddr = dhcpc_state.default_router;
+      if(s->nodeid == MyNodeID) {
+        uip_hostaddr = s->ipaddr;
+        uip_netmask = s->netmask;
+        uip_draddr = s->default_router;
         uip_ipv4_net_broadcast_addr.u16[0] = uip_hostaddr.u16[0] | ~uip_netmask.u16[0];
         uip_ipv4_net_broadcast_addr.u16[1] = uip_hostaddr.u16[1] | ~uip_netmask.u16[1];
 
+        dhcpc_state.dnsaddr = s->dnsaddr;
         resolv_conf(&dhcpc_state.dnsaddr);
 
 #ifdef __ASIX_C51__
         //Update STOE engine with IPv4 address
-        STOE_SetIPAddr(*((uint32_t *)dhcpc_state.ipaddr.u8));
-        STOE_SetGateway(*((uint32_t *)dhcpc_state.default_router.u8));
-        STOE_SetSubnetMask(*((uint32_t *)dhcpc_state.netmask.u8));
-		printf("Default Gateway address %bu.%bu.%bu.%bu\n", dhcpc_state.default_router.u8[0],dhcpc_state.default_router.u8[1],dhcpc_state.default_router.u8[2],dhcpc_state.default_router.u8[3] );
-		printf("DNS Server address %bu.%bu.%bu.%bu\n", dhcpc_state.dnsaddr.u8[0],dhcpc_state.dnsaddr.u8[1],dhcpc_state.dnsaddr.u8[2],dhcpc_state.dnsaddr.u8[3] );
+        STOE_SetIPAddr(*((uint32_t *)s->ipaddr.u8));
+        STOE_SetGateway(*((uint32_t *)s->default_router.u8));
+        STOE_SetSubnetMask(*((uint32_t *)s->netmask.u8));
+		printf("Default Gateway address %bu.%bu.%bu.%bu\n", s->default_router.u8[0],s->default_router.u8[1],s->default_router.u8[2],s->default_router.u8[3] );
+		printf("DNS Server address %bu.%bu.%bu.%bu\n", s->dnsaddr.u8[0],s->dnsaddr.u8[1],s->dnsaddr.u8[2],s->dnsaddr.u8[3] );
 #endif
       }
 #ifdef __C51__
-      process_post(&zip_process,ZIP_EVENT_NODE_IPV4_ASSIGNED,(void*) (DWORD)dhcpc_state.session->nodeid);
+      process_post(&zip_process,ZIP_EVENT_NODE_IPV4_ASSIGNED,(void*) (DWORD)s->nodeid);
 #else
-      process_post(&zip_process,ZIP_EVENT_NODE_IPV4_ASSIGNED,(void*) (intptr_t)dhcpc_state.session->nodeid);
+      process_post(&zip_process,ZIP_EVENT_NODE_IPV4_ASSIGNED,(void*) (intptr_t)s->nodeid);
 #endif
-      ipv46nat_ipv4addr_of_entry((uip_ipv4addr_t*)&a,dhcpc_state.session);
-      LOG_PRINTF("Node %u has ipv4 address %u.%u.%u.%u\n",dhcpc_state.session->nodeid,a.u8[0],a.u8[1],a.u8[2],a.u8[3] );
+      ipv46nat_ipv4addr_of_entry((uip_ipv4addr_t*)&a,e);
+      LOG_PRINTF("Node %u has ipv4 address %u.%u.%u.%u\n",s->nodeid,a.u8[0],a.u8[1],a.u8[2],a.u8[3] );
 
-      update_current_dhcp_session(DHCP_IDLE);
+      update_dhcp_session(s, DHCP_IDLE);
     }
     break;
   case DHCP_RECV_NAK:
-    if(dhcpc_state.state == DHCP_SEND_REQUEST) {
+    if(s->state == DHCP_SEND_REQUEST) {
       WRN_PRINTF("got DHCP NAK\n");
 
       /**
        * Clear my address
        */
-      if(dhcpc_state.session->nodeid == MyNodeID) {
+      if(s->nodeid == MyNodeID) {
         memset(&uip_hostaddr,0,sizeof(uip_ipaddr_t));
         memset(&uip_netmask,0,sizeof(uip_ipaddr_t));
         memset(&uip_draddr,0,sizeof(uip_ipaddr_t));
       }
 
-      dhcpc_state.session->ip_suffix = 0;
+      e = ipv46nat_entry_of_node(s->nodeid);
+      if(e) {
+        ipv46nat_set_suffix(e, 0);
+      }
 
       /*Trigger a timeout*/
-      dhcpc_state.session_timeout = 1;
-      etimer_restart(&dhcpc_state.timer);
-//      update_current_dhcp_session(DHCP_IDLE);
+      s->session_timeout = 1;
     }
     break;
   case DHCP_TIME_OUT:
 #ifdef __C51__
-      process_post(&zip_process,ZIP_EVENT_NODE_DHCP_TIMEOUT,(void*) (DWORD)dhcpc_state.session->nodeid);
+      process_post(&zip_process,ZIP_EVENT_NODE_DHCP_TIMEOUT,(void*) (DWORD)s->nodeid);
 #else
-      process_post(&zip_process,ZIP_EVENT_NODE_DHCP_TIMEOUT,(void*) (intptr_t)dhcpc_state.session->nodeid);
+      process_post(&zip_process,ZIP_EVENT_NODE_DHCP_TIMEOUT,(void*) (intptr_t)s->nodeid);
 #endif
-    WRN_PRINTF("DHCP Timeout\n");
-    if(dhcpc_state.state == DHCP_SEND_DISCOVER) {
-      update_current_dhcp_session(DHCP_SEND_DISCOVER);
+    WRN_PRINTF("DHCP Timeout for node %i\n", s->nodeid);
+    if(s->state == DHCP_SEND_DISCOVER) {
+      send_at_poll(s, DHCP_SEND_DISCOVER);
     } else {
       dhcpc_state.renew_failed = 1;
-      update_current_dhcp_session(DHCP_IDLE);
+      update_dhcp_session(s, DHCP_IDLE);
     }
 
     break;
-  case DHCP_UDP_POLL: //dummy
+  default:
     break;
   }
 }
 
 static void timeout(void) {
-
-  if(dhcpc_state.session_timeout) {
-    dhcpc_state.session_timeout--;
-    if(dhcpc_state.session_timeout==0) {
-      update_current_dhcp_session(DHCP_TIME_OUT);
+  int i;
+  dhcpc_session_t *s;
+
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    s = &dhcpc_state.sessions[i];
+    if(s->nodeid && s->session_timeout) {
+      s->session_timeout--;
+      if(s->session_timeout==0) {
+        update_dhcp_session(s, DHCP_TIME_OUT);
+      }
     }
   }
 
+  dhcpc_state.renew_age++;
+  if(dhcpc_state.renew_wait) {
+    dhcpc_state.renew_wait--;
+    if(dhcpc_state.renew_wait == 0) {
+      dhcp_check_for_new_sessions();
+    }
+  }
 
   if(dhcpc_state.ticks == 0) {
-    int i;
     /*This is T2, all is lost */
     ERR_PRINTF("DHCP Lease timeout. Dropping all addresses.\n");
     memset(&uip_hostaddr,0,sizeof(uip_ipaddr_t));
@@ -665,7 +778,7 @@ static void timeout(void) {
     memset(&uip_draddr,0,sizeof(uip_ipaddr_t));
 
     for(i=0; i < nat_table_size; i++) {
-      nat_table[i].ip_suffix =0;
+      ipv46nat_set_suffix(&nat_table[i], 0);
     }
 
     dhcpc_state.ticks   = 120;
@@ -677,6 +790,10 @@ static void timeout(void) {
   if(dhcpc_state.ticks == dhcpc_state.timeout) {
     /*This is T1 */
     dhcpc_state.last_renew=0;
+    dhcpc_state.renew_age = 0;
+    dhcpc_state.renew_wait = 0;
+    /* Spread the renewals over the first quarter of what is left of the lease */
+    dhcpc_state.renew_interval = nat_table_size ? (dhcpc_state.ticks / 4) / nat_table_size : 0;
 
     if (dhcpc_state.timeout > 120) {
       dhcpc_state.timeout /= 2;
@@ -700,6 +817,7 @@ static void timeout(void) {
 PROCESS_THREAD(dhcp_client_process, ev, data) {
   int type;
   uip_ipaddr_t addr;
+  dhcpc_session_t *s;
   PROCESS_BEGIN();
 
   if (cfg.ipv4disable) {
@@ -723,8 +841,11 @@ PROCESS_THREAD(dhcp_client_process, ev, data) {
     //Do not clear the all the states, we need stuff like the dhcp server id.
     //memset(&dhcpc_state,0,sizeof(dhcpc_state));
     dhcpc_state.lease_time = 0xFFFFFFFF;
-    dhcpc_state.state = DHCP_IDLE;
+    memset(dhcpc_state.sessions, 0, sizeof(dhcpc_state.sessions));
     dhcpc_state.last_renew = 0;
+    dhcpc_state.renew_interval = 0;
+    dhcpc_state.renew_wait = 0;
+    dhcpc_state.renew_age = 0;
 //    dhcpc_state.ticks = 0;
 
     /*1s timer*/
@@ -738,16 +859,16 @@ PROCESS_THREAD(dhcp_client_process, ev, data) {
       }else if (ev == tcpip_event && data == &dhcpc_state) {
 
         if(uip_newdata()) {
-          type = msg_for_me();
+          type = msg_for_me(&s);
           switch(type) {
           case DHCPOFFER:
-            update_current_dhcp_session(DHCP_RECV_OFFER);
+            update_dhcp_session(s, DHCP_RECV_OFFER);
             break;
           case DHCPACK:
-            update_current_dhcp_session(DHCP_RECV_ACK);
+            update_dhcp_session(s, DHCP_RECV_ACK);
             break;
           case DHCPNAK:
-            update_current_dhcp_session(DHCP_RECV_NAK);
+            update_dhcp_session(s, DHCP_RECV_NAK);
             break;
            /*These are client messages */
           case DHCPDECLINE:
@@ -760,7 +881,7 @@ PROCESS_THREAD(dhcp_client_process, ev, data) {
             break;
           }
         } else {
-          update_current_dhcp_session(DHCP_UDP_POLL);
+          dhcp_udp_poll();
         }
 
       }
@@ -770,6 +891,15 @@ PROCESS_THREAD(dhcp_client_process, ev, data) {
 }
 
 u8_t dhcpc_answer_pending() {
-  return (dhcpc_state.state == DHCP_SEND_DISCOVER ||dhcpc_state.state == DHCP_SEND_REQUEST);
+  int i;
+
+  for(i = 0; i < DHCPC_SESSIONS; i++) {
+    if(dhcpc_state.sessions[i].nodeid
+       && (dhcpc_state.sessions[i].state == DHCP_SEND_DISCOVER
+           || dhcpc_state.sessions[i].state == DHCP_SEND_REQUEST)) {
+      return 1;
+    }
+  }
+  return 0;
 }
 /*--------------------------------------------------------------------------*/
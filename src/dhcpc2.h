@@ -16,13 +16,18 @@
  * All DHCP discover and requests are sent with a pr node unique client ID.
  * The clientid is used by the DHCP server to distinguish the sessions.
  *
+ * Up to DHCPC_SESSIONS sessions run at the same time, each with its own XID.
+ * The gateway gets its own address before the nodes do. Leases are renewed
+ * one node at a time, spread over the first quarter of what is left of the
+ * lease at T1.
+ *
  * This process emits two Contiki events, a \ref ZIP_EVENT_NODE_IPV4_ASSIGNED and a \ref ZIP_EVENT_ALL_IPV4_ASSIGNED.
  *
  */
 PROCESS_NAME(dhcp_client_process);
 
 /**
- * Abort all running DHCP session.
+ * Abort all running DHCP sessions.
  */
 void dhcpc_session_abort();
 
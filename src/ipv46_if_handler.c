@@ -111,6 +111,31 @@ uint8_t is_4to6_addr(const uip_ip6addr_t* ip) {
     ip->u16[5] == 0xFFFF);
 }
 
+/**
+ * One's complement addition of two sums in host byte order.
+ */
+static u16_t chksum_add(u16_t a, u16_t b) {
+  a += b;
+  return a + (a < b);
+}
+
+/**
+ * Update a checksum after some of the data it covers has been replaced, as
+ * described in RFC 1624.
+ *
+ * \param field   The checksum field, in network byte order.
+ * \param old_sum Sum of the replaced data in host byte order, see chksum().
+ * \param new_sum Sum of the new data.
+ * \return The new checksum field, in network byte order.
+ */
+static u16_t chksum_update(u16_t field, u16_t old_sum, u16_t new_sum) {
+  /* HC' = ~(~HC + ~m + m') */
+  u16_t sum = chksum_add((u16_t)~UIP_HTONS(field), (u16_t)~old_sum);
+
+  sum = chksum_add(sum, new_sum);
+  return UIP_HTONS((u16_t)~sum);
+}
+
 /**
  * Do the actual ipv4 to ipv6 translation
  */
@@ -123,6 +148,8 @@ static void do_46_translation(nodeid_t node) {
 
   uint16_t len,i;
   u8_t *p,*q;
+  u16_t addr_sum;
+  u8_t type;
 
   ip6h = &__ip6h;
 
@@ -148,6 +175,9 @@ static void do_46_translation(nodeid_t node) {
   }
   ip4to6_addr(&ip6h->srcipaddr, &ip4h->srcipaddr);
 
+  /* Only the addresses differ in the IPv4 and IPv6 pseudo headers */
+  addr_sum = chksum(0, (u8_t*)&ip4h->srcipaddr, 2 * sizeof(uip_ip4addr_t));
+
   /*End of the ipv4 package */
   p = (u8_t*)ip4h + UIP_HTONS(ip4h->len);
 
@@ -176,9 +206,13 @@ static void do_46_translation(nodeid_t node) {
   switch(ip6h->proto) {
   case UIP_PROTO_UDP:
     udph = (struct uip_udp_hdr*)( (u8_t*) ip6h + sizeof(ip6_hdr_t));
-    udph->udpchksum = 0;
-
-    udph->udpchksum = ~(uip_udpchksum());
+    if(udph->udpchksum == 0) {
+      /* The checksum is optional in IPv4, but not in IPv6 */
+      udph->udpchksum = ~(uip_udpchksum());
+    } else {
+      udph->udpchksum = chksum_update(udph->udpchksum, addr_sum,
+          chksum(0, (u8_t*)&ip6h->srcipaddr, 2 * sizeof(uip_ip6addr_t)));
+    }
     if(udph->udpchksum == 0) {
       udph->udpchksum = 0xffff;
     }
@@ -187,6 +221,7 @@ static void do_46_translation(nodeid_t node) {
   case UIP_PROTO_ICMP:
     icmph = (struct uip_icmp_hdr*) ((u8_t*) ip6h + sizeof(ip6_hdr_t));
     ip6h->proto = UIP_PROTO_ICMP6;
+    type = icmph->type;
 
     /*See http://tools.ietf.org/html/rfc2765 3.3.  Translating ICMPv4 Headers into ICMPv6 Headers*/
     if(icmph->type == 8)
@@ -197,6 +232,12 @@ static void do_46_translation(nodeid_t node) {
       PRINTF("Strange ICMP type %d\n", icmph->type);
       goto drop;
     }
+#if !CHECKSUM_OFFLOAD
+    /* ICMPv6 adds the pseudo header to the checksum */
+    icmph->icmpchksum = chksum_update(icmph->icmpchksum, type << 8,
+        chksum(chksum_add(len + UIP_PROTO_ICMP6, icmph->type << 8),
+               (u8_t*)&ip6h->srcipaddr, 2 * sizeof(uip_ip6addr_t)));
+#endif
     PRINTF("Translated icmp\n");
     break;
   default:
@@ -222,6 +263,8 @@ static void do_64_translation() {
 
   uint16_t len,i;
   u8_t *p,*q;
+  u16_t pseudo_sum;
+  u8_t type;
 
   ip4h = (ip4_hdr_t*)&__ip4h;
 
@@ -242,6 +285,9 @@ static void do_64_translation() {
   memcpy(ip4h->destipaddr.u8,ip6h->destipaddr.u8+12,4);
   memcpy(ip4h->srcipaddr.u8,ip6h->srcipaddr.u8+12,4);
 
+  /* The IPv6 header is overwritten below */
+  pseudo_sum = chksum(len + UIP_PROTO_ICMP6, ip6h->srcipaddr.u8, 2 * sizeof(uip_ip6addr_t));
+
   p = (u8_t*)ip6h + 20;
   /*As the ipv6 header is longer than the ipv4 header we do a forwards copy*/
   q = (u8_t*)ip6h + sizeof(ip6_hdr_t);
@@ -264,6 +310,7 @@ static void do_64_translation() {
   case UIP_PROTO_ICMP6:
     icmph = (struct uip_icmp_hdr*) ((u8_t*) ip4h + 20);
     ip4h->proto = UIP_PROTO_ICMP;
+    type = icmph->type;
 
     /*See http://tools.ietf.org/html/rfc2765 3.3.  Translating ICMPv4 Headers into ICMPv6 Headers*/
     if(icmph->type == 128)
@@ -275,8 +322,9 @@ static void do_64_translation() {
       goto drop;
     }
 #if !CHECKSUM_OFFLOAD
-    icmph->icmpchksum = 0x0;
-    icmph->icmpchksum = ~UIP_HTONS(chksum(0, (u8_t*)icmph, len));
+    /* ICMPv4 has no pseudo header */
+    icmph->icmpchksum = chksum_update(icmph->icmpchksum,
+        chksum_add(pseudo_sum, type << 8), icmph->type << 8);
 #endif
 
     PRINTF("Translated icmp\n");
@@ -380,7 +428,7 @@ void ipv46nat_interface_input() {
 uint8_t ipv46nat_interface_output() {
   uip_ip4addr_t addr;
   ip6_hdr_t* ip6h = (ip6_hdr_t*) &(uip_buf[14]);
-  uint16_t i;
+  nat_table_entry_t *e;
   nodeid_t node;
 
   addr = uip_hostaddr;
@@ -397,14 +445,9 @@ uint8_t ipv46nat_interface_output() {
     }
 
 
-    for(i = 0; i < nat_table_size; i++) {
-      if( (nat_table[i].nodeid) == node ) {
-        addr.u16[1] |= nat_table[i].ip_suffix;
-        break;
-      }
-    }
-
-    if(i != nat_table_size) {
+    e = ipv46nat_entry_of_node(node);
+    if(e) {
+      addr.u16[1] |= e->ip_suffix;
       ip4to6_addr(&ip6h->srcipaddr,&addr);
 
       /*Convert to ipv4 package*/
@@ -29,9 +29,10 @@ typedef struct nat_table_entry {
 } nat_table_entry_t;
 
 /**
- * Maximum number of entries in the NAT table.
+ * Maximum number of entries in the NAT table. The table grows as nodes
+ * are added, up to one entry per node id.
  */
-#define MAX_NAT_ENTRIES 1000
+#define MAX_NAT_ENTRIES ZW_MAX_NODES
 
 /**
  * Actual number of entries in the NAT table.
@@ -40,8 +41,11 @@ extern uint16_t nat_table_size;
 
 /**
  * The NAT entry database.
+ *
+ * The table is reallocated when it grows, so pointers to its entries are
+ * only valid until the next entry is added or deleted.
  */
-extern nat_table_entry_t nat_table[MAX_NAT_ENTRIES];
+extern nat_table_entry_t *nat_table;
 
 /* For DHCP */
 
@@ -52,5 +56,22 @@ extern nat_table_entry_t nat_table[MAX_NAT_ENTRIES];
  */
 void ipv46nat_ipv4addr_of_entry(uip_ipv4addr_t* ip,nat_table_entry_t *e);
 
+/**
+ * Get the nat table entry of a node.
+ * @param node Node to look up
+ * @return The entry, or NULL if the node has no entry.
+ */
+nat_table_entry_t* ipv46nat_entry_of_node(nodeid_t node);
+
+/**
+ * Set the IPv4 suffix of a nat table entry.
+ *
+ * The suffix must be set with this function so that the entry can be
+ * found by its address.
+ * @param e Entry to update
+ * @param suffix New suffix, 0 if the entry has no address
+ */
+void ipv46nat_set_suffix(nat_table_entry_t *e, u16_t suffix);
+
 /** @} */
 #endif
@@ -11,8 +11,17 @@
 #include "ZW_typedefs.h"
 #include "ZW_classcmd.h"
 #include "RD_types.h"
+#include "ZW_transport_api.h"
+#include <stdlib.h>
 uint16_t  nat_table_size =0;
-nat_table_entry_t nat_table[MAX_NAT_ENTRIES];
+nat_table_entry_t *nat_table;
+/** Number of entries allocated for #nat_table */
+static uint16_t nat_table_alloc;
+
+/** Index of the entry of each node id in #nat_table plus one, 0 if the node has no entry */
+static uint16_t node_index[ZW_MAX_NODES + 1];
+/** Index of the entry of each IPv4 suffix in #nat_table plus one, 0 if the suffix is not in use */
+static uint16_t suffix_index[0x10000];
 
 /* This file uses contiki IPv4, but also needs to know about the ipv6 address type. */
 #if !UIP_CONF_IPV6
@@ -29,6 +38,56 @@ void ipv46nat_ipv4addr_of_entry(uip_ipv4addr_t* ip,nat_table_entry_t *e);
 
 #define PRINTF(a,...)
 
+/**
+ * Point the indexes of the entry at position i to i.
+ */
+static void index_entry(uint16_t i) {
+  node_index[nat_table[i].nodeid] = i + 1;
+  if(nat_table[i].ip_suffix) {
+    suffix_index[nat_table[i].ip_suffix] = i + 1;
+  }
+}
+
+/**
+ * Remove the entry at position i from the indexes.
+ */
+static void unindex_entry(uint16_t i) {
+  if(node_index[nat_table[i].nodeid] == i + 1) {
+    node_index[nat_table[i].nodeid] = 0;
+  }
+  if(nat_table[i].ip_suffix && suffix_index[nat_table[i].ip_suffix] == i + 1) {
+    suffix_index[nat_table[i].ip_suffix] = 0;
+  }
+}
+
+/**
+ * Make room for one more entry in #nat_table.
+ * @return 0 if the table could not grow.
+ */
+static u8_t grow_table() {
+  nat_table_entry_t *t;
+  uint16_t n;
+
+  if(nat_table_size < nat_table_alloc) {
+    return 1;
+  }
+  n = nat_table_alloc ? nat_table_alloc * 2 : 32;
+  if(n > MAX_NAT_ENTRIES) {
+    n = MAX_NAT_ENTRIES;
+  }
+  if(n <= nat_table_size) {
+    return 0;
+  }
+  t = realloc(nat_table, n * sizeof(nat_table_entry_t));
+  if(!t) {
+    ERR_PRINTF("Unable to grow the NAT table to %u entries\n", n);
+    return 0;
+  }
+  nat_table = t;
+  nat_table_alloc = n;
+  return 1;
+}
+
 /**
  * @return The node id behind the ipv4 address
  * Return NULL if this is not one of our ipaddresses
@@ -37,10 +96,9 @@ nodeid_t ipv46nat_get_nat_addr(uip_ipv4addr_t *ip) {
   uint16_t i;
 
   if(uip_ipaddr_maskcmp(ip, &uip_hostaddr, &uip_netmask)) {
-    for(i = 0; i < nat_table_size; i++) {
-      if( (nat_table[i].ip_suffix) == (ip->u16[1] & (~uip_netmask.u16[1]))   ) {
-        return nat_table[i].nodeid;
-      }
+    i = suffix_index[ip->u16[1] & (~uip_netmask.u16[1])];
+    if(i) {
+      return nat_table[i - 1].nodeid;
     }
   }
   return 0;
@@ -50,16 +108,15 @@ nodeid_t ipv46nat_get_nat_addr(uip_ipv4addr_t *ip) {
  * Add NAT table entry. Returns 0 is the add entry fails
  */
 u8_t ipv46nat_add_entry(nodeid_t node) {
-  uint16_t i;
-  if(nat_table_size >= MAX_NAT_ENTRIES) {
+  if(node == 0 || node > ZW_MAX_NODES) {
     return 0;
   }
-
-  for(i = 0; i < nat_table_size; i++) {
-    if( (nat_table[i].nodeid) == node ) {
-      PRINTF("Entry %d already exists\n",node);
-      return nat_table_size;
-    }
+  if(node_index[node]) {
+    PRINTF("Entry %d already exists\n",node);
+    return 1;
+  }
+  if(!grow_table()) {
+    return 0;
   }
 
   nat_table[nat_table_size].nodeid = node;
@@ -68,33 +125,43 @@ u8_t ipv46nat_add_entry(nodeid_t node) {
   PRINTF("Nat entry added node = %d ip = %u\n",
       nat_table[nat_table_size].nodeid, (unsigned)UIP_HTONS(nat_table[nat_table_size].ip_suffix));
 
+  index_entry(nat_table_size);
   nat_table_size++;
   dhcp_check_for_new_sessions();
-  return nat_table_size;
+  return 1;
 }
 
 
+/**
+ * Release the address of an entry and remove it from the table.
+ */
+static void remove_entry(nat_table_entry_t *e) {
+  uint16_t i;
+
+  DBG_PRINTF("Releasing DHCP entry for node %d\n",e->nodeid);
+  dhcp_release(e);
+
+  /* Keep the order of the table, the DHCP client walks it when renewing */
+  i = e - nat_table;
+  unindex_entry(i);
+  nat_table_size--;
+  for(; i < nat_table_size; i++) {
+    nat_table[i] = nat_table[i + 1];
+    index_entry(i);
+  }
+}
+
 /**
  * Remove a nat table entry, return 1 if the entry was removed.
  */
 u8_t ipv46nat_del_entry(nodeid_t node) {
-  uint16_t i,removing;
+  nat_table_entry_t *e = ipv46nat_entry_of_node(node);
 
-  if(node == MyNodeID) {
+  if(node == MyNodeID || !e) {
     return 0;
   }
-  removing = 0;
-  for(i=0; i < nat_table_size;i++) {
-    if(removing) {
-      nat_table[i-1] = nat_table[i];
-    } else if(nat_table[i].nodeid == node) {
-      DBG_PRINTF("Releasing DHCP entry for node %d\n",node);
-      dhcp_release(&nat_table[i]);
-      removing++;
-    }
-  }
-  nat_table_size-=removing;
-  return removing;
+  remove_entry(e);
+  return 1;
 }
 
 /**
@@ -105,6 +172,7 @@ void ipv46nat_del_all_nodes() {
   uint16_t my_index = 0;
 
   for (i=0; i < nat_table_size;i++) {
+    unindex_entry(i);
     if (nat_table[i].nodeid == MyNodeID) {
       my_index = i;
     } else {
@@ -113,27 +181,49 @@ void ipv46nat_del_all_nodes() {
       dhcp_release(&nat_table[i]);
     }
   }
+  if(nat_table_size == 0) {
+    return;
+  }
   nat_table[0] = nat_table[my_index];
   nat_table_size = 1;
+  index_entry(0);
 }
 
 void ipv46nat_init() {
   nat_table_size = 0;
+  memset(node_index, 0, sizeof(node_index));
+  memset(suffix_index, 0, sizeof(suffix_index));
 }
 
 u8_t ipv46nat_ipv4addr_of_node(uip_ipv4addr_t* ip,nodeid_t node) {
-  uint16_t i;
+  nat_table_entry_t *e = ipv46nat_entry_of_node(node);
 
-  for(i=0; i < nat_table_size;i++) {
-    PRINTF("%d of %d %d\n",i,nat_table[i].nodeid, node);
-    if(nat_table[i].nodeid == node && nat_table[i].ip_suffix) {
-      ipv46nat_ipv4addr_of_entry( ip,&nat_table[i]);
-      return 1;
-    }
+  if(e && e->ip_suffix) {
+    ipv46nat_ipv4addr_of_entry(ip, e);
+    return 1;
   }
   return 0;
 }
 
+nat_table_entry_t* ipv46nat_entry_of_node(nodeid_t node) {
+  if(node > ZW_MAX_NODES || node_index[node] == 0) {
+    return 0;
+  }
+  return &nat_table[node_index[node] - 1];
+}
+
+void ipv46nat_set_suffix(nat_table_entry_t *e, u16_t suffix) {
+  uint16_t i = e - nat_table;
+
+  if(e->ip_suffix && suffix_index[e->ip_suffix] == i + 1) {
+    suffix_index[e->ip_suffix] = 0;
+  }
+  e->ip_suffix = suffix;
+  if(suffix) {
+    suffix_index[suffix] = i + 1;
+  }
+}
+
 void ipv46nat_ipv4addr_of_entry(uip_ipv4addr_t* ip,nat_table_entry_t *e) {
   memcpy(ip,uip_hostaddr.u8, sizeof(uip_ipv4addr_t));
 
@@ -155,14 +245,23 @@ u8_t ipv46nat_all_nodes_has_ip() {
 }
 
 void ipv46nat_rename_node(nodeid_t old_id, nodeid_t new_id) {
-  uint16_t i;
+  nat_table_entry_t *e = ipv46nat_entry_of_node(old_id);
 
   /* TODO-reset: The gateway should always have index 0, no matter
    * what MyNodeID is, so renaming the gateway itself should be simple
    * and it should never be necessary to delete it. */
-  for(i=0; i < nat_table_size;i++) {
-      if(nat_table[i].nodeid == old_id) {
-        nat_table[i].nodeid = new_id;
-      }
-    }
+  if(!e || new_id == 0 || new_id > ZW_MAX_NODES || new_id == old_id) {
+    return;
+  }
+  if(node_index[new_id]) {
+    WRN_PRINTF("Node %d already has a NAT entry, it is replaced by the entry of node %d\n",
+               new_id, old_id);
+    /* Drop the old entry, so that its suffix is not left in the index */
+    remove_entry(ipv46nat_entry_of_node(new_id));
+    /* The entries after it have moved */
+    e = ipv46nat_entry_of_node(old_id);
+  }
+  node_index[old_id] = 0;
+  e->nodeid = new_id;
+  node_index[new_id] = e - nat_table + 1;
 }
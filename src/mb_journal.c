@@ -0,0 +1,571 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mb_journal.h"
+#include "lib/crc16.h"
+#include "ZIP_Router_logging.h"
+
+/** "ZGMB" */
+#define MB_JOURNAL_MAGIC 0x424D475A
+#define MB_JOURNAL_VERSION 1
+/** Marks a record. A zero magic marks the end of the log. */
+#define MB_JOURNAL_REC_MAGIC 0x4D42524A
+
+/** Size of a new journal file. */
+#define MB_JOURNAL_INITIAL_SIZE (64 * 1024)
+/** The journal is never grown beyond this. 2000 entries of 1280 bytes fit
+ * with plenty of room for deleted entries. */
+#define MB_JOURNAL_MAX_SIZE (16 * 1024 * 1024)
+
+#define MB_JOURNAL_ALIGN(x) (((x) + 3) & ~((size_t)3))
+
+enum {
+  MB_JOURNAL_REC_ADD = 1,
+  MB_JOURNAL_REC_DEL = 2,
+};
+
+typedef struct mb_journal_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t home_id;
+} mb_journal_hdr_t;
+
+typedef struct mb_journal_rec {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t handle;
+  uint8_t waiting_enabled;
+  uint8_t reserved;
+  uint32_t id;
+  uint32_t queued_time;
+  uint16_t data_len;
+  uint16_t crc;
+  uint8_t proxy[16];
+} mb_journal_rec_t;
+
+/** A mapped journal file */
+typedef struct mb_journal_file {
+  int fd;
+  uint8_t *map;
+  size_t size;
+  /** Offset of the end of the log. */
+  size_t end;
+} mb_journal_file_t;
+
+static mb_journal_file_t jf = { -1, NULL, 0, 0 };
+/** The new file while compacting. */
+static mb_journal_file_t compact_jf = { -1, NULL, 0, 0 };
+static int compact_failed;
+
+/**
+ * A committed compaction is synced to the storage by compact_thread, so the
+ * main loop does not wait for it. Until the thread is done, records are
+ * appended to both files, and mb_journal_compact_poll() switches to the new
+ * file.
+ */
+static pthread_t compact_thread;
+static int compact_syncing;
+/** Result of the fsync() of the new file, set before compact_done */
+static int compact_result;
+static int compact_done;
+/** End of the new file when it was committed, the records after it may not
+ * have been synced. */
+static size_t compact_synced_end;
+
+static char *journal_filename;
+static char *compact_filename;
+static uint32_t journal_home_id;
+static uint32_t next_id;
+
+/** Start of the range written since the last flush. */
+static size_t dirty_start;
+/** Number of add records of live entries in the log. */
+static uint32_t live_records;
+/** Number of add records of deleted entries and delete records in the log. */
+static uint32_t dead_records;
+
+static size_t rec_size(uint16_t data_len)
+{
+  return MB_JOURNAL_ALIGN(sizeof(mb_journal_rec_t) + data_len);
+}
+
+static uint16_t rec_crc(const mb_journal_rec_t *r, const uint8_t *data)
+{
+  mb_journal_rec_t tmp = *r;
+  uint16_t crc;
+
+  tmp.magic = 0;
+  tmp.crc = 0;
+  crc = crc16_data((const unsigned char*)&tmp, sizeof(tmp), 0);
+  return crc16_data(data, r->data_len, crc);
+}
+
+static void jf_unmap(mb_journal_file_t *f)
+{
+  if (f->map) {
+    munmap(f->map, f->size);
+    f->map = NULL;
+  }
+  if (f->fd >= 0) {
+    close(f->fd);
+    f->fd = -1;
+  }
+  f->size = 0;
+  f->end = 0;
+}
+
+/**
+ * Resize the file of f to size and (re)map it.
+ */
+static int jf_map(mb_journal_file_t *f, size_t size)
+{
+  if (f->map) {
+    msync(f->map, f->size, MS_ASYNC);
+    munmap(f->map, f->size);
+    f->map = NULL;
+  }
+  if (ftruncate(f->fd, size) < 0) {
+    ERR_PRINTF("Mailbox journal: cannot resize to %zu bytes: %s\n", size, strerror(errno));
+    return 0;
+  }
+  f->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  if (f->map == MAP_FAILED) {
+    ERR_PRINTF("Mailbox journal: mmap failed: %s\n", strerror(errno));
+    f->map = NULL;
+    return 0;
+  }
+  f->size = size;
+  return 1;
+}
+
+/** Make room for len more bytes in f. */
+static int jf_reserve(mb_journal_file_t *f, size_t len)
+{
+  size_t size = f->size;
+
+  /* Always leave room for the zero magic marking the end of the log */
+  while (f->end + len + sizeof(uint32_t) > size) {
+    size *= 2;
+  }
+  if (size == f->size) {
+    return 1;
+  }
+  if (size > MB_JOURNAL_MAX_SIZE) {
+    ERR_PRINTF("Mailbox journal is full\n");
+    return 0;
+  }
+  return jf_map(f, size);
+}
+
+static void jf_write_hdr(mb_journal_file_t *f, uint32_t home_id)
+{
+  mb_journal_hdr_t *h = (mb_journal_hdr_t*)f->map;
+
+  memset(f->map, 0, f->size);
+  h->magic = MB_JOURNAL_MAGIC;
+  h->version = MB_JOURNAL_VERSION;
+  h->home_id = home_id;
+  f->end = sizeof(mb_journal_hdr_t);
+}
+
+/**
+ * Write a record at the end of f.
+ *
+ * The magic is written last, so that a record is not seen before it is
+ * complete.
+ */
+static int jf_append(mb_journal_file_t *f, uint8_t type, const mb_journal_entry_t *e)
+{
+  mb_journal_rec_t r;
+  uint8_t *p;
+  size_t len = rec_size(e->data_len);
+
+  if (!jf_reserve(f, len)) {
+    return 0;
+  }
+  p = f->map + f->end;
+
+  memset(&r, 0, sizeof(r));
+  r.type = type;
+  r.handle = e->handle;
+  r.waiting_enabled = e->waiting_enabled;
+  r.id = e->id;
+  r.queued_time = e->queued_time;
+  r.data_len = e->data_len;
+  memcpy(r.proxy, e->proxy, sizeof(r.proxy));
+  r.crc = rec_crc(&r, e->data);
+
+  memcpy(p + sizeof(r), e->data, e->data_len);
+  memcpy(p, &r, sizeof(r));
+  ((mb_journal_rec_t*)p)->magic = MB_JOURNAL_REC_MAGIC;
+  f->end += len;
+  return 1;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Find the end of the log and replay the live entries.
+ */
+static void jf_replay(mb_journal_file_t *f, mb_journal_replay_cb_t cb, void *user)
+{
+  size_t off = sizeof(mb_journal_hdr_t);
+  uint32_t *deleted = NULL;
+  uint32_t n_deleted = 0;
+  uint32_t n_added = 0;
+  size_t end;
+  mb_journal_entry_t e;
+
+  next_id = 1;
+
+  /* First pass, validate the log and collect the deleted ids. */
+  while (off + sizeof(mb_journal_rec_t) <= f->size) {
+    mb_journal_rec_t *r = (mb_journal_rec_t*)(f->map + off);
+
+    if (r->magic != MB_JOURNAL_REC_MAGIC) {
+      break;
+    }
+    if ((r->type != MB_JOURNAL_REC_ADD && r->type != MB_JOURNAL_REC_DEL)
+        || off + rec_size(r->data_len) > f->size
+        || rec_crc(r, (uint8_t*)(r + 1)) != r->crc) {
+      WRN_PRINTF("Mailbox journal: dropping torn record at offset %zu\n", off);
+      break;
+    }
+    if (r->type == MB_JOURNAL_REC_DEL) {
+      uint32_t *tmp = realloc(deleted, (n_deleted + 1) * sizeof(uint32_t));
+      if (!tmp) {
+        break;
+      }
+      deleted = tmp;
+      deleted[n_deleted++] = r->id;
+    } else {
+      n_added++;
+    }
+    if (r->id >= next_id) {
+      next_id = r->id + 1;
+    }
+    off += rec_size(r->data_len);
+  }
+  f->end = off;
+  /* Clear whatever is left of a torn record */
+  memset(f->map + off, 0, f->size - off);
+
+  if (n_deleted) {
+    qsort(deleted, n_deleted, sizeof(uint32_t), id_cmp);
+  }
+
+  /* Second pass, replay the entries that have not been deleted.
+   *
+   * The callback may append to the journal, which can grow and remap it, so
+   * the record is looked up again from the mapping after each callback.
+   * Records appended by the callback are past end and are not replayed. */
+  dead_records = n_added + n_deleted;
+  end = f->end;
+  off = sizeof(mb_journal_hdr_t);
+  while (off < end) {
+    mb_journal_rec_t *r = (mb_journal_rec_t*)(f->map + off);
+    size_t len = rec_size(r->data_len);
+
+    if (r->type == MB_JOURNAL_REC_ADD
+        && !(n_deleted && bsearch(&r->id, deleted, n_deleted, sizeof(uint32_t), id_cmp))) {
+      e.id = r->id;
+      e.queued_time = r->queued_time;
+      memcpy(e.proxy, r->proxy, sizeof(e.proxy));
+      e.handle = r->handle;
+      e.waiting_enabled = r->waiting_enabled;
+      e.data_len = r->data_len;
+      e.data = (const uint8_t*)(r + 1);
+      live_records++;
+      dead_records--;
+      if (cb) {
+        cb(&e, user);
+      }
+    }
+    off += len;
+  }
+  free(deleted);
+}
+
+int mb_journal_open(const char *filename, uint32_t home_id,
+                    mb_journal_replay_cb_t cb, void *user)
+{
+  struct stat st;
+  mb_journal_hdr_t *h;
+
+  mb_journal_close();
+
+  jf.fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if (jf.fd < 0) {
+    ERR_PRINTF("Mailbox journal: cannot open %s: %s\n", filename, strerror(errno));
+    return 0;
+  }
+  if (fstat(jf.fd, &st) < 0) {
+    goto fail;
+  }
+
+  if (st.st_size < MB_JOURNAL_INITIAL_SIZE) {
+    st.st_size = MB_JOURNAL_INITIAL_SIZE;
+  }
+  if (!jf_map(&jf, st.st_size)) {
+    goto fail;
+  }
+
+  journal_filename = strdup(filename);
+  compact_filename = malloc(strlen(filename) + 5);
+  if (!journal_filename || !compact_filename) {
+    goto fail;
+  }
+  sprintf(compact_filename, "%s.tmp", filename);
+  journal_home_id = home_id;
+  live_records = 0;
+  dead_records = 0;
+
+  h = (mb_journal_hdr_t*)jf.map;
+  if (h->magic != MB_JOURNAL_MAGIC || h->version != MB_JOURNAL_VERSION
+      || h->home_id != home_id) {
+    if (h->magic == MB_JOURNAL_MAGIC) {
+      LOG_PRINTF("Mailbox journal belongs to home ID %08X, discarding it\n", h->home_id);
+    }
+    jf_write_hdr(&jf, home_id);
+    next_id = 1;
+    msync(jf.map, jf.size, MS_SYNC);
+  } else {
+    jf_replay(&jf, cb, user);
+    LOG_PRINTF("Mailbox journal: %u entries restored from %s\n", live_records, filename);
+  }
+  dirty_start = jf.end;
+  return 1;
+
+fail:
+  jf_unmap(&jf);
+  free(journal_filename);
+  free(compact_filename);
+  journal_filename = NULL;
+  compact_filename = NULL;
+  return 0;
+}
+
+/** Give up a compaction. The journal is left unchanged. */
+static void compact_discard(void)
+{
+  if (compact_syncing) {
+    pthread_join(compact_thread, NULL);
+    compact_syncing = 0;
+  }
+  if (compact_jf.fd >= 0) {
+    jf_unmap(&compact_jf);
+    unlink(compact_filename);
+  }
+}
+
+static void *compact_sync(void *arg)
+{
+  int fd = (int)(intptr_t)arg;
+
+  /* On Linux, fsync() also writes back the pages dirtied through the
+   * mapping, so no msync() of the mapping, which the main loop may move,
+   * is needed. */
+  __atomic_store_n(&compact_result, fsync(fd), __ATOMIC_RELAXED);
+  __atomic_store_n(&compact_done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+void mb_journal_close(void)
+{
+  if (!jf.map) {
+    return;
+  }
+  compact_discard();
+  msync(jf.map, jf.size, MS_SYNC);
+  jf_unmap(&jf);
+  free(journal_filename);
+  free(compact_filename);
+  journal_filename = NULL;
+  compact_filename = NULL;
+}
+
+int mb_journal_is_open(void)
+{
+  return jf.map != NULL;
+}
+
+uint32_t mb_journal_append_add(const mb_journal_entry_t *e)
+{
+  mb_journal_entry_t tmp;
+
+  if (!jf.map) {
+    return 0;
+  }
+  tmp = *e;
+  tmp.id = next_id;
+  if (!jf_append(&jf, MB_JOURNAL_REC_ADD, &tmp)) {
+    return 0;
+  }
+  if (compact_syncing && !compact_failed
+      && !jf_append(&compact_jf, MB_JOURNAL_REC_ADD, &tmp)) {
+    compact_failed = 1;
+  }
+  next_id++;
+  live_records++;
+  return tmp.id;
+}
+
+void mb_journal_append_del(uint32_t id)
+{
+  mb_journal_entry_t tmp;
+
+  if (!jf.map || id == 0) {
+    return;
+  }
+  memset(&tmp, 0, sizeof(tmp));
+  tmp.id = id;
+  if (jf_append(&jf, MB_JOURNAL_REC_DEL, &tmp)) {
+    live_records--;
+    dead_records += 2;
+    if (compact_syncing && !compact_failed
+        && !jf_append(&compact_jf, MB_JOURNAL_REC_DEL, &tmp)) {
+      compact_failed = 1;
+    }
+  }
+}
+
+int mb_journal_is_dirty(void)
+{
+  return jf.map && jf.end != dirty_start;
+}
+
+void mb_journal_flush(void)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  size_t start;
+
+  if (!mb_journal_is_dirty()) {
+    return;
+  }
+  /* msync() wants a page aligned start address */
+  start = dirty_start - (dirty_start % page);
+  msync(jf.map + start, jf.end - start, MS_ASYNC);
+  dirty_start = jf.end;
+}
+
+int mb_journal_should_compact(void)
+{
+  return jf.map
+      && compact_jf.fd < 0
+      && dead_records > live_records
+      && jf.end > MB_JOURNAL_INITIAL_SIZE / 2;
+}
+
+int mb_journal_compact_begin(void)
+{
+  if (!jf.map || compact_syncing) {
+    return 0;
+  }
+  jf_unmap(&compact_jf);
+  compact_failed = 0;
+  compact_jf.fd = open(compact_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (compact_jf.fd < 0) {
+    ERR_PRINTF("Mailbox journal: cannot create %s: %s\n", compact_filename, strerror(errno));
+    return 0;
+  }
+  if (!jf_map(&compact_jf, MB_JOURNAL_INITIAL_SIZE)) {
+    jf_unmap(&compact_jf);
+    unlink(compact_filename);
+    return 0;
+  }
+  jf_write_hdr(&compact_jf, journal_home_id);
+  return 1;
+}
+
+int mb_journal_compact_add(const mb_journal_entry_t *e)
+{
+  if (!compact_jf.map || compact_failed) {
+    return 0;
+  }
+  if (!jf_append(&compact_jf, MB_JOURNAL_REC_ADD, e)) {
+    compact_failed = 1;
+    return 0;
+  }
+  return 1;
+}
+
+void mb_journal_compact_commit(void)
+{
+  if (!compact_jf.map || compact_syncing) {
+    return;
+  }
+  compact_done = 0;
+  compact_synced_end = compact_jf.end;
+  if (compact_failed
+      || pthread_create(&compact_thread, NULL, compact_sync,
+                        (void*)(intptr_t)compact_jf.fd) != 0) {
+    ERR_PRINTF("Mailbox journal compaction failed\n");
+    compact_discard();
+    return;
+  }
+  compact_syncing = 1;
+}
+
+int mb_journal_compact_poll(void)
+{
+  uint32_t adds = 0;
+  uint32_t dels = 0;
+  mb_journal_rec_t *r;
+  size_t off;
+
+  if (!compact_syncing) {
+    return 0;
+  }
+  if (!__atomic_load_n(&compact_done, __ATOMIC_ACQUIRE)) {
+    return 1;
+  }
+  pthread_join(compact_thread, NULL);
+  compact_syncing = 0;
+
+  /* The rename is done here rather than in the thread, so that a compaction
+   * which has missed an append since the commit can still be given up. */
+  if (compact_failed || compact_result < 0
+      || rename(compact_filename, journal_filename) < 0) {
+    ERR_PRINTF("Mailbox journal compaction failed\n");
+    compact_discard();
+    return 0;
+  }
+
+  for (off = sizeof(mb_journal_hdr_t); off < compact_jf.end; off += rec_size(r->data_len)) {
+    r = (mb_journal_rec_t*)(compact_jf.map + off);
+    if (r->type == MB_JOURNAL_REC_ADD) {
+      adds++;
+    } else {
+      dels++;
+    }
+  }
+  DBG_PRINTF("Mailbox journal compacted from %zu to %zu bytes\n", jf.end, compact_jf.end);
+
+  jf_unmap(&jf);
+  jf = compact_jf;
+  compact_jf.fd = -1;
+  compact_jf.map = NULL;
+  compact_jf.size = 0;
+  compact_jf.end = 0;
+
+  live_records = adds - dels;
+  dead_records = 2 * dels;
+  dirty_start = compact_synced_end;
+  return 0;
+}
@@ -0,0 +1,165 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+#ifndef MB_JOURNAL_H_
+#define MB_JOURNAL_H_
+
+#include <stdint.h>
+
+/**
+ * \ingroup mailbox
+ * \defgroup mb_journal Mailbox persistent journal
+ *
+ * Optional on-disk journal of the mailbox queue, so that frames queued for
+ * sleeping nodes survive a restart or upgrade of the gateway.
+ *
+ * The journal is an append-only log of add and delete records, kept in a
+ * memory-mapped file. Appending a record is a memcpy into the mapping, the
+ * kernel writes the pages back and the mailbox asks for an explicit
+ * asynchronous flush in batches (see mb_journal_flush()). Each record carries
+ * a CRC16, so a record torn by a power loss marks the end of the log on
+ * replay.
+ *
+ * Deleted entries stay in the log until it is compacted, which the mailbox
+ * does from a timer when mb_journal_should_compact() says so. The compacted
+ * file is synced to the storage by a separate thread, so compaction does not
+ * block the main loop on the storage either.
+ *
+ * The journal is bound to the home ID of the network. Entries journaled in
+ * another network are discarded when the journal is opened.
+ *
+ * Enabled with the configuration parameter ZipMBJournalFile in
+ * zipgateway.cfg.
+ * @{
+ */
+
+/** A mailbox entry as stored in the journal. */
+typedef struct mb_journal_entry {
+  /** Journal id of the entry, assigned by mb_journal_append_add(). */
+  uint32_t id;
+  /** Wall clock time (seconds since the epoch) the entry was queued. */
+  uint32_t queued_time;
+  /** IPv6 address of the mailbox proxy, all zero for local entries. */
+  uint8_t proxy[16];
+  /** Proxy handle of the entry. */
+  uint8_t handle;
+  /** Waiting messages are sent for this entry. */
+  uint8_t waiting_enabled;
+  /** Length of data. */
+  uint16_t data_len;
+  /** The queued IP packet. */
+  const uint8_t *data;
+} mb_journal_entry_t;
+
+/**
+ * Callback for each live entry found by mb_journal_open().
+ *
+ * The data pointer of the entry is only valid during the callback. The
+ * callback may append records, e.g., delete an entry it cannot restore.
+ */
+typedef void (*mb_journal_replay_cb_t)(const mb_journal_entry_t *e, void *user);
+
+/**
+ * Open the journal file and replay it.
+ *
+ * The file is created if it does not exist. If it belongs to another home
+ * ID, or it is not a journal file, it is reset.
+ *
+ * \param filename Path of the journal file.
+ * \param home_id Home ID of the current network.
+ * \param cb Called for each live entry in the journal, in queue order.
+ * \param user Passed to cb.
+ * \return 1 on success, 0 if the journal could not be opened.
+ */
+int mb_journal_open(const char *filename, uint32_t home_id,
+                    mb_journal_replay_cb_t cb, void *user);
+
+/**
+ * Flush and close the journal. Does nothing if the journal is not open.
+ *
+ * A compaction in progress is given up.
+ */
+void mb_journal_close(void);
+
+/**
+ * \return 1 if the journal is open.
+ */
+int mb_journal_is_open(void);
+
+/**
+ * Append an add record for a new mailbox entry.
+ *
+ * The id field of e is ignored.
+ *
+ * \return The journal id of the entry, or 0 if the record could not be
+ * written.
+ */
+uint32_t mb_journal_append_add(const mb_journal_entry_t *e);
+
+/**
+ * Append a delete record for the entry with journal id id.
+ */
+void mb_journal_append_del(uint32_t id);
+
+/**
+ * \return 1 if there are records appended since the last flush.
+ */
+int mb_journal_is_dirty(void);
+
+/**
+ * Schedule write-back of the records appended since the last flush.
+ *
+ * The write-back is asynchronous, it does not block on the storage.
+ */
+void mb_journal_flush(void);
+
+/**
+ * \return 1 if enough of the journal is taken up by deleted entries that it
+ * should be compacted.
+ */
+int mb_journal_should_compact(void);
+
+/**
+ * Start compaction of the journal.
+ *
+ * Compaction writes the live entries to a new file with
+ * mb_journal_compact_add() and replaces the journal with it in
+ * mb_journal_compact_commit().
+ *
+ * \return 1 on success, 0 if the new file could not be created.
+ */
+int mb_journal_compact_begin(void);
+
+/**
+ * Add a live entry to the compacted journal. The journal id of the entry is
+ * preserved.
+ *
+ * \return 1 on success, 0 on failure.
+ */
+int mb_journal_compact_add(const mb_journal_entry_t *e);
+
+/**
+ * Start replacing the journal with the compacted journal.
+ *
+ * The compacted file is synced in the background. Records appended in the
+ * meantime go to both files. Call mb_journal_compact_poll() until it
+ * returns 0 to finish the compaction.
+ *
+ * If compaction has failed, the compacted file is discarded and the journal
+ * is left unchanged.
+ */
+void mb_journal_compact_commit(void);
+
+/**
+ * Finish a compaction once its file has been synced.
+ *
+ * Replaces the journal with the compacted file, or discards the compacted
+ * file if it could not be synced.
+ *
+ * \return 1 if the compacted file is still being synced, 0 otherwise.
+ */
+int mb_journal_compact_poll(void);
+
+/**
+ * @}
+ */
+#endif /* MB_JOURNAL_H_ */
@@ -60,6 +60,7 @@ struct mcast_group {
    mcast_groupid_t prev;  /**< Previous element in linked list of use age. */
    mcast_groupid_t next;  /**< Next element in linked list of use age. */
   //mcast_groupid_t gid;  // GroupID is implicit as (1 + index in mcast_groups_list)
+   uint32_t hash;    /**< Hash of nlist, see mcast_nodemask_hash(). */
    nodemask_t nlist; /**< Actual node mask of the mcast group. */
 };
 
@@ -276,18 +277,41 @@ uint_least16_t mcast_byte_distance(uint8_t old, uint8_t new) {
  * \return Number of bits to change if it is possible (may be 0), MCAST_DIST_INF otherwise.
  */
 uint_least16_t mcast_nodemask_distance(const nodemask_t old_group, const nodemask_t new_group) {
-   uint_least16_t dist = 0;
-   uint_least16_t byte_dist = 0;
+   if (!nodemask_is_subset(old_group, new_group)) {
+      return MCAST_DIST_INF;
+   }
+   /* old_group is a subset, so the difference is what has to be added */
+   return nodemask_count(new_group) - nodemask_count(old_group);
+}
+
+/**
+ * Hash a nodemask, for finding the group of a mask without comparing
+ * it to every group.
+ *
+ * FNV-1a over the 64 bit words of the mask, folded to 32 bits.
+ */
+static uint32_t mcast_nodemask_hash(const nodemask_t nodemask) {
+   uint64_t hash = 0xCBF29CE484222325ULL;
+   uint64_t w;
    uint16_t ii;
 
-   for (ii=0; ii<sizeof(nodemask_t); ii++) {
-      byte_dist = mcast_byte_distance(old_group[ii], new_group[ii]);
-      if (byte_dist == MCAST_DIST_INF) {
-         return MCAST_DIST_INF;
-      }
-      dist = dist + byte_dist;
+   for (ii = 0; ii + sizeof(uint64_t) <= sizeof(nodemask_t); ii += sizeof(uint64_t)) {
+      memcpy(&w, nodemask + ii, sizeof(w));
+      hash = (hash ^ w) * 0x100000001B3ULL;
+   }
+   for (; ii < sizeof(nodemask_t); ii++) {
+      hash = (hash ^ nodemask[ii]) * 0x100000001B3ULL;
    }
-   return dist;
+   return (uint32_t) (hash ^ (hash >> 32));
+}
+
+/**
+ * Set the node mask of a group.
+ */
+static void mcast_group_set_nodemask(mcast_groupid_t group_id,
+                                     const nodemask_t nodemask, uint32_t hash) {
+   nodemask_copy(mcast_get_entry(group_id).nlist, nodemask);
+   mcast_get_entry(group_id).hash = hash;
 }
 
 /**
@@ -296,15 +320,26 @@ uint_least16_t mcast_nodemask_distance(const nodemask_t old_group, const nodemas
 
 mcast_groupid_t mcast_group_get_id_by_nodemask(const nodemask_t nodemask)
 {
-   nodemask_t empty = {0};
    mcast_groupid_t candidate = 0;
    mcast_groupid_t first_unused = 0;
    int_least16_t lowest_dist = 0xFF;
+   uint32_t hash;
 
-   if (nodemask_equal(nodemask, empty) == 0) {
+   if (nodemask_is_empty(nodemask)) {
       return 0;
    }
 
+   /* Look for the group itself first. Different masks rarely have the
+    * same hash, so this is usually a single mask comparison. */
+   hash = mcast_nodemask_hash(nodemask);
+   for (int ii = 0; ii < MCAST_MAX_GROUPS; ii++) {
+      if (mcast_groups_list[ii].in_use && mcast_groups_list[ii].hash == hash
+          && nodemask_equal(mcast_groups_list[ii].nlist, nodemask) == 0) {
+         mcast_group_use_age_update(ii+1);
+         return ii+1;
+      }
+   }
+
    for (int ii = 0; ii < MCAST_MAX_GROUPS; ii++) {
       if (mcast_groups_list[ii].in_use) {
          uint_least16_t tmp = mcast_nodemask_distance(mcast_groups_list[ii].nlist,
@@ -322,7 +357,7 @@ mcast_groupid_t mcast_group_get_id_by_nodemask(const nodemask_t nodemask)
    if (candidate) {
       if (lowest_dist != 0) {
          DBG_PRINTF("Expanding multicast group with id %u\n", candidate);
-         nodemask_copy(mcast_get_entry(candidate).nlist, nodemask);
+         mcast_group_set_nodemask(candidate, nodemask, hash);
       }
       mcast_group_use_age_update(candidate);
       return candidate;
@@ -338,7 +373,7 @@ mcast_groupid_t mcast_group_get_id_by_nodemask(const nodemask_t nodemask)
       mcast_group_use_age_element_insert_new(first_unused);
    }
    DBG_PRINTF("Adding multicast group with id %u\n", first_unused);
-   nodemask_copy(mcast_get_entry(first_unused).nlist, nodemask);
+   mcast_group_set_nodemask(first_unused, nodemask, hash);
    return first_unused;
 }
 
@@ -348,6 +383,7 @@ void mcast_group_init(void) {
       mcast_groups_list[ii].in_use = 0;
       mcast_groups_list[ii].next = 0;
       mcast_groups_list[ii].prev = 0;
+      mcast_groups_list[ii].hash = 0;
       memset(mcast_groups_list[ii].nlist, 0, sizeof(mcast_groups_list[ii].nlist));
    }
    mcast_group_use_age_head = 0;
@@ -19,6 +19,11 @@
 #include "crc32alg.h"
 #include "ZIP_Router_logging.h"
 #include "DTLS_server.h"
+#include "zw_node_latency.h"
+#include "zgw_metrics.h"
+
+/** Time a first attempt is given to reach a node without latency estimate */
+#define FIRST_ATTEMPT_TIMEOUT 800
 #define UIP_IP_BUF                          ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 struct uip_packetqueue_handle first_attempt_queue;
 struct uip_packetqueue_handle long_queue;
@@ -439,7 +444,8 @@ static void queue_send_done(BYTE status, BYTE* sent_buffer, uint16_t send_len)
   }
 
   queue_state = QS_IDLE;
-  process_post(&zip_process, ZIP_EVENT_QUEUE_UPDATED, 0);
+  /* Called from the Serial API callback, after the Z/IP ACK went out */
+  process_post_prio(&zip_process, ZIP_EVENT_QUEUE_UPDATED, 0, PROCESS_PRIO_HIGH);
 }
 
 /**
@@ -461,8 +467,6 @@ process_node_queues()
       ClassicZIPNode_setTXOptions(
       TRANSMIT_OPTION_ACK);
       ClassicZIPNode_sendNACK(FALSE);
-      /* TODO-KM: Why is the timeout 800ms here?? */
-      ctimer_set(&queue_timer, 800, queue_send_timeout, q);
       DBG_PRINTF("Sending first attempt\n");
     }
     else if (uip_packetqueue_len(&long_queue))
@@ -498,6 +502,14 @@ process_node_queues()
 
       already_requeued = isPacketRequeued(uip_packetqueue_buf(q));
 
+      if (queue_state == QS_SENDING_FIRST)
+      {
+        /* A first attempt may be a nonce exchange followed by the frame.
+         * Nodes get twice the time one of their exchanges usually takes. */
+        ctimer_set(&queue_timer, 2 * zw_node_latency_tx_timeout(node, FIRST_ATTEMPT_TIMEOUT / 2),
+                   queue_send_timeout, q);
+      }
+
       if (!ClassicZIPNode_input(node, queue_send_done, FALSE, already_requeued))
       {
         queue_send_done(TRANSMIT_COMPLETE_FAIL, 0, 0);
@@ -516,6 +528,23 @@ process_node_queues()
   }
 }
 
+static int64_t first_attempt_queue_length(void)
+{
+  return uip_packetqueue_len(&first_attempt_queue);
+}
+
+static int64_t long_queue_length(void)
+{
+  return uip_packetqueue_len(&long_queue);
+}
+
+ZGW_SAMPLED_GAUGE(first_attempt_queue_gauge, "zgw_node_queue_first_attempt_length",
+                  "Frames waiting for their first attempt to be sent to a node",
+                  first_attempt_queue_length);
+ZGW_SAMPLED_GAUGE(long_queue_gauge, "zgw_node_queue_long_length",
+                  "Frames waiting to be sent again to a node",
+                  long_queue_length);
+
 void
 node_queue_init()
 {
@@ -534,4 +563,6 @@ node_queue_init()
   uip_packetqueue_new(&first_attempt_queue);
   uip_packetqueue_new(&long_queue);
   queue_state = QS_IDLE;
+  zgw_metrics_register(&first_attempt_queue_gauge);
+  zgw_metrics_register(&long_queue_gauge);
 }
@@ -5,6 +5,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
 
 #include <assert.h>
 #include <provisioning_list.h>
@@ -40,6 +43,60 @@
 /** The provisioning list. */
 static provisioning_list_t pvs_list[PROVISIONING_LIST_SIZE];
 
+/**
+ * Number of buckets in each of the provisioning list indexes.  Must
+ * be a power of 2.
+ */
+#define PVS_INDEX_BUCKETS 1024
+
+/** End of an index chain. */
+#define PVS_INDEX_NONE 0xFFFF
+
+#if PROVISIONING_LIST_SIZE >= PVS_INDEX_NONE
+#error "PROVISIONING_LIST_SIZE is too large for the provisioning list indexes"
+#endif
+
+/** Length of the DSK prefix that an S2 inclusion challenge is matched on. */
+#define PVS_CHALLENGE_KEY_LEN 14
+
+/** The indexes on the provisioning list.
+ *
+ * Every index is a hash table of chains of pvs_list slots, so a
+ * lookup only compares the provisions in one chain.  An entry
+ * without a key, e.g., a DSK that is too short to contain a HomeID,
+ * is not in that index.
+ */
+typedef enum {
+    PVS_INDEX_DSK,       /**< The full DSK. */
+    PVS_INDEX_HOMEID,    /**< The SmartStart HomeID derived from the DSK. */
+    PVS_INDEX_CHALLENGE, /**< Byte 2 to 15 of the DSK, see provisioning_list_dev_match_challenge(). */
+    PVS_INDEX_COUNT
+} pvs_index_t;
+
+/** First slot of each chain. */
+static uint16_t pvs_index_head[PVS_INDEX_COUNT][PVS_INDEX_BUCKETS];
+/** Next slot in the chain of each slot. */
+static uint16_t pvs_index_next[PVS_INDEX_COUNT][PROVISIONING_LIST_SIZE];
+/** Set when the chain heads have been initialized. */
+static uint8_t pvs_index_ready = 0;
+
+/** Empty all the indexes. */
+static void pvs_index_reset(void);
+
+/** Add the provision in slot to the indexes. */
+static void pvs_index_insert(uint16_t slot);
+
+/** Remove the provision in slot from the indexes.  Must be called
+ * before the dsk of the slot is released. */
+static void pvs_index_remove(uint16_t slot);
+
+/**
+ * Find the first slot in the chain of an index key.
+ *
+ * \return The slot, or PVS_INDEX_NONE if the chain is empty.
+ */
+static uint16_t pvs_index_first(pvs_index_t idx, const uint8_t *key, uint8_t key_len)__attribute__((nonnull));
+
 
 /** Add a new provision unconditionally.
  */
@@ -73,15 +130,36 @@ static void pvs_tlv_print(FILE *strm, /*@null@*/struct pvs_tlv *tlvs)__attribute
  * elsewhere. */
 /*@null@*/static const char *pvs_store_filename = PROVISIONING_LIST_STORE_FILENAME_DEFAULT;
 
-/** File formatting helper. */
+/** File formatting helper.
+ *
+ * Version 1.1 files can contain journal records.  Version 1.0 files
+ * only contain entries, so they are also read by this version. */
 #ifdef PVS_TEST
-static const char *pvs_store_hdr = "zgwpvssttstv1.0";
+static const char *pvs_store_hdr = "zgwpvssttstv1.1";
+static const char *pvs_store_hdr_v10 = "zgwpvssttstv1.0";
 #else
-static const char *pvs_store_hdr = "zgwpvsstorev1.0";
+static const char *pvs_store_hdr = "zgwpvsstorev1.1";
+static const char *pvs_store_hdr_v10 = "zgwpvsstorev1.0";
 #endif
 /** File formatting helper. */
 static const char * pvs_entry_hdr_fmt = "pvs entry 000";
 static const char * pvs_fmt = "pvs entry %03d";
+/** Header of a journal record that removes a device.  Same length as
+ * pvs_entry_hdr_fmt. */
+static const char * pvs_del_hdr = "pvs del entry";
+
+/**
+ * Number of journal records that can be appended to the storage file
+ * on top of the number of devices in the list before the file is
+ * compacted.
+ */
+#ifndef PVS_JOURNAL_SLACK
+#define PVS_JOURNAL_SLACK 64
+#endif
+
+/** Number of journal records appended since the storage file was
+ * last written in full. */
+static uint16_t pvs_journal_records = 0;
 
 
 static pvs_result_t pvs_list_store_find_file(const char *filename);
@@ -117,18 +195,61 @@ static pvs_result_t pvs_list_store_setup_and_import_file(/*@null@*/const char *f
 /**
  * Populate the provisioning list from an open storage file.
  * Assume that the provisioning list is empty.
+ *
+ * The entries of the file are imported, and then the journal records
+ * are replayed in the order they were written.  An incomplete record
+ * at the end of the file, e.g., after a power cut, is ignored.
  */
 static pvs_result_t pvs_list_import_file(FILE *strm)__attribute__((nonnull));
 
-/** Import one device provision from file.
+/** Import one entry or journal record from file.
+ * \return PVS_ERROR at the end of the file or if the record is incomplete.
  */
-static pvs_result_t pvs_list_dev_import(FILE *strm, uint16_t ii)__attribute__((nonnull));
+static pvs_result_t pvs_list_record_import(FILE *strm)__attribute__((nonnull));
+
+/** Read the provision of an entry from file.
+ *
+ * On success, pvs owns a newly allocated dsk and tlv list.
+ */
+static pvs_result_t pvs_list_dev_read(FILE *strm, struct provision *pvs)__attribute__((nonnull));
+
+/** Insert pvs in the provisioning list, replacing the provision with
+ * the same DSK if there is one.  The list takes over the dsk and
+ * tlvs of pvs. */
+static pvs_result_t pvs_dev_put(const struct provision *pvs)__attribute__((nonnull));
+
+/** Release the provision in a slot of the provisioning list and
+ * remove it from the indexes. */
+static void pvs_dev_release(uint16_t slot);
 
 /**
  * Clear the storage file and dump the current pvs_list instead.
+ *
+ * The new file is written next to the old one, synced and renamed, and
+ * then the directory is synced, so a power cut leaves either the old or
+ * the new file.
  */
 static void pvs_list_persist_in_file(void);
 
+/**
+ * Open the storage file for appending a journal record.
+ *
+ * If the journal has grown larger than the list itself, the file is
+ * compacted instead, and NULL is returned.  The change to be recorded
+ * must already be applied to the list.
+ */
+/*@null@*/static FILE * pvs_list_journal_open(void);
+
+/**
+ * Record a new or modified device in the storage file.
+ */
+static void pvs_list_journal_put(const struct provision *pvs)__attribute__((nonnull));
+
+/**
+ * Record a removed device in the storage file.
+ */
+static void pvs_list_journal_del(uint8_t dsk_len, const uint8_t *dsk)__attribute__((nonnull));
+
 /**
  * Update the provisioning list storage with one new/modified item.
  *
@@ -144,47 +265,295 @@ static pvs_result_t pvs_list_dev_store(FILE *strm, const struct provision *pvs,
    Locals
    **** */
 
+/* **** Indexes ****/
+
+/** FNV-1a hash of an index key, folded to a bucket. */
+static uint16_t pvs_index_bucket(const uint8_t *key, uint8_t key_len)
+{
+    uint32_t h = 2166136261u;
+    uint8_t ii;
+
+    for (ii = 0; ii < key_len; ii++)
+    {
+        h = (h ^ key[ii]) * 16777619u;
+    }
+    return (uint16_t)((h ^ (h >> 16)) & (PVS_INDEX_BUCKETS - 1));
+}
+
+/** Write the SmartStart HomeID of a DSK to homeid.
+ *
+ * The HomeID is byte 8 to 11 of the DSK with the two most
+ * significant bits set and the least significant bit cleared.
+ *
+ * \return 0 if the dsk is too short to contain a HomeID.
+ */
+static int pvs_dsk_homeid(const struct provision *pvs, uint8_t homeid[4])
+{
+    if (pvs->dsk_len < 12 || pvs->dsk == NULL) {
+        return 0;
+    }
+    memcpy(homeid, &(pvs->dsk[8]), 4);
+    homeid[0] |= 0xC0;
+    homeid[3] &= 0xFE;
+    return 1;
+}
+
+/** Find the key of the provision in slot in an index.
+ *
+ * \param buf Space for a key that is not stored in the provision.
+ * \return The key, or NULL if the provision is not in the index.
+ */
+static const uint8_t * pvs_index_key(pvs_index_t idx, uint16_t slot,
+                                     uint8_t buf[4], uint8_t *key_len)
+{
+    const struct provision *pvs = &pvs_list[slot];
+
+    if (pvs->dsk == NULL) {
+        return NULL;
+    }
+    switch (idx) {
+    case PVS_INDEX_DSK:
+        *key_len = pvs->dsk_len;
+        return pvs->dsk;
+    case PVS_INDEX_HOMEID:
+        *key_len = 4;
+        return pvs_dsk_homeid(pvs, buf) ? buf : NULL;
+    case PVS_INDEX_CHALLENGE:
+        if (pvs->dsk_len < 2 + PVS_CHALLENGE_KEY_LEN) {
+            return NULL;
+        }
+        *key_len = PVS_CHALLENGE_KEY_LEN;
+        return &(pvs->dsk[2]);
+    default:
+        return NULL;
+    }
+}
+
+static void pvs_index_reset(void)
+{
+    memset(pvs_index_head, 0xFF, sizeof(pvs_index_head));
+    pvs_index_ready = 1;
+}
+
+static void pvs_index_insert(uint16_t slot)
+{
+    const uint8_t *key;
+    uint8_t buf[4];
+    uint8_t key_len;
+    uint16_t b;
+    int idx;
+
+    if (!pvs_index_ready) {
+        pvs_index_reset();
+    }
+    for (idx = 0; idx < PVS_INDEX_COUNT; idx++)
+    {
+        key = pvs_index_key(idx, slot, buf, &key_len);
+        if (key == NULL) {
+            continue;
+        }
+        b = pvs_index_bucket(key, key_len);
+        pvs_index_next[idx][slot] = pvs_index_head[idx][b];
+        pvs_index_head[idx][b] = slot;
+    }
+}
+
+static void pvs_index_remove(uint16_t slot)
+{
+    const uint8_t *key;
+    uint8_t buf[4];
+    uint8_t key_len;
+    uint16_t *link;
+    int idx;
+
+    for (idx = 0; idx < PVS_INDEX_COUNT; idx++)
+    {
+        key = pvs_index_key(idx, slot, buf, &key_len);
+        if (key == NULL) {
+            continue;
+        }
+        link = &pvs_index_head[idx][pvs_index_bucket(key, key_len)];
+        while (*link != PVS_INDEX_NONE && *link != slot)
+        {
+            link = &pvs_index_next[idx][*link];
+        }
+        if (*link == slot) {
+            *link = pvs_index_next[idx][slot];
+        }
+    }
+}
+
+static uint16_t pvs_index_first(pvs_index_t idx, const uint8_t *key, uint8_t key_len)
+{
+    if (!pvs_index_ready) {
+        /* The list is empty until it is initialized. */
+        return PVS_INDEX_NONE;
+    }
+    return pvs_index_head[idx][pvs_index_bucket(key, key_len)];
+}
+
 /* **** Storage in file stuff ****/
 
+/**
+ * Write the directory holding a file to disk, to make a rename of the file
+ * durable.
+ */
+static void pvs_sync_dir(const char *filename)
+{
+    char *path = strdup(filename);
+    int fd;
+
+    if (path == NULL) {
+        return;
+    }
+    fd = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        if (fsync(fd) != 0) {
+            WRN_PRINTF("Failed to sync the directory of %s: %s (%d)\n",
+                       filename, strerror(errno), errno);
+        }
+        close(fd);
+    }
+    free(path);
+}
+
 static void pvs_list_persist_in_file()
 {
-    FILE *strm;
+    FILE *strm = NULL;
     size_t written;
-    pvs_result_t res;
+    pvs_result_t res = PVS_SUCCESS;
     uint16_t ii;
+    char *tmp_filename;
+    const char *filename;
 
     if (!pvs_store_filename) {
         return;
     }
 
-    /* Open file, dumping the previous content. */
-    strm = fopen(pvs_store_filename, "w");
-    if (strm == NULL) {
-        ERR_PRINTF("Failed to open provisioning list file %s: %s (%d)\n",
-                   pvs_store_filename, strerror(errno), errno);
-        return;
+    tmp_filename = malloc(strlen(pvs_store_filename) + sizeof(".tmp"));
+    if (tmp_filename != NULL) {
+        sprintf(tmp_filename, "%s.tmp", pvs_store_filename);
+        strm = fopen(tmp_filename, "w");
+        if (strm == NULL) {
+            /* E.g., the directory is not writeable, try the file itself. */
+            free(tmp_filename);
+            tmp_filename = NULL;
+        }
     }
+    if (tmp_filename == NULL) {
+        /* Open file, dumping the previous content. */
+        strm = fopen(pvs_store_filename, "w");
+        if (strm == NULL) {
+            ERR_PRINTF("Failed to open provisioning list file %s: %s (%d)\n",
+                       pvs_store_filename, strerror(errno), errno);
+            return;
+        }
+    }
+    filename = tmp_filename ? tmp_filename : pvs_store_filename;
     written = fwrite(pvs_store_hdr, strlen(pvs_store_hdr), 1, strm);
     if (written != 1) {
         ERR_PRINTF("Failed to write to provisioning list file %s: %s (%d)\n",
-                   pvs_store_filename, strerror(errno), errno);
-        (void)fclose(strm);
-        return;
+                   filename, strerror(errno), errno);
+        res = PVS_ERROR;
     }
 
-    for (ii = 0; ii < PROVISIONING_LIST_SIZE; ii++)
+    for (ii = 0; ii < PROVISIONING_LIST_SIZE && res == PVS_SUCCESS; ii++)
     {
         if (pvs_list[ii].dsk_len)
         {
+            /* No need to continue writing after an error */
             res = pvs_list_dev_store(strm, &pvs_list[ii], ii);
-            if (PVS_ERROR == res) {
-                /* No need to continue writing */
-                break;
-            }
         }
     }
 
-    (void)fclose(strm);
+    /* The new file must be on disk before it replaces the old one. */
+    if (res == PVS_SUCCESS
+        && (fflush(strm) != 0 || fsync(fileno(strm)) != 0)) {
+        ERR_PRINTF("Failed to sync provisioning list file %s: %s (%d)\n",
+                   filename, strerror(errno), errno);
+        res = PVS_ERROR;
+    }
+    if (fclose(strm) != 0) {
+        res = PVS_ERROR;
+    }
+    if (tmp_filename != NULL) {
+        if (res == PVS_SUCCESS && rename(tmp_filename, pvs_store_filename) != 0) {
+            ERR_PRINTF("Failed to rename %s to %s: %s (%d)\n",
+                       tmp_filename, pvs_store_filename, strerror(errno), errno);
+            res = PVS_ERROR;
+        }
+        if (res == PVS_SUCCESS) {
+            pvs_sync_dir(pvs_store_filename);
+        }
+        if (res == PVS_ERROR) {
+            /* Keep the old file and its journal. */
+            (void)remove(tmp_filename);
+        }
+        free(tmp_filename);
+    }
+    if (res == PVS_SUCCESS) {
+        pvs_journal_records = 0;
+    }
+}
+
+static FILE * pvs_list_journal_open(void)
+{
+    FILE *strm;
+
+    if (!pvs_store_filename) {
+        return NULL;
+    }
+    if (pvs_journal_records >= provisioning_list_get_count() + PVS_JOURNAL_SLACK) {
+        pvs_list_persist_in_file();
+        return NULL;
+    }
+    strm = fopen(pvs_store_filename, "a");
+    if (strm == NULL) {
+        ERR_PRINTF("Failed to open provisioning list file %s: %s (%d)\n",
+                   pvs_store_filename, strerror(errno), errno);
+        return NULL;
+    }
+    if (fseek(strm, 0, SEEK_END) != 0 || ftell(strm) <= 0) {
+        /* The file has disappeared, start a new one with a header. */
+        (void)fclose(strm);
+        pvs_list_persist_in_file();
+        return NULL;
+    }
+    pvs_journal_records++;
+    return strm;
+}
+
+static void pvs_list_journal_put(const struct provision *pvs)
+{
+    FILE *strm = pvs_list_journal_open();
+    pvs_result_t res;
+
+    if (strm == NULL) {
+        return;
+    }
+    res = pvs_list_dev_store(strm, pvs, (uint16_t)(pvs - pvs_list));
+    if (fclose(strm) != 0 || res == PVS_ERROR) {
+        /* The file may end in half a record, write it in full instead. */
+        pvs_list_persist_in_file();
+    }
+}
+
+static void pvs_list_journal_del(uint8_t dsk_len, const uint8_t *dsk)
+{
+    FILE *strm = pvs_list_journal_open();
+    size_t res;
+
+    if (strm == NULL) {
+        return;
+    }
+    res = fwrite(pvs_del_hdr, strlen(pvs_del_hdr), 1, strm);
+    res += fwrite(&dsk_len, sizeof(dsk_len), 1, strm);
+    res += fwrite(dsk, dsk_len, 1, strm);
+    if (fclose(strm) != 0 || res != 3) {
+        WRN_PRINTF("Failed to write removal to provisioning list file: %s (%d).\n",
+                   strerror(errno), errno);
+        pvs_list_persist_in_file();
+    }
 }
 
 /**
@@ -370,111 +739,172 @@ static void pvs_list_store_setup_and_import(const char *filename)
 static pvs_result_t pvs_list_import_file(FILE *strm)
 {
     char txt[16];
-    uint16_t ii;
-    pvs_result_t res;
+    uint32_t records = 0;
     size_t rd;
+    int c;
 
     rd = fread(txt, strlen(pvs_store_hdr), 1, strm);
-    if ((rd != 1) || (strncmp(txt, pvs_store_hdr, strlen(pvs_store_hdr)) != 0)) {
+    if ((rd != 1)
+        || ((strncmp(txt, pvs_store_hdr, strlen(pvs_store_hdr)) != 0)
+            && (strncmp(txt, pvs_store_hdr_v10, strlen(pvs_store_hdr_v10)) != 0))) {
         return PVS_ERROR;
     }
-    for (ii = 0; ii < PROVISIONING_LIST_SIZE; ii++)
+    while ((c = fgetc(strm)) != EOF)
     {
-        res = pvs_list_dev_import(strm, ii);
-        if (res == PVS_ERROR) {
-            DBG_PRINTF("Imported %u provisions, stored %u\n", ii, provisioning_list_get_count());
-            if (ii != provisioning_list_get_count()) {
-                ERR_PRINTF("Errors during provisioning list import, item %u.\n", ii);
-            }
+        (void)ungetc(c, strm);
+        if (pvs_list_record_import(strm) == PVS_ERROR) {
+            /* Normally a record that was cut short when the gateway
+             * stopped.  The rest of the file cannot be trusted. */
+            ERR_PRINTF("Errors during provisioning list import, record %u.\n", records);
             break;
         }
+        records++;
     }
+    DBG_PRINTF("Imported %u records, stored %u provisions\n",
+               records, provisioning_list_get_count());
     return PVS_SUCCESS;
 }
 
-static pvs_result_t pvs_list_dev_import(FILE *strm, uint16_t ii)
+static pvs_result_t pvs_list_record_import(FILE *strm)
 {
     struct provision pvs;
-    struct pvs_tlv tlv;
-    uint8_t val[256];
-    uint8_t *dsk;
+    struct provision *prev;
     char   txt[14];
-    pvs_result_t res;
+    uint8_t dsk_len;
+    uint8_t dsk[256];
     size_t rd;
 
-    pvs.dsk = NULL;
-    pvs.tlv_list = NULL;
     rd = fread(txt, strlen(pvs_entry_hdr_fmt), 1, strm);
     if (rd != 1) {
         /* This can be an error or EOF */
-        //printf("Finished reading from provisioning list store file.\n");
         return PVS_ERROR;
     }
-    /*@ignore@*/
     txt[strlen(pvs_entry_hdr_fmt)] = '\0';
-    if (strncmp(txt, pvs_entry_hdr_fmt, 10) == 0) {
-//        printf("Reading entry %d from file (%s)\n", ii, txt);
-    } else {
-        WRN_PRINTF("Import error on entry %d\n", ii);
-    }
-    rd = fread(&pvs, sizeof(struct provision), 1, strm);
-    if (rd == 1) {
-        /* The dsk pointer here is invalid, but still confuses lint.*/
-        if (pvs.dsk_len < 4) {
-            return PVS_ERROR;
-        } else {
-            dsk = malloc(pvs.dsk_len);
-            if (dsk == NULL) {
-                return PVS_ERROR;
-            } else {
-                rd = fread(dsk, pvs.dsk_len, 1, strm);
-            }
-            pvs.dsk = dsk;
+
+    if (strcmp(txt, pvs_del_hdr) == 0) {
+        rd = fread(&dsk_len, sizeof(dsk_len), 1, strm);
+        if (rd == 1 && dsk_len > 0) {
+            rd = fread(dsk, dsk_len, 1, strm);
         }
-    }
-    if (pvs.tlv_list != NULL) {
-        /* The pointer here is invalid, but still confuses lint.*/
-        /* Start over creating the list */
-        pvs.tlv_list = NULL;
-#ifdef PVS_TEST
-        pvs.num_tlvs = 0;
-#endif
-        rd = fread(&tlv, sizeof(struct pvs_tlv), 1, strm);
         if (rd != 1) {
-            WRN_PRINTF("Error reading first tlv, %s (%d)\n", strerror(errno), errno);
+            WRN_PRINTF("Incomplete removal record in provisioning list file\n");
             return PVS_ERROR;
         }
-        rd = fread(&val, tlv.length, 1, strm);
-        if (rd != 1) {
-            WRN_PRINTF("Error reading first tlv value, expected length %u\n", tlv.length);
-            return PVS_ERROR;
+        prev = provisioning_list_dev_get(dsk_len, dsk);
+        if (prev) {
+            pvs_dev_release(prev - pvs_list);
         }
-        res = pvs_tlv_set(&pvs, tlv.type, tlv.length, val, NULL);
-        if (res != PVS_SUCCESS) {
-            WRN_PRINTF("Error populating first tlv\n");
-            return PVS_ERROR;
+        return PVS_SUCCESS;
+    }
+
+    if (strncmp(txt, pvs_entry_hdr_fmt, 10) != 0) {
+        WRN_PRINTF("Import error on record %s\n", txt);
+    }
+    if (pvs_list_dev_read(strm, &pvs) == PVS_ERROR) {
+        return PVS_ERROR;
+    }
+    if (pvs_dev_put(&pvs) == PVS_ERROR) {
+        /* The list is full, skip the device but keep reading. */
+        free(pvs.dsk);
+        pvs_tlv_clear(pvs.tlv_list);
+    }
+    return PVS_SUCCESS;
+}
+
+static pvs_result_t pvs_dev_put(const struct provision *pvs)
+{
+    struct provision *prev;
+    uint16_t ii;
+
+    prev = provisioning_list_dev_get(pvs->dsk_len, pvs->dsk);
+    if (prev) {
+        /* Same DSK, so the slot stays in the same index chains. */
+        free(prev->dsk);
+        pvs_tlv_clear(prev->tlv_list);
+        memcpy(prev, pvs, sizeof(struct provision));
+        return PVS_SUCCESS;
+    }
+    for (ii = 0; ii < PROVISIONING_LIST_SIZE; ii++)
+    {
+        if (pvs_list[ii].dsk_len == 0) {
+            memcpy(&pvs_list[ii], pvs, sizeof(struct provision));
+            pvs_index_insert(ii);
+            return PVS_SUCCESS;
         }
+    }
+    ERR_PRINTF("No room for imported provision in the provisioning list\n");
+    return PVS_ERROR;
+}
 
-        while (tlv.next != NULL) {
-            rd = fread(&tlv, sizeof(struct pvs_tlv), 1, strm);
-            if (rd != 1) {
-                WRN_PRINTF("Error reading tlv\n");
-                return PVS_ERROR;
-            }
+static void pvs_dev_release(uint16_t slot)
+{
+    pvs_index_remove(slot);
+    pvs_list[slot].dsk_len = 0;
+    free(pvs_list[slot].dsk);
+    pvs_list[slot].dsk = NULL;
+    pvs_tlv_clear(pvs_list[slot].tlv_list);
+#ifdef PVS_TEST
+    pvs_list[slot].num_tlvs = 0;
+#endif
+    pvs_list[slot].tlv_list = NULL;
+}
+
+static pvs_result_t pvs_list_dev_read(FILE *strm, struct provision *pvs)
+{
+    struct pvs_tlv tlv;
+    uint8_t val[256];
+    uint8_t *dsk;
+    int more_tlvs;
+    pvs_result_t res;
+    size_t rd;
+
+    /*@ignore@*/
+    rd = fread(pvs, sizeof(struct provision), 1, strm);
+    /* The pointers here are invalid, but still confuse lint.*/
+    more_tlvs = (pvs->tlv_list != NULL);
+    pvs->dsk = NULL;
+    pvs->tlv_list = NULL;
+#ifdef PVS_TEST
+    pvs->num_tlvs = 0;
+#endif
+    if (rd != 1 || pvs->dsk_len < 4) {
+        return PVS_ERROR;
+    }
+    dsk = malloc(pvs->dsk_len);
+    if (dsk == NULL) {
+        return PVS_ERROR;
+    }
+    rd = fread(dsk, pvs->dsk_len, 1, strm);
+    if (rd != 1) {
+        free(dsk);
+        return PVS_ERROR;
+    }
+    pvs->dsk = dsk;
+
+    /* Start over creating the list */
+    while (more_tlvs) {
+        rd = fread(&tlv, sizeof(struct pvs_tlv), 1, strm);
+        if (rd == 1) {
             rd = fread(&val, tlv.length, 1, strm);
-            if (rd != 1) {
-                WRN_PRINTF("Error reading tlv value\n");
-                return PVS_ERROR;
-            }
-            res = pvs_tlv_set(&pvs, tlv.type, tlv.length, val, NULL);
+        }
+        if (rd != 1) {
+            WRN_PRINTF("Error reading tlv, expected length %u\n", tlv.length);
+            res = PVS_ERROR;
+        } else {
+            res = pvs_tlv_set(pvs, tlv.type, tlv.length, val, NULL);
             if (res != PVS_SUCCESS) {
                 WRN_PRINTF("Error populating tlv\n");
-                return PVS_ERROR;
             }
         }
+        if (res != PVS_SUCCESS) {
+            free(pvs->dsk);
+            pvs->dsk = NULL;
+            pvs_tlv_clear(pvs->tlv_list);
+            pvs->tlv_list = NULL;
+            return PVS_ERROR;
+        }
+        more_tlvs = (tlv.next != NULL);
     }
-
-    memcpy(&pvs_list[ii], &pvs, sizeof(struct provision));
     /*@end@*/
     return PVS_SUCCESS;
 }
@@ -495,6 +925,7 @@ void provisioning_list_init(/*@null@*/const char* storage_filename, /*@null@*/co
 {
     /* Zero provisioning list. */
     memset(pvs_list, 0, sizeof(struct provision) * PROVISIONING_LIST_SIZE);
+    pvs_index_reset();
 
     /* Do we have a persisten storage file to import from?  Otherwise
      * this is a "first run", initialize from config. */
@@ -576,6 +1007,7 @@ void provisioning_list_clear()
 #endif
         pvs_list[i].tlv_list = NULL;
     }
+    pvs_index_reset();
     pvs_list_persist_in_file();
 }
 
@@ -705,8 +1137,9 @@ static struct provision * pvs_dev_add(uint8_t dsk_len, uint8_t *dsk, provisionin
                 pvs_list[i].num_tlvs = 0;
 #endif
                 pvs_list[i].tlv_list = NULL;
+                pvs_index_insert(i);
                 ret = &(pvs_list[i]);
-                pvs_list_persist_in_file();
+                pvs_list_journal_put(ret);
             }
             break;
         }
@@ -728,7 +1161,7 @@ struct provision * provisioning_list_dev_set(uint8_t dsk_len, uint8_t *dsk, prov
 
     if (prev) {
         prev->bootmode = bootmode;
-        pvs_list_persist_in_file();
+        pvs_list_journal_put(prev);
         return prev;
     } else {
         return pvs_dev_add(dsk_len, dsk, bootmode);
@@ -737,19 +1170,18 @@ struct provision * provisioning_list_dev_set(uint8_t dsk_len, uint8_t *dsk, prov
 
 struct provision * provisioning_list_dev_get(uint8_t dsk_len, const uint8_t *dsk)
 {
-    int i = 0;
+    uint16_t i;
 
     if (dsk_len < 4) {
         return NULL;
     }
 
-    for (i = 0; i < PROVISIONING_LIST_SIZE; i++)
+    for (i = pvs_index_first(PVS_INDEX_DSK, dsk, dsk_len);
+         i != PVS_INDEX_NONE;
+         i = pvs_index_next[PVS_INDEX_DSK][i])
     {
-        if (pvs_list[i].dsk_len != dsk_len || pvs_list[i].dsk == NULL) {
-            continue;
-        }
-
-        if (memcmp(pvs_list[i].dsk, dsk, dsk_len) == 0)
+        if (pvs_list[i].dsk_len == dsk_len
+            && memcmp(pvs_list[i].dsk, dsk, dsk_len) == 0)
         {
             return &pvs_list[i];
         }
@@ -759,25 +1191,24 @@ struct provision * provisioning_list_dev_get(uint8_t dsk_len, const uint8_t *dsk
 
 struct provision * provisioning_list_dev_get_homeid(uint8_t *homeid)
 {
-    int i = 0;
+    uint16_t i;
+    uint16_t found = PVS_INDEX_NONE;
     uint8_t buf[4];
 
-    for (i = 0; i < PROVISIONING_LIST_SIZE; i++)
+    /* Several DSKs can map to the same HomeID.  Return the one in the
+     * lowest slot, as it is the one that was added first. */
+    for (i = pvs_index_first(PVS_INDEX_HOMEID, homeid, 4);
+         i != PVS_INDEX_NONE;
+         i = pvs_index_next[PVS_INDEX_HOMEID][i])
     {
-        /* If the dsk is shorter than 12 bytes, it will not match. */
-        if (pvs_list[i].dsk_len < 12 || pvs_list[i].dsk == NULL)
-            continue;
-
-        memcpy(buf, &(pvs_list[i].dsk[8]), 4);
-        buf[0] |= 0xC0;
-        buf[3] &= 0xFE;
-
-        if (memcmp(buf, homeid, 4) == 0)
+        if (i < found
+            && pvs_dsk_homeid(&pvs_list[i], buf)
+            && memcmp(buf, homeid, 4) == 0)
         {
-            return &pvs_list[i];
+            found = i;
         }
     }
-    return NULL;
+    return (found == PVS_INDEX_NONE) ? NULL : &pvs_list[found];
 }
 
 static struct provision * pvs_dev_get_idx(uint8_t dsk_len, uint8_t *dsk, uint8_t start_idx)
@@ -813,37 +1244,43 @@ struct provision * provisioning_list_dev_match_challenge(uint8_t challenge_len,
     challenge_len = 16;
   }
 
+  if (challenge_len == 2 + PVS_CHALLENGE_KEY_LEN)
+  {
+    /* The normal case, a challenge with a full public key. */
+    uint16_t i;
+    uint16_t found = PVS_INDEX_NONE;
+
+    for (i = pvs_index_first(PVS_INDEX_CHALLENGE, &challenge[2], PVS_CHALLENGE_KEY_LEN);
+         i != PVS_INDEX_NONE;
+         i = pvs_index_next[PVS_INDEX_CHALLENGE][i])
+    {
+      if (i < found
+          && memcmp(&(pvs_list[i].dsk[2]), &challenge[2], PVS_CHALLENGE_KEY_LEN) == 0)
+      {
+        found = i;
+      }
+    }
+    return (found == PVS_INDEX_NONE) ? NULL : &pvs_list[found];
+  }
+
+  /* Only a part of the key is known, so the index cannot be used. */
   return pvs_dev_get_idx(challenge_len-2, &challenge[2], 2);
 }
 
 int provisioning_list_dev_remove(uint8_t dsk_len, uint8_t *dsk)
 {
-    int i = 0;
-    int ret = PVS_ERROR;
+    struct provision *pvs;
+    uint16_t i;
 
-    if (dsk_len < 4) {
-        return ret;
+    pvs = provisioning_list_dev_get(dsk_len, dsk);
+    if (pvs == NULL) {
+        return PVS_ERROR;
     }
+    i = pvs - pvs_list;
 
-    for (i = 0; i < PROVISIONING_LIST_SIZE; i++)
-    {
-        if ((pvs_list[i].dsk != NULL)
-            && (pvs_list[i].dsk_len == dsk_len)
-            && (memcmp(pvs_list[i].dsk, dsk, dsk_len) == 0))
-        {
-            pvs_list[i].dsk_len = 0;
-            free(pvs_list[i].dsk);
-            pvs_tlv_clear(pvs_list[i].tlv_list);
-#ifdef PVS_TEST
-            pvs_list[i].num_tlvs = 0;
-#endif
-            pvs_list[i].tlv_list = NULL;
-            pvs_list_persist_in_file();
-            ret = PVS_SUCCESS;
-            break;
-        }
-    }
-    return ret;
+    pvs_dev_release(i);
+    pvs_list_journal_del(dsk_len, dsk);
+    return PVS_SUCCESS;
 }
 
 /* The pseudo tlvs */
@@ -854,7 +1291,7 @@ int provisioning_list_bootmode_set(struct provision *pvs, provisioning_bootmode_
     }
 
     pvs->bootmode = bootmode;
-    pvs_list_persist_in_file();
+    pvs_list_journal_put(pvs);
     return PVS_SUCCESS;
 }
 
@@ -876,7 +1313,7 @@ int provisioning_list_tlv_set(struct provision *pvs, uint8_t type, uint8_t len,
 
         res = pvs_tlv_set(pvs, type, len, val, tmp_tlv);
         if (res == PVS_SUCCESS) {
-            pvs_list_persist_in_file();
+            pvs_list_journal_put(pvs);
             return PVS_SUCCESS;
         } else {
             WRN_PRINTF("TLV creation failed\n");
@@ -1009,7 +1446,7 @@ int provisioning_list_tlv_remove(struct provision *pvs, uint8_t type)
 #ifdef PVS_TEST
             pvs->num_tlvs--;
 #endif
-            pvs_list_persist_in_file();
+            pvs_list_journal_put(pvs);
             return PVS_SUCCESS;
         } else {
             tlv_handle = &((*tlv_handle)->next);
@@ -1119,7 +1556,7 @@ int provisioning_list_status_set(struct provision *pvs, pvs_status_t status)
     }
 
     pvs->status = status;
-    pvs_list_persist_in_file();
+    pvs_list_journal_put(pvs);
     return PVS_SUCCESS;
 }
 
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ZIP_Router_logging.h>
+#include "zgw_metrics.h"
 
 #ifdef __ROUTER_VERSION__
 #include "net/uip.h" //TODO: seems to be needed somewhere, figure out if it can't be removed
@@ -75,6 +76,11 @@ typedef struct SerialAPICpabilities {
 } SerialAPICpabilities_t;
 SerialAPICpabilities_t capabilities;
 
+ZGW_COUNTER(serial_retransmissions, "zgw_serial_retransmissions_total",
+            "Serial API frames sent again because the module did not acknowledge them");
+ZGW_COUNTER(serial_restarts, "zgw_serial_restarts_total",
+            "Times the serial port was reopened because frames were not acknowledged");
+
 typedef struct chip_data {
    uint8_t chip_type;
    uint8_t chip_version;
@@ -382,6 +388,9 @@ BOOL SerialAPI_Init(const char* serial_port, const struct SerialAPI_Callbacks* _
   int i;
     if(!ConInit(serial_port)) return FALSE;
 
+    zgw_metrics_register(&serial_retransmissions);
+    zgw_metrics_register(&serial_restarts);
+
 
     cbFuncZWSendData = NULL;
     cbFuncZWSendTestFrame = NULL;
@@ -660,6 +669,7 @@ static int SendFrame(
 		//SER_PRINTF("Retransmission %i of %2x %s\n",i,cmd, ConTypeToStr(ret));
 
 		SER_PRINTF("Retransmission %d of 0x%02x\n",i,cmd);
+		zgw_metric_add(&serial_retransmissions, 1);
 
 #ifdef __ASIX_C51__
 		  //When SSL handshake is in progress, don't retry sending out.
@@ -673,6 +683,7 @@ static int SendFrame(
 		/* It seems that the serial port sometimes stalls on osx, this seems to help */
 		if((i & 7) == 7) {
 		  SER_PRINTF("Reopening serial port\n");
+		  zgw_metric_add(&serial_restarts, 1);
           SerialRestart();
 		}
                 /* This is a layer violation, since SerialFlush is not in conhandle */
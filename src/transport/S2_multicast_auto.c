@@ -8,6 +8,8 @@
 #include "sys/cc.h"
 #include "NodeCache.h"
 #include "zgw_nodemask.h"
+#include "Bridge.h" /* virtual_nodes_mask */
+#include "zw_network_info.h" /* MyNodeID */
 
 static const security_scheme_t scheme_state_map[] = { NO_SCHEME,
     SECURITY_SCHEME_2_UNAUTHENTICATED, SECURITY_SCHEME_2_AUTHENTICATED,
@@ -40,8 +42,6 @@ struct {
   uint8_t abort; //Should we abort the current transmission
 } auto_mc_state;
 
-static const nodemask_t empty_node_list = { 0 };
-
 static void s2_send_callback_auto(BYTE txStatus, void* user,
     TX_STATUS_TYPE *txStatEx) {
 
@@ -68,8 +68,7 @@ static void s2_send_callback_auto(BYTE txStatus, void* user,
   int send_sc_followups = auto_mc_state.state > MC_AUTO_C2;
 
   //If there is noting to send skip this step
-  if (nodemask_equal(auto_mc_state.ts.node_list,
-      empty_node_list) == 0) {
+  if (nodemask_is_empty(auto_mc_state.ts.node_list)) {
     s2_send_callback_auto(txStatus, user, txStatEx);
     return;
   }
@@ -106,30 +105,53 @@ uint8_t sec2_send_multicast_auto_split(ts_param_t *p, const uint8_t *data,
   auto_mc_state.termination_state =
       send_sc_followups ? MC_AUTO_C2_FU : MC_AUTO_C2;
 
-  for (int i = 0; i < 4; i++) {
-    nodemask_clear(auto_mc_state.sub_mask[i]);
+  /* Split the node list by the highest S2 class of each node, using the
+   * security nodemasks of the resource directory. */
+  nodemask_t *sub = auto_mc_state.sub_mask;
+  nodemask_t virtual_nodes;
+  const uint8_t *s2_access = rd_security_nodemask(NODE_FLAG_SECURITY2_ACCESS);
+  const uint8_t *s2_auth = rd_security_nodemask(NODE_FLAG_SECURITY2_AUTHENTICATED);
+
+  nodemask_and(sub[MC_AUTO_C2], p->node_list, s2_access);
+
+  nodemask_andnot(sub[MC_AUTO_C1], p->node_list, s2_access);
+  nodemask_and(sub[MC_AUTO_C1], sub[MC_AUTO_C1], s2_auth);
+
+  nodemask_andnot(sub[MC_AUTO_C0], p->node_list, s2_access);
+  nodemask_andnot(sub[MC_AUTO_C0], sub[MC_AUTO_C0], s2_auth);
+  nodemask_and(sub[MC_AUTO_C0], sub[MC_AUTO_C0],
+               rd_security_nodemask(NODE_FLAG_SECURITY2_UNAUTHENTICATED));
+
+  /* FIXME-MCAST: we should probably handle secure separately
+     from non-secure here, to allow for status fail to be
+     returned or for singlecast handling of the secure nodes, as
+     proposed during spec devel.  First version could be to
+     block multicast commands that contain secure nodes when
+     doing the tlv parsing, but that is probably not where we
+     want to end up. */
+  nodemask_copy(sub[MC_AUTO_NO_SCHEME], p->node_list);
+  for (int i = 0; i < 8; i++) {
+    if (NODE_FLAGS_SECURITY & (1 << i)) {
+      nodemask_andnot(sub[MC_AUTO_NO_SCHEME], sub[MC_AUTO_NO_SCHEME],
+                      rd_security_nodemask(1 << i));
+    }
   }
 
-  for (int n = 1; n <= ZW_MAX_NODES; n++) {
-
-    if (nodemask_test_node(n, p->node_list)) {
-      uint8_t node_scheme_mask = GetCacheEntryFlag(n);
-      if (node_scheme_mask & NODE_FLAG_SECURITY2_ACCESS) {
-        nodemask_add_node(n, auto_mc_state.sub_mask[MC_AUTO_C2]);
-      } else if (node_scheme_mask & NODE_FLAG_SECURITY2_AUTHENTICATED) {
-        nodemask_add_node(n, auto_mc_state.sub_mask[MC_AUTO_C1]);
-      } else if (node_scheme_mask & NODE_FLAG_SECURITY2_UNAUTHENTICATED) {
-        nodemask_add_node(n, auto_mc_state.sub_mask[MC_AUTO_C0]);
-      } else if (0 == (node_scheme_mask & NODE_FLAGS_SECURITY)) {
-	/* FIXME-MCAST: we should probably handle secure separately
-	   from non-secure here, to allow for status fail to be
-	   returned or for singlecast handling of the secure nodes, as
-	   proposed during spec devel.  First version could be to
-	   block multicast commands that contain secure nodes when
-	   doing the tlv parsing, but that is probably not where we
-	   want to end up. */
-        nodemask_add_node(n, auto_mc_state.sub_mask[MC_AUTO_NO_SCHEME]);
-      }
+  /* Virtual nodes are not in the security nodemasks. They have the
+   * security flags of the gateway. */
+  nodemask_and(virtual_nodes, p->node_list, virtual_nodes_mask);
+  if (!nodemask_is_empty(virtual_nodes)) {
+    uint8_t gw_scheme_mask = GetCacheEntryFlag(MyNodeID);
+
+    nodemask_andnot(sub[MC_AUTO_NO_SCHEME], sub[MC_AUTO_NO_SCHEME], virtual_nodes);
+    if (gw_scheme_mask & NODE_FLAG_SECURITY2_ACCESS) {
+      nodemask_or(sub[MC_AUTO_C2], sub[MC_AUTO_C2], virtual_nodes);
+    } else if (gw_scheme_mask & NODE_FLAG_SECURITY2_AUTHENTICATED) {
+      nodemask_or(sub[MC_AUTO_C1], sub[MC_AUTO_C1], virtual_nodes);
+    } else if (gw_scheme_mask & NODE_FLAG_SECURITY2_UNAUTHENTICATED) {
+      nodemask_or(sub[MC_AUTO_C0], sub[MC_AUTO_C0], virtual_nodes);
+    } else if (0 == (gw_scheme_mask & NODE_FLAGS_SECURITY)) {
+      nodemask_or(sub[MC_AUTO_NO_SCHEME], sub[MC_AUTO_NO_SCHEME], virtual_nodes);
     }
   }
   s2_send_callback_auto(0, user, 0);
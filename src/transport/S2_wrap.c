@@ -35,6 +35,11 @@
 #include "ZIP_Router_logging.h"
 #include "DataStore.h"
 #include "random.h"
+#include "zw_node_latency.h"
+#include "zgw_metrics.h"
+#include "zgw_crc.h"
+#include "ResourceDirectory.h"
+#include "node_queue.h"
 #ifdef TEST_MULTICAST_TX
 #include "multicast_group_manager.h"
 //#include "multicast_tlv.h"
@@ -46,6 +51,16 @@
  * If that changes, this timeout must be calculated in a more sophisticated way. Unit: milliseconds. */
 #define END_NODE_VERIFY_DELIVERY_TIMEOUT 500
 
+/** Interval between the checks for changes to the SPAN table which must be
+ * written to the data store */
+#define SPAN_CHECKPOINT_INTERVAL (5 * 60 * CLOCK_SECOND)
+/** Pause between two SPAN presync Nonce Gets, and between the checks for an
+ * idle gateway */
+#define SPAN_PRESYNC_INTERVAL (2 * CLOCK_SECOND)
+
+ZGW_COUNTER(s2_resyncs, "zgw_s2_resyncs_total",
+            "S2 resynchronizations with other nodes");
+
 extern u8_t send_data(ts_param_t* p, const u8_t* data, u16_t len,ZW_SendDataAppl_Callback_t cb,void* user);
 extern void print_hex(uint8_t* buf, int len);
 
@@ -63,6 +78,8 @@ struct {
   uint8_t  data_len;
   security_class_t s2_class;
   uint8_t s2_groupd_id;
+  /** libs2 transmit session of the multicast frame or follow-up being sent */
+  uint8_t session;
   enum {
     MC_SEND_STATE_IDLE,
     MC_SEND_STATE_SEND_FIRST,
@@ -73,15 +90,31 @@ struct {
 } mc_state;
 
 
-static ZW_SendDataAppl_Callback_t s2_send_callback;
+/**
+ * A libs2 transmit session. libs2 runs a state machine for each destination
+ * it is sending to, and calls the glue functions for the session returned by
+ * S2_tx_session().
+ */
+typedef struct s2_tx_session {
+  ZW_SendDataAppl_Callback_t callback;
+  void* user;
+  /* Holds the TX_STATUS_TYPE of ZW_SendDataXX() callback for the most recent S2 frame */
+  TX_STATUS_TYPE tx_status;
+  struct ctimer timer;
+  clock_time_t transmit_start_time;
+  /** Destination of the frame being sent, 0 for multicast */
+  nodeid_t transmit_node;
+} s2_tx_session_t;
+
+static s2_tx_session_t s2_tx[S2_TX_SESSIONS];
 static sec2_inclusion_cb_t sec_incl_cb;
-/* Holds the TX_STATUS_TYPE of ZW_SendDataXX() callback for the most recent S2 frame */
-static TX_STATUS_TYPE s2_send_tx_status;
-
-static void* s2_send_user;
-static struct ctimer s2_timer;
 static struct ctimer s2_inclusion_timer;
-clock_time_t transmit_start_time;
+static struct ctimer span_checkpoint_timer;
+/** CRC of the SPAN table when it was last written to the data store */
+static uint16_t span_checkpoint_crc;
+static struct ctimer span_presync_timer;
+/** Next node to synchronize with, 0 when the presync is done */
+static nodeid_t span_presync_node;
 
 static uint8_t
 keystore_flags_2_node_flags(uint8_t key_store_flags)
@@ -231,9 +264,16 @@ void sec2_init() {
   static uint8_t s2_cmd_class_sup_report[64];
 
   uint8_t retval;
+  int i;
 
-  ctimer_stop(&s2_timer);
+  for (i = 0; i < S2_TX_SESSIONS; i++) {
+    ctimer_stop(&s2_tx[i].timer);
+    s2_tx[i].callback = 0;
+  }
   ctimer_stop(&s2_inclusion_timer);
+  ctimer_stop(&span_presync_timer);
+  span_presync_node = 0;
+  zgw_metrics_register(&s2_resyncs);
   if(s2_ctx) S2_destroy(s2_ctx);
 
   if( 0 != (retval = s2_inclusion_init(SECURITY_2_SCHEME_1_SUPPORT,KEX_REPORT_CURVE_25519,
@@ -244,7 +284,6 @@ void sec2_init() {
   s2_ctx = S2_init_ctx(UIP_HTONL(homeID));
   s2_inclusion_set_event_handler(&sec2_event_handler);
   sec2_create_new_dynamic_ecdh_key();
-  //memset(&s2_send_tx_status, 0, sizeof s2_send_tx_status); //Redundant: Static vars are always initialized to zero
   mc_state.state = MC_SEND_STATE_IDLE;
 }
 
@@ -350,9 +389,8 @@ static uint8_t is_get_in_multi_cmd(ZW_APPLICATION_TX_BUFFER *pCmd)
 
 uint8_t sec2_send_data(ts_param_t* p, uint8_t* data, uint16_t len,ZW_SendDataAppl_Callback_t callback,void* user) {
   s2_connection_t s2_con;
-
-  ZW_SendDataAppl_Callback_t cb_save;
-  void* user_save;
+  s2_tx_session_t *tx;
+  uint8_t session;
 
   s2_con.l_node = p->snode;
   s2_con.r_node = p->dnode;
@@ -369,20 +407,35 @@ uint8_t sec2_send_data(ts_param_t* p, uint8_t* data, uint16_t len,ZW_SendDataApp
 
   s2_con.class_id = p->scheme - SECURITY_SCHEME_2_UNAUTHENTICATED;
 
-  cb_save = s2_send_callback;
-  user_save = s2_send_user;
-
-  s2_send_callback = callback;
-  s2_send_user = user;
+  /* The callback must be in place before libs2 can report the transmission done */
+  session = S2_tx_session_find(s2_ctx, &s2_con);
+  if (session == S2_TX_SESSION_NONE) {
+    DBG_PRINTF("S2 transmission to node %d is already in progress\n", s2_con.r_node);
+    return 0;
+  }
+  tx = &s2_tx[session];
+  tx->callback = callback;
+  tx->user = user;
   if(S2_send_data(s2_ctx,&s2_con,data,len)) {
       return 1;
   } else {
-      s2_send_callback = cb_save;
-      s2_send_user = user_save;
+      tx->callback = 0;
       return 0;
   }
 }
 
+uint8_t sec2_tx_session_available(const ts_param_t* p) {
+  s2_connection_t s2_con;
+
+  if (!s2_ctx) {
+    return 0;
+  }
+  memset(&s2_con, 0, sizeof(s2_con));
+  s2_con.l_node = p->snode;
+  s2_con.r_node = p->dnode;
+  return S2_tx_session_find(s2_ctx, &s2_con) != S2_TX_SESSION_NONE;
+}
+
 #ifdef TEST_MULTICAST_TX
 /**
  * Abort multicast single-cast follow-ups
@@ -410,8 +463,8 @@ void sec2_abort_multicast(void)
  */
 uint8_t sec2_send_multicast(ts_param_t *p, const uint8_t *data, uint8_t data_len, BOOL send_sc_followups, ZW_SendDataAppl_Callback_t callback, void *user) {
   s2_connection_t s2_con;
-  ZW_SendDataAppl_Callback_t cb_save;
-  void* user_save;
+  s2_tx_session_t *tx;
+  uint8_t session;
 
   if(mc_state.state == MC_SEND_STATE_IDLE) {
     mc_state.l_node = p->snode;
@@ -432,25 +485,26 @@ uint8_t sec2_send_multicast(ts_param_t *p, const uint8_t *data, uint8_t data_len
       mc_state.state = MC_SEND_STATE_SEND_FIRST_NOFOLLOWUP;
     }
 
-    s2_send_callback = callback;
-
     s2_con.l_node = p->snode;
     s2_con.r_node = mc_state.s2_groupd_id;
     s2_con.zw_tx_options = 0;
     s2_con.tx_options = 0;
     s2_con.class_id = mc_state.s2_class;
 
-    cb_save = s2_send_callback;
-    user_save = s2_send_user;
-
-    s2_send_callback = callback;
-    s2_send_user = user;
+    session = S2_tx_session_find(s2_ctx, &s2_con);
+    if (session == S2_TX_SESSION_NONE) {
+      mc_state.state = MC_SEND_STATE_IDLE;
+      return 0;
+    }
+    tx = &s2_tx[session];
+    tx->callback = callback;
+    tx->user = user;
+    mc_state.session = session;
     DBG_PRINTF("Sending Multicast\n");
     if (S2_send_data_multicast(s2_ctx, &s2_con, mc_state.data, mc_state.data_len)) {
       return 1;
     } else {
-        s2_send_callback = cb_save;
-        s2_send_user = user_save;
+        tx->callback = 0;
 
         /* Transmission failed */
         mc_state.state = MC_SEND_STATE_IDLE;
@@ -470,17 +524,23 @@ void S2_send_done_event(struct S2* ctxt, s2_tx_status_t status) {
   /* The two zeros are padding to align with libs2 numeric value of S2_TRANSMIT_COMPLETE_VERIFIED */
   const uint8_t s2zw_codes[] = {TRANSMIT_COMPLETE_OK,TRANSMIT_COMPLETE_NO_ACK,TRANSMIT_COMPLETE_FAIL, 0, 0, TRANSMIT_COMPLETE_OK};
   ZW_SendDataAppl_Callback_t cb_save;
+#ifdef TEST_MULTICAST_TX
+  void* user_save;
+#endif
+  uint8_t session = S2_tx_session(ctxt);
+  s2_tx_session_t *tx = &s2_tx[session];
 
-  ctimer_stop(&s2_timer);
+  ctimer_stop(&tx->timer);
 
 #ifdef TEST_MULTICAST_TX
-  if (mc_state.state == MC_SEND_STATE_SEND_FIRST_NOFOLLOWUP)
+  /* Other sessions may complete while the multicast is in progress */
+  if (mc_state.state == MC_SEND_STATE_SEND_FIRST_NOFOLLOWUP && mc_state.session == session)
   {
     global_mcast_status_len = 0;
     mc_state.state = MC_SEND_STATE_IDLE;
   }
 
-  if(mc_state.state != MC_SEND_STATE_IDLE) {
+  if(mc_state.state != MC_SEND_STATE_IDLE && mc_state.session == session) {
     /*
      * Begin (or continue) sending single cast follow-ups to
      * all remote nodes specified in dest_nodemask
@@ -531,6 +591,7 @@ void S2_send_done_event(struct S2* ctxt, s2_tx_status_t status) {
         DBG_PRINTF("Multicast transmission is done\n");
       } else {
         s2_connection_t s2_con;
+        s2_tx_session_t *next;
 
         s2_con.l_node = mc_state.l_node;
         s2_con.r_node = mc_state.r_node;
@@ -543,23 +604,39 @@ void S2_send_done_event(struct S2* ctxt, s2_tx_status_t status) {
         DBG_PRINTF("Sending Multicast followup to node %i\n",s2_con.r_node);
         mc_state.state = MC_SEND_STATE_SEND;
 
-        if(S2_send_data(s2_ctx,&s2_con,mc_state.data,mc_state.data_len)) {
-          return;
-        } else {
-          status = S2_TRANSMIT_COMPLETE_FAIL;
-          mc_state.state = MC_SEND_STATE_IDLE;
+        /* The follow-up may go in another session, which takes over the callback */
+        session = S2_tx_session_find(s2_ctx, &s2_con);
+        if (session != S2_TX_SESSION_NONE) {
+          next = &s2_tx[session];
+          cb_save = tx->callback;
+          user_save = tx->user;
+          tx->callback = 0;
+          next->callback = cb_save;
+          next->user = user_save;
+          mc_state.session = session;
+          if(S2_send_data(s2_ctx,&s2_con,mc_state.data,mc_state.data_len)) {
+            return;
+          }
+          next->callback = 0;
+          tx->callback = cb_save;
+          tx->user = user_save;
         }
+        status = S2_TRANSMIT_COMPLETE_FAIL;
+        mc_state.state = MC_SEND_STATE_IDLE;
       }
     }
   }
 #endif
 
-  cb_save = s2_send_callback;
-  s2_send_callback = 0;
+  cb_save = tx->callback;
+  tx->callback = 0;
   if(cb_save) {
-    cb_save(s2zw_codes[status],s2_send_user, &s2_send_tx_status);
+    cb_save(s2zw_codes[status],tx->user, &tx->tx_status);
+  } else {
+    /* A frame libs2 sent on its own is done, a queued frame may use the session */
+    ZW_SendDataAppl_S2_session_free();
   }
-  memset(&s2_send_tx_status, 0, sizeof s2_send_tx_status);
+  memset(&tx->tx_status, 0, sizeof tx->tx_status);
 
 }
 
@@ -583,29 +660,34 @@ void S2_msg_received_event(struct S2* ctxt,s2_connection_t* src , uint8_t* buf,
   ApplicationCommandHandlerZIP(&p,(ZW_APPLICATION_TX_BUFFER*)buf,len);
 }
 
-//This is the time it takes a z-wave node to do 3*S2 frame decryption + generating a nonce report
+//This is the least time it takes a z-wave node to do 3*S2 frame decryption + generating a nonce report
 //#define NONCE_REP_TIME 50
+//Nodes with a latency estimate get their transmit time instead, at least 100 ms
 #define NONCE_REP_TIME 250
 static void S2_send_frame_callback(BYTE txStatus,void* user, TX_STATUS_TYPE *t) {
+  s2_tx_session_t *tx = (s2_tx_session_t*) user;
+
   if (t) {
-    s2_send_tx_status = *t;
+    tx->tx_status = *t;
   }
-  S2_send_frame_done_notify((struct S2*) user,
+  S2_tx_session_send_frame_done_notify(s2_ctx, tx - s2_tx,
       txStatus == TRANSMIT_COMPLETE_OK ? S2_TRANSMIT_COMPLETE_OK : S2_TRANSMIT_COMPLETE_NO_ACK,
-          clock_time()-transmit_start_time + NONCE_REP_TIME);
+          clock_time()-tx->transmit_start_time + zw_node_latency_tx_timeout(tx->transmit_node, NONCE_REP_TIME));
 }
 
 /** Must be implemented elsewhere maps to ZW_SendData or ZW_SendDataBridge note that ctxt is
  * passed as a handle. The ctxt MUST be provided when the \ref S2_send_frame_done_notify is called */
 uint8_t S2_send_frame(struct S2* ctxt,const s2_connection_t* conn, uint8_t* buf, uint16_t len) {
+  s2_tx_session_t *tx = &s2_tx[S2_tx_session(ctxt)];
   ts_param_t p;
   ts_set_std(&p,0);
   p.snode = conn->l_node;
   p.dnode = conn->r_node;
   p.tx_flags = conn->zw_tx_options;
   LOG_PRINTF(" Sending S2_send_frame %i %d -> %d\n", len, p.snode, p.dnode);
-  transmit_start_time = clock_time();
-  return send_data(&p, buf,  len,S2_send_frame_callback,ctxt);
+  tx->transmit_start_time = clock_time();
+  tx->transmit_node = p.dnode;
+  return send_data(&p, buf,  len,S2_send_frame_callback,tx);
 }
 
 typedef struct
@@ -693,6 +775,7 @@ uint8_t S2_send_frame_no_cb(struct S2* ctxt,const s2_connection_t* conn, uint8_t
  * TODO
  */
 uint8_t S2_send_frame_multi(struct S2* ctxt, s2_connection_t* conn, uint8_t* buf, uint16_t len){
+  s2_tx_session_t *tx = &s2_tx[S2_tx_session(ctxt)];
   ts_param_t p;
   ts_set_std(&p,0);
   p.snode = conn->l_node;
@@ -701,27 +784,31 @@ uint8_t S2_send_frame_multi(struct S2* ctxt, s2_connection_t* conn, uint8_t* buf
 
   p.tx_flags = conn->zw_tx_options | TRANSMIT_OPTION_MULTICAST_AS_BROADCAST;
   LOG_PRINTF("Sending S2_send_frame_multi len=%i\n", len);
-  transmit_start_time = clock_time();
-  return send_data(&p, buf, len, S2_send_frame_callback, ctxt);
+  tx->transmit_start_time = clock_time();
+  tx->transmit_node = 0;
+  return send_data(&p, buf, len, S2_send_frame_callback, tx);
 }
 
 
-static void timeout(void* ctxt) {
-  S2_timeout_notify((struct S2*)ctxt);
+static void timeout(void* user) {
+  S2_tx_session_timeout_notify(s2_ctx, (s2_tx_session_t*) user - s2_tx);
 }
 /**
- * Must be implemented elsewhere maps to ZW_TimerStart. Note that this must start the same timer every time.
- * Ie. two calls to this function must reset the timer to a new value. On timout \ref S2_timeout_event must be called.
+ * Must be implemented elsewhere maps to ZW_TimerStart. Note that this must start the same timer every time
+ * for a transmit session. Ie. two calls to this function must reset the timer to a new value. On timout
+ * \ref S2_tx_session_timeout_notify must be called.
  *
  */
 void S2_set_timeout(struct S2* ctxt, uint32_t interval) {
+  s2_tx_session_t *tx = &s2_tx[S2_tx_session(ctxt)];
+
   DBG_PRINTF("S2_set_timeout interval =%i ms\n",interval );
 
-  ctimer_set(&s2_timer,interval,timeout,ctxt);
+  ctimer_set(&tx->timer,interval,timeout,tx);
 }
 
 void S2_stop_timeout(struct S2* ctxt) {
-  ctimer_stop(&s2_timer);
+  ctimer_stop(&s2_tx[S2_tx_session(ctxt)].timer);
 }
 
 static void incl_timeout(void* ctxt) {
@@ -837,6 +924,7 @@ void S2_resynchronization_event(
 {
   uint8_t resync_event_packet[6];
 
+  zgw_metric_add(&s2_resyncs, 1);
   resync_event_packet[0] = COMMAND_CLASS_NETWORK_MANAGEMENT_INSTALLATION_MAINTENANCE;
   resync_event_packet[1] = COMMAND_S2_RESYNCHRONIZATION_EVENT;
   if (is_lr_node(remote_node)) {
@@ -856,8 +944,35 @@ void S2_resynchronization_event(
 }
 
 
+static uint16_t span_table_crc(void)
+{
+  return zgw_crc16(CRC_INIT_VALUE, (uint8_t*)s2_ctx->span_table, sizeof(s2_ctx->span_table));
+}
+
+/**
+ * Write the SPAN table to the data store if it has changed, so that a
+ * gateway which is not shut down cleanly does not lose all SPANs.
+ */
+static void span_checkpoint(void *user)
+{
+  uint16_t crc;
+
+  if(s2_ctx) {
+    crc = span_table_crc();
+    if (crc != span_checkpoint_crc) {
+      rd_datastore_persist_s2_span_table(s2_ctx->span_table, SPAN_TABLE_SIZE);
+      span_checkpoint_crc = crc;
+    }
+  }
+  ctimer_set(&span_checkpoint_timer, SPAN_CHECKPOINT_INTERVAL, span_checkpoint, 0);
+}
+
 void sec2_persist_span_table()
 {
+  /* The data store is closed after this */
+  ctimer_stop(&span_checkpoint_timer);
+  ctimer_stop(&span_presync_timer);
+  span_presync_node = 0;
   if(s2_ctx) {
     rd_datastore_persist_s2_span_table(s2_ctx->span_table, SPAN_TABLE_SIZE);
   }
@@ -885,8 +1000,107 @@ void sec2_unpersist_span_table()
       if (s2_ctx->span_table[i].state == SPAN_NEGOTIATED)
         LOG_PRINTF("S2_SPAN (%03zu): state: %d\n", i, s2_ctx->span_table[i].state);
     }
+    span_checkpoint_crc = span_table_crc();
+    ctimer_set(&span_checkpoint_timer, SPAN_CHECKPOINT_INTERVAL, span_checkpoint, 0);
   }
   else {
     WRN_PRINTF("Failed to unpersist S2 SPAN table, missing s2_ctx\n");
   }
 }
+
+/**
+ * Next node id after n, or 0 after the last one.
+ */
+static nodeid_t span_presync_next(nodeid_t n)
+{
+  n++;
+  if (n > ZW_CLASSIC_MAX_NODES && n < ZW_LR_MIN_NODE_ID) {
+    n = ZW_LR_MIN_NODE_ID;
+  }
+  return nodemask_nodeid_is_valid(n) ? n : 0;
+}
+
+/**
+ * Only always listening nodes are synchronized with. Waking up a FLIRS node
+ * costs battery, and sleeping nodes synchronize when they wake up.
+ */
+static bool span_presync_candidate(nodeid_t n)
+{
+  uint8_t flags = GetCacheEntryFlag(n);
+
+  return (n != MyNodeID)
+         && (flags & NODE_FLAGS_SECURITY2)
+         && !(flags & NODE_FLAG_KNOWN_BAD)
+         && ((rd_get_node_mode(n) & 0xff) == MODE_ALWAYSLISTENING)
+         && (rd_get_node_state(n) == STATUS_DONE);
+}
+
+static void span_presync_step(void *user);
+
+static void span_presync_done(BYTE status, void* user, TX_STATUS_TYPE *t)
+{
+  DBG_PRINTF("S2 SPAN presync with node %d %s\n", (nodeid_t)(intptr_t)user,
+             status == TRANSMIT_COMPLETE_OK ? "done" : "failed");
+  ctimer_set(&span_presync_timer, SPAN_PRESYNC_INTERVAL, span_presync_step, 0);
+}
+
+/**
+ * Send a Nonce Get to the next node without a usable SPAN, if the gateway
+ * has nothing else to send.
+ */
+static void span_presync_step(void *user)
+{
+  s2_connection_t s2_con;
+  s2_tx_session_t *tx;
+  security_scheme_t scheme;
+  uint8_t session;
+  nodeid_t n;
+
+  if (!s2_ctx) {
+    return;
+  }
+  if (!ZW_SendDataAppl_idle() || !node_queue_idle() || rd_probe_in_progress()
+      || S2_is_busy(s2_ctx)) {
+    ctimer_set(&span_presync_timer, SPAN_PRESYNC_INTERVAL, span_presync_step, 0);
+    return;
+  }
+
+  while (span_presync_node) {
+    n = span_presync_node;
+    span_presync_node = span_presync_next(n);
+    if (!span_presync_candidate(n)) {
+      continue;
+    }
+    scheme = highest_scheme(GetCacheEntryFlag(n) & GetCacheEntryFlag(MyNodeID));
+    if (scheme < SECURITY_SCHEME_2_UNAUTHENTICATED || scheme > SECURITY_SCHEME_2_ACCESS) {
+      continue;
+    }
+
+    s2_con.l_node = MyNodeID;
+    s2_con.r_node = n;
+    s2_con.zw_tx_options = TRANSMIT_OPTION_ACK | TRANSMIT_OPTION_AUTO_ROUTE | TRANSMIT_OPTION_EXPLORE;
+    s2_con.tx_options = 0;
+    s2_con.class_id = scheme - SECURITY_SCHEME_2_UNAUTHENTICATED;
+
+    session = S2_tx_session_find(s2_ctx, &s2_con);
+    if (session == S2_TX_SESSION_NONE) {
+      continue;
+    }
+    tx = &s2_tx[session];
+    tx->callback = span_presync_done;
+    tx->user = (void*)(intptr_t)n;
+    if (S2_span_presync(s2_ctx, &s2_con)) {
+      return;
+    }
+    /* The SPAN is usable already */
+    tx->callback = 0;
+  }
+  LOG_PRINTF("S2 SPAN presync done\n");
+}
+
+void sec2_span_presync_start()
+{
+  span_presync_node = span_presync_next(0);
+  ctimer_set(&span_presync_timer, SPAN_PRESYNC_INTERVAL, span_presync_step, 0);
+}
+
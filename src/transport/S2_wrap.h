@@ -19,6 +19,13 @@ void sec2_init();
 
 uint8_t sec2_send_data(ts_param_t* p,uint8_t* data, uint16_t len,ZW_SendDataAppl_Callback_t callback,void* user);
 
+/**
+ * Check if \ref sec2_send_data will take a singlecast frame from p->snode to
+ * p->dnode, ie., if a transmit session is free and no transmission to the
+ * node is in progress.
+ */
+uint8_t sec2_tx_session_available(const ts_param_t* p);
+
 uint8_t sec2_send_multicast(ts_param_t *p, const uint8_t *data, uint8_t data_len, BOOL send_sc_followups, ZW_SendDataAppl_Callback_t callback, void *user);
 
 void sec2_abort_multicast(void);
@@ -104,13 +111,27 @@ void keystore_network_generate_key_if_missing();
 
 /**
  * Persist S2 SPAN Table to DataStore
+ *
+ * Called at shutdown. Stops the periodic checkpoints and the presync.
  */
 void sec2_persist_span_table();
 
 /**
  * Unpersist S2 SPAN Table from DataStore
+ *
+ * From then on, changes to the table are written to the DataStore
+ * periodically, until \ref sec2_persist_span_table is called.
  */
 void sec2_unpersist_span_table();
+
+/**
+ * Start synchronizing the SPANs with the always listening S2 nodes.
+ *
+ * One node at a time, and only when the gateway has nothing else to send,
+ * a Nonce Get is sent to each node without a usable SPAN. The first frame
+ * to the node is then sent without waiting for a nonce exchange.
+ */
+void sec2_span_presync_start();
 /**
  * Reset all the SPANs from SPAN table with node as destination node id
  * @param node: Destination node id to match to reset the SPANs
@@ -9,6 +9,7 @@
 #include "ZIP_Router_logging.h"
 #include "zip_router_config.h"
 #include "random.h"
+#include "zw_node_latency.h"
 #define NONCE_OPT 0
 
 /**/
@@ -497,7 +498,8 @@ static void tx_session_state_set(sec_tx_session_t* s,tx_state_t state) {
     break;
   case NONCE_GET_SENT:
     if(!secure_learn_active()) {
-        ctimer_set(&s->timer, NONCE_REQUEST_TIMEOUT_MSEC + clock_time()-s->transition_time,tx_timeout,s);
+        ctimer_set(&s->timer, zw_node_latency_tx_timeout(s->param.dnode, NONCE_REQUEST_TIMEOUT_MSEC)
+                              + clock_time()-s->transition_time,tx_timeout,s);
     }
     break;
   case ENC_MSG:
@@ -513,7 +515,8 @@ static void tx_session_state_set(sec_tx_session_t* s,tx_state_t state) {
     if(s->data_len==0) {
       tx_session_state_set(s,TX_DONE);
     } else {
-      ctimer_set(&s->timer,NONCE_REQUEST_TIMEOUT_MSEC + clock_time()-s->transition_time,tx_timeout,s);
+      ctimer_set(&s->timer, zw_node_latency_tx_timeout(s->param.dnode, NONCE_REQUEST_TIMEOUT_MSEC)
+                            + clock_time()-s->transition_time,tx_timeout,s);
     }
     break;
   case ENC_MSG2:
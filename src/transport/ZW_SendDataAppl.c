@@ -20,6 +20,8 @@
 #include "ZW_transport_api.h"
 #include "ZIP_Router_logging.h"
 #include "zgw_crc.h"
+#include "zw_node_latency.h"
+#include "zgw_metrics.h"
 #include "zw_frame_buffer.h"
 #include "CommandAnalyzer.h"
 #include "ZW_classcmd_ex.h"
@@ -44,6 +46,7 @@ typedef struct
   struct ctimer discard_timer;         /* Timer for discarding element if it stays in the queue too long */
   uint8_t reset_span; /* This flag will be set on sending activation set to the end node. On successfull ack
                          S2 Span for the destinaiton node will be reset */
+  uint8_t is_get; /* The command is a get, the encapsulation headers are added in fb before it is sent */
 } send_data_appl_session_t;
 
 static uint8_t lock = 0;
@@ -52,6 +55,9 @@ static struct etimer backoff_timer;
 static nodeid_t backoff_node; //Node on which the backoff timer is started
 
 LIST(session_list);
+/* S2 singlecast sessions in flight, one per destination node. They run beside
+ * current_session, each in its own libs2 transmit session. */
+LIST(s2_session_list);
 MEMB(session_memb, send_data_appl_session_t, 8);
 
 static uint8_t lock_ll = 0;
@@ -64,6 +70,11 @@ ZW_SendData_scheme_select(const ts_param_t* param, const u8_t* data, u8_t len);
 
 PROCESS(ZW_SendDataAppl_process, "ZW_SendDataAppl_process process");
 
+ZGW_HISTOGRAM(tx_time_ms, "zgw_zwave_transmit_milliseconds",
+              "Transmit time reported by the Z-Wave module for frames sent by the gateway");
+ZGW_COUNTER(tx_failures, "zgw_zwave_transmit_failures_total",
+            "Frames the Z-Wave module was unable to deliver");
+
 enum
 {
   SEND_EVENT_SEND_NEXT, SEND_EVENT_SEND_NEXT_LL,SEND_EVENT_SEND_NEXT_DELAYED
@@ -123,15 +134,31 @@ ZW_SendDataAppl_CallbackEx(uint8_t status, void*user, TX_STATUS_TYPE *ts) REENTR
   send_data_appl_session_t* s = (send_data_appl_session_t*) user;
   uint32_t backoff_interval = 0;
 
-  if (!lock)
+  if (list_contains(s2_session_list, s))
+  {
+    list_remove(s2_session_list, s);
+  }
+  else if (lock && (s == current_session))
+  {
+    lock = FALSE;
+    current_session = NULL;
+  }
+  else
   {
     ERR_PRINTF("Double callback! ");
     return;
   }
-  lock = FALSE;
-  
+
+  zw_node_latency_tx_status(s->fb->param.dnode, status, ts);
+  if (status != TRANSMIT_COMPLETE_OK) {
+    zgw_metric_add(&tx_failures, 1);
+  }
+  if (ts) {
+    zgw_histogram_record(&tx_time_ms, ts->wTransmitTicks * 10);
+  }
+
     /*Check if this is a get message, and set the backoff accordinly */
-  if((status == TRANSMIT_COMPLETE_OK) && (ts!=NULL) && CommandAnalyzerIsGet(s->fb->frame_data[0],s->fb->frame_data[1])) {
+  if((status == TRANSMIT_COMPLETE_OK) && (ts!=NULL) && s->is_get) {
     /* Make some room for the report */
     backoff_interval = ts->wTransmitTicks*10+250;
     backoff_node = s->fb->param.dnode;
@@ -139,7 +166,8 @@ ZW_SendDataAppl_CallbackEx(uint8_t status, void*user, TX_STATUS_TYPE *ts) REENTR
   } else {
     backoff_interval = 0;
     // This is an async post, the next element will only be send when contiki has scheduled the event.
-    process_post(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT, NULL);
+    // The radio is idle until then, so it goes ahead of background work.
+    process_post_prio(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT, NULL, PROCESS_PRIO_HIGH);
   }
   if(status == TRANSMIT_COMPLETE_OK) {
       if (s->reset_span) {
@@ -255,6 +283,7 @@ do_discard_timeout_memb(void * data)
   }
   list_remove(send_data_list,s);
   ERR_PRINTF("Discarding %p because maximum delay was exceeded in dest\n", s);
+  zw_frame_buffer_free(s->fb);
   retval = memb_free(&session_memb, s);
   if (retval != 0) {
     ERR_PRINTF("memb_free() failed in %s(). Return code %d, ptr %p\n", __func__, retval, s);
@@ -311,7 +340,7 @@ send_data_callback_func(u8_t status, TX_STATUS_TYPE* ts)
     ASSERT(0);
   }
 
-  process_post(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT_LL, NULL);
+  process_post_prio(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT_LL, NULL, PROCESS_PRIO_HIGH);
 }
 
 /**
@@ -327,11 +356,11 @@ send_data_multi_bridge_callback_func(u8_t status)
 
 
 /**
- * Low level send data. This call will not do any encapsulation except transport service encap
+ * Queue a frame buffer for the low level send data. The reference to fb is
+ * handed over, also when this fails.
  */
-u8_t
-send_data(ts_param_t* p, const u8_t* data, u16_t len,
-    ZW_SendDataAppl_Callback_t cb, void* user)
+static u8_t
+send_data_fb(zw_frame_buffer_element_t* fb, ZW_SendDataAppl_Callback_t cb, void* user)
 {
   send_data_appl_session_t* s;
 
@@ -339,14 +368,11 @@ send_data(ts_param_t* p, const u8_t* data, u16_t len,
   if (s == 0)
   {
     DBG_PRINTF("OMG! No more queue space");
+    zw_frame_buffer_free(fb);
     return FALSE;
   }
 
-  
-  s->fb = zw_frame_buffer_create(p,data,len); 
-  if(s->fb == NULL) {
-    return FALSE;
-  }
+  s->fb = fb;
   s->user = user;
   s->callback = cb;
 
@@ -361,55 +387,64 @@ send_data(ts_param_t* p, const u8_t* data, u16_t len,
   return TRUE;
 }
 
+/**
+ * Low level send data. This call will not do any encapsulation except transport service encap
+ */
+u8_t
+send_data(ts_param_t* p, const u8_t* data, u16_t len,
+    ZW_SendDataAppl_Callback_t cb, void* user)
+{
+  zw_frame_buffer_element_t* fb;
+
+  fb = zw_frame_buffer_create(p,data,len);
+  if(fb == NULL) {
+    return FALSE;
+  }
+  return send_data_fb(fb, cb, user);
+}
+
 /**
  * Send data to an endpoint and do endpoint encap security encap CRC16 or transport service encap
  * if needed. This function is not reentrant. It will only be called from the ZW_SendDataAppl event tree
- * @param p
- * @param data
- * @param len
+ *
+ * The endpoint and CRC16 headers are added in the headroom of fb, and frames
+ * which are not encrypted are queued for the low level send data in fb itself,
+ * so the frame is not copied on its way to the serial API.
+ * @param fb
  * @param cb
  * @param user
  * @return
  */
 u8_t
-send_endpoint(ts_param_t* p, const u8_t* data, u16_t len, ZW_SendDataAppl_Callback_t cb, void* user)
+send_endpoint(zw_frame_buffer_element_t* fb, ZW_SendDataAppl_Callback_t cb, void* user)
 {
-  u16_t new_len;
+  ts_param_t* p = &fb->param;
+  u16_t len = fb->frame_len;
+  u8_t* new_buf;
   security_scheme_t scheme;
-  static u8_t new_buf[UIP_BUFSIZE]; //Todo we should have some max frame size
-
-  new_len = len;
-
-  if (len > sizeof(new_buf))
-    return FALSE;
 
   if (p->dendpoint || p->sendpoint)
   {
+    new_buf = zw_frame_buffer_push(fb, 4);
+    if (!new_buf)
+      return FALSE;
+
     new_buf[0] = COMMAND_CLASS_MULTI_CHANNEL_V2;
     new_buf[1] = MULTI_CHANNEL_CMD_ENCAP_V2;
     new_buf[2] = p->sendpoint;
     new_buf[3] = p->dendpoint;
-    new_len += 4;
-
-    if (new_len > sizeof(new_buf))
-      return FALSE;
-
-    memcpy(&new_buf[4], data, len);
-  }
-  else
-  {
-    memcpy(new_buf, data, len);
   }
+  new_buf = fb->frame_data;
 
 #ifdef TEST_MULTICAST_TX
   /*Multicast AUTO_SCHEME is handled separately */
   if ((p->tx_flags & TRANSMIT_OPTION_MULTICAST) && (p->scheme == AUTO_SCHEME) ) {
-    return sec2_send_multicast_auto_split(p, new_buf, new_len, p->is_mcast_with_folloup, cb, user);
+    return sec2_send_multicast_auto_split(p, new_buf, fb->frame_len, p->is_mcast_with_folloup, cb, user);
   }
 #endif
 
   /*Select the right security shceme*/
-  scheme = ZW_SendData_scheme_select(p, data, len);
+  scheme = ZW_SendData_scheme_select(p, new_buf + fb->frame_len - len, len);
   LOG_PRINTF("Sending with scheme %s\n", network_scheme_name(scheme));
   switch (scheme)
   {
@@ -418,26 +453,32 @@ send_endpoint(ts_param_t* p, const u8_t* data, u16_t len, ZW_SendDataAppl_Callba
      *
      *
      * */
-    if (new_len < META_DATA_MAX_DATA_SIZE && new_buf[0] != COMMAND_CLASS_TRANSPORT_SERVICE
+    if (fb->frame_len < META_DATA_MAX_DATA_SIZE && new_buf[0] != COMMAND_CLASS_TRANSPORT_SERVICE
         && new_buf[0] != COMMAND_CLASS_SECURITY && new_buf[0] != COMMAND_CLASS_SECURITY_2
         && new_buf[0] != COMMAND_CLASS_CRC_16_ENCAP)
     {
       WORD crc;
-      memmove(new_buf + 2, new_buf, new_len);
+      u8_t* crc_buf;
+
+      new_buf = zw_frame_buffer_push(fb, 2);
+      if (!new_buf)
+        return FALSE;
       new_buf[0] = COMMAND_CLASS_CRC_16_ENCAP;
       new_buf[1] = CRC_16_ENCAP;
-      crc = zgw_crc16(CRC_INIT_VALUE, (BYTE*) new_buf, new_len + 2);
-      new_buf[2 + new_len] = (crc >> 8) & 0xFF;
-      new_buf[2 + new_len + 1] = (crc >> 0) & 0xFF;
-      new_len += 4;
+      crc = zgw_crc16(CRC_INIT_VALUE, (BYTE*) new_buf, fb->frame_len);
+      crc_buf = zw_frame_buffer_put(fb, 2);
+      if (!crc_buf)
+        return FALSE;
+      crc_buf[0] = (crc >> 8) & 0xFF;
+      crc_buf[1] = (crc >> 0) & 0xFF;
     }
-    return send_data(p, new_buf, new_len, cb, user);
+    return send_data_fb(zw_frame_buffer_ref(fb), cb, user);
   case NO_SCHEME:
     if (p->tx_flags & TRANSMIT_OPTION_MULTICAST) {
       WRN_PRINTF("TODO: implement non-secure multicast\n");
       return FALSE;
     } else {
-      return send_data(p, new_buf, new_len, cb, user);
+      return send_data_fb(zw_frame_buffer_ref(fb), cb, user);
     }
     break;
   case SECURITY_SCHEME_0:
@@ -445,7 +486,7 @@ send_endpoint(ts_param_t* p, const u8_t* data, u16_t len, ZW_SendDataAppl_Callba
       WRN_PRINTF("Attempt to transmit multicast with S0\n");
       return FALSE;
     } else {
-      return sec0_send_data(p, new_buf, new_len, cb, user);
+      return sec0_send_data(p, new_buf, fb->frame_len, cb, user);
     }
     break;
   case SECURITY_SCHEME_2_ACCESS:
@@ -454,10 +495,10 @@ send_endpoint(ts_param_t* p, const u8_t* data, u16_t len, ZW_SendDataAppl_Callba
     p->scheme = scheme;
 #ifdef TEST_MULTICAST_TX
     if (p->tx_flags & TRANSMIT_OPTION_MULTICAST) {
-      return sec2_send_multicast(p, new_buf, new_len, p->is_mcast_with_folloup, cb, user);
+      return sec2_send_multicast(p, new_buf, fb->frame_len, p->is_mcast_with_folloup, cb, user);
     } else {
 #endif
-      return sec2_send_data(p, new_buf, new_len, cb, user);
+      return sec2_send_data(p, new_buf, fb->frame_len, cb, user);
 #ifdef TEST_MULTICAST_TX
     }
 #endif
@@ -468,25 +509,108 @@ send_endpoint(ts_param_t* p, const u8_t* data, u16_t len, ZW_SendDataAppl_Callba
   }
 }
 
-static void
-send_first()
+/**
+ * Check if a frame to the destination of s is in flight, or queued ahead of s.
+ * Frames to the same node are sent in the order they were queued.
+ */
+static int
+node_busy(const send_data_appl_session_t* s)
 {
-  current_session = list_pop(session_list);
+  const send_data_appl_session_t* t;
+  nodeid_t dnode = s->fb->param.dnode;
 
-  if (!current_session)
+  if (lock && current_session && (current_session->fb->param.dnode == dnode))
   {
-    return;
+    return TRUE;
+  }
+  for (t = list_head(s2_session_list); t; t = list_item_next((void*) t))
+  {
+    if (t->fb->param.dnode == dnode)
+    {
+      return TRUE;
+    }
+  }
+  for (t = list_head(session_list); t && (t != s); t = list_item_next((void*) t))
+  {
+    if (t->fb->param.dnode == dnode)
+    {
+      return TRUE;
+    }
   }
+  return FALSE;
+}
 
-  lock = TRUE;
+/**
+ * Check if s is a singlecast frame which goes out with S2. Those may be sent in
+ * parallel with other frames, since libs2 has a transmit session per node.
+ */
+static int
+is_s2_singlecast(const send_data_appl_session_t* s)
+{
+  const zw_frame_buffer_element_t* fb = s->fb;
 
-  if (!send_endpoint(&current_session->fb->param, current_session->fb->frame_data,
-      current_session->fb->frame_len, ZW_SendDataAppl_CallbackEx, current_session))
+  if (fb->param.tx_flags & TRANSMIT_OPTION_MULTICAST)
+  {
+    return FALSE;
+  }
+  switch (ZW_SendData_scheme_select(&fb->param, fb->frame_data, fb->frame_len))
   {
-    ZW_SendDataAppl_CallbackEx(TRANSMIT_COMPLETE_ERROR, current_session, NULL);
+  case SECURITY_SCHEME_2_ACCESS:
+  case SECURITY_SCHEME_2_AUTHENTICATED:
+  case SECURITY_SCHEME_2_UNAUTHENTICATED:
+    return TRUE;
+  default:
+    return FALSE;
   }
 }
 
+/**
+ * Send queued frames while the transmit sessions allow it.
+ *
+ * S2 singlecast frames go out in a free libs2 transmit session, one per
+ * destination node. All other frames go out one at a time in current_session.
+ * A frame is never sent while an earlier frame to the same node is in flight or
+ * queued.
+ */
+static void
+send_next()
+{
+  send_data_appl_session_t* s;
+
+  do
+  {
+    for (s = list_head(session_list); s; s = list_item_next(s))
+    {
+      if (node_busy(s))
+      {
+        continue;
+      }
+      if (is_s2_singlecast(s))
+      {
+        if (sec2_tx_session_available(&s->fb->param))
+        {
+          list_remove(session_list, s);
+          list_add(s2_session_list, s);
+          break;
+        }
+      }
+      else if (!lock)
+      {
+        list_remove(session_list, s);
+        current_session = s;
+        lock = TRUE;
+        break;
+      }
+    }
+
+    if (s && !send_endpoint(s->fb, ZW_SendDataAppl_CallbackEx, s))
+    {
+      ZW_SendDataAppl_CallbackEx(TRANSMIT_COMPLETE_ERROR, s, NULL);
+    }
+    /* A get starts the backoff, which holds the rest of the queue */
+  } while (s && etimer_expired(&backoff_timer));
+}
+
 uint8_t
 ZW_SendDataAppl(ts_param_t* p, const void *pData, uint16_t dataLength,
     ZW_SendDataAppl_Callback_t callback, void* user)
@@ -520,8 +644,7 @@ ZW_SendDataAppl(ts_param_t* p, const void *pData, uint16_t dataLength,
                p->snode, p->dnode, COMMAND_CLASS_NO_OPERATION_LR, 0, 2);
   } else {
     s->fb = zw_frame_buffer_create(p, pData, dataLength);
-    LOG_PRINTF("Sending %d->%d, [%s]\n",
-               p->snode, p->dnode, print_frame(pData, dataLength));
+    LOG_PRINTF_FRAME(pData, dataLength, "Sending %d->%d,", p->snode, p->dnode);
   }
  
   if (s->fb == NULL)
@@ -530,6 +653,7 @@ ZW_SendDataAppl(ts_param_t* p, const void *pData, uint16_t dataLength,
     ERR_PRINTF("ZW_SendDataAppl: malloc failed\r\n");
     return 0;
   }
+  s->is_get = CommandAnalyzerIsGet(s->fb->frame_data[0], s->fb->frame_data[1]);
   s->user = user;
   s->callback = callback; //ZW_SendDataAppl_CallbackEx
 
@@ -554,7 +678,7 @@ ZW_SendDataApplAbort(uint8_t handle ) {
   s = (send_data_appl_session_t*)( session_memb.mem + session_memb.size*h);
 
 
-  if(s == current_session) {
+  if((lock && (s == current_session)) || list_contains(s2_session_list, s)) {
     /*Transmission is in progress so stop the module from making more routing attempts
      * This will trigger a transmit complete fail or ok for the current transmission. At some
      * point this will call ZW_SendDataAppl_CallbackEx which will free the session */
@@ -584,6 +708,7 @@ ZW_SendDataApplAbort(uint8_t handle ) {
     list_remove(session_list,s);
 
     /*De-allocate the session */
+    zw_frame_buffer_free(s->fb);
     memb_free(&session_memb, s);
     if (s->callback)
     {
@@ -600,6 +725,7 @@ bool ZW_SendDataAppl_idle(void) {
    return ((current_session == NULL)
            && (current_session_ll == NULL)
            && (list_head(session_list) == NULL)
+           && (list_head(s2_session_list) == NULL)
            && (list_head(send_data_list) == NULL));
 }
 
@@ -611,8 +737,12 @@ ZW_SendDataAppl_init()
   lock_ll = FALSE;
   sec0_abort_all_tx_sessions();
   list_init(session_list);
+  list_init(s2_session_list);
+  current_session = NULL;
   list_init(send_data_list);
   memb_init(&session_memb);
+  zgw_metrics_register(&tx_time_ms.m);
+  zgw_metrics_register(&tx_failures);
 
   process_exit(&ZW_SendDataAppl_process);
   process_start(&ZW_SendDataAppl_process, NULL);
@@ -652,12 +782,16 @@ scheme_compare(security_scheme_t a, security_scheme_t b)
 }
 
 
+void ZW_SendDataAppl_S2_session_free(void) {
+  process_post(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT, NULL);
+}
+
 void ZW_SendDataAppl_FrameRX_Notify(const ts_param_t *c, const uint8_t* frame, uint16_t length) {
   if(!etimer_expired(&backoff_timer) && (c->snode == backoff_node)) {
     //ERR_PRINTF("Backoff timer stopped\n");
     /*Stop the backoff timer and send the next message */
     etimer_stop(&backoff_timer);
-    process_post(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT, NULL);
+    process_post_prio(&ZW_SendDataAppl_process, SEND_EVENT_SEND_NEXT, NULL, PROCESS_PRIO_HIGH);
   }
 }
 
@@ -684,9 +818,9 @@ PROCESS_THREAD(ZW_SendDataAppl_process, ev, data)
         
         break;
       case SEND_EVENT_SEND_NEXT:
-        if (!lock && etimer_expired(&backoff_timer) )
+        if (etimer_expired(&backoff_timer))
         {
-          send_first();
+          send_next();
         }
         break;
       case SEND_EVENT_SEND_NEXT_DELAYED:
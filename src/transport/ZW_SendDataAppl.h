@@ -195,6 +195,12 @@ uint8_t ZW_SendDataAppl(ts_param_t* p,
  */
 bool ZW_SendDataAppl_idle(void);
 
+/**
+ * Tell SendDataAppl that an S2 transmit session has become free without a
+ * callback into SendDataAppl, so that a frame waiting for it can be sent.
+ */
+void ZW_SendDataAppl_S2_session_free(void);
+
 /**
  * Initialize senddataAppl module.
  */
@@ -2,15 +2,26 @@
  */
 #include "ZW_SendRequest.h"
 #include "ZW_SendDataAppl.h"
+#include "ZW_transport_api.h"
 #include "sys/ctimer.h"
 #include "lib/list.h"
 #include "lib/memb.h"
 #include "ZIP_Router_logging.h"
+#include "zip_router_config.h"
+#include "zw_node_latency.h"
 
 
-#define NUM_REQS 4
+/** Upper bound of ZipMaxSendRequests, the size of the request pool. */
+#define NUM_REQS 64
+/** Requests in flight to a single node. More than this are refused, so one
+ * busy node cannot take the whole pool from the others. */
+#define SEND_REQUEST_MAX_PER_NODE 4
+/** Number of hash buckets. Must be a power of 2. */
+#define SEND_REQUEST_BUCKETS 16
 #define NOT_SENDING 0xFF
 #define ROUTING_RETRANSMISSION_DELAY 250
+/** Longest wait for a report the latency estimate may ask for. */
+#define REPORT_WAIT_MAX (30 * CLOCK_SECOND)
 
 typedef enum
 {
@@ -19,7 +30,7 @@ typedef enum
 
 typedef struct send_request_state
 {
-  list_t *list;
+  struct send_request_state *next;
   ts_param_t param;
   req_state_t state;
   BYTE class;
@@ -29,26 +40,89 @@ typedef struct send_request_state
   ZW_SendRequst_Callback_t callback;
   struct ctimer timer;
   clock_time_t round_trip_start;
+  /** Time the request was acknowledged by the node */
+  clock_time_t wait_start;
 } send_request_state_t;
 
 MEMB(reqs,struct send_request_state,NUM_REQS);
-LIST(reqs_list);
+
+/** Pending requests, hashed on the node which is supposed to reply. */
+static void* reqs_buckets[SEND_REQUEST_BUCKETS];
+static uint8_t reqs_count;
+
+static list_t
+bucket_of(nodeid_t node)
+{
+  return (list_t)&reqs_buckets[node & (SEND_REQUEST_BUCKETS - 1)];
+}
+
+static uint8_t
+max_requests(void)
+{
+  if (cfg.max_send_requests == 0)
+  {
+    return 1;
+  }
+  if (cfg.max_send_requests > NUM_REQS)
+  {
+    return NUM_REQS;
+  }
+  return cfg.max_send_requests;
+}
+
+static uint8_t
+requests_to_node(nodeid_t node)
+{
+  send_request_state_t* s;
+  uint8_t n = 0;
+
+  for (s = list_head(bucket_of(node)); s; s = list_item_next(s))
+  {
+    if (s->param.snode == node)
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+static void
+request_free(send_request_state_t* s)
+{
+  list_remove(bucket_of(s->param.snode), s);
+  memb_free(&reqs, s);
+  reqs_count--;
+}
+
+/**
+ * Time to wait for the report after the request has been acknowledged.
+ *
+ * The timeout given by the caller is the least we wait. Nodes which are known
+ * to be slower than that get the time they usually need.
+ */
+static clock_time_t
+report_wait_time(send_request_state_t* s)
+{
+  return zw_node_latency_reply_timeout(s->param.snode,
+                                       (clock_time_t)s->timeout * 10,
+                                       REPORT_WAIT_MAX);
+}
 
 static void
 request_timeout(void* d)
 {
   send_request_state_t* s = (send_request_state_t*) d;
-  s->param.dnode = 0;
+  ZW_SendRequst_Callback_t callback = s->callback;
+  void* user = s->user;
 
+  WRN_PRINTF("SendRequest timeout waiting for 0x%2x 0x%2x\n", s->class, s->cmd);
   s->state = REQ_DONE;
   ctimer_stop(&s->timer);
-  list_remove(reqs_list,s);
-  memb_free(&reqs,s);
+  request_free(s);
 
-  WRN_PRINTF("SendRequest timeout waiting for 0x%2x 0x%2x\n", s->class, s->cmd);
-  if (s->callback)
+  if (callback)
   {
-    s->callback(TRANSMIT_COMPLETE_FAIL, 0, 0, 0, s->user);
+    callback(TRANSMIT_COMPLETE_FAIL, 0, 0, 0, user);
   }
 }
 
@@ -57,7 +131,7 @@ ZW_SendRequest_Callback(BYTE status, void* user, TX_STATUS_TYPE *t)
 {
   send_request_state_t* s = (send_request_state_t*)user;
   clock_time_t round_trip_end = clock_time();
-  clock_time_t round_trip_duration; 
+  clock_time_t round_trip_duration;
 
 
 
@@ -67,14 +141,15 @@ ZW_SendRequest_Callback(BYTE status, void* user, TX_STATUS_TYPE *t)
     round_trip_duration = 10;
   }
 
-  /*250 ms added to be safe for delays with routing and hops and retransmission */
-  round_trip_duration += ROUTING_RETRANSMISSION_DELAY;
+  /* Time for routing, hops and retransmission, 250 ms if the node is not known */
+  round_trip_duration += zw_node_latency_tx_timeout(s->param.snode, ROUTING_RETRANSMISSION_DELAY);
 
   //DBG_PRINTF("round_trip_duration : %lu\n", round_trip_duration);
   if ((status == TRANSMIT_COMPLETE_OK) && (s->state == REQ_SENDING))
   {
     s->state = REQ_WAITING;
-    ctimer_set(&s->timer, (s->timeout * 10) + round_trip_duration, request_timeout, s);
+    s->wait_start = round_trip_end;
+    ctimer_set(&s->timer, report_wait_time(s) + round_trip_duration, request_timeout, s);
   }
   else
   {
@@ -99,14 +174,26 @@ BYTE responseCmd, WORD timeout, void* user, ZW_SendRequst_Callback_t callback)
   if (!callback)
     goto fail;
 
+  if (reqs_count >= max_requests())
+  {
+    WRN_PRINTF("All %u send requests are in use\n", max_requests());
+    goto fail;
+  }
+
+  if (requests_to_node(p->dnode) >= SEND_REQUEST_MAX_PER_NODE)
+  {
+    WRN_PRINTF("Too many send requests to node %u\n", p->dnode);
+    goto fail;
+  }
+
   s = memb_alloc(&reqs);
 
   if (!s)
     goto fail;
 
-  list_add(reqs_list,s);
-
   ts_param_make_reply(&s->param, p); //Save the node/endpoint which is supposed to reply
+  list_add(bucket_of(s->param.snode), s);
+  reqs_count++;
 
   s->state = REQ_SENDING;
   s->class = pData[0];
@@ -122,8 +209,7 @@ BYTE responseCmd, WORD timeout, void* user, ZW_SendRequst_Callback_t callback)
   }
   else
   {
-    list_remove(reqs_list,s);
-    memb_free(&reqs,s);
+    request_free(s);
   }
 
 fail:
@@ -133,16 +219,16 @@ fail:
 
 void ZW_Abort_SendRequest(uint8_t n)
 {
-//  DBG_PRINTF("--------------- Inside ZW_Abort_SendRequest()\n");
   send_request_state_t* s;
-  for (s = list_head(reqs_list); s; s=list_item_next(s)) {
-//    DBG_PRINTF("--------------- Comparing n=%bu with dnode=%bu, snode=%bu\n", n, s->param.dnode, s->param.snode);
+  send_request_state_t* next;
+
+  for (s = list_head(bucket_of(n)); s; s = next) {
+    next = list_item_next(s);
     if (s->state == REQ_WAITING && (s->param.snode == n))
       {
         s->state = REQ_DONE;
         ctimer_stop(&s->timer);
-        list_remove(reqs_list,s);
-        memb_free(&reqs,s);
+        request_free(s);
         s->callback(TRANSMIT_COMPLETE_FAIL, 0, 0, 0, s->user);
       }
   }
@@ -153,7 +239,9 @@ SendRequest_ApplicationCommandHandler(ts_param_t* p,
     ZW_APPLICATION_TX_BUFFER *pCmd, WORD cmdLength)
 {
   send_request_state_t* s;
-  for (s = list_head(reqs_list); s; s=list_item_next(s))
+  list_t bucket = bucket_of(p->snode);
+
+  for (s = list_head(bucket); s; s=list_item_next(s))
   {
     if (s->state == REQ_WAITING && ts_param_cmp(&s->param, p)
         && s->class == pCmd->ZW_Common.cmdClass
@@ -168,17 +256,20 @@ SendRequest_ApplicationCommandHandler(ts_param_t* p,
       }
 
       s->state = REQ_DONE;
+      zw_node_latency_reply(s->param.snode, clock_time() - s->wait_start);
 
       ctimer_stop(&s->timer);
-      list_remove(reqs_list,s);
+      list_remove(bucket,s);
       if(s->callback(TRANSMIT_COMPLETE_OK, p->rx_flags, pCmd, cmdLength, s->user)) {
         WRN_PRINTF("ZW_SendRequest Callback returned 1. There are more reports"
                    " expected.\n");
         s->state = REQ_WAITING;
+        s->wait_start = clock_time();
         ctimer_set(&s->timer, (s->timeout * 10), request_timeout, s);
-        list_add(reqs_list,s);
+        list_add(bucket,s);
       } else {
         memb_free(&reqs,s);
+        reqs_count--;
       }
       return TRUE;
     }
@@ -189,6 +280,12 @@ SendRequest_ApplicationCommandHandler(ts_param_t* p,
 void
 ZW_SendRequest_init()
 {
+  int i;
+
   memb_init(&reqs);
-  list_init(reqs_list);
+  for (i = 0; i < SEND_REQUEST_BUCKETS; i++)
+  {
+    list_init(bucket_of(i));
+  }
+  reqs_count = 0;
 }
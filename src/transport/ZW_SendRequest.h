@@ -46,9 +46,12 @@ typedef int( *ZW_SendRequst_Callback_t)(
  * \param dataLength See \ref ZW_SendDataAppl
  * \param responseCmd Expected command to receive. The command class is derived from the first
  * byte of pData.
+ * \param timeout Time in units of 10 ms to wait for the response once the request has
+ * been sent. Nodes which have been measured to reply slower than this are given longer.
  * \param user User defined value which will be return in \ref ZW_SendRequst_Callback_t
  *
- * \return True if the command was sent.
+ * \return True if the command was sent. False if it could not be sent, or if there are
+ * already ZipMaxSendRequests requests pending, or 4 requests pending to the same node.
  */
 BYTE ZW_SendRequest(
     ts_param_t* p,
@@ -7,13 +7,20 @@
 #include"assert.h"
 
 zw_frame_buffer_element_t* zw_frame_buffer_alloc() {
-  return malloc(sizeof(zw_frame_buffer_element_t));
+  zw_frame_buffer_element_t* f = malloc(sizeof(zw_frame_buffer_element_t));
+
+  if(f) {
+    f->frame_data = f->buf + FRAME_BUFFER_HEADROOM;
+    f->frame_len = 0;
+    f->refs = 1;
+  }
+  return f;
 }
 
 zw_frame_buffer_element_t* zw_frame_buffer_create(const ts_param_t *p,const uint8_t* cmd, uint16_t length) {
   zw_frame_buffer_element_t* f=zw_frame_buffer_alloc();
 
-  if(f && (length < sizeof(f->frame_data))) {
+  if(f && (length < FRAME_BUFFER_ELEMENT_SIE)) {
     f->param = *p;
     f->frame_len = length;
     memcpy(f->frame_data, cmd, length);
@@ -25,8 +32,34 @@ zw_frame_buffer_element_t* zw_frame_buffer_create(const ts_param_t *p,const uint
   }
 }
 
+zw_frame_buffer_element_t* zw_frame_buffer_ref(zw_frame_buffer_element_t* e) {
+  e->refs++;
+  return e;
+}
+
 void zw_frame_buffer_free(zw_frame_buffer_element_t* e) {
-  free(e);
+  if(e && --e->refs == 0) {
+    free(e);
+  }
+}
+
+uint8_t* zw_frame_buffer_push(zw_frame_buffer_element_t* e, uint16_t len) {
+  if(e->frame_data - e->buf < len) {
+    return NULL;
+  }
+  e->frame_data -= len;
+  e->frame_len += len;
+  return e->frame_data;
+}
+
+uint8_t* zw_frame_buffer_put(zw_frame_buffer_element_t* e, uint16_t len) {
+  uint8_t* tail = e->frame_data + e->frame_len;
+
+  if(tail + len > e->buf + sizeof(e->buf)) {
+    return NULL;
+  }
+  e->frame_len += len;
+  return tail;
 }
 
 
@@ -13,10 +13,27 @@
 
 #define FRAME_BUFFER_ELEMENT_SIE 256
 
+/** Room in front of the frame for the multi channel (4 bytes) and CRC16 (2 bytes)
+ * encapsulation headers. */
+#define FRAME_BUFFER_HEADROOM 8
+/** Room after the frame for the CRC16 checksum. */
+#define FRAME_BUFFER_TAILROOM 2
+
+/**
+ * A Z-Wave frame buffer.
+ *
+ * The buffer is reference counted, so the same frame can be queued at more
+ * than one layer without being copied. The encapsulation headers are added
+ * in front of the frame with \ref zw_frame_buffer_push, which moves
+ * frame_data into the headroom.
+ */
 typedef struct {
   ts_param_t param;
-  uint8_t frame_data[FRAME_BUFFER_ELEMENT_SIE];
+  /** Start of the frame, points into buf */
+  uint8_t *frame_data;
   uint16_t frame_len;
+  uint8_t refs;
+  uint8_t buf[FRAME_BUFFER_HEADROOM + FRAME_BUFFER_ELEMENT_SIE + FRAME_BUFFER_TAILROOM];
 } zw_frame_buffer_element_t;
 
 typedef struct {
@@ -39,10 +56,31 @@ zw_frame_buffer_element_t* zw_frame_buffer_alloc();
 zw_frame_buffer_element_t* zw_frame_buffer_create(const ts_param_t *p,const uint8_t* cmd, uint16_t length);
 
 /**
- * Free a framebuffer
+ * Take a reference to a frame buffer. Each reference must be released with
+ * \ref zw_frame_buffer_free.
+ * \return e
+ */
+zw_frame_buffer_element_t* zw_frame_buffer_ref(zw_frame_buffer_element_t* e);
+
+/**
+ * Release a reference to a frame buffer. The buffer is freed with the last
+ * reference.
  */
 void zw_frame_buffer_free(zw_frame_buffer_element_t* e);
 
+/**
+ * Add len bytes in front of the frame.
+ * \return Pointer to the new start of the frame, or NULL if there is not
+ * enough headroom.
+ */
+uint8_t* zw_frame_buffer_push(zw_frame_buffer_element_t* e, uint16_t len);
+
+/**
+ * Add len bytes at the end of the frame.
+ * \return Pointer to the added bytes, or NULL if there is not enough room.
+ */
+uint8_t* zw_frame_buffer_put(zw_frame_buffer_element_t* e, uint16_t len);
+
 
 /**
  * Allocate a new frame IP buffer, the buffer must be freed with
@@ -0,0 +1,188 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include "zw_node_latency.h"
+#include "ZIP_Router_logging.h"
+
+/** Longest timeout the transmit estimate may ask for. */
+#define TX_TIMEOUT_MAX (5 * CLOCK_SECOND)
+/** Shortest timeout the transmit estimate may ask for. It leaves a node
+ * time to process the frame and to start sending the answer. */
+#define TX_TIMEOUT_MIN (CLOCK_SECOND / 10)
+/** Number of transmissions in a row without an acknowledge, after which a
+ * node is treated as unknown until it acknowledges again. */
+#define TX_FAILURES_MAX 2
+/** Estimates are kept in milliseconds and saturate here. */
+#define LATENCY_MAX 0xFFFF
+
+typedef struct estimate {
+  /** Smoothed latency, 0 if there is no sample yet. */
+  uint16_t srtt;
+  uint16_t rttvar;
+} estimate_t;
+
+typedef struct node_latency {
+  estimate_t tx;
+  estimate_t reply;
+  /** Repeaters in the route of the last transmission */
+  uint8_t repeaters;
+  /** Transmissions in a row without an acknowledge */
+  uint8_t tx_failures;
+} node_latency_t;
+
+static node_latency_t latency[ZW_MAX_NODES + 1];
+
+static node_latency_t*
+latency_of(nodeid_t node)
+{
+  if (node == 0 || node > ZW_MAX_NODES)
+  {
+    return 0;
+  }
+  return &latency[node];
+}
+
+static void
+estimate_restart(estimate_t* e, uint32_t sample)
+{
+  if (sample == 0)
+  {
+    sample = 1;
+  }
+  if (sample > LATENCY_MAX)
+  {
+    sample = LATENCY_MAX;
+  }
+  e->srtt = sample;
+  e->rttvar = sample / 2;
+}
+
+static void
+estimate_update(estimate_t* e, uint32_t sample)
+{
+  uint32_t err;
+
+  if (e->srtt == 0)
+  {
+    estimate_restart(e, sample);
+    return;
+  }
+  if (sample > LATENCY_MAX)
+  {
+    sample = LATENCY_MAX;
+  }
+  err = (e->srtt > sample) ? e->srtt - sample : sample - e->srtt;
+  e->rttvar = (3 * (uint32_t)e->rttvar + err) / 4;
+  e->srtt = (7 * (uint32_t)e->srtt + sample) / 8;
+  if (e->srtt == 0)
+  {
+    e->srtt = 1;
+  }
+}
+
+static clock_time_t
+estimate_timeout(const estimate_t* e)
+{
+  return (clock_time_t)e->srtt + 4 * (clock_time_t)e->rttvar;
+}
+
+void
+zw_node_latency_init(void)
+{
+  memset(latency, 0, sizeof(latency));
+}
+
+void
+zw_node_latency_reset(nodeid_t node)
+{
+  node_latency_t* l = latency_of(node);
+
+  if (l)
+  {
+    memset(l, 0, sizeof(*l));
+  }
+}
+
+void
+zw_node_latency_tx_status(nodeid_t node, uint8_t status, const TX_STATUS_TYPE* ts)
+{
+  node_latency_t* l = latency_of(node);
+  uint32_t sample;
+
+  if (!l)
+  {
+    return;
+  }
+  if (status != TRANSMIT_COMPLETE_OK)
+  {
+    if (l->tx_failures < 0xFF)
+    {
+      l->tx_failures++;
+    }
+    return;
+  }
+  l->tx_failures = 0;
+  if (!ts)
+  {
+    return;
+  }
+
+  sample = (uint32_t)ts->wTransmitTicks * 10;
+  if (ts->bRepeaters != l->repeaters)
+  {
+    /* The route has changed, what we know about the old one does not apply */
+    DBG_PRINTF("Route to node %d now has %d repeaters\n", node, ts->bRepeaters);
+    l->repeaters = ts->bRepeaters;
+    estimate_restart(&l->tx, sample);
+  }
+  else
+  {
+    estimate_update(&l->tx, sample);
+  }
+}
+
+void
+zw_node_latency_reply(nodeid_t node, clock_time_t delay)
+{
+  node_latency_t* l = latency_of(node);
+
+  if (l)
+  {
+    estimate_update(&l->reply, delay * 1000 / CLOCK_SECOND);
+  }
+}
+
+clock_time_t
+zw_node_latency_tx_timeout(nodeid_t node, clock_time_t dflt)
+{
+  node_latency_t* l = latency_of(node);
+  clock_time_t t;
+
+  if (!l || l->tx.srtt == 0 || l->tx_failures >= TX_FAILURES_MAX)
+  {
+    return dflt;
+  }
+  t = estimate_timeout(&l->tx) * CLOCK_SECOND / 1000;
+  if (t > TX_TIMEOUT_MAX)
+  {
+    t = TX_TIMEOUT_MAX;
+  }
+  return (t > TX_TIMEOUT_MIN) ? t : TX_TIMEOUT_MIN;
+}
+
+clock_time_t
+zw_node_latency_reply_timeout(nodeid_t node, clock_time_t min, clock_time_t max)
+{
+  node_latency_t* l = latency_of(node);
+  clock_time_t t;
+
+  if (!l || l->reply.srtt == 0)
+  {
+    return min;
+  }
+  t = estimate_timeout(&l->reply) * CLOCK_SECOND / 1000;
+  if (t > max)
+  {
+    t = max;
+  }
+  return (t > min) ? t : min;
+}
@@ -0,0 +1,82 @@
+/* © 2020 Silicon Laboratories Inc. */
+#ifndef ZW_NODE_LATENCY_H
+#define ZW_NODE_LATENCY_H
+#include <stdint.h>
+#include "RD_types.h"
+#include "ZW_transport_api.h"
+#include "sys/clock.h"
+
+/** \ingroup transport
+ * \defgroup node_latency Node latency estimator
+ *
+ * Per-node estimate of how long the Z-Wave network takes to deliver a frame
+ * to a node, and how long the node takes to answer a request.
+ *
+ * Both are smoothed averages with a variance, in the style of the TCP
+ * retransmission timer (RFC 6298). Timeouts that wait for a node are
+ * derived from them, so deep multi-hop nodes get the time they need and
+ * fast nodes are not waited for longer than they need. Nodes that do not
+ * acknowledge are not waited for longer than the default.
+ *
+ * The transmit estimate is fed with the TX status of every frame sent by
+ * \ref ZW_SendDataAppl. A change of the number of repeaters in the route
+ * restarts the estimate. The reply estimate is fed by \ref ZW_SendRequest.
+ * @{
+ */
+
+/**
+ * Reset all estimates.
+ */
+void zw_node_latency_init(void);
+
+/**
+ * Forget the estimates of a node, e.g., when it is removed from the network.
+ */
+void zw_node_latency_reset(nodeid_t node);
+
+/**
+ * Feed the transmit estimate with the result of a transmission.
+ *
+ * \param node Destination node.
+ * \param status Transmit status, see \ref ZW_SendData.
+ * \param ts TX status report of the transmission, may be NULL.
+ */
+void zw_node_latency_tx_status(nodeid_t node, uint8_t status, const TX_STATUS_TYPE* ts);
+
+/**
+ * Feed the reply estimate with the time a node took to answer a request,
+ * counted from the acknowledge of the request.
+ */
+void zw_node_latency_reply(nodeid_t node, clock_time_t delay);
+
+/**
+ * Time to allow for a frame to reach a node and for the answer to travel back.
+ *
+ * The estimate may be shorter than \p dflt, so fast nodes that stop
+ * answering are given up on sooner. It is never shorter than 100 ms.
+ *
+ * \param node Destination node.
+ * \param dflt Returned if the node is not known, or has stopped
+ * acknowledging frames.
+ * \return Timeout in clock ticks, between 100 ms and 5 s for a known node.
+ */
+clock_time_t zw_node_latency_tx_timeout(nodeid_t node, clock_time_t dflt);
+
+/**
+ * Time to wait for a node to answer a request once the request has been
+ * acknowledged.
+ *
+ * Unlike the transmit timeout, this is never shorter than \p min: it is the
+ * timeout the application asked for.
+ *
+ * \param node Destination node.
+ * \param min Returned if the node answers faster than this, or is not known.
+ * \param max Upper bound of the timeout.
+ * \return Timeout in clock ticks, between min and max.
+ */
+clock_time_t zw_node_latency_reply_timeout(nodeid_t node, clock_time_t min, clock_time_t max);
+
+/**
+ * @}
+ */
+#endif
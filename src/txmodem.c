@@ -8,6 +8,7 @@
 #include "port.h"
 #include "ZIP_Router_logging.h"
 #include "zgw_crc.h"
+#include "sys/clock.h"
 
 #define DEBUG 0
 #ifndef DEBUG
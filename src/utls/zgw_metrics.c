@@ -0,0 +1,178 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "zgw_metrics.h"
+
+/** Registered metrics, in the order they were registered */
+static zgw_metric_t *metrics_head;
+static zgw_metric_t *metrics_tail;
+
+void zgw_metrics_register(zgw_metric_t *m)
+{
+  if (m->registered) {
+    return;
+  }
+  m->registered = 1;
+  m->next = NULL;
+  if (metrics_tail) {
+    metrics_tail->next = m;
+  } else {
+    metrics_head = m;
+  }
+  metrics_tail = m;
+}
+
+void zgw_metric_add(zgw_metric_t *m, int64_t n)
+{
+  if (!m->registered) {
+    zgw_metrics_register(m);
+  }
+  m->value += n;
+}
+
+void zgw_metric_set(zgw_metric_t *m, int64_t v)
+{
+  if (!m->registered) {
+    zgw_metrics_register(m);
+  }
+  m->value = v;
+}
+
+int zgw_histogram_bucket(uint32_t v)
+{
+  int mag;
+
+  if (v < ZGW_HIST_SUB) {
+    return v;
+  }
+  mag = 31 - __builtin_clz(v);
+  if (mag >= ZGW_HIST_MAGS) {
+    return ZGW_HIST_BUCKETS;
+  }
+  return ZGW_HIST_SUB * (mag - ZGW_HIST_SUB_BITS + 1)
+         + (v >> (mag - ZGW_HIST_SUB_BITS)) - ZGW_HIST_SUB;
+}
+
+uint32_t zgw_histogram_bucket_max(int bucket)
+{
+  int shift;
+  uint32_t sub;
+
+  if (bucket < ZGW_HIST_SUB) {
+    return bucket;
+  }
+  shift = bucket / ZGW_HIST_SUB - 1;
+  sub = bucket % ZGW_HIST_SUB;
+  return ((ZGW_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+void zgw_histogram_record(zgw_histogram_t *h, uint32_t v)
+{
+  int b = zgw_histogram_bucket(v);
+
+  if (!h->m.registered) {
+    zgw_metrics_register(&h->m);
+  }
+  if (b < ZGW_HIST_BUCKETS) {
+    h->buckets[b]++;
+  }
+  h->count++;
+  h->m.value += v;
+}
+
+/**
+ * Append to the render buffer.
+ * \return 0 if the text did not fit.
+ */
+static int append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf + *len, size - *len, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t) n >= size - *len) {
+    return 0;
+  }
+  *len += n;
+  return 1;
+}
+
+static int render_metric(char *buf, size_t size, size_t *len, zgw_metric_t *m)
+{
+  static const char *type_name[] = {
+    [ZGW_METRIC_COUNTER] = "counter",
+    [ZGW_METRIC_GAUGE] = "gauge",
+    [ZGW_METRIC_HISTOGRAM] = "histogram",
+  };
+  zgw_histogram_t *h;
+  uint64_t cumulative = 0;
+  int i;
+
+  if (!append(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n",
+              m->name, m->help, m->name, type_name[m->type])) {
+    return 0;
+  }
+  if (m->type != ZGW_METRIC_HISTOGRAM) {
+    int64_t v = m->sample ? m->sample() : m->value;
+    return append(buf, size, len, "%s %lld\n", m->name, (long long) v);
+  }
+
+  h = (zgw_histogram_t *) m;
+  for (i = 0; i < ZGW_HIST_BUCKETS; i++) {
+    cumulative += h->buckets[i];
+    if (!append(buf, size, len, "%s_bucket{le=\"%u\"} %llu\n", m->name,
+                zgw_histogram_bucket_max(i), (unsigned long long) cumulative)) {
+      return 0;
+    }
+  }
+  return append(buf, size, len,
+                "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %lld\n%s_count %llu\n",
+                m->name, (unsigned long long) h->count,
+                m->name, (long long) m->value,
+                m->name, (unsigned long long) h->count);
+}
+
+size_t zgw_metrics_render(char *buf, size_t size)
+{
+  zgw_metric_t *m;
+  size_t len = 0;
+  size_t start;
+
+  if (size == 0) {
+    return 0;
+  }
+  buf[0] = 0;
+  for (m = metrics_head; m; m = m->next) {
+    start = len;
+    if (!render_metric(buf, size, &len, m)) {
+      /* Leave out the rest of the metric */
+      len = start;
+      buf[len] = 0;
+    }
+  }
+  return len;
+}
+
+void zgw_metrics_reset(void)
+{
+  zgw_metric_t *m;
+  zgw_metric_t *next;
+
+  for (m = metrics_head; m; m = next) {
+    next = m->next;
+    if (m->type == ZGW_METRIC_HISTOGRAM) {
+      zgw_histogram_t *h = (zgw_histogram_t *) m;
+      h->count = 0;
+      memset(h->buckets, 0, sizeof(h->buckets));
+    }
+    m->value = 0;
+    m->registered = 0;
+    m->next = NULL;
+  }
+  metrics_head = NULL;
+  metrics_tail = NULL;
+}
@@ -0,0 +1,137 @@
+/* © 2020 Silicon Laboratories Inc. */
+#ifndef ZGW_METRICS_H_
+#define ZGW_METRICS_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \defgroup zgw_metrics Run-time metrics
+ *
+ * Counters, gauges and latency histograms which subsystems update on their
+ * hot paths, and which can be read out in the Prometheus text format.
+ *
+ * Metrics are statically allocated by the subsystem that owns them, with
+ * \ref ZGW_COUNTER, \ref ZGW_GAUGE, \ref ZGW_HISTOGRAM and their sampled
+ * variants. A metric is added to the registry the first time it is updated,
+ * or by \ref zgw_metrics_register. Subsystems register their metrics when
+ * they are initialized, so that they are exported before the first update.
+ * Sampled metrics are read through their callback when the metrics are
+ * rendered, so they must be registered.
+ *
+ * Histograms use log-linear buckets in the style of HDR histograms: values
+ * below \ref ZGW_HIST_SUB have a bucket each, and every power of two above
+ * that is split into \ref ZGW_HIST_SUB buckets, which bounds the relative
+ * error of a bucket to 1/\ref ZGW_HIST_SUB.
+ *
+ * All functions must be called from the main loop.
+ * @{
+ */
+
+/** Number of buckets per power of two of a histogram. Must be a power of 2. */
+#define ZGW_HIST_SUB 4
+/** log2 of \ref ZGW_HIST_SUB */
+#define ZGW_HIST_SUB_BITS 2
+/** Number of powers of two covered by a histogram. Values of 2^ZGW_HIST_MAGS
+ * and more are only counted in the +Inf bucket. */
+#define ZGW_HIST_MAGS 16
+#define ZGW_HIST_BUCKETS (ZGW_HIST_SUB * (ZGW_HIST_MAGS - ZGW_HIST_SUB_BITS + 1))
+
+typedef enum {
+  ZGW_METRIC_COUNTER,
+  ZGW_METRIC_GAUGE,
+  ZGW_METRIC_HISTOGRAM,
+} zgw_metric_type_t;
+
+typedef struct zgw_metric {
+  struct zgw_metric *next;
+  /** Name of the metric, including the unit, e.g., "zgw_rd_probe_milliseconds" */
+  const char *name;
+  /** One line description */
+  const char *help;
+  zgw_metric_type_t type;
+  /** Reads the value of a sampled metric, NULL for other metrics */
+  int64_t (*sample)(void);
+  uint8_t registered;
+  /** Value of a counter or gauge, sum of the values of a histogram */
+  int64_t value;
+} zgw_metric_t;
+
+typedef struct zgw_histogram {
+  zgw_metric_t m;
+  /** Number of values recorded, including values larger than the last bucket */
+  uint64_t count;
+  uint32_t buckets[ZGW_HIST_BUCKETS];
+} zgw_histogram_t;
+
+/** Define a counter. */
+#define ZGW_COUNTER(var, name, help) \
+  static zgw_metric_t var = { NULL, name, help, ZGW_METRIC_COUNTER, NULL, 0, 0 }
+
+/** Define a gauge which is set by the subsystem. */
+#define ZGW_GAUGE(var, name, help) \
+  static zgw_metric_t var = { NULL, name, help, ZGW_METRIC_GAUGE, NULL, 0, 0 }
+
+/** Define a gauge which is read by calling fn when the metrics are rendered. */
+#define ZGW_SAMPLED_GAUGE(var, name, help, fn) \
+  static zgw_metric_t var = { NULL, name, help, ZGW_METRIC_GAUGE, fn, 0, 0 }
+
+/** Define a counter which is read by calling fn when the metrics are
+ * rendered, for counts kept by a module of its own. */
+#define ZGW_SAMPLED_COUNTER(var, name, help, fn) \
+  static zgw_metric_t var = { NULL, name, help, ZGW_METRIC_COUNTER, fn, 0, 0 }
+
+/** Define a histogram. */
+#define ZGW_HISTOGRAM(var, name, help) \
+  static zgw_histogram_t var = { { NULL, name, help, ZGW_METRIC_HISTOGRAM, NULL, 0, 0 }, 0, { 0 } }
+
+/**
+ * Add a metric to the registry. Adding it again has no effect.
+ */
+void zgw_metrics_register(zgw_metric_t *m);
+
+/**
+ * Add n to a counter or gauge.
+ */
+void zgw_metric_add(zgw_metric_t *m, int64_t n);
+
+/**
+ * Set the value of a gauge.
+ */
+void zgw_metric_set(zgw_metric_t *m, int64_t v);
+
+/**
+ * Record a value in a histogram.
+ */
+void zgw_histogram_record(zgw_histogram_t *h, uint32_t v);
+
+/**
+ * Index of the bucket of a histogram which counts v.
+ * \return The index, or \ref ZGW_HIST_BUCKETS if v is larger than the last bucket.
+ */
+int zgw_histogram_bucket(uint32_t v);
+
+/**
+ * Largest value counted in a bucket.
+ */
+uint32_t zgw_histogram_bucket_max(int bucket);
+
+/**
+ * Render all registered metrics in the Prometheus text format.
+ *
+ * Metrics which do not fit in the buffer are left out.
+ *
+ * \param buf Buffer to write to. Always zero terminated.
+ * \param size Size of buf.
+ * \return Length of the text.
+ */
+size_t zgw_metrics_render(char *buf, size_t size);
+
+/**
+ * Remove all metrics from the registry and clear their values.
+ */
+void zgw_metrics_reset(void);
+
+/**
+ * @}
+ */
+#endif /* ZGW_METRICS_H_ */
@@ -4,9 +4,52 @@
 /****************************************************************************/
 /*                              INCLUDE FILES                               */
 /****************************************************************************/
+#include <string.h>
 #include <ZIP_Router_logging.h>
 #include "zgw_nodemask.h"
 
+/****************************************************************************/
+/*                      PRIVATE TYPES and DEFINITIONS                       */
+/****************************************************************************/
+
+/** Number of bytes of a nodemask which are covered by whole 64 bit words */
+#define NODEMASK_WORD_BYTES (sizeof(nodemask_t) & ~(sizeof(uint64_t) - 1))
+
+/* Nodemasks are byte arrays, so words are copied in and out to avoid
+ * unaligned accesses. The compiler turns this into plain loads and stores,
+ * and vectorizes the loops below where the target has vector registers. */
+static inline uint64_t load_word(const uint8_t *p)
+{
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline void store_word(uint8_t *p, uint64_t w)
+{
+  memcpy(p, &w, sizeof(w));
+}
+
+/**
+ * Word i of a nodemask, with bit k of the word holding bit 64 * i + k of
+ * the mask. The last word is padded with zeroes.
+ */
+static inline uint64_t ordered_word(const nodemask_t m, size_t i)
+{
+  uint64_t w = 0;
+  size_t off = i * sizeof(uint64_t);
+
+  if (off < NODEMASK_WORD_BYTES) {
+    w = load_word(m + off);
+  } else {
+    memcpy(&w, m + off, sizeof(nodemask_t) - off);
+  }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
 /****************************************************************************/
 /*                              EXPORTED FUNCTIONS                          */
 /****************************************************************************/
@@ -48,3 +91,134 @@ int nodemask_remove_node(uint16_t nodeID, nodemask_t nodelist_mask)
   return 1;
 }
 
+void nodemask_and(nodemask_t dst, const nodemask_t a, const nodemask_t b)
+{
+  size_t i;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    store_word(dst + i, load_word(a + i) & load_word(b + i));
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    dst[i] = a[i] & b[i];
+  }
+}
+
+void nodemask_or(nodemask_t dst, const nodemask_t a, const nodemask_t b)
+{
+  size_t i;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    store_word(dst + i, load_word(a + i) | load_word(b + i));
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    dst[i] = a[i] | b[i];
+  }
+}
+
+void nodemask_andnot(nodemask_t dst, const nodemask_t a, const nodemask_t b)
+{
+  size_t i;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    store_word(dst + i, load_word(a + i) & ~load_word(b + i));
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    dst[i] = a[i] & ~b[i];
+  }
+}
+
+int nodemask_count(const nodemask_t nodelist_mask)
+{
+  size_t i;
+  int count = 0;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    count += __builtin_popcountll(load_word(nodelist_mask + i));
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    count += __builtin_popcount(nodelist_mask[i]);
+  }
+  return count;
+}
+
+int nodemask_equal(const nodemask_t m1, const nodemask_t m2)
+{
+  size_t i;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    if (load_word(m1 + i) != load_word(m2 + i)) {
+      return 1;
+    }
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    if (m1[i] != m2[i]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int nodemask_is_empty(const nodemask_t nodelist_mask)
+{
+  size_t i;
+  uint64_t acc = 0;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    acc |= load_word(nodelist_mask + i);
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    acc |= nodelist_mask[i];
+  }
+  return acc == 0;
+}
+
+int nodemask_is_subset(const nodemask_t a, const nodemask_t b)
+{
+  size_t i;
+
+  for (i = 0; i < NODEMASK_WORD_BYTES; i += sizeof(uint64_t)) {
+    if (load_word(a + i) & ~load_word(b + i)) {
+      return 0;
+    }
+  }
+  for (; i < sizeof(nodemask_t); i++) {
+    if (a[i] & ~b[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+nodemask_iter_t nodemask_iter_start(const nodemask_t nodelist_mask)
+{
+  nodemask_iter_t it;
+
+  it.mask = nodelist_mask;
+  it.base = 0;
+  it.word = ordered_word(nodelist_mask, 0);
+  return it;
+}
+
+uint16_t nodemask_iter_next(nodemask_iter_t *it)
+{
+  unsigned int bit;
+
+  for (;;) {
+    while (it->word == 0) {
+      if (it->base + 64 > ZW_LR_MAX_NODE_ID) {
+        return 0;
+      }
+      it->base += 64;
+      it->word = ordered_word(it->mask, it->base / 64);
+    }
+    bit = it->base + __builtin_ctzll(it->word);
+    it->word &= it->word - 1;
+    if (bit < ZW_CLASSIC_MAX_NODES) {
+      return bit + 1;
+    }
+    if (bit >= ZW_LR_MIN_NODE_ID && bit <= ZW_LR_MAX_NODE_ID) {
+      return bit;
+    }
+    /* Stray bit outside the node ranges, skip it */
+  }
+}
@@ -3,6 +3,7 @@
 #ifndef ZGW_NODEMASK_H_
 #define ZGW_NODEMASK_H_
 #include <stdint.h>
+#include <string.h> /* The macros use memset and memcpy */
 
 #include "ZW_transport_api.h" /* For ZW_MAX_NODES */
 
@@ -58,15 +59,6 @@
  */
 #define NODEMASK_GET_LR(nodemask) ((nodemask) + ZW_LR_NODEMASK_OFFSET)
 
-/**
- * Test if two nodemasks are identical.
- *
- * The masks must be non-overlapping.
- *
- * \return 0 if the masks are identical, non-zero otherwise.
- */
-#define nodemask_equal(m1, m2) memcmp((m1), (m2), sizeof(nodemask_t))
-
 /**
  * Clears all bits in nodemask.
  *
@@ -113,4 +105,121 @@ int nodemask_test_node(uint16_t nodeID, const nodemask_t nodelist_mask);
  */
 int nodemask_remove_node(uint16_t nodeID, nodemask_t nodelist_mask);
 
+/*
+ * The set operations below work on a nodemask 64 bits at a time, so
+ * they are much cheaper than testing the nodes one by one. Unless
+ * noted, dst may be the same mask as a or b.
+ */
+
+/**
+ * Intersection of two nodemasks.
+ *
+ * @param[out] dst Nodes which are in both a and b.
+ * @param[in] a First node list.
+ * @param[in] b Second node list.
+ */
+void nodemask_and(nodemask_t dst, const nodemask_t a, const nodemask_t b);
+
+/**
+ * Union of two nodemasks.
+ *
+ * @param[out] dst Nodes which are in a or b.
+ * @param[in] a First node list.
+ * @param[in] b Second node list.
+ */
+void nodemask_or(nodemask_t dst, const nodemask_t a, const nodemask_t b);
+
+/**
+ * Difference of two nodemasks.
+ *
+ * @param[out] dst Nodes which are in a but not in b.
+ * @param[in] a Node list to remove nodes from.
+ * @param[in] b Nodes to remove.
+ */
+void nodemask_andnot(nodemask_t dst, const nodemask_t a, const nodemask_t b);
+
+/**
+ * Count the nodes in a nodemask.
+ *
+ * @param[in] nodelist_mask Node list to count.
+ * @return Number of bits set in nodelist_mask.
+ */
+int nodemask_count(const nodemask_t nodelist_mask);
+
+/**
+ * Test if two nodemasks are identical.
+ *
+ * \return 0 if the masks are identical, non-zero otherwise.
+ */
+int nodemask_equal(const nodemask_t m1, const nodemask_t m2);
+
+/**
+ * Test if a nodemask has no nodes.
+ *
+ * \return 1 if no bits are set in nodelist_mask, 0 otherwise.
+ */
+int nodemask_is_empty(const nodemask_t nodelist_mask);
+
+/**
+ * Test if all nodes of a are also in b.
+ *
+ * \return 1 if a is a subset of b, 0 otherwise.
+ */
+int nodemask_is_subset(const nodemask_t a, const nodemask_t b);
+
+/**
+ * State of an iteration over the nodes of a nodemask.
+ *
+ * See \ref nodemask_for_each_node.
+ */
+typedef struct nodemask_iter {
+  const uint8_t *mask;
+  /** Bit number of the first bit of word */
+  uint16_t base;
+  /** Bits of the current word which have not been visited yet */
+  uint64_t word;
+} nodemask_iter_t;
+
+/**
+ * Start an iteration over the nodes of a nodemask.
+ *
+ * @param[in] nodelist_mask Node list to iterate over. It must not change
+ * during the iteration.
+ * @return The iterator, positioned before the first node.
+ */
+nodemask_iter_t nodemask_iter_start(const nodemask_t nodelist_mask);
+
+/**
+ * Get the next node of an iteration.
+ *
+ * The mask is searched a word at a time, and the set bits of a word are
+ * found with count trailing zeroes, so a node costs a few instructions
+ * however sparse the mask is. Bits outside the classic and LR node
+ * ranges are skipped.
+ *
+ * @param it Iterator from nodemask_iter_start().
+ * @return The next node id in increasing order, or 0 when there are no
+ * more nodes.
+ */
+uint16_t nodemask_iter_next(nodemask_iter_t *it);
+
+/**
+ * Iterate over the nodes of a nodemask in increasing order.
+ *
+ * The mask must not change in the loop body.
+ *
+ * \code
+ * nodeid_t n;
+ * nodemask_for_each_node(n, mask) {
+ *   ...
+ * }
+ * \endcode
+ *
+ * \param n A variable which holds each node id in turn.
+ * \param nodemask Node list to iterate over.
+ */
+#define nodemask_for_each_node(n, nodemask) \
+  for (nodemask_iter_t n##_iter = nodemask_iter_start(nodemask); \
+       ((n) = nodemask_iter_next(&n##_iter)) != 0; )
+
 #endif
@@ -9,6 +9,10 @@
 #include <pkgconfig.h>
 #include <parse_config.h>
 #include <limits.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "contiki.h"
+#include "crc32alg.h"
 #include "nvm_tools.h"
 #include "zgw_backup.h"
 #include "Serialapi.h"
@@ -84,13 +88,80 @@ static int record_to_manifest(const char* varname, const char* path)
   return 1;
 }
 
-static int make_backup(void)
+/** Time the backup may run before it lets the rest of the gateway run. */
+#define BACKUP_SLICE_MS 20
+/** Database pages copied per step of the online backup. */
+#define BACKUP_DB_PAGES_PER_STEP 16
+/** Time the database may stay busy before the backup gives up. */
+#define BACKUP_DB_BUSY_MS 10000
+/** Attempts at reading the NVM, if the read is disturbed by a write. */
+#define BACKUP_NVM_TRIES 3
+/** Size of the NVM regions which are hashed. */
+#define NVM_REGION_SIZE 4096
+/** The Serial API addresses the NVM with a 16 bit offset. */
+#define NVM_REGIONS_MAX (0x10000 / NVM_REGION_SIZE)
+
+typedef enum {
+  BU_IDLE,
+  BU_MANIFEST,
+  BU_CONFIG_FILE,
+  BU_DATABASE_OPEN,
+  BU_DATABASE,
+  BU_PROVISIONING_FILES,
+  BU_NVM_OPEN,
+  BU_NVM_READ,
+  BU_NVM_CLOSE,
+  BU_DONE,
+  BU_FAILED,
+} backup_step_t;
+
+/** State of the backup in progress. */
+static struct {
+  backup_step_t step;
+  sqlite3 *src_db;
+  sqlite3 *dst_db;
+  sqlite3_backup *db_backup;
+  /** When the database became busy, 0 if it is not. */
+  clock_time_t db_busy_since;
+  FILE *nvm_file;
+  char nvm_path[PATH_MAX + sizeof("nvm_backup")];
+  uint32_t nvm_len;
+  uint16_t nvm_offset;
+  uint8_t nvm_tries;
+  /** CRC32 of each NVM region of this backup. */
+  uint32_t region_crc[NVM_REGIONS_MAX];
+  void (*done)(void);
+} bu;
+
+/** NVM region hashes of the last successful backup. */
+static uint32_t last_region_crc[NVM_REGIONS_MAX];
+static uint32_t last_nvm_len;
+
+PROCESS(zgw_backup_process, "Backup process");
+
+static void backup_db_release(void)
+{
+  if (bu.db_backup) {
+    sqlite3_backup_finish(bu.db_backup);
+    bu.db_backup = NULL;
+  }
+  if (bu.dst_db) {
+    sqlite3_close(bu.dst_db);
+    bu.dst_db = NULL;
+  }
+  if (bu.src_db) {
+    sqlite3_close(bu.src_db);
+    bu.src_db = NULL;
+  }
+}
+
+static backup_step_t backup_manifest(void)
 {
-  char buff[PATH_MAX + sizeof("nvm_backup")];
+  char buff[32];
   uint8_t chip_library;
   const char *nvm_id;
 
-  if(!record_to_manifest("GW_VERSION", (PACKAGE_VERSION))) return 0;
+  if(!record_to_manifest("GW_VERSION", (PACKAGE_VERSION))) return BU_FAILED;
 
   // Find out the library running on the chip.
   BYTE zw_protocol_version[14] = {};
@@ -107,39 +178,367 @@ static int make_backup(void)
               zw_protocol_version2.protocolVersionRevision,
               chip_library, chip_desc.my_chip_type);
 
-  if(!record_to_manifest("GW_PROTOCOL_VERSION", nvm_id)) return 0; 
+  if(!record_to_manifest("GW_PROTOCOL_VERSION", nvm_id)) return BU_FAILED;
 
   snprintf(buff, sizeof(buff), "%lu", clock_time());
-  if(!record_to_manifest("GW_TIMESTAMP", (buff))) return 0;
+  if(!record_to_manifest("GW_TIMESTAMP", (buff))) return BU_FAILED;
+
+  if(!record_to_manifest("GW_ZipCaCert", cfg.ca_cert)) return BU_FAILED;
+  if(!record_to_manifest("GW_ZipCert", cfg.cert)) return BU_FAILED;
+  if(!record_to_manifest("GW_ZipPrivKey", cfg.priv_key)) return BU_FAILED;
+  return BU_CONFIG_FILE;
+}
+
+static backup_step_t backup_config_file(void)
+{
+  if(!copy_to_bkup_dir(get_cfg_filename())) return BU_FAILED;
+  if(!record_to_manifest("GW_CONFIG_FILE_PATH", get_cfg_filename())) return BU_FAILED;
+  return BU_DATABASE_OPEN;
+}
+
+/**
+ * Start an online backup of the database into the backup directory.
+ *
+ * The backup reads the database through a connection of its own, so the
+ * Resource Directory can go on using the database. If the database is
+ * written during the backup, SQLite restarts the copy.
+ */
+static backup_step_t backup_database_open(void)
+{
+  char dst[PATH_MAX * 2];
+  const char *name = strrchr(linux_conf_database_file, '/');
+
+  name = name ? name + 1 : linux_conf_database_file;
+  snprintf(dst, sizeof(dst), "%s%s", bkup_dir, name);
+
+  if (sqlite3_open_v2(linux_conf_database_file, &bu.src_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK
+      || sqlite3_open(dst, &bu.dst_db) != SQLITE_OK) {
+    ERR_PRINTF("Cannot open database for backup: %s\n",
+               sqlite3_errmsg(bu.dst_db ? bu.dst_db : bu.src_db));
+    return BU_FAILED;
+  }
+  bu.db_backup = sqlite3_backup_init(bu.dst_db, "main", bu.src_db, "main");
+  if (!bu.db_backup) {
+    ERR_PRINTF("Cannot start database backup: %s\n", sqlite3_errmsg(bu.dst_db));
+    return BU_FAILED;
+  }
+  return BU_DATABASE;
+}
+
+static backup_step_t backup_database(void)
+{
+  int rc = sqlite3_backup_step(bu.db_backup, BACKUP_DB_PAGES_PER_STEP);
+
+  if (rc == SQLITE_OK) {
+    bu.db_busy_since = 0;
+    return BU_DATABASE;
+  }
+  if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+    /* Retry in the next slice, so the writer holding the lock can run */
+    if (!bu.db_busy_since) {
+      bu.db_busy_since = clock_time() | 1;
+    }
+    if (clock_time() - bu.db_busy_since < BACKUP_DB_BUSY_MS * CLOCK_SECOND / 1000) {
+      return BU_DATABASE;
+    }
+    ERR_PRINTF("Database stayed busy for %u ms\n", BACKUP_DB_BUSY_MS);
+  }
+  backup_db_release();
+  if (rc != SQLITE_DONE) {
+    ERR_PRINTF("Database backup failed: %s\n", sqlite3_errstr(rc));
+    return BU_FAILED;
+  }
+  if(!record_to_manifest("GW_Databasefile", linux_conf_database_file)) return BU_FAILED;
+  return BU_PROVISIONING_FILES;
+}
+
+static backup_step_t backup_provisioning_files(void)
+{
+  if(!copy_to_bkup_dir(linux_conf_provisioning_cfg_file)) return BU_FAILED;
+  if(!record_to_manifest("GW_ProvisioningConfigFile", linux_conf_provisioning_cfg_file)) return BU_FAILED;
+
+  if(!copy_to_bkup_dir(linux_conf_provisioning_list_storage_file)) return BU_FAILED;
+  if(!record_to_manifest("GW_PVSStorageFile", linux_conf_provisioning_list_storage_file)) return BU_FAILED;
+  return BU_NVM_OPEN;
+}
+
+/* According to INS12350-17:
+ The correct sequence of commands for initiating a backup is the following:
+ FUNC_ID_NVM_BACKUP_RESTORE (open) Returns the backup size.
+ FUNC_ID_NVM_BACKUP_RESTORE (read, read, .)Returns EOF if no more data or error if the backup is disturbed by other writes to the NVM.
+ FUNC_ID_NVM_BACKUP_RESTORE (close) Returns an error if backup was disturbed by other writes. Ok is returned if the backup was done without any writes to the NVM.
+ If an error was returned, discard backed up data and try again.
+ */
+static uint8_t backup_nvm_close_chip(void);
+
+static backup_step_t backup_nvm_open(void)
+{
+  if (bu.nvm_file) {
+    fclose(bu.nvm_file);
+  }
+  snprintf(bu.nvm_path, sizeof(bu.nvm_path), "%snvm_backup", bkup_dir);
+  bu.nvm_file = fopen(bu.nvm_path, "wb");
+  if (NULL == bu.nvm_file) {
+    ERR_PRINTF("Cannot create NVM file \"%s\": %s.\n", bu.nvm_path, strerror(errno));
+    return BU_FAILED;
+  }
+  bu.nvm_tries++;
+  bu.nvm_offset = 0;
+  memset(bu.region_crc, 0, sizeof(bu.region_crc));
+  LOG_PRINTF("Starting NVM read operation...\n");
+  bu.nvm_len = SerialAPI_nvm_open();
+  if (bu.nvm_len == 0) {
+    ERR_PRINTF("ERROR: NVM open failed\n");
+    backup_nvm_close_chip();
+    return BU_FAILED;
+  }
+  return BU_NVM_READ;
+}
+
+/** Close the NVM, which restarts the radio. */
+static uint8_t backup_nvm_close_chip(void)
+{
+  uint8_t nvm_close_status = SerialAPI_nvm_close();
+
+  /* On 700/800-series chips, SerialAPI_nvm_close must be followed by a chip reset */
+  if (ZW_GECKO_CHIP_TYPE(chip_desc.my_chip_type)) {
+    ZW_SoftReset();
+  }
+  return nvm_close_status;
+}
+
+/** Retry the NVM read if it was disturbed, or give up. */
+static backup_step_t backup_nvm_retry(void)
+{
+  if (bu.nvm_tries < BACKUP_NVM_TRIES) {
+    WRN_PRINTF("NVM read was disturbed, trying again\n");
+    return BU_NVM_OPEN;
+  }
+  ERR_PRINTF("ERROR: nvm backup failed\n");
+  return BU_FAILED;
+}
 
-  if(!record_to_manifest("GW_ZipCaCert", cfg.ca_cert)) return 0;
-  if(!record_to_manifest("GW_ZipCert", cfg.cert)) return 0;
-  if(!record_to_manifest("GW_ZipPrivKey", cfg.priv_key)) return 0;
+static backup_step_t backup_nvm_read(void)
+{
+  uint8_t read_buffer[BUF_SIZE];
+  uint8_t length_read = 0;
+  uint8_t read_status;
+  uint16_t done = 0;
 
-  if(!copy_to_bkup_dir(get_cfg_filename())) return 0;
-  if(!record_to_manifest("GW_CONFIG_FILE_PATH", get_cfg_filename())) return 0;
+  read_status = SerialAPI_nvm_backup(bu.nvm_offset, read_buffer, BUF_SIZE, &length_read);
+  if (read_status == 1) {
+    ERR_PRINTF("ERROR: Reading NVM failed at offset %u\n", bu.nvm_offset);
+    backup_nvm_close_chip();
+    return backup_nvm_retry();
+  }
 
-  if(!copy_to_bkup_dir(linux_conf_database_file)) return 0;
-  if(!record_to_manifest("GW_Databasefile", linux_conf_database_file)) return 0;
+  if (fwrite(read_buffer, sizeof(uint8_t), length_read, bu.nvm_file) != length_read) {
+    ERR_PRINTF("Cannot write NVM file \"%s\": %s.\n", bu.nvm_path, strerror(errno));
+    backup_nvm_close_chip();
+    return BU_FAILED;
+  }
+  /* Hash the chunk into the regions it covers */
+  while (done < length_read) {
+    uint32_t offset = (uint32_t)bu.nvm_offset + done;
+    uint16_t n = NVM_REGION_SIZE - (offset % NVM_REGION_SIZE);
 
-  if(!copy_to_bkup_dir(linux_conf_provisioning_cfg_file)) return 0;
-  if(!record_to_manifest("GW_ProvisioningConfigFile", linux_conf_provisioning_cfg_file)) return 0;
+    if (n > length_read - done) {
+      n = length_read - done;
+    }
+    bu.region_crc[offset / NVM_REGION_SIZE] =
+        crc32(read_buffer + done, n, bu.region_crc[offset / NVM_REGION_SIZE]);
+    done += n;
+  }
+  bu.nvm_offset += length_read;
 
-  if(!copy_to_bkup_dir(linux_conf_provisioning_list_storage_file)) return 0;
-  if(!record_to_manifest("GW_PVSStorageFile", linux_conf_provisioning_list_storage_file)) return 0;
+  return (read_status == 2) ? BU_NVM_CLOSE : BU_NVM_READ;
+}
 
-  snprintf(buff, sizeof(buff), "%snvm_backup", bkup_dir);
-  if(!ZW_NVM_Backup(buff, chip_desc.my_chip_type )) {
-    printf("ERROR: nvm backup failed\n");
+/**
+ * Read the hashes of a previous backup, so the changed regions are also
+ * found for the first backup after a restart.
+ */
+static void backup_nvm_hashes_load(const char *path)
+{
+  char line[64];
+  unsigned int offset, crc, len;
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    return;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "# NVM length %u", &len) == 1) {
+      last_nvm_len = len;
+    } else if (sscanf(line, "0x%x 0x%x", &offset, &crc) == 2
+               && offset / NVM_REGION_SIZE < NVM_REGIONS_MAX) {
+      last_region_crc[offset / NVM_REGION_SIZE] = crc;
+    }
+  }
+  fclose(f);
+}
+
+/**
+ * Write the hashes of the NVM regions next to the NVM backup, and record
+ * which regions changed since the last backup, so the backup script only
+ * needs to store those.
+ */
+static int backup_nvm_hashes(void)
+{
+  char path[PATH_MAX + sizeof("nvm_backup.hashes")];
+  char changed[NVM_REGIONS_MAX * sizeof("0xffff,")] = "";
+  uint32_t regions = (bu.nvm_offset + NVM_REGION_SIZE - 1) / NVM_REGION_SIZE;
+  uint32_t i;
+  size_t len = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%snvm_backup.hashes", bkup_dir);
+  if (!last_nvm_len) {
+    /* No backup yet in this run, compare with the one in the directory */
+    backup_nvm_hashes_load(path);
+  }
+  f = fopen(path, "w");
+  if (!f) {
+    ERR_PRINTF("Cannot create NVM hash file \"%s\": %s.\n", path, strerror(errno));
     return 0;
+  }
+  fprintf(f, "# NVM length %u\n", bu.nvm_offset);
+  for (i = 0; i < regions; i++) {
+    fprintf(f, "0x%04x 0x%08x\n", i * NVM_REGION_SIZE, bu.region_crc[i]);
+    if (last_nvm_len != bu.nvm_offset || last_region_crc[i] != bu.region_crc[i]) {
+      len += snprintf(changed + len, sizeof(changed) - len, "%s0x%04x",
+                      len ? "," : "", i * NVM_REGION_SIZE);
+    }
+  }
+  fclose(f);
+
+  if(!record_to_manifest("NVM_Hashes", path)) return 0;
+  if(!record_to_manifest("NVM_ChangedRegions", changed)) return 0;
+  LOG_PRINTF("NVM regions changed since last backup: %s\n", len ? changed : "none");
+  return 1;
+}
+
+static backup_step_t backup_nvm_close(void)
+{
+  uint8_t nvm_close_status;
+
+  fclose(bu.nvm_file);
+  bu.nvm_file = NULL;
+
+  nvm_close_status = backup_nvm_close_chip();
+  if (nvm_close_status != 0) {
+    ERR_PRINTF("ERROR: NVM close command failed with status %u.\n", nvm_close_status);
+    return backup_nvm_retry();
+  }
+  LOG_PRINTF("NVM read successfully, %u bytes\n", bu.nvm_offset);
+
+  if(!record_to_manifest("NVM_Backup", bu.nvm_path)) return BU_FAILED;
+  if(!backup_nvm_hashes()) return BU_FAILED;
+
+  memcpy(last_region_crc, bu.region_crc, sizeof(last_region_crc));
+  last_nvm_len = bu.nvm_offset;
+  return BU_DONE;
+}
+
+static backup_step_t backup_step(backup_step_t step)
+{
+  switch (step) {
+  case BU_MANIFEST: return backup_manifest();
+  case BU_CONFIG_FILE: return backup_config_file();
+  case BU_DATABASE_OPEN: return backup_database_open();
+  case BU_DATABASE: return backup_database();
+  case BU_PROVISIONING_FILES: return backup_provisioning_files();
+  case BU_NVM_OPEN: return backup_nvm_open();
+  case BU_NVM_READ: return backup_nvm_read();
+  case BU_NVM_CLOSE: return backup_nvm_close();
+  default: return step;
+  }
+}
+
+/** True for the steps which send an NVM command to the chip. */
+static bool backup_in_nvm(backup_step_t step)
+{
+  return step == BU_NVM_OPEN || step == BU_NVM_READ || step == BU_NVM_CLOSE;
+}
+
+/**
+ * Run the backup for one time slice.
+ *
+ * Each step is bounded: a few database pages, a file copy or one NVM
+ * command. Between slices the main loop serves the network and the
+ * Serial API.
+ *
+ * A slice sends at most one NVM command, so other Serial API traffic is
+ * interleaved with the chunk reads. If that traffic writes the NVM, the
+ * read or the close reports it and the NVM is read again.
+ */
+static void backup_run_slice(void)
+{
+  clock_time_t start = clock_time();
+  void (*done)(void);
+
+  while (bu.step != BU_DONE && bu.step != BU_FAILED
+         && clock_time() - start < BACKUP_SLICE_MS * CLOCK_SECOND / 1000) {
+    backup_step_t step = bu.step;
+
+    bu.step = backup_step(step);
+    if (backup_in_nvm(step)) {
+      /* Yield after each Serial API command */
+      break;
+    }
+    if (bu.step == BU_DATABASE && bu.db_busy_since) {
+      break;
+    }
+  }
+
+  if (bu.step != BU_DONE && bu.step != BU_FAILED) {
+    process_poll(&zgw_backup_process);
+    return;
+  }
+
+  backup_db_release();
+  if (bu.nvm_file) {
+    fclose(bu.nvm_file);
+    bu.nvm_file = NULL;
+  }
+  if (bu.step == BU_DONE) {
+    send_done_to_backup_script();
   } else {
-    if(!record_to_manifest("NVM_Backup", buff)) return 0;
-    return 1;
+    zgw_backup_send_failed();
+  }
+  bu.step = BU_IDLE;
+
+  done = bu.done;
+  bu.done = NULL;
+  if (done) {
+    done();
   }
 }
 
+PROCESS_THREAD(zgw_backup_process, ev, data)
+{
+  PROCESS_BEGIN();
+  while (1) {
+    PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+    if (bu.step != BU_IDLE) {
+      backup_run_slice();
+    }
+  }
+  PROCESS_END();
+}
+
+bool zgw_backup_in_progress(void)
+{
+  return bu.step != BU_IDLE;
+}
+
 int zgw_backup_init(void)
 {
+  if (zgw_backup_in_progress()) {
+    /* The running backup owns the backup directory and the manifest */
+    ERR_PRINTF("Backup already in progress\n");
+    return 0;
+  }
   if (!zgw_backup_initialize_comm(bkup_dir)) {
     zgw_backup_send_failed();
     return 0;
@@ -155,16 +554,23 @@ int zgw_backup_init(void)
   return 1;
 }
 
-void zgw_backup_now(void)
+void zgw_backup_now(void (*done)(void))
 {
   DBG_PRINTF("zgw_backup_now\n");
+  if (zgw_backup_in_progress()) {
+    WRN_PRINTF("Backup already in progress\n");
+    return;
+  }
 #ifndef DISABLE_DTLS
   dtls_close_all();
 #endif
   send_backup_started_to_script();
-  if (make_backup()) {
-    send_done_to_backup_script();
-  } else {
-    zgw_backup_send_failed();
+
+  memset(&bu, 0, sizeof(bu));
+  bu.step = BU_MANIFEST;
+  bu.done = done;
+  if (!process_is_running(&zgw_backup_process)) {
+    process_start(&zgw_backup_process, 0);
   }
+  process_poll(&zgw_backup_process);
 }
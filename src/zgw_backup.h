@@ -1,6 +1,8 @@
 #ifndef ZGW_BACKUP_H
 #define ZGW_BACKUP_H
 
+#include <stdbool.h>
+
 /**
  * \ingroup ZIP_Router
  * \defgroup zgw_backup Zipgateway back-up component.
@@ -11,14 +13,21 @@
 /** Send a "backup failed" message to the backup script. */
 void zgw_backup_send_failed(void);
 
-/** Executes the backup.
+/** Starts the backup.
  *
  * The zipgateway must be in idle state before calling this function.
  *
+ * The backup runs in the background, in slices of at most a few tens of
+ * milliseconds, so the gateway keeps serving the network meanwhile.
+ *
  *  - closes all DTLS connections
+ *  - Copies the database with the SQLite online backup
  *  - Stops the radio
- *  - Copies the Z-Wave NVM 
+ *  - Copies the Z-Wave NVM, one chunk per step
  *  - Tuns on the radio again / Resets the module
+ *  - Hashes the NVM in regions of 4 KB and records which regions
+ *    changed since the last backup. After a restart the last backup is
+ *    the one whose hashes are found in bkup_dir.
  *  - crates manifest file with following format
  *
  *  GW_VERSION="version"
@@ -33,6 +42,8 @@ void zgw_backup_send_failed(void);
  *  GW_ProvisioningConfigFile="path"
  *  GW_Eepromfile="path"
  *  ZW_NVM_FILE="path"
+ *  NVM_Hashes="path"
+ *  NVM_ChangedRegions="offset,offset,..."
  *
  * Stores all backup contents to file with names stores in bkup_dir variable, which is sent
  * by backup script
@@ -43,8 +54,12 @@ void zgw_backup_send_failed(void);
  * If something fails in the backup, "backup failed" is sent to the
  * backup script.
  *
+ * \param done Called when the backup has completed or failed.
  */
-void zgw_backup_now(void);
+void zgw_backup_now(void (*done)(void));
+
+/** \return True if a backup is running. */
+bool zgw_backup_in_progress(void);
 
 /** Initialize the communication file (zgw_backup_communication_file) 
  *
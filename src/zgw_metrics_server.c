@@ -0,0 +1,181 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "contiki.h"
+#include "zgw_metrics.h"
+#include "zgw_metrics_server.h"
+#include "zgw_poll.h"
+#include "zgw_log_ring.h"
+#include "ZIP_Router_logging.h"
+
+/** Size of the rendered metrics. */
+#define METRICS_BUF_SZ (64 * 1024)
+/** Clients served per wakeup. The rest wait in the listen backlog, so a
+ * busy scraper cannot hold up the main loop. */
+#define METRICS_ACCEPT_MAX 4
+
+static int listen_fd = -1;
+static struct sockaddr_un listen_addr;
+
+static int64_t sample_event_overflows(void)
+{
+  return process_overflows();
+}
+
+static int64_t sample_event_queue_max(void)
+{
+  return process_maxevents;
+}
+
+static int64_t sample_log_dropped(void)
+{
+  return zgw_log_ring_dropped();
+}
+
+ZGW_SAMPLED_COUNTER(event_overflows, "zgw_event_queue_overflows_total",
+                    "Events refused because the event queue was full",
+                    sample_event_overflows);
+ZGW_SAMPLED_GAUGE(event_queue_max, "zgw_event_queue_max",
+                  "Largest number of events waiting at the same time",
+                  sample_event_queue_max);
+ZGW_SAMPLED_COUNTER(log_dropped, "zgw_log_lines_dropped_total",
+                    "Log lines dropped because the log ring was full",
+                    sample_log_dropped);
+
+#if PROCESS_CONF_STATS
+/**
+ * Append the event, poll and run time statistics of the processes to the
+ * rendered metrics. The registry only holds metrics without labels, so
+ * these are rendered here, with a process label.
+ *
+ * \return The new length of buf. A family which does not fit is left out.
+ */
+static size_t render_process_stats(char *buf, size_t size, size_t len)
+{
+  struct process *p;
+  size_t start = len;
+  unsigned long cumulative;
+  int n;
+  int i;
+
+#define APPEND(...) \
+  do { \
+    n = snprintf(buf + len, size - len, __VA_ARGS__); \
+    if (n < 0 || (size_t) n >= size - len) { \
+      goto cut; \
+    } \
+    len += n; \
+  } while (0)
+
+  APPEND("# HELP zgw_process_events_total Events delivered to a process\n"
+         "# TYPE zgw_process_events_total counter\n");
+  for (p = PROCESS_LIST(); p; p = p->next) {
+    APPEND("zgw_process_events_total{process=\"%s\"} %lu\n",
+           PROCESS_NAME_STRING(p), p->nevents);
+  }
+  start = len;
+  APPEND("# HELP zgw_process_polls_total Times a process was polled\n"
+         "# TYPE zgw_process_polls_total counter\n");
+  for (p = PROCESS_LIST(); p; p = p->next) {
+    APPEND("zgw_process_polls_total{process=\"%s\"} %lu\n",
+           PROCESS_NAME_STRING(p), p->npolls);
+  }
+  start = len;
+  APPEND("# HELP zgw_process_run_ticks Run time of the calls of a process, in clock ticks\n"
+         "# TYPE zgw_process_run_ticks histogram\n");
+  for (p = PROCESS_LIST(); p; p = p->next) {
+    cumulative = 0;
+    for (i = 0; i < PROCESS_STATS_RUN_BUCKETS - 1; i++) {
+      cumulative += p->run_hist[i];
+      /* Bucket i counts the calls shorter than 2^i ticks */
+      APPEND("zgw_process_run_ticks_bucket{process=\"%s\",le=\"%lu\"} %lu\n",
+             PROCESS_NAME_STRING(p), (1UL << i) - 1, cumulative);
+    }
+    cumulative += p->run_hist[i];
+    APPEND("zgw_process_run_ticks_bucket{process=\"%s\",le=\"+Inf\"} %lu\n"
+           "zgw_process_run_ticks_sum{process=\"%s\"} %lu\n"
+           "zgw_process_run_ticks_count{process=\"%s\"} %lu\n",
+           PROCESS_NAME_STRING(p), cumulative,
+           PROCESS_NAME_STRING(p), p->run_ticks,
+           PROCESS_NAME_STRING(p), cumulative);
+  }
+  return len;
+#undef APPEND
+
+cut:
+  buf[start] = 0;
+  return start;
+}
+#endif /* PROCESS_CONF_STATS */
+
+static void metrics_accept(int fd, void *user)
+{
+  static char buf[METRICS_BUF_SZ];
+  size_t len;
+  int client;
+  int i;
+
+  for (i = 0; i < METRICS_ACCEPT_MAX && (client = accept(fd, NULL, NULL)) >= 0; i++) {
+    len = zgw_metrics_render(buf, sizeof(buf));
+#if PROCESS_CONF_STATS
+    len = render_process_stats(buf, sizeof(buf), len);
+#endif
+    /* The client is local, so the socket buffer takes it all. A client
+     * which has not made room in time gets what fits. */
+    if (send(client, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+      WRN_PRINTF("Unable to send metrics: %s\n", strerror(errno));
+    }
+    close(client);
+  }
+}
+
+int zgw_metrics_server_start(const char *path)
+{
+  if (listen_fd >= 0) {
+    return 0;
+  }
+  if (strlen(path) >= sizeof(listen_addr.sun_path)) {
+    ERR_PRINTF("Metrics socket path is too long: %s\n", path);
+    return -1;
+  }
+  memset(&listen_addr, 0, sizeof(listen_addr));
+  listen_addr.sun_family = AF_UNIX;
+  strcpy(listen_addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    ERR_PRINTF("Unable to create metrics socket: %s\n", strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr *) &listen_addr, sizeof(listen_addr)) < 0
+      || listen(listen_fd, 4) < 0
+      || zgw_poll_add(listen_fd, 0, metrics_accept, NULL) < 0) {
+    ERR_PRINTF("Unable to open metrics socket %s: %s\n", path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  zgw_metrics_register(&event_overflows);
+  zgw_metrics_register(&event_queue_max);
+  zgw_metrics_register(&log_dropped);
+  LOG_PRINTF("Metrics are available on %s\n", path);
+  return 0;
+}
+
+void zgw_metrics_server_stop(void)
+{
+  if (listen_fd < 0) {
+    return;
+  }
+  zgw_poll_remove(listen_fd);
+  close(listen_fd);
+  unlink(listen_addr.sun_path);
+  listen_fd = -1;
+}
@@ -0,0 +1,39 @@
+/* © 2020 Silicon Laboratories Inc. */
+#ifndef ZGW_METRICS_SERVER_H_
+#define ZGW_METRICS_SERVER_H_
+
+/**
+ * \ingroup zgw_metrics
+ * \defgroup zgw_metrics_server Metrics socket
+ *
+ * Exports the \ref zgw_metrics registry on a local UNIX stream socket. A
+ * client which connects gets the current metrics in the Prometheus text
+ * format, and the connection is closed. For example:
+ *
+ * \code
+ * socat -u UNIX-CONNECT:/run/zipgateway.metrics -
+ * \endcode
+ *
+ * The socket is opened when ZipMetricsSocket is set in zipgateway.cfg.
+ * @{
+ */
+
+/**
+ * Open the metrics socket and add it to the main loop.
+ *
+ * A stale socket file at path is removed.
+ *
+ * \param path File system path of the socket.
+ * \return 0 on success, -1 on failure.
+ */
+int zgw_metrics_server_start(const char *path);
+
+/**
+ * Close the metrics socket and remove its file.
+ */
+void zgw_metrics_server_stop(void);
+
+/**
+ * @}
+ */
+#endif /* ZGW_METRICS_SERVER_H_ */
@@ -255,6 +255,27 @@ struct router_config {
    */
   uint16_t mb_port;
 
+  /** Configuration parameter ZipMaxParallelProbes in zipgateway.cfg.
+   *
+   * Number of nodes the Resource Directory probes in parallel.
+   * Default 4.
+   */
+  uint8_t max_parallel_probes;
+
+  /** Configuration parameter ZipMaxSendRequests in zipgateway.cfg.
+   *
+   * Number of requests waiting for a report from a Z-Wave node at a time.
+   * Default 16.
+   */
+  uint8_t max_send_requests;
+
+  /** Configuration parameter ZipFwUpdateWindow in zipgateway.cfg.
+   *
+   * Largest number of firmware fragments requested at a time when the
+   * gateway is the target of a firmware update. Default 32.
+   */
+  uint8_t fw_update_window;
+
   //obsolete
   const char* echd_key_file;
 
@@ -0,0 +1,448 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/md5.h>
+
+#include "test_helpers.h"
+#include "test_CC_helpers.h"
+#include "zip_router_config.h"
+#include "ZW_classcmd.h"
+#include <ZW_classcmd_ex.h>
+#include <CC_FirmwareUpdate.h>
+#include "Serialapi.h"
+#include "zgw_crc.h"
+
+/* The transfer state and the image sink are static */
+#include "../../src/CC_FirmwareUpdate.c"
+
+/**
+ * \defgroup test_fw_stream Firmware image streaming unit test
+ *
+ * Test plan
+ *
+ * - Request Get for the Z-Wave chip firmware is answered with Not
+ *   Upgradable, and no transfer is started. The other cases start the
+ *   transfer directly, as a Request Get would if it was accepted.
+ * - A 500 series image sent as Meta Data Reports is written to the
+ *   temporary file as it is received. The CRC16 of the image is checked
+ *   against the Request Get and the MD5 digest against the one stored in
+ *   the image, and the image is handed to the chip update.
+ * - An image with a wrong CRC16 is refused.
+ * - An image with a wrong MD5 digest is not handed to the chip update.
+ * - The window of fragments requested with one Get grows from 4 to the
+ *   configured maximum while no fragments are lost.
+ * - A lost fragment is requested again alone, the fragments after it are
+ *   kept, and the window is halved.
+ * - Duplicate and out of order fragments do not corrupt the image.
+ */
+
+/* Mock the chip descriptor to say we are using a 500 series chip */
+struct chip_descriptor chip_desc = {ZW_CHIP_TYPE, 0};
+
+struct router_config cfg;
+
+uint8_t gisZIPRReady = 0;
+
+/** Fragment size given in the Request Get */
+#define FRAGMENT_SIZE 100
+/** Bytes of the image covered by the MD5 digest */
+#define IMAGE_LEN 3000
+
+/** The image sent: the signature, the length, the payload and the MD5 digest */
+static uint8_t image[IMAGE_LEN + MD5_DIGEST_LENGTH];
+
+/** How the fragments of a Get are sent by answer_gets() */
+static struct {
+  /** Fragment which is lost the first time it is sent, 0 for none */
+  uint16_t lose;
+  /** Send every fragment twice */
+  bool duplicate;
+  /** Send the fragments of a Get in reverse order */
+  bool reverse;
+} sender;
+
+/** The Gets answered, first fragment and number of fragments */
+#define MAX_GETS 200
+static struct {
+  uint16_t first;
+  uint8_t count;
+} md_gets[MAX_GETS];
+static int n_gets;
+
+/** Image handed to ZWFirmwareUpdate, NULL if it was not called */
+static uint8_t *updated;
+static int updated_len;
+
+/* Stubs */
+
+nodeid_t nodeOfIP(const uip_ip6addr_t *ip)
+{
+  return 0;
+}
+
+u16_t uip_htons(u16_t val)
+{
+  return UIP_HTONS(val);
+}
+
+u32_t uip_htonl(u32_t val)
+{
+  return UIP_HTONL(val);
+}
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr)
+{
+}
+
+void ctimer_stop(struct ctimer *c)
+{
+}
+
+struct process zip_process;
+struct process serial_api_process;
+
+void process_start(struct process *p, const char *arg)
+{
+}
+
+int process_post(struct process *p, process_event_t ev, process_data_t data)
+{
+  return 0;
+}
+
+void process_exit(struct process *p)
+{
+}
+
+int zwave_connection_compare(zwave_connection_t* a, zwave_connection_t* b)
+{
+  return 1;
+}
+
+void ZW_SoftReset(void)
+{
+}
+
+BYTE ZW_LTimerStart(void (*func)(), unsigned long timerTicks, BYTE repeats)
+{
+  return 1;
+}
+
+BYTE ZW_LTimerCancel(BYTE handle)
+{
+  return 1;
+}
+
+void TcpTunnel_ReStart(void)
+{
+}
+
+int ZWFirmwareUpdate(unsigned char isAPM, char *fw_filename, int size)
+{
+  FILE *f = fopen(fw_filename, "r");
+
+  free(updated);
+  updated = malloc(size);
+  updated_len = 0;
+  if (f) {
+    updated_len = fread(updated, 1, size, f);
+    fclose(f);
+  }
+  return TRUE;
+}
+
+int ZWGeckoFirmwareUpdate(struct image_descriptor *fw_desc, struct chip_descriptor *chip_desc,
+                          char *filename, size_t len)
+{
+  return FALSE;
+}
+
+/* Helpers */
+
+/** Build an image with a valid header and digest */
+static void image_build(void)
+{
+  int i;
+
+  memcpy(image, "ZWFW", 4);
+  image[4] = (IMAGE_LEN >> 24) & 0xFF;
+  image[5] = (IMAGE_LEN >> 16) & 0xFF;
+  image[6] = (IMAGE_LEN >> 8) & 0xFF;
+  image[7] = IMAGE_LEN & 0xFF;
+  for (i = 8; i < IMAGE_LEN; i++) {
+    image[i] = (uint8_t)(i * 7 + (i >> 8));
+  }
+  MD5(image, IMAGE_LEN, image + IMAGE_LEN);
+}
+
+/** Send a Request Get for the Z-Wave chip firmware */
+static void send_request_get(uint16_t crc)
+{
+  uint8_t f[] = {COMMAND_CLASS_FIRMWARE_UPDATE_MD_V5,
+                 FIRMWARE_UPDATE_MD_REQUEST_GET_V4,
+                 0x00, 0x00, /* manufacturer id */
+                 0x00, 0x00, /* firmware id */
+                 crc >> 8, crc & 0xFF,
+                 0x00, /* firmware target */
+                 FRAGMENT_SIZE >> 8, FRAGMENT_SIZE & 0xFF,
+                 0x00, /* no activation */
+                 0x01 /* hardware version */
+  };
+
+  memset(&ZW_SendDataZIP_args, 0, sizeof(ZW_SendDataZIP_args));
+  Fwupdate_Md_CommandHandler(&dummy_connection, f, sizeof(f));
+}
+
+/**
+ * Start the transfer of the Z-Wave chip firmware as an accepted version 5
+ * Request Get would, and send the first Get.
+ */
+static void request_get(uint16_t crc)
+{
+  memset(&ZW_SendDataZIP_args, 0, sizeof(ZW_SendDataZIP_args));
+  FwUpdate_Reset_Var();
+  bVersion = 5;
+  bActivationRequest = 0;
+  fw_desc.firmware_id = ZW_FW_ID;
+  fw_desc.target = ZW_FW_TARGET_ID;
+  fw_desc.crc = crc;
+  fwmss = FRAGMENT_SIZE;
+  build_crc = CRC_INIT_VALUE;
+  blockno = 1;
+  ups = dummy_connection;
+  FwUpdateDataGet_Send();
+}
+
+/** Number of fragments of the image */
+static uint16_t fragments(void)
+{
+  return (sizeof(image) + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+}
+
+/** Send fragment n of the image, numbered from 1 */
+static void send_fragment(uint16_t n)
+{
+  uint8_t f[4 + FRAGMENT_SIZE + 2];
+  uint32_t offset = (uint32_t)(n - 1) * FRAGMENT_SIZE;
+  uint16_t len = FRAGMENT_SIZE;
+  uint8_t last = (n == fragments());
+  uint16_t crc;
+
+  if (last) {
+    len = sizeof(image) - offset;
+  }
+  f[0] = COMMAND_CLASS_FIRMWARE_UPDATE_MD_V3;
+  f[1] = FIRMWARE_UPDATE_MD_REPORT_V3;
+  f[2] = (last ? 0x80 : 0) | ((n >> 8) & 0x7F);
+  f[3] = n & 0xFF;
+  memcpy(f + 4, image + offset, len);
+  crc = zgw_crc16(CRC_INIT_VALUE, f, 4 + len);
+  f[4 + len] = crc >> 8;
+  f[4 + len + 1] = crc & 0xFF;
+  Fwupdate_Md_CommandHandler(&dummy_connection, f, 4 + len + 2);
+}
+
+/**
+ * Answer the Meta Data Gets of the gateway until it sends something else.
+ * \return The command sent last by the gateway.
+ */
+static uint8_t answer_gets(void)
+{
+  ZW_FIRMWARE_UPDATE_MD_GET_V3_FRAME get;
+  uint16_t n;
+  int i;
+
+  while (ZW_SendDataZIP_args.dataptr[1] == FIRMWARE_UPDATE_MD_GET_V3 && n_gets < MAX_GETS) {
+    memcpy(&get, ZW_SendDataZIP_args.dataptr, sizeof(get));
+    n = ((get.properties1 & 0x7F) << 8) | get.reportNumber2;
+    md_gets[n_gets].first = n;
+    md_gets[n_gets].count = get.numberOfReports;
+    n_gets++;
+    memset(&ZW_SendDataZIP_args, 0, sizeof(ZW_SendDataZIP_args));
+    for (i = 0; i < get.numberOfReports && n + i <= fragments(); i++) {
+      uint16_t k = sender.reverse ? n + get.numberOfReports - 1 - i : n + i;
+
+      if (k > fragments()) {
+        continue;
+      }
+      if (k == sender.lose) {
+        sender.lose = 0;
+        continue;
+      }
+      send_fragment(k);
+      if (sender.duplicate) {
+        send_fragment(k);
+      }
+    }
+  }
+  return ZW_SendDataZIP_args.dataptr[1];
+}
+
+/** Status of the Status Report sent last by the gateway */
+static uint8_t last_status(void)
+{
+  ZW_FIRMWARE_UPDATE_MD_STATUS_REPORT_V3_FRAME *f =
+      (ZW_FIRMWARE_UPDATE_MD_STATUS_REPORT_V3_FRAME *)ZW_SendDataZIP_args.dataptr;
+
+  return f->status;
+}
+
+static void reset(void)
+{
+  free(updated);
+  updated = NULL;
+  updated_len = 0;
+  memset(&sender, 0, sizeof(sender));
+  n_gets = 0;
+  image_build();
+  Fwupdate_MD_init();
+}
+
+/* Tests */
+
+static void test_not_upgradable(void)
+{
+  ZW_FIRMWARE_UPDATE_MD_REQUEST_REPORT_V3_FRAME *f;
+
+  start_case("Request Get is refused", NULL);
+  reset();
+  send_request_get(zgw_crc16(CRC_INIT_VALUE, image, sizeof(image)));
+  f = (ZW_FIRMWARE_UPDATE_MD_REQUEST_REPORT_V3_FRAME *)ZW_SendDataZIP_args.dataptr;
+  check_true(f != NULL, "Request Get is answered");
+  check_equal(f ? f->cmd : 0, FIRMWARE_UPDATE_MD_REQUEST_REPORT_V3, "Answer is a Request Report");
+  check_equal(f ? f->status : 0, FIRMWARE_NOT_UPGRADABALE, "The chip firmware is not upgradable");
+  check_equal(fw_desc.firmware_id, 0xFFFF, "No transfer is started");
+  close_case("Request Get is refused");
+}
+
+static void test_stream(void)
+{
+  start_case("Stream image", NULL);
+  reset();
+  request_get(zgw_crc16(CRC_INIT_VALUE, image, sizeof(image)));
+  check_equal(ZW_SendDataZIP_args.dataptr[1], FIRMWARE_UPDATE_MD_GET_V3,
+              "The transfer starts with a Get");
+  check_equal(answer_gets(), FIRMWARE_UPDATE_MD_STATUS_REPORT_V3, "Transfer ends with a status");
+  check_equal(last_status(), 0xFF, "Image is accepted");
+  check_true(updated != NULL, "Image is handed to the chip update");
+  check_equal(updated_len, sizeof(image), "Whole image is written");
+  check_true(updated && !memcmp(updated, image, sizeof(image)), "Image is written in order");
+  close_case("Stream image");
+}
+
+static void test_bad_crc(void)
+{
+  start_case("Wrong CRC16", NULL);
+  reset();
+  request_get(zgw_crc16(CRC_INIT_VALUE, image, sizeof(image)) ^ 1);
+  check_equal(answer_gets(), FIRMWARE_UPDATE_MD_STATUS_REPORT_V3, "Transfer ends with a status");
+  check_equal(last_status(), 0x00, "Image with wrong CRC16 is refused");
+  check_true(updated == NULL, "Image is not handed to the chip update");
+  close_case("Wrong CRC16");
+}
+
+static void test_bad_md5(void)
+{
+  start_case("Wrong MD5 digest", NULL);
+  reset();
+  image[IMAGE_LEN + 3] ^= 0x10;
+  request_get(zgw_crc16(CRC_INIT_VALUE, image, sizeof(image)));
+  check_equal(answer_gets(), FIRMWARE_UPDATE_MD_STATUS_REPORT_V3, "Transfer ends with a status");
+  check_equal(last_status(), 0x01, "Image with wrong MD5 digest is refused");
+  check_true(updated == NULL, "Image is not handed to the chip update");
+  close_case("Wrong MD5 digest");
+}
+
+/** Check that the image was received completely and in order */
+static void check_image(void)
+{
+  check_equal(last_status(), 0xFF, "Image is accepted");
+  check_equal(updated_len, sizeof(image), "Whole image is written");
+  check_true(updated && !memcmp(updated, image, sizeof(image)), "Image is written in order");
+}
+
+static void start_transfer(void)
+{
+  request_get(zgw_crc16(CRC_INIT_VALUE, image, sizeof(image)));
+}
+
+static void test_window_refill(void)
+{
+  start_case("Window refill", NULL);
+  reset();
+  start_transfer();
+  answer_gets();
+  check_image();
+  check_true(n_gets >= 4, "Image takes several Gets");
+  check_equal(md_gets[0].first, 1, "First Get starts at the first fragment");
+  check_equal(md_gets[0].count, 4, "First window is 4 fragments");
+  check_equal(md_gets[1].first, 5, "Next window starts after the first");
+  check_equal(md_gets[1].count, 8, "Window is doubled");
+  check_equal(md_gets[2].first, 13, "Window is refilled when it is written");
+  check_equal(md_gets[2].count, 16, "Window grows to the configured maximum");
+  check_equal(md_gets[3].count, 16, "Window stays at the configured maximum");
+  close_case("Window refill");
+}
+
+static void test_lost_fragment(void)
+{
+  start_case("Lost fragment", NULL);
+  reset();
+  sender.lose = 7;
+  start_transfer();
+  answer_gets();
+  check_image();
+  check_equal(md_gets[1].first, 5, "Window with the lost fragment");
+  check_equal(md_gets[1].count, 8, "Window of 8 fragments");
+  check_equal(md_gets[2].first, 7, "Lost fragment is requested again");
+  check_equal(md_gets[2].count, 1, "Only the lost fragment is requested");
+  check_equal(md_gets[3].first, 13, "Next window starts after the kept fragments");
+  check_equal(md_gets[3].count, 4, "Window is halved after a loss");
+  close_case("Lost fragment");
+}
+
+static void test_duplicate_fragments(void)
+{
+  start_case("Duplicate fragments", NULL);
+  reset();
+  sender.duplicate = TRUE;
+  start_transfer();
+  answer_gets();
+  check_image();
+  close_case("Duplicate fragments");
+}
+
+static void test_out_of_order(void)
+{
+  start_case("Out of order fragments", NULL);
+  reset();
+  sender.reverse = TRUE;
+  start_transfer();
+  answer_gets();
+  check_image();
+  check_true(n_gets < MAX_GETS, "Transfer completes");
+  close_case("Out of order fragments");
+}
+
+int main()
+{
+  /* A LAN client, the Z-Wave network only allows small fragments */
+  uip_ipaddr_t lan = {{0xfd, 0, 0xbb, 0xbb, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5}};
+
+  dummy_connection.ripaddr = lan;
+  cfg.manufacturer_id = 0;
+  cfg.hardware_version = 1;
+  cfg.fw_update_window = 16;
+
+  test_not_upgradable();
+  test_stream();
+  test_bad_crc();
+  test_bad_md5();
+  test_window_refill();
+  test_lost_fragment();
+  test_duplicate_fragments();
+  test_out_of_order();
+
+  close_run();
+  return numErrs;
+}
@@ -41,6 +41,10 @@ clock_time_t clock_time() {
     return 0x42;
 }
 
+clock_time_t zw_node_latency_tx_timeout(nodeid_t node, clock_time_t dflt) {
+    return dflt;
+}
+
 u8_t send_data(ts_param_t* p, const u8_t* data, u16_t len,
     ZW_SendDataAppl_Callback_t cb, void* user)
 {
@@ -0,0 +1,376 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdlib.h>
+
+#include "test_helpers.h"
+
+/* The session handling is static */
+#include "../../src/dhcpc2.c"
+
+/**
+ * \defgroup test_dhcpc2 DHCP client unit test
+ *
+ * Test plan
+ *
+ * - A reply is matched to its session by the XID and the hardware address.
+ *   Replies with an unknown XID, or with the XID of another node, are
+ *   ignored.
+ * - Each session keeps the server id and the options of its own offer, also
+ *   when two servers make offers at the same time.
+ * - No more than DHCPC_SESSIONS sessions run at the same time. A session
+ *   slot is reused when its exchange ends.
+ * - The renewals of a pass are spread over the first quarter of what is
+ *   left of the lease.
+ */
+
+#define NUM_NODES 12
+#define MAX_SENT 64
+
+struct router_config cfg;
+nodeid_t MyNodeID = 1;
+uip_lladdr_t uip_lladdr;
+uip_ipaddr_t uip_hostaddr, uip_netmask, uip_draddr;
+u16_t uip_ipv4_len;
+void *uip_ipv4_appdata;
+u8_t uip_ipv4_flags;
+struct process zip_process;
+process_event_t tcpip_ipv4_event;
+
+static nat_table_entry_t nat_entries[NUM_NODES];
+nat_table_entry_t *nat_table = nat_entries;
+uint16_t nat_table_size;
+
+static uint8_t appdata[sizeof(struct dhcp_msg)];
+static struct uip_udp_conn conn;
+
+/** Messages sent by the client */
+static struct {
+  u8_t type;
+  u32_t xid;
+  nodeid_t nodeid;
+  u8_t serverid[4];
+  u32_t tick;
+} sent[MAX_SENT];
+static int n_sent;
+static u32_t now;
+
+/* Mocks */
+
+void macOfNode(uip_lladdr_t *dst, nodeid_t nodeID)
+{
+  memset(dst, 0, sizeof(*dst));
+  dst->addr[0] = 0x02;
+  dst->addr[4] = nodeID >> 8;
+  dst->addr[5] = nodeID & 0xff;
+}
+
+nat_table_entry_t *ipv46nat_entry_of_node(nodeid_t node)
+{
+  int i;
+
+  for (i = 0; i < nat_table_size; i++) {
+    if (nat_table[i].nodeid == node) {
+      return &nat_table[i];
+    }
+  }
+  return NULL;
+}
+
+void ipv46nat_ipv4addr_of_entry(uip_ipv4addr_t *ip, nat_table_entry_t *e)
+{
+  ip->u8[0] = 192;
+  ip->u8[1] = 168;
+  ip->u16[1] = e->ip_suffix;
+}
+
+void ipv46nat_set_suffix(nat_table_entry_t *e, u16_t suffix)
+{
+  e->ip_suffix = suffix;
+}
+
+void uip_ipv4_udp_packet_send(struct uip_udp_conn *c, const void *data, int len)
+{
+  const struct dhcp_msg *m = data;
+  const u8_t *opt = &m->options[4];
+
+  if (n_sent >= MAX_SENT) {
+    return;
+  }
+  memset(&sent[n_sent], 0, sizeof(sent[n_sent]));
+  memcpy(&sent[n_sent].xid, m->xid, 4);
+  sent[n_sent].nodeid = (m->chaddr[4] << 8) | m->chaddr[5];
+  sent[n_sent].tick = now;
+  while (*opt != DHCP_OPTION_END) {
+    if (*opt == DHCP_OPTION_MSG_TYPE) {
+      sent[n_sent].type = opt[2];
+    } else if (*opt == DHCP_OPTION_SERVER_ID) {
+      memcpy(sent[n_sent].serverid, opt + 2, 4);
+    }
+    opt += opt[1] + 2;
+  }
+  n_sent++;
+}
+
+void tcpip_ipv4_poll_udp(struct uip_udp_conn *c) {}
+
+int process_is_running(struct process *p)
+{
+  return 1;
+}
+
+int process_post(struct process *p, process_event_t ev, process_data_t data)
+{
+  return 0;
+}
+
+void resolv_conf(const uip_ipaddr_t *dnsserver) {}
+
+void etimer_set(struct etimer *et, clock_time_t interval) {}
+
+void etimer_restart(struct etimer *et) {}
+
+struct uip_udp_conn *udp_ipv4_new(const uip_ipaddr_t *ripaddr, u16_t port, void *appstate)
+{
+  return &conn;
+}
+
+/* Helpers */
+
+static void reset(int nodes, int with_suffix)
+{
+  int i;
+
+  memset(&dhcpc_state, 0, sizeof(dhcpc_state));
+  dhcpc_state.lease_time = 0xFFFFFFFF;
+  dhcpc_state.ticks = 0xFFFFFFFF;
+  dhcpc_state.conn = &conn;
+  uip_ipv4_appdata = appdata;
+  n_sent = 0;
+  now = 0;
+  /* The gateway has an address, so the nodes are handled */
+  uip_hostaddr.u8[0] = 192;
+  uip_hostaddr.u8[1] = 168;
+  uip_hostaddr.u8[3] = 1;
+  uip_netmask.u16[0] = 0xffff;
+  nat_table_size = nodes;
+  for (i = 0; i < nodes; i++) {
+    nat_table[i].nodeid = i + 2;
+    nat_table[i].ip_suffix = with_suffix ? UIP_HTONS(10 + i) : 0;
+  }
+}
+
+/** The last message sent for node, or -1 */
+static int last_sent(nodeid_t node)
+{
+  int i;
+
+  for (i = n_sent - 1; i >= 0; i--) {
+    if (sent[i].nodeid == node) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/** Deliver a reply from the server, as the client process does */
+static void reply(u8_t type, u32_t xid, nodeid_t node, u8_t server, u8_t router)
+{
+  struct dhcp_msg *m = (struct dhcp_msg *)appdata;
+  dhcpc_session_t *s;
+  u8_t *opt;
+
+  memset(m, 0, sizeof(*m));
+  m->op = DHCP_REPLY;
+  memcpy(m->xid, &xid, 4);
+  macOfNode((uip_lladdr_t *)m->chaddr, node);
+  m->yiaddr[0] = 192;
+  m->yiaddr[1] = 168;
+  m->yiaddr[3] = 100 + node;
+  memcpy(m->options, magic_cookie, 4);
+  opt = add_msg_type(&m->options[4], type);
+  *opt++ = DHCP_OPTION_SERVER_ID;
+  *opt++ = 4;
+  *opt++ = 10;
+  *opt++ = 0;
+  *opt++ = 0;
+  *opt++ = server;
+  *opt++ = DHCP_OPTION_ROUTER;
+  *opt++ = 4;
+  *opt++ = 10;
+  *opt++ = 0;
+  *opt++ = 0;
+  *opt++ = router;
+  opt = add_end(opt);
+  uip_ipv4_len = opt - appdata;
+
+  switch (msg_for_me(&s)) {
+  case DHCPOFFER:
+    update_dhcp_session(s, DHCP_RECV_OFFER);
+    break;
+  case DHCPACK:
+    update_dhcp_session(s, DHCP_RECV_ACK);
+    break;
+  case DHCPNAK:
+    update_dhcp_session(s, DHCP_RECV_NAK);
+    break;
+  default:
+    break;
+  }
+}
+
+static int running_sessions(void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < DHCPC_SESSIONS; i++) {
+    n += dhcpc_state.sessions[i].nodeid != 0;
+  }
+  return n;
+}
+
+/* Tests */
+
+static void test_xid_matching(void)
+{
+  int d2, d3, r;
+
+  start_case("XID matching", NULL);
+  reset(2, 0);
+  dhcp_check_for_new_sessions();
+  dhcp_udp_poll();
+  d2 = last_sent(2);
+  d3 = last_sent(3);
+  check_true(d2 >= 0 && sent[d2].type == DHCPDISCOVER, "Node 2 sends a discover");
+  check_true(d3 >= 0 && sent[d3].type == DHCPDISCOVER, "Node 3 sends a discover");
+  check_true(sent[d2].xid != sent[d3].xid, "The sessions have their own XID");
+
+  reply(DHCPOFFER, sent[d2].xid + sent[d3].xid + 1, 2, 1, 1);
+  reply(DHCPOFFER, sent[d2].xid, 3, 1, 1);
+  dhcp_udp_poll();
+  check_equal(n_sent, 2, "Offers with an unknown XID or another node are ignored");
+
+  reply(DHCPOFFER, sent[d3].xid, 3, 7, 70);
+  reply(DHCPOFFER, sent[d2].xid, 2, 8, 80);
+  dhcp_udp_poll();
+  r = last_sent(3);
+  check_true(sent[r].type == DHCPREQUEST && sent[r].xid == sent[d3].xid,
+             "Node 3 requests in its own session");
+  check_equal(sent[r].serverid[3], 7, "Node 3 requests from the server of its offer");
+  r = last_sent(2);
+  check_true(sent[r].type == DHCPREQUEST && sent[r].xid == sent[d2].xid,
+             "Node 2 requests in its own session");
+  check_equal(sent[r].serverid[3], 8, "Node 2 requests from the server of its offer");
+  check_equal(session_of_node(3)->default_router.u8[3], 70,
+              "Node 3 keeps the options of its offer");
+
+  reply(DHCPACK, sent[d3].xid, 3, 7, 70);
+  check_true(session_of_node(3) == NULL, "The ACK ends the session of node 3");
+  check_equal(nat_table[1].ip_suffix, UIP_HTONS(103), "Node 3 has its address");
+  check_true(session_of_node(2) != NULL, "The session of node 2 is still running");
+  check_equal(nat_table[0].ip_suffix, 0, "Node 2 has no address yet");
+  close_case("XID matching");
+}
+
+static void test_slot_reuse(void)
+{
+  int i, d;
+
+  start_case("Session slot reuse", NULL);
+  reset(NUM_NODES, 0);
+  dhcp_check_for_new_sessions();
+  dhcp_udp_poll();
+  check_equal(running_sessions(), DHCPC_SESSIONS, "All session slots are used");
+  check_equal(n_sent, DHCPC_SESSIONS, "One discover is sent per session");
+  check_equal(last_sent(2 + DHCPC_SESSIONS), -1, "The next node waits for a slot");
+
+  /* Complete the exchange of node 2 */
+  d = last_sent(2);
+  reply(DHCPOFFER, sent[d].xid, 2, 1, 1);
+  dhcp_udp_poll();
+  reply(DHCPACK, sent[d].xid, 2, 1, 1);
+  check_equal(running_sessions(), DHCPC_SESSIONS, "The free slot is reused at once");
+  dhcp_udp_poll();
+  d = last_sent(2 + DHCPC_SESSIONS);
+  check_true(d >= 0 && sent[d].type == DHCPDISCOVER, "The next node sends a discover");
+
+  /* Complete the rest */
+  for (i = 3; i < 2 + NUM_NODES; i++) {
+    d = last_sent(i);
+    if (d < 0) {
+      dhcp_udp_poll();
+      d = last_sent(i);
+    }
+    reply(DHCPOFFER, sent[d].xid, i, 1, 1);
+    dhcp_udp_poll();
+    reply(DHCPACK, sent[d].xid, i, 1, 1);
+  }
+  check_equal(running_sessions(), 0, "All sessions have ended");
+  for (i = 0; i < NUM_NODES; i++) {
+    if (nat_table[i].ip_suffix == 0) {
+      break;
+    }
+  }
+  check_equal(i, NUM_NODES, "All nodes have an address");
+  close_case("Session slot reuse");
+}
+
+static void test_spread_renewals(void)
+{
+  u32_t t1, interval, first, last;
+  int i, r, n_requests = 0, errors = 0;
+
+  start_case("Spread out renewals", NULL);
+  reset(NUM_NODES, 1);
+  dhcpc_state.last_renew = NUM_NODES;
+  dhcpc_state.ticks = 4001;
+  dhcpc_state.timeout = 4000;
+
+  /* T1 */
+  timeout();
+  t1 = now;
+  interval = (4000 / 4) / NUM_NODES;
+  check_equal(dhcpc_state.renew_interval, interval, "Renewals are spread over a quarter of the lease");
+
+  for (now = 1; now < 2000 && n_requests < NUM_NODES; now++) {
+    dhcp_udp_poll();
+    /* Answer each request at once, so no session slot is short */
+    for (r = 0; r < n_sent; r++) {
+      if (sent[r].type == DHCPREQUEST && sent[r].tick == now) {
+        reply(DHCPACK, sent[r].xid, sent[r].nodeid, 1, 1);
+        n_requests++;
+      }
+    }
+    timeout();
+  }
+  check_equal(n_requests, NUM_NODES, "All nodes are renewed");
+
+  first = last = 0;
+  for (i = 0, r = 0; r < n_sent; r++) {
+    if (sent[r].type != DHCPREQUEST) {
+      continue;
+    }
+    if (i == 0) {
+      first = sent[r].tick;
+    } else if (sent[r].tick - last < interval / 2 || sent[r].tick - last > interval * 3 / 2) {
+      errors++;
+    }
+    last = sent[r].tick;
+    i++;
+  }
+  check_true(first <= t1 + 1, "The first renewal starts at T1");
+  check_equal(errors, 0, "Renewals are between a half and one and a half intervals apart");
+  check_true(last - first <= interval * 3 / 2 * (NUM_NODES - 1),
+             "The last renewal starts within the spread");
+  close_case("Spread out renewals");
+}
+
+int main()
+{
+  srand(47);
+  test_xid_matching();
+  test_slot_reuse();
+  test_spread_renewals();
+
+  close_run();
+  return numErrs;
+}
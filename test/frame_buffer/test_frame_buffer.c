@@ -0,0 +1,78 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdint.h>
+
+#include "test_helpers.h"
+#include "zw_frame_buffer.h"
+
+/**
+ * \defgroup test_frame_buffer Z-Wave frame buffer unit test
+ *
+ * Test plan
+ *
+ * - A created buffer holds a copy of the frame.
+ * - Headers can be added in front of the frame until the headroom is used.
+ * - A checksum can be added after the frame.
+ * - The buffer stays valid until the last reference is released.
+ */
+
+static const uint8_t cmd[] = { 0x25, 0x02 };
+
+static void test_headroom(void)
+{
+  ts_param_t p;
+  zw_frame_buffer_element_t* fb;
+  uint8_t* head;
+  uint8_t* tail;
+
+  start_case("Headroom", NULL);
+  memset(&p, 0, sizeof(p));
+  p.dnode = 5;
+  fb = zw_frame_buffer_create(&p, cmd, sizeof(cmd));
+  check_true(fb != NULL, "Buffer is created");
+  check_equal(fb->frame_len, sizeof(cmd), "Frame length");
+  check_true(memcmp(fb->frame_data, cmd, sizeof(cmd)) == 0, "Frame is copied");
+  check_equal(fb->param.dnode, 5, "Parameters are copied");
+
+  head = zw_frame_buffer_push(fb, 4);
+  check_true(head == fb->frame_data, "Push returns the start of the frame");
+  check_equal(fb->frame_len, sizeof(cmd) + 4, "Push adds to the frame");
+  check_true(memcmp(head + 4, cmd, sizeof(cmd)) == 0, "Frame is kept after push");
+
+  check_true(zw_frame_buffer_push(fb, FRAME_BUFFER_HEADROOM - 4 + 1) == NULL,
+             "Push beyond the headroom fails");
+  check_equal(fb->frame_len, sizeof(cmd) + 4, "Failed push leaves the frame");
+
+  tail = zw_frame_buffer_put(fb, 2);
+  check_true(tail == fb->frame_data + sizeof(cmd) + 4, "Put returns the end of the frame");
+  check_equal(fb->frame_len, sizeof(cmd) + 6, "Put adds to the frame");
+  zw_frame_buffer_free(fb);
+  close_case("Headroom");
+}
+
+static void test_refs(void)
+{
+  ts_param_t p;
+  zw_frame_buffer_element_t* fb;
+
+  start_case("References", NULL);
+  memset(&p, 0, sizeof(p));
+  fb = zw_frame_buffer_create(&p, cmd, sizeof(cmd));
+  check_true(zw_frame_buffer_ref(fb) == fb, "Ref returns the buffer");
+  check_equal(fb->refs, 2, "Two references");
+  zw_frame_buffer_free(fb);
+  check_equal(fb->refs, 1, "Buffer is kept for the last reference");
+  check_true(memcmp(fb->frame_data, cmd, sizeof(cmd)) == 0, "Frame is kept");
+  zw_frame_buffer_free(fb);
+  zw_frame_buffer_free(NULL);
+  close_case("References");
+}
+
+int main()
+{
+  test_headroom();
+  test_refs();
+
+  close_run();
+  return numErrs;
+}
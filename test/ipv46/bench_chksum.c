@@ -0,0 +1,121 @@
+/* © 2020 Silicon Laboratories Inc. */
+/*
+ * Compare chksum() in uip6.c with the byte at a time RFC 1071 sum it
+ * replaced. The sums of the two are compared, and the time to sum a
+ * 1280 byte buffer, the IPv6 minimum MTU, is printed for each. With
+ * --check only the sums are compared, which is how ctest runs it.
+ *
+ * Usage: bench_chksum [--check] [iterations]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_LEN 1280
+
+typedef uint16_t u16_t;
+typedef uint8_t u8_t;
+
+u16_t chksum(u16_t sum, const u8_t *data, u16_t len);
+
+/* The previous chksum() */
+static u16_t bytewise_chksum(u16_t sum, const u8_t *data, u16_t len)
+{
+  u16_t t;
+  const u8_t *dataptr;
+  const u8_t *last_byte;
+
+  dataptr = data;
+  last_byte = data + len - 1;
+
+  while(dataptr < last_byte) {   /* At least two more bytes */
+    t = (dataptr[0] << 8) + dataptr[1];
+    sum += t;
+    if(sum < t) {
+      sum++;      /* carry */
+    }
+    dataptr += 2;
+  }
+
+  if(dataptr == last_byte) {
+    t = (dataptr[0] << 8) + 0;
+    sum += t;
+    if(sum < t) {
+      sum++;      /* carry */
+    }
+  }
+  return sum;
+}
+
+typedef u16_t (*chksum_t)(u16_t sum, const u8_t *data, u16_t len);
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* The sum is fed back, so the calls cannot be folded */
+static double time_us(chksum_t f, const u8_t *buf, long iterations, u16_t *sum)
+{
+  double start = now_us();
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    *sum = f(*sum, buf, BENCH_LEN);
+  }
+  return (now_us() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+  static u8_t buf[BENCH_LEN + 1];
+  long iterations = 100000;
+  int check_only = 0;
+  u16_t sum_new = 0, sum_old = 0;
+  double us_new, us_old;
+  int len, offset;
+
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+    check_only = 1;
+    argc--;
+    argv++;
+  }
+  if (argc > 1) {
+    iterations = atol(argv[1]);
+    if (iterations <= 0) {
+      fprintf(stderr, "Usage: bench_chksum [--check] [iterations]\n");
+      return 2;
+    }
+  }
+
+  for (len = 0; len < (int)sizeof(buf); len++) {
+    buf[len] = rand();
+  }
+  for (offset = 0; offset < 2; offset++) {
+    for (len = 0; len <= BENCH_LEN; len++) {
+      if (chksum(len, buf + offset, len) != bytewise_chksum(len, buf + offset, len)) {
+        printf("chksum differs for length %d at offset %d\n", len, offset);
+        return 1;
+      }
+    }
+  }
+  if (check_only) {
+    printf("chksum agrees for all lengths up to %d\n", BENCH_LEN);
+    return 0;
+  }
+
+  us_old = time_us(bytewise_chksum, buf, iterations, &sum_old);
+  us_new = time_us(chksum, buf, iterations, &sum_new);
+  if (sum_new != sum_old) {
+    printf("chksum differs after %ld iterations\n", iterations);
+    return 1;
+  }
+  printf("%d bytes: byte wise %.3f us, chksum %.3f us, %.1f times faster\n",
+         BENCH_LEN, us_old, us_new, us_old / us_new);
+  return 0;
+}
@@ -0,0 +1,40 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+/* Stubs for the parts of the IPv6 stack that uip6.c calls. */
+
+#include "contiki-net.h"
+
+uip_ds6_netif_t uip_ds6_if;
+
+void uip_ds6_init(void) {}
+
+uip_ds6_addr_t *uip_ds6_addr_lookup(uip_ipaddr_t *ipaddr)
+{
+  return NULL;
+}
+
+uip_ds6_maddr_t *uip_ds6_maddr_lookup(uip_ipaddr_t *ipaddr)
+{
+  return NULL;
+}
+
+uint8_t uip_ds6_is_addr_onlink(uip_ipaddr_t *ipaddr)
+{
+  return 0;
+}
+
+void uip_ds6_select_src(uip_ipaddr_t *src, uip_ipaddr_t *dst) {}
+
+void tcpip_uipcall(void) {}
+
+void tcpip_icmp6_call(uint8_t type) {}
+
+void uip_icmp6_echo_request_input(void) {}
+
+void uip_icmp6_error_output(uint8_t type, uint8_t code, uint32_t param) {}
+
+void uip_nd6_ns_input(void) {}
+
+void uip_nd6_na_input(void) {}
+
+void uip_nd6_rs_input(void) {}
@@ -0,0 +1,310 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdlib.h>
+
+#include "test_helpers.h"
+
+/* The translation functions are static */
+#include "../../src/ipv46_if_handler.c"
+
+/**
+ * \defgroup test_ipv46_chksum IPv4/IPv6 translation checksum unit test
+ *
+ * Test plan
+ *
+ * - chksum() gives the same sum as the byte at a time RFC 1071 sum, for all
+ *   lengths and alignments.
+ * - The UDP checksum after 4-to-6 translation equals a full recomputation
+ *   over the IPv6 pseudo header, both when it is updated and when the IPv4
+ *   datagram had no checksum.
+ * - The ICMP echo checksum after 4-to-6 and 6-to-4 translation equals a full
+ *   recomputation.
+ */
+
+#define ETH_LEN 14
+#define IP4_LEN 20
+#define IP6_LEN 40
+#define MAX_PAYLOAD 600
+
+nodeid_t MyNodeID = 1;
+uip_ipaddr_t uip_hostaddr, uip_netmask;
+const uip_ipaddr_t uip_broadcast_addr = { { 0xff, 0xff, 0xff, 0xff } };
+uip_ipv4addr_t uip_ipv4_net_broadcast_addr;
+
+static const uip_ip6addr_t node_ip = { { 0xfd, 0x00, 0xaa, 0xbb, 0, 0, 0, 0,
+                                         0, 0, 0, 0, 0, 0, 0x12, 0x05 } };
+
+/* Mocks */
+
+void ipOfNode(uip_ip6addr_t *dst, nodeid_t nodeID)
+{
+  *dst = node_ip;
+}
+
+nodeid_t nodeOfIP(uip_ip6addr_t *ip)
+{
+  return 0;
+}
+
+u16_t uip_ipv4_ipchksum(void)
+{
+  return 0;
+}
+
+void uip_arp_out(void) {}
+
+nodeid_t ipv46nat_get_nat_addr(uip_ipv4addr_t *ip)
+{
+  return 0;
+}
+
+nat_table_entry_t *ipv46nat_entry_of_node(nodeid_t node)
+{
+  return NULL;
+}
+
+/* Helpers */
+
+/** The byte at a time one's complement sum, as chksum() used to do it */
+static u16_t ref_chksum(u16_t sum, const u8_t *data, u16_t len)
+{
+  uint32_t acc = sum;
+  u16_t i;
+
+  for (i = 0; i + 1 < len; i += 2) {
+    acc += (data[i] << 8) | data[i + 1];
+  }
+  if (len & 1) {
+    acc += data[len - 1] << 8;
+  }
+  while (acc >> 16) {
+    acc = (acc & 0xffff) + (acc >> 16);
+  }
+  return acc;
+}
+
+/** Full checksum of an upper layer message, in network byte order */
+static u16_t ref_upper_chksum(u16_t pseudo_sum, u8_t *msg, u16_t len, int field)
+{
+  u8_t save[2];
+  u16_t sum;
+
+  memcpy(save, msg + field, 2);
+  memset(msg + field, 0, 2);
+  sum = ~ref_chksum(pseudo_sum, msg, len);
+  memcpy(msg + field, save, 2);
+  if (sum == 0) {
+    sum = 0xffff;
+  }
+  return UIP_HTONS(sum);
+}
+
+static u16_t ref_pseudo_sum(u16_t len, u8_t proto, const u8_t *addrs, int addr_len)
+{
+  return ref_chksum(len + proto, addrs, addr_len);
+}
+
+static u16_t get16(const u8_t *p)
+{
+  u16_t v;
+
+  memcpy(&v, p, 2);
+  return v;
+}
+
+static void put16(u8_t *p, u16_t v)
+{
+  memcpy(p, &v, 2);
+}
+
+/** Build an IPv4 datagram with a valid upper layer checksum in uip_buf */
+static u8_t *make_ip4(u8_t proto, u16_t len, int chksum_field, int with_chksum)
+{
+  u8_t *ip = &uip_buf[ETH_LEN];
+  u8_t *msg = ip + IP4_LEN;
+  int i;
+
+  memset(uip_buf, 0, ETH_LEN + IP4_LEN);
+  ip[0] = 0x45;
+  put16(ip + 2, UIP_HTONS(IP4_LEN + len));
+  ip[8] = 64;
+  ip[9] = proto;
+  for (i = 12; i < 20; i++) {
+    ip[i] = rand();
+  }
+  for (i = 0; i < len; i++) {
+    msg[i] = rand();
+  }
+  if (proto == UIP_PROTO_UDP) {
+    put16(msg + 4, UIP_HTONS(len));
+  }
+  if (!with_chksum) {
+    put16(msg + chksum_field, 0);
+  } else if (proto == UIP_PROTO_UDP) {
+    put16(msg + chksum_field, ref_upper_chksum(
+        ref_pseudo_sum(len, proto, ip + 12, 8), msg, len, chksum_field));
+  } else {
+    put16(msg + chksum_field, ref_upper_chksum(0, msg, len, chksum_field));
+  }
+  uip_len = ETH_LEN + IP4_LEN + len;
+  return msg;
+}
+
+/** Build an IPv6 datagram with a valid upper layer checksum in uip_buf */
+static u8_t *make_ip6(u8_t proto, u16_t len, int chksum_field)
+{
+  u8_t *ip = &uip_buf[ETH_LEN];
+  u8_t *msg = ip + IP6_LEN;
+  int i;
+
+  memset(uip_buf, 0, ETH_LEN + IP6_LEN);
+  ip[0] = 0x60;
+  put16(ip + 4, UIP_HTONS(len));
+  ip[6] = proto;
+  ip[7] = 64;
+  memcpy(ip + 8, &node_ip, 16);
+  ip[34] = 0xff;
+  ip[35] = 0xff;
+  for (i = 36; i < 40; i++) {
+    ip[i] = rand();
+  }
+  for (i = 0; i < len; i++) {
+    msg[i] = rand();
+  }
+  put16(msg + chksum_field, ref_upper_chksum(
+      ref_pseudo_sum(len, proto, ip + 8, 32), msg, len, chksum_field));
+  uip_len = ETH_LEN + IP6_LEN + len;
+  return msg;
+}
+
+/* Tests */
+
+static void test_chksum(void)
+{
+  static u8_t buf[MAX_PAYLOAD + 8];
+  int len, offset, errors = 0;
+  u16_t sum;
+
+  start_case("chksum against the byte wise sum", NULL);
+  for (len = 0; len < (int)sizeof(buf); len++) {
+    buf[len] = rand();
+  }
+  for (offset = 0; offset < 8; offset++) {
+    for (len = 0; len <= MAX_PAYLOAD; len++) {
+      sum = rand();
+      if (chksum(sum, buf + offset, len) != ref_chksum(sum, buf + offset, len)) {
+        errors++;
+      }
+    }
+  }
+  check_equal(errors, 0, "chksum matches for all lengths and alignments");
+  memset(buf, 0xff, sizeof(buf));
+  check_equal(chksum(0, buf, MAX_PAYLOAD), ref_chksum(0, buf, MAX_PAYLOAD),
+              "chksum matches when every word carries");
+  close_case("chksum against the byte wise sum");
+}
+
+static void test_udp_46(int with_chksum)
+{
+  const char *name = with_chksum ? "UDP 4-to-6, updated checksum"
+                                 : "UDP 4-to-6, no IPv4 checksum";
+  int i, errors = 0;
+  u16_t len;
+  u8_t *ip, *msg;
+
+  start_case(name, NULL);
+  for (i = 0; i < 200; i++) {
+    len = 8 + rand() % (MAX_PAYLOAD - 8);
+    make_ip4(UIP_PROTO_UDP, len, 6, with_chksum);
+    do_46_translation(5);
+
+    ip = &uip_buf[ETH_LEN];
+    msg = ip + IP6_LEN;
+    if (uip_len != ETH_LEN + IP6_LEN + len || ip[6] != UIP_PROTO_UDP) {
+      errors++;
+      continue;
+    }
+    if (get16(msg + 6) != ref_upper_chksum(
+            ref_pseudo_sum(len, UIP_PROTO_UDP, ip + 8, 32), msg, len, 6)) {
+      errors++;
+    }
+  }
+  check_equal(errors, 0, "Checksum equals the full recomputation");
+  close_case(name);
+}
+
+static void test_icmp_46(void)
+{
+  int i, errors = 0;
+  u16_t len;
+  u8_t *ip, *msg, type;
+
+  start_case("ICMP echo 4-to-6", NULL);
+  for (i = 0; i < 200; i++) {
+    len = 8 + rand() % (MAX_PAYLOAD - 8);
+    type = (i & 1) ? 0 : 8;
+    msg = make_ip4(UIP_PROTO_ICMP, len, 2, 1);
+    msg[0] = type;
+    msg[1] = 0;
+    put16(msg + 2, ref_upper_chksum(0, msg, len, 2));
+    do_46_translation(5);
+
+    ip = &uip_buf[ETH_LEN];
+    msg = ip + IP6_LEN;
+    if (ip[6] != UIP_PROTO_ICMP6 || msg[0] != (type ? 128 : 129)) {
+      errors++;
+      continue;
+    }
+    if (get16(msg + 2) != ref_upper_chksum(
+            ref_pseudo_sum(len, UIP_PROTO_ICMP6, ip + 8, 32), msg, len, 2)) {
+      errors++;
+    }
+  }
+  check_equal(errors, 0, "Checksum equals the full recomputation");
+  close_case("ICMP echo 4-to-6");
+}
+
+static void test_icmp_64(void)
+{
+  int i, errors = 0;
+  u16_t len;
+  u8_t *ip, *msg, type;
+
+  start_case("ICMP echo 6-to-4", NULL);
+  for (i = 0; i < 200; i++) {
+    len = 8 + rand() % (MAX_PAYLOAD - 8);
+    type = (i & 1) ? 129 : 128;
+    msg = make_ip6(UIP_PROTO_ICMP6, len, 2);
+    msg[0] = type;
+    msg[1] = 0;
+    ip = &uip_buf[ETH_LEN];
+    put16(msg + 2, ref_upper_chksum(
+        ref_pseudo_sum(len, UIP_PROTO_ICMP6, ip + 8, 32), msg, len, 2));
+    do_64_translation();
+
+    msg = ip + IP4_LEN;
+    if (uip_len != ETH_LEN + IP4_LEN + len || ip[9] != UIP_PROTO_ICMP
+        || msg[0] != (type == 128 ? 8 : 0)) {
+      errors++;
+      continue;
+    }
+    if (get16(msg + 2) != ref_upper_chksum(0, msg, len, 2)) {
+      errors++;
+    }
+  }
+  check_equal(errors, 0, "Checksum equals the full recomputation");
+  close_case("ICMP echo 6-to-4");
+}
+
+int main()
+{
+  srand(46);
+  test_chksum();
+  test_udp_46(1);
+  test_udp_46(0);
+  test_icmp_46();
+  test_icmp_64();
+
+  close_run();
+  return numErrs;
+}
@@ -0,0 +1,218 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+
+#include "test_helpers.h"
+#include "contiki-net-ipv4.h"
+#include "ipv46_internal.h"
+#include "ipv46_nat.h"
+#include "ZW_transport_api.h"
+
+/**
+ * \defgroup test_ipv46_nat NAT table unit test
+ *
+ * Test plan
+ *
+ * - Entries are added once per node, also beyond the first allocation and
+ *   for Long Range node ids.
+ * - Deleting an entry shifts the entries after it, and both indexes follow
+ *   them. The gateway entry is not deleted.
+ * - Renaming moves the entry to the new node id. If the new id already has
+ *   an entry, that entry is released and deleted first.
+ * - An IPv4 address is mapped to the node of its suffix, and a changed or
+ *   deleted suffix no longer maps to the node.
+ */
+
+nodeid_t MyNodeID = 1;
+uip_ipaddr_t uip_hostaddr, uip_netmask;
+
+/** Node ids released with dhcp_release() */
+static nodeid_t released[8];
+static int n_released;
+
+/* Mocks */
+
+void dhcp_check_for_new_sessions() {}
+
+void dhcp_release(nat_table_entry_t *e)
+{
+  if (n_released < 8) {
+    released[n_released] = e->nodeid;
+  }
+  n_released++;
+}
+
+/* Helpers */
+
+static void reset(void)
+{
+  uip_ipv4_ipaddr(&uip_hostaddr, 192, 168, 0, 1);
+  uip_ipv4_ipaddr(&uip_netmask, 255, 255, 255, 0);
+  n_released = 0;
+  ipv46nat_init();
+  ipv46nat_add_entry(MyNodeID);
+}
+
+/** Node behind 192.168.0.host */
+static nodeid_t node_of_host(u8_t host)
+{
+  uip_ipv4addr_t ip;
+
+  uip_ipv4_ipaddr(&ip, 192, 168, 0, host);
+  return ipv46nat_get_nat_addr(&ip);
+}
+
+static void set_host(nodeid_t node, u8_t host)
+{
+  ipv46nat_set_suffix(ipv46nat_entry_of_node(node), UIP_HTONS(host));
+}
+
+/** Check that every entry is found by its node id and suffix */
+static int index_errors(void)
+{
+  int i, errors = 0;
+
+  for (i = 0; i < nat_table_size; i++) {
+    if (ipv46nat_entry_of_node(nat_table[i].nodeid) != &nat_table[i]) {
+      errors++;
+    }
+    if (nat_table[i].ip_suffix
+        && node_of_host(UIP_HTONS(nat_table[i].ip_suffix)) != nat_table[i].nodeid) {
+      errors++;
+    }
+  }
+  return errors;
+}
+
+/* Tests */
+
+static void test_add(void)
+{
+  int i;
+
+  start_case("Add", NULL);
+  reset();
+  check_equal(nat_table_size, 1, "The gateway has an entry");
+  check_equal(nat_table[0].ip_suffix, UIP_HTONS(1), "The gateway entry has its address");
+  check_equal(node_of_host(1), MyNodeID, "The gateway address maps to the gateway");
+
+  check_true(!ipv46nat_add_entry(0), "Node id 0 is refused");
+  check_true(!ipv46nat_add_entry(ZW_MAX_NODES + 1), "Node ids above ZW_MAX_NODES are refused");
+  for (i = 2; i < 102; i++) {
+    ipv46nat_add_entry(i);
+  }
+  check_true(ipv46nat_add_entry(ZW_MAX_NODES), "The largest Long Range node id is added");
+  check_equal(nat_table_size, 102, "The table grows beyond the first allocation");
+  check_true(ipv46nat_add_entry(50), "Adding a node twice succeeds");
+  check_equal(nat_table_size, 102, "A node has one entry only");
+  check_equal(ipv46nat_entry_of_node(ZW_MAX_NODES)->nodeid, ZW_MAX_NODES,
+              "The Long Range node is found");
+  check_true(ipv46nat_entry_of_node(102) == NULL, "A node without entry is not found");
+  check_equal(index_errors(), 0, "All entries are indexed");
+  check_true(!ipv46nat_all_nodes_has_ip(), "Added nodes have no address yet");
+  close_case("Add");
+}
+
+static void test_delete_shift(void)
+{
+  start_case("Delete", NULL);
+  reset();
+  ipv46nat_add_entry(2);
+  ipv46nat_add_entry(3);
+  ipv46nat_add_entry(4);
+  set_host(2, 12);
+  set_host(3, 13);
+  set_host(4, 14);
+
+  check_true(ipv46nat_del_entry(3), "The entry is deleted");
+  check_equal(n_released, 1, "The address is released");
+  check_equal(released[0], 3, "The address of the deleted node is released");
+  check_equal(nat_table_size, 3, "The table shrinks");
+  check_equal(nat_table[1].nodeid, 2, "Entries before it keep their place");
+  check_equal(nat_table[2].nodeid, 4, "Entries after it move down");
+  check_true(ipv46nat_entry_of_node(3) == NULL, "The deleted node is not found");
+  check_equal(node_of_host(13), 0, "The suffix of the deleted node is free");
+  check_equal(node_of_host(14), 4, "The suffix of a moved entry is found");
+  check_equal(index_errors(), 0, "All entries are indexed");
+
+  check_true(!ipv46nat_del_entry(3), "Deleting again fails");
+  check_true(!ipv46nat_del_entry(MyNodeID), "The gateway entry is not deleted");
+  check_equal(node_of_host(1), MyNodeID, "The gateway keeps its address");
+  close_case("Delete");
+}
+
+static void test_rename(void)
+{
+  start_case("Rename", NULL);
+  reset();
+  ipv46nat_add_entry(2);
+  ipv46nat_add_entry(3);
+  ipv46nat_add_entry(4);
+  set_host(2, 12);
+  set_host(3, 13);
+  set_host(4, 14);
+
+  ipv46nat_rename_node(4, 5);
+  check_true(ipv46nat_entry_of_node(4) == NULL, "The old id is not found");
+  check_equal(ipv46nat_entry_of_node(5)->ip_suffix, UIP_HTONS(14), "The entry keeps its address");
+  check_equal(node_of_host(14), 5, "The address maps to the new id");
+  check_equal(n_released, 0, "Nothing is released");
+
+  ipv46nat_rename_node(5, 2);
+  check_equal(n_released, 1, "The entry of the new id is released");
+  check_equal(released[0], 2, "The released entry is the old entry of the new id");
+  check_equal(nat_table_size, 3, "The old entry of the new id is deleted");
+  check_equal(ipv46nat_entry_of_node(2)->ip_suffix, UIP_HTONS(14),
+              "The new id has the renamed entry");
+  check_true(ipv46nat_entry_of_node(5) == NULL, "The old id is not found");
+  check_equal(node_of_host(12), 0, "The suffix of the deleted entry is free");
+  check_equal(node_of_host(14), 2, "The renamed address maps to the new id");
+  check_equal(node_of_host(13), 3, "Other entries are not affected");
+  check_equal(index_errors(), 0, "All entries are indexed");
+
+  ipv46nat_rename_node(7, 8);
+  check_equal(nat_table_size, 3, "Renaming a node without entry does nothing");
+  close_case("Rename");
+}
+
+static void test_suffix(void)
+{
+  uip_ipv4addr_t ip;
+
+  start_case("Suffix lookup", NULL);
+  reset();
+  ipv46nat_add_entry(2);
+  ipv46nat_add_entry(3);
+  check_equal(node_of_host(20), 0, "A free suffix maps to no node");
+  set_host(2, 20);
+  check_equal(node_of_host(20), 2, "The suffix maps to its node");
+  set_host(2, 21);
+  check_equal(node_of_host(20), 0, "The old suffix is free after a change");
+  check_equal(node_of_host(21), 2, "The new suffix maps to the node");
+  set_host(3, 30);
+  check_true(ipv46nat_all_nodes_has_ip(), "All nodes have an address");
+  ipv46nat_set_suffix(ipv46nat_entry_of_node(3), 0);
+  check_equal(node_of_host(30), 0, "A cleared suffix is free");
+
+  uip_ipv4_ipaddr(&ip, 10, 0, 0, 21);
+  check_equal(ipv46nat_get_nat_addr(&ip), 0, "Addresses outside the net are not mapped");
+  check_true(ipv46nat_ipv4addr_of_node(&ip, 2), "The address of a node is found");
+  check_true(ip.u8[0] == 192 && ip.u8[3] == 21, "The address is on the net of the gateway");
+  check_true(!ipv46nat_ipv4addr_of_node(&ip, 3), "A node without address has none");
+
+  ipv46nat_del_all_nodes();
+  check_equal(nat_table_size, 1, "Only the gateway is left");
+  check_equal(node_of_host(21), 0, "Suffixes of deleted nodes are free");
+  check_equal(node_of_host(1), MyNodeID, "The gateway keeps its address");
+  close_case("Suffix lookup");
+}
+
+int main()
+{
+  test_add();
+  test_delete_shift();
+  test_rename();
+  test_suffix();
+
+  close_run();
+  return numErrs;
+}
@@ -0,0 +1,280 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test_helpers.h"
+#include "mb_journal.h"
+
+/**
+ * \defgroup test_mb_journal Mailbox journal unit test
+ *
+ * Test plan
+ *
+ * - Entries added to the journal are replayed in order when it is reopened.
+ * - Deleted entries are not replayed.
+ * - A journal from another home ID is discarded.
+ * - A torn record ends the log, records before it are replayed.
+ * - Entries deleted by the replay callback stay deleted, also when the
+ *   deletes make the journal grow during the replay.
+ * - Compaction keeps the live entries and their ids.
+ * - Entries added and deleted while the compacted file is being synced are
+ *   kept in the compacted journal.
+ */
+
+#define JOURNAL_FILE "test_mb_journal.dat"
+#define HOME_ID 0xCAFEBABE
+
+static mb_journal_entry_t replayed[16];
+static uint8_t replayed_data[16][64];
+static int n_replayed;
+
+static void replay_cb(const mb_journal_entry_t *e, void *user)
+{
+  (void)user;
+  if (n_replayed < 16) {
+    replayed[n_replayed] = *e;
+    memcpy(replayed_data[n_replayed], e->data, e->data_len);
+    replayed[n_replayed].data = replayed_data[n_replayed];
+  }
+  n_replayed++;
+}
+
+static int reopen(uint32_t home_id)
+{
+  mb_journal_close();
+  n_replayed = 0;
+  return mb_journal_open(JOURNAL_FILE, home_id, replay_cb, NULL);
+}
+
+/** Replay callback of a full mailbox, which drops every other entry. */
+static void drop_cb(const mb_journal_entry_t *e, void *user)
+{
+  (void)user;
+  if (n_replayed++ & 1) {
+    mb_journal_append_del(e->id);
+  }
+}
+
+static void compact_replayed(void)
+{
+  int i;
+
+  check_true(mb_journal_compact_begin(), "Compaction can be started");
+  for (i = 0; i < n_replayed; i++) {
+    check_true(mb_journal_compact_add(&replayed[i]), "Entry can be compacted");
+  }
+  mb_journal_compact_commit();
+}
+
+static void compact_finish(void)
+{
+  while (mb_journal_compact_poll()) {
+    usleep(1000);
+  }
+}
+
+static uint32_t add_entry(uint8_t tag, uint16_t len)
+{
+  mb_journal_entry_t e;
+  uint8_t data[64];
+
+  memset(&e, 0, sizeof(e));
+  memset(data, tag, sizeof(data));
+  e.queued_time = 1000 + tag;
+  e.proxy[15] = tag;
+  e.handle = tag;
+  e.waiting_enabled = 1;
+  e.data_len = len;
+  e.data = data;
+  return mb_journal_append_add(&e);
+}
+
+static void test_replay(void)
+{
+  uint32_t id1, id2, id3;
+  uint8_t expected[64];
+
+  start_case("Replay of added and deleted entries", NULL);
+  unlink(JOURNAL_FILE);
+
+  check_true(reopen(HOME_ID), "New journal can be opened");
+  check_equal(n_replayed, 0, "New journal is empty");
+
+  id1 = add_entry(1, 40);
+  id2 = add_entry(2, 41);
+  id3 = add_entry(3, 42);
+  check_true(id1 && id2 && id3, "Entries are added");
+  check_true(id1 != id2 && id2 != id3, "Entries get distinct ids");
+  check_true(mb_journal_is_dirty(), "Journal is dirty after append");
+  mb_journal_flush();
+  check_true(!mb_journal_is_dirty(), "Journal is clean after flush");
+
+  mb_journal_append_del(id2);
+
+  check_true(reopen(HOME_ID), "Journal can be reopened");
+  check_equal(n_replayed, 2, "Two live entries are replayed");
+  check_equal(replayed[0].id, id1, "First entry is replayed first");
+  check_equal(replayed[1].id, id3, "Deleted entry is skipped");
+  check_equal(replayed[1].data_len, 42, "Data length is restored");
+  check_equal(replayed[1].handle, 3, "Handle is restored");
+  check_equal(replayed[1].queued_time, 1003, "Queue time is restored");
+  check_equal(replayed[1].proxy[15], 3, "Proxy is restored");
+  memset(expected, 3, sizeof(expected));
+  check_mem(expected, replayed_data[1], 42, "Data mismatch %s\n", "Data is restored");
+
+  check_true(add_entry(4, 10) > id3, "Ids are not reused after reopen");
+  close_case("Replay of added and deleted entries");
+
+  start_case("Journal of another network", NULL);
+  check_true(reopen(HOME_ID + 1), "Journal can be opened with another home ID");
+  check_equal(n_replayed, 0, "Entries of the other network are discarded");
+  check_true(reopen(HOME_ID + 1), "Journal can be reopened");
+  check_equal(n_replayed, 0, "Discarded entries stay discarded");
+  close_case("Journal of another network");
+}
+
+static void test_torn_record(void)
+{
+  FILE *f;
+  long off;
+  uint8_t b;
+
+  start_case("Torn record", NULL);
+  unlink(JOURNAL_FILE);
+  check_true(reopen(HOME_ID), "New journal can be opened");
+  add_entry(1, 20);
+  add_entry(2, 20);
+  mb_journal_close();
+
+  /* Corrupt the payload of the last record.  Header is 12 bytes, records
+   * are 36 bytes of header and 20 bytes of data. */
+  off = 12 + 56 + 36 + 5;
+  f = fopen(JOURNAL_FILE, "r+");
+  fseek(f, off, SEEK_SET);
+  b = 0xEE;
+  fwrite(&b, 1, 1, f);
+  fclose(f);
+
+  check_true(reopen(HOME_ID), "Journal with torn record can be opened");
+  check_equal(n_replayed, 1, "Records before the torn record are replayed");
+  check_true(add_entry(3, 20) != 0, "Journal can be appended after a torn record");
+  check_true(reopen(HOME_ID), "Journal can be reopened");
+  check_equal(n_replayed, 2, "Record appended after a torn record is replayed");
+  check_equal(replayed[1].handle, 3, "Torn record is overwritten");
+  close_case("Torn record");
+}
+
+static void test_replay_delete(void)
+{
+  int i;
+  int n;
+  struct stat st;
+
+  start_case("Delete during replay", NULL);
+  unlink(JOURNAL_FILE);
+  check_true(reopen(HOME_ID), "New journal can be opened");
+
+  /* Fill the journal up to just below its initial size, so the delete
+   * records appended by the replay make it grow. */
+  n = (64 * 1024 - 12) / 56 - 1;
+  for (i = 0; i < n; i++) {
+    add_entry(i & 0x3F, 20);
+  }
+  mb_journal_close();
+  check_true(stat(JOURNAL_FILE, &st) == 0 && st.st_size == 64 * 1024,
+             "Journal has its initial size");
+
+  n_replayed = 0;
+  check_true(mb_journal_open(JOURNAL_FILE, HOME_ID, drop_cb, NULL),
+             "Journal can be replayed with deletes");
+  check_equal(n_replayed, n, "All entries are replayed once");
+  check_true(stat(JOURNAL_FILE, &st) == 0 && st.st_size > 64 * 1024,
+             "Journal has grown during the replay");
+
+  check_true(reopen(HOME_ID), "Journal can be reopened");
+  check_equal(n_replayed, (n + 1) / 2, "Entries deleted during the replay stay deleted");
+  mb_journal_close();
+  unlink(JOURNAL_FILE);
+  close_case("Delete during replay");
+}
+
+static void test_compaction(void)
+{
+  int i;
+  uint32_t keep[3];
+  struct stat st;
+
+  start_case("Compaction", NULL);
+  unlink(JOURNAL_FILE);
+  check_true(reopen(HOME_ID), "New journal can be opened");
+
+  keep[0] = add_entry(100, 60);
+  for (i = 0; i < 1000; i++) {
+    mb_journal_append_del(add_entry(i & 0x3F, 60));
+  }
+  keep[1] = add_entry(101, 60);
+  keep[2] = add_entry(102, 60);
+  check_true(mb_journal_should_compact(), "Journal of mostly deleted entries should be compacted");
+
+  check_true(reopen(HOME_ID), "Journal can be reopened");
+  check_equal(n_replayed, 3, "Three live entries");
+
+  compact_replayed();
+  check_true(!mb_journal_should_compact(), "Compaction in progress is not started again");
+  check_true(!mb_journal_compact_begin(), "Compaction in progress cannot be restarted");
+  compact_finish();
+  check_true(!mb_journal_should_compact(), "Compacted journal should not be compacted");
+  check_true(stat(JOURNAL_FILE ".tmp", &st) != 0, "Compaction file is gone");
+
+  check_true(reopen(HOME_ID), "Compacted journal can be reopened");
+  check_equal(n_replayed, 3, "Live entries survive compaction");
+  for (i = 0; i < 3; i++) {
+    check_equal(replayed[i].id, keep[i], "Ids survive compaction");
+    check_equal(replayed[i].handle, 100 + i, "Entries survive compaction");
+  }
+  check_true(add_entry(5, 10) > keep[2], "Ids are not reused after compaction");
+  mb_journal_close();
+  unlink(JOURNAL_FILE);
+  close_case("Compaction");
+
+  start_case("Appends during compaction", NULL);
+  check_true(reopen(HOME_ID), "New journal can be opened");
+  keep[0] = add_entry(100, 60);
+  keep[1] = add_entry(101, 60);
+  for (i = 0; i < 1000; i++) {
+    mb_journal_append_del(add_entry(i & 0x3F, 60));
+  }
+  check_true(reopen(HOME_ID), "Journal can be reopened");
+  check_equal(n_replayed, 2, "Two live entries");
+
+  compact_replayed();
+  /* The compacted file is not in use before it has been polled in */
+  mb_journal_append_del(keep[0]);
+  keep[2] = add_entry(102, 60);
+  check_true(keep[2] != 0, "Entry can be added during compaction");
+  compact_finish();
+  check_true(stat(JOURNAL_FILE ".tmp", &st) != 0, "Compaction file is gone");
+
+  check_true(reopen(HOME_ID), "Compacted journal can be reopened");
+  check_equal(n_replayed, 2, "Appends during compaction are kept");
+  check_equal(replayed[0].id, keep[1], "Entry from before compaction is kept");
+  check_equal(replayed[1].id, keep[2], "Entry added during compaction is kept");
+  check_equal(replayed[1].handle, 102, "Entry added during compaction is intact");
+  mb_journal_close();
+  unlink(JOURNAL_FILE);
+  close_case("Appends during compaction");
+}
+
+int main()
+{
+  test_replay();
+  test_torn_record();
+  test_replay_delete();
+  test_compaction();
+
+  close_run();
+  return numErrs;
+}
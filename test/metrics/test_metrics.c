@@ -0,0 +1,128 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdio.h>
+
+#include "test_helpers.h"
+#include "zgw_metrics.h"
+
+/**
+ * \defgroup test_metrics Metrics registry unit test
+ *
+ * Test plan
+ *
+ * - Every value is counted in the bucket whose range contains it.
+ * - Counters and gauges are registered when they are first updated.
+ * - Sampled gauges are read when the metrics are rendered.
+ * - Histograms are rendered with cumulative buckets, sum and count.
+ * - Metrics which do not fit in the buffer are left out whole.
+ */
+
+ZGW_COUNTER(frames, "test_frames_total", "Frames");
+ZGW_GAUGE(depth, "test_depth", "Depth");
+ZGW_HISTOGRAM(latency, "test_latency_milliseconds", "Latency");
+
+static int64_t sampled_value;
+
+static int64_t sample(void)
+{
+  return sampled_value;
+}
+
+ZGW_SAMPLED_GAUGE(sampled, "test_sampled", "Sampled", sample);
+
+static char buf[16 * 1024];
+
+static void test_buckets(void)
+{
+  uint32_t v;
+  int b;
+  int ok = 1;
+
+  start_case("Histogram buckets", NULL);
+  check_equal(zgw_histogram_bucket(0), 0, "0 in the first bucket");
+  check_equal(zgw_histogram_bucket(3), 3, "Small values have a bucket each");
+  check_equal(zgw_histogram_bucket(4), 4, "4 starts the log-linear buckets");
+  check_equal(zgw_histogram_bucket_max(ZGW_HIST_BUCKETS - 1), 65535,
+              "Last bucket ends below 2^16");
+  check_equal(zgw_histogram_bucket(65536), ZGW_HIST_BUCKETS,
+              "Larger values are beyond the buckets");
+
+  for (v = 0; v < 65536; v++) {
+    b = zgw_histogram_bucket(v);
+    if (v > zgw_histogram_bucket_max(b)
+        || (b > 0 && v <= zgw_histogram_bucket_max(b - 1))) {
+      ok = 0;
+    }
+  }
+  check_true(ok, "Every value is within the range of its bucket");
+  close_case("Histogram buckets");
+}
+
+static void test_render(void)
+{
+  size_t len;
+
+  start_case("Render", NULL);
+  zgw_metrics_reset();
+  check_equal(zgw_metrics_render(buf, sizeof(buf)), 0, "Nothing is registered");
+
+  zgw_metric_add(&frames, 2);
+  zgw_metric_add(&frames, 1);
+  zgw_metric_set(&depth, 7);
+  zgw_metrics_register(&sampled);
+  sampled_value = 42;
+  len = zgw_metrics_render(buf, sizeof(buf));
+  check_equal(len, strlen(buf), "Length of the text");
+  check_true(strstr(buf, "# TYPE test_frames_total counter\ntest_frames_total 3\n") != NULL,
+             "Counter");
+  check_true(strstr(buf, "# TYPE test_depth gauge\ntest_depth 7\n") != NULL, "Gauge");
+  check_true(strstr(buf, "test_sampled 42\n") != NULL, "Sampled gauge");
+  check_true(strstr(buf, "test_latency") == NULL, "Unused histogram is not registered");
+
+  zgw_histogram_record(&latency, 3);
+  zgw_histogram_record(&latency, 10);
+  zgw_histogram_record(&latency, 100000);
+  zgw_metrics_render(buf, sizeof(buf));
+  check_true(strstr(buf, "# TYPE test_latency_milliseconds histogram\n") != NULL,
+             "Histogram type");
+  check_true(strstr(buf, "test_latency_milliseconds_bucket{le=\"2\"} 0\n") != NULL,
+             "Bucket below the values");
+  check_true(strstr(buf, "test_latency_milliseconds_bucket{le=\"3\"} 1\n") != NULL,
+             "Bucket of the first value");
+  check_true(strstr(buf, "test_latency_milliseconds_bucket{le=\"11\"} 2\n") != NULL,
+             "Buckets are cumulative");
+  check_true(strstr(buf, "test_latency_milliseconds_bucket{le=\"65535\"} 2\n") != NULL,
+             "Value beyond the buckets is left out of them");
+  check_true(strstr(buf, "test_latency_milliseconds_bucket{le=\"+Inf\"} 3\n") != NULL,
+             "+Inf counts everything");
+  check_true(strstr(buf, "test_latency_milliseconds_sum 100013\n") != NULL, "Sum");
+  check_true(strstr(buf, "test_latency_milliseconds_count 3\n") != NULL, "Count");
+  close_case("Render");
+}
+
+static void test_truncate(void)
+{
+  char small[160];
+  size_t len;
+
+  start_case("Truncated render", NULL);
+  zgw_metrics_reset();
+  zgw_metric_add(&frames, 1);
+  zgw_histogram_record(&latency, 1);
+  zgw_metric_set(&depth, 1);
+  len = zgw_metrics_render(small, sizeof(small));
+  check_equal(len, strlen(small), "Text is terminated");
+  check_true(strstr(small, "test_frames_total 1\n") != NULL, "First metric fits");
+  check_true(strstr(small, "test_latency") == NULL, "Histogram is left out whole");
+  check_true(strstr(small, "test_depth 1\n") != NULL, "Metrics after it still fit");
+  close_case("Truncated render");
+}
+
+int main(void)
+{
+  test_buckets();
+  test_render();
+  test_truncate();
+  close_run();
+  return numErrs;
+}
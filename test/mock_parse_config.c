@@ -24,6 +24,8 @@ const char* linux_conf_provisioning_list_storage_file="./pvs.dat";
 const char* linux_conf_id_script = "zipgateway_node_identify_generic.sh";
 const char* linux_conf_tun_script;
 const char* linux_conf_fin_script;
+const char* linux_conf_mb_journal_file;
+const char* linux_conf_metrics_socket;
 
 
 /* functions */
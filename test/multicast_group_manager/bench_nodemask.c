@@ -0,0 +1,198 @@
+/* © 2020 Silicon Laboratories Inc.
+ */
+/*
+ * Compare the word operations of zgw_nodemask with the byte and
+ * node-by-node loops they replace.
+ *
+ * The results of both are compared on random masks, and the time of each
+ * operation is printed for both. With --check only the results are
+ * compared, which is how ctest runs it.
+ *
+ * Usage: bench_nodemask [--check] [iterations]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zgw_nodemask.h"
+
+static uint64_t rnd_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t random_word(void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return rnd_state;
+}
+
+/* A mask with about one node in 2^sparseness, in both node ranges */
+static void random_mask(nodemask_t m, int sparseness)
+{
+  uint16_t n;
+
+  nodemask_clear(m);
+  for (n = 1; n <= ZW_LR_MAX_NODE_ID; n++) {
+    if ((random_word() & ((1 << sparseness) - 1)) == 0) {
+      nodemask_add_node(n, m);
+    }
+  }
+}
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* The byte loops */
+
+static void byte_andnot(nodemask_t dst, const nodemask_t a, const nodemask_t b)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(nodemask_t); i++) {
+    dst[i] = a[i] & ~b[i];
+  }
+}
+
+static int byte_count(const nodemask_t m)
+{
+  size_t i;
+  int count = 0;
+  uint8_t b;
+
+  for (i = 0; i < sizeof(nodemask_t); i++) {
+    for (b = m[i]; b; b &= b - 1) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static int node_sum(const nodemask_t m)
+{
+  int sum = 0;
+  uint16_t n;
+
+  for (n = 1; n <= ZW_LR_MAX_NODE_ID; n++) {
+    if (nodemask_test_node(n, m)) {
+      sum += n;
+    }
+  }
+  return sum;
+}
+
+/* The word operations */
+
+static int word_count(const nodemask_t m)
+{
+  return nodemask_count(m);
+}
+
+static int iterator_sum(const nodemask_t m)
+{
+  int sum = 0;
+  uint16_t n;
+
+  nodemask_for_each_node(n, m) {
+    sum += n;
+  }
+  return sum;
+}
+
+typedef void (*binop_t)(nodemask_t dst, const nodemask_t a, const nodemask_t b);
+typedef int (*reduce_t)(const nodemask_t m);
+
+/* Keeps the compiler from optimizing the benchmark loops away */
+static volatile int sink;
+
+static double bench_binop(binop_t op, nodemask_t a, const nodemask_t b,
+                          int iterations)
+{
+  double start = now_us();
+  int i;
+
+  for (i = 0; i < iterations; i++) {
+    op(a, a, b);
+    sink += a[i % sizeof(nodemask_t)];
+  }
+  return (now_us() - start) * 1000 / iterations;
+}
+
+static double bench_reduce(reduce_t op, const nodemask_t m, int iterations)
+{
+  double start = now_us();
+  int i;
+
+  for (i = 0; i < iterations; i++) {
+    sink += op(m);
+  }
+  return (now_us() - start) * 1000 / iterations;
+}
+
+static void report(const char *name, double ns_bytes, double ns_words)
+{
+  printf("%-16s %10.1f ns %10.1f ns %6.1fx\n", name, ns_bytes, ns_words,
+         ns_bytes / ns_words);
+}
+
+int main(int argc, char **argv)
+{
+  nodemask_t a;
+  nodemask_t b;
+  nodemask_t r_bytes;
+  nodemask_t r_words;
+  int iterations = 10000;
+  int check_only = 0;
+  int i;
+
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+    check_only = 1;
+    argc--;
+    argv++;
+  }
+  if (argc > 1) {
+    iterations = atoi(argv[1]);
+    if (iterations <= 0) {
+      fprintf(stderr, "Usage: bench_nodemask [--check] [iterations]\n");
+      return 2;
+    }
+  }
+
+  for (i = 0; i < iterations; i++) {
+    random_mask(a, i % 8);
+    random_mask(b, (i / 8) % 8);
+    byte_andnot(r_bytes, a, b);
+    nodemask_andnot(r_words, a, b);
+    if (memcmp(r_bytes, r_words, sizeof(nodemask_t)) != 0
+        || byte_count(a) != nodemask_count(a)
+        || node_sum(a) != iterator_sum(a)) {
+      printf("Results differ in iteration %d\n", i);
+      return 1;
+    }
+  }
+  printf("Results agree on %d random masks\n", iterations);
+  if (check_only) {
+    return 0;
+  }
+
+  printf("%-16s %13s %13s\n", "", "bytes/nodes", "words");
+  random_mask(a, 1);
+  random_mask(b, 4);
+  report("andnot", bench_binop(byte_andnot, a, b, iterations),
+         bench_binop(nodemask_andnot, a, b, iterations));
+  report("count", bench_reduce(byte_count, a, iterations),
+         bench_reduce(word_count, a, iterations));
+  random_mask(a, 1);
+  report("iterate, 1/2", bench_reduce(node_sum, a, iterations),
+         bench_reduce(iterator_sum, a, iterations));
+  random_mask(a, 6);
+  report("iterate, 1/64", bench_reduce(node_sum, a, iterations),
+         bench_reduce(iterator_sum, a, iterations));
+  return 0;
+}
@@ -99,12 +99,93 @@ void test_nodelist_manipulation(void)
   close_case(tc_name);
 }
 
+/**
+ * Test the set operations and the node iterator
+ */
+void test_nodemask_words(void)
+{
+  char *tc_name = "nodemask set operations";
+  nodemask_t a = {0};
+  nodemask_t b = {0};
+  nodemask_t r;
+  uint16_t n;
+  int count;
+
+  start_case(tc_name, 0);
+  CT(nodemask_is_empty(a));
+  nodemask_add_node(1, a);
+  nodemask_add_node(232, a);
+  nodemask_add_node(300, a);
+  nodemask_add_node(4000, a);
+  nodemask_add_node(232, b);
+  nodemask_add_node(2000, b);
+  CT(!nodemask_is_empty(a));
+  CT(4 == nodemask_count(a));
+
+  nodemask_and(r, a, b);
+  CT(1 == nodemask_count(r));
+  CT(nodemask_test_node(232, r));
+
+  nodemask_or(r, a, b);
+  CT(5 == nodemask_count(r));
+  CT(nodemask_test_node(2000, r) && nodemask_test_node(4000, r));
+  CT(nodemask_is_subset(a, r));
+  CT(nodemask_is_subset(b, r));
+  CT(!nodemask_is_subset(r, a));
+
+  nodemask_andnot(r, r, b);
+  CT(3 == nodemask_count(r));
+  CT(!nodemask_test_node(232, r));
+  nodemask_add_node(232, r);
+  CT(0 == nodemask_equal(r, a));
+  nodemask_remove_node(4000, r);
+  CT(0 != nodemask_equal(r, a));
+  close_case(tc_name);
+
+  tc_name = "nodemask iterator";
+  start_case(tc_name, 0);
+  nodemask_iter_t it = nodemask_iter_start(a);
+  CT(1 == nodemask_iter_next(&it));
+  CT(232 == nodemask_iter_next(&it));
+  CT(300 == nodemask_iter_next(&it));
+  CT(4000 == nodemask_iter_next(&it));
+  CT(0 == nodemask_iter_next(&it));
+  CT(0 == nodemask_iter_next(&it));
+
+  nodemask_clear(r);
+  it = nodemask_iter_start(r);
+  CT(0 == nodemask_iter_next(&it));
+
+  /* Bits outside the node ranges are not nodes */
+  BIT8_SET(240, a);
+  BIT8_SET(4001, a);
+  count = 0;
+  nodemask_for_each_node(n, a) {
+    CT(nodemask_nodeid_is_valid(n));
+    count++;
+  }
+  CT(4 == count);
+
+  nodemask_clear(r);
+  for (n = 1; n <= ZW_LR_MAX_NODE_ID; n += 7) {
+    nodemask_add_node(n, r);
+  }
+  count = 0;
+  nodemask_for_each_node(n, r) {
+    CT(nodemask_test_node(n, r));
+    count++;
+  }
+  CT(count == nodemask_count(r));
+  close_case(tc_name);
+}
+
  /**
   * Main function
   */
 int main()
 {
    test_nodelist_manipulation();
+   test_nodemask_words();
 
    close_run();
    return numErrs;
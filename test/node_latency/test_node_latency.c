@@ -0,0 +1,122 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdint.h>
+
+#include "test_helpers.h"
+#include "zw_node_latency.h"
+
+/**
+ * \defgroup test_node_latency Node latency estimator unit test
+ *
+ * Test plan
+ *
+ * - Unknown nodes get the default transmit timeout and the minimum reply
+ *   timeout.
+ * - The transmit timeout follows the measured transmit times, also below
+ *   the default, down to 100 ms.
+ * - A route change restarts the transmit estimate.
+ * - Nodes which stop acknowledging get the default transmit timeout.
+ * - The reply timeout follows the measured replies and is bounded.
+ * - Resetting a node forgets its estimates.
+ */
+
+#define NODE 7
+
+static void tx(nodeid_t node, uint8_t status, uint16_t ticks, uint8_t repeaters)
+{
+  TX_STATUS_TYPE ts;
+
+  memset(&ts, 0, sizeof(ts));
+  ts.wTransmitTicks = ticks;
+  ts.bRepeaters = repeaters;
+  zw_node_latency_tx_status(node, status, &ts);
+}
+
+static void test_tx_timeout(void)
+{
+  int i;
+  clock_time_t t;
+
+  start_case("Transmit timeout", NULL);
+  zw_node_latency_init();
+
+  check_equal(zw_node_latency_tx_timeout(NODE, 250), 250, "Unknown node gets the default");
+  check_equal(zw_node_latency_tx_timeout(0, 250), 250, "Node 0 gets the default");
+  check_equal(zw_node_latency_tx_timeout(ZW_MAX_NODES + 1, 250), 250,
+              "Invalid node gets the default");
+
+  for (i = 0; i < 20; i++) {
+    tx(NODE, TRANSMIT_COMPLETE_OK, 2, 0);
+  }
+  check_equal(zw_node_latency_tx_timeout(NODE, 250), CLOCK_SECOND / 10,
+              "Fast node gets the minimum of 100 ms");
+
+  for (i = 0; i < 20; i++) {
+    tx(NODE, TRANSMIT_COMPLETE_OK, 15, 0);
+  }
+  t = zw_node_latency_tx_timeout(NODE, 250);
+  check_true(t > CLOCK_SECOND / 10 && t < 250, "Node faster than the default gets its transmit time");
+
+  for (i = 0; i < 20; i++) {
+    tx(NODE, TRANSMIT_COMPLETE_OK, 80, 0);
+  }
+  t = zw_node_latency_tx_timeout(NODE, 250);
+  check_true(t >= 800 && t < 1200, "Slow node gets its transmit time");
+
+  tx(NODE, TRANSMIT_COMPLETE_OK, 30, 2);
+  t = zw_node_latency_tx_timeout(NODE, 250);
+  check_equal(t, 300 + 4 * 150, "Route change restarts the estimate");
+
+  tx(NODE, TRANSMIT_COMPLETE_NO_ACK, 0, 0);
+  check_equal(zw_node_latency_tx_timeout(NODE, 250), 300 + 4 * 150,
+              "One missing acknowledge keeps the estimate");
+  tx(NODE, TRANSMIT_COMPLETE_NO_ACK, 0, 0);
+  check_equal(zw_node_latency_tx_timeout(NODE, 250), 250,
+              "Node which stopped acknowledging gets the default");
+  tx(NODE, TRANSMIT_COMPLETE_OK, 30, 2);
+  check_true(zw_node_latency_tx_timeout(NODE, 250) > 250,
+             "Estimate is back when the node acknowledges");
+
+  for (i = 0; i < 20; i++) {
+    tx(NODE, TRANSMIT_COMPLETE_OK, 60000, 2);
+  }
+  check_equal(zw_node_latency_tx_timeout(NODE, 250), 5 * CLOCK_SECOND,
+              "Transmit timeout is bounded");
+  close_case("Transmit timeout");
+}
+
+static void test_reply_timeout(void)
+{
+  int i;
+  clock_time_t t;
+
+  start_case("Reply timeout", NULL);
+  zw_node_latency_init();
+
+  check_equal(zw_node_latency_reply_timeout(NODE, 1000, 5000), 1000,
+              "Unknown node gets the minimum");
+
+  for (i = 0; i < 20; i++) {
+    zw_node_latency_reply(NODE, 2000);
+  }
+  t = zw_node_latency_reply_timeout(NODE, 1000, 5000);
+  check_true(t >= 2000 && t < 2500, "Slow node gets its reply time");
+  check_equal(zw_node_latency_reply_timeout(NODE, 3000, 5000), 3000,
+              "Minimum applies to slow node");
+  check_equal(zw_node_latency_reply_timeout(NODE, 1000, 1500), 1500,
+              "Reply timeout is bounded");
+
+  zw_node_latency_reset(NODE);
+  check_equal(zw_node_latency_reply_timeout(NODE, 1000, 5000), 1000,
+              "Reset node gets the minimum");
+  close_case("Reply timeout");
+}
+
+int main()
+{
+  test_tx_timeout();
+  test_reply_timeout();
+
+  close_run();
+  return numErrs;
+}
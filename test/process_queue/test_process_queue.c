@@ -0,0 +1,161 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+
+#include "contiki.h"
+#include "test_helpers.h"
+
+/**
+ * \defgroup test_process_queue Contiki event queue unit test
+ *
+ * Test plan
+ *
+ * - High priority events are delivered before waiting normal events.
+ * - A stream of high priority events lets a normal event through after
+ *   PROCESS_CONF_HIGH_BURST events.
+ * - Events of the same priority keep their order.
+ * - The queue grows beyond PROCESS_CONF_NUMEVENTS and refuses events
+ *   at PROCESS_CONF_NUMEVENTS_MAX, counting them.
+ * - Events and polls are counted per process.
+ */
+
+#define LOG_SZ (2 * PROCESS_CONF_NUMEVENTS_MAX)
+#define EV_NORMAL 1
+#define EV_HIGH 2
+
+static process_event_t log_ev[LOG_SZ];
+static int log_data[LOG_SZ];
+static int log_len;
+
+PROCESS(recorder_process, "Recorder");
+
+PROCESS_THREAD(recorder_process, ev, data)
+{
+  PROCESS_BEGIN();
+  while (1) {
+    PROCESS_YIELD();
+    if (ev != PROCESS_EVENT_POLL && log_len < LOG_SZ) {
+      log_ev[log_len] = ev;
+      log_data[log_len] = (int) (intptr_t) data;
+      log_len++;
+    }
+  }
+  PROCESS_END();
+}
+
+static void setup(void)
+{
+  process_init();
+  process_start(&recorder_process, NULL);
+  while (process_run())
+    ;
+  log_len = 0;
+  memset(recorder_process.run_hist, 0, sizeof(recorder_process.run_hist));
+  recorder_process.nevents = 0;
+  recorder_process.npolls = 0;
+  recorder_process.run_ticks = 0;
+}
+
+static void post(int n, process_event_t ev, unsigned char prio)
+{
+  process_post_prio(&recorder_process, ev, (void *) (intptr_t) n, prio);
+}
+
+static void test_priority(void)
+{
+  start_case("High priority first", NULL);
+  setup();
+  post(0, EV_NORMAL, PROCESS_PRIO_NORMAL);
+  post(1, EV_NORMAL, PROCESS_PRIO_NORMAL);
+  post(2, EV_HIGH, PROCESS_PRIO_HIGH);
+  post(3, EV_HIGH, PROCESS_PRIO_HIGH);
+  while (process_run())
+    ;
+  check_equal(log_len, 4, "All events delivered");
+  check_equal(log_data[0], 2, "First high event first");
+  check_equal(log_data[1], 3, "Second high event second");
+  check_equal(log_data[2], 0, "Normal events keep their order");
+  check_equal(log_data[3], 1, "Last normal event last");
+  close_case("High priority first");
+}
+
+static void test_burst(void)
+{
+  int i;
+
+  start_case("High priority burst", NULL);
+  setup();
+  post(100, EV_NORMAL, PROCESS_PRIO_NORMAL);
+  for (i = 0; i < PROCESS_CONF_HIGH_BURST + 2; i++) {
+    post(i, EV_HIGH, PROCESS_PRIO_HIGH);
+  }
+  while (process_run())
+    ;
+  check_equal(log_len, PROCESS_CONF_HIGH_BURST + 3, "All events delivered");
+  check_equal(log_ev[PROCESS_CONF_HIGH_BURST], EV_NORMAL,
+              "Normal event after a burst of high events");
+  check_equal(log_data[PROCESS_CONF_HIGH_BURST + 1], PROCESS_CONF_HIGH_BURST,
+              "High events continue after the normal event");
+  close_case("High priority burst");
+}
+
+static void test_grow(void)
+{
+  int i;
+  int ok = 1;
+
+  start_case("Queue growth", NULL);
+  setup();
+  for (i = 0; i < PROCESS_CONF_NUMEVENTS_MAX; i++) {
+    if (process_post(&recorder_process, EV_NORMAL, (void *) (intptr_t) i)
+        != PROCESS_ERR_OK) {
+      ok = 0;
+    }
+  }
+  check_true(ok, "Queue grows beyond its initial size");
+  check_equal(process_post(&recorder_process, EV_NORMAL, NULL), PROCESS_ERR_FULL,
+              "Queue refuses events at its largest size");
+  check_equal(process_overflows(), 1, "Refused event is counted");
+  check_equal(process_maxevents, PROCESS_CONF_NUMEVENTS_MAX, "Largest queue length");
+
+  while (process_run())
+    ;
+  check_equal(log_len, PROCESS_CONF_NUMEVENTS_MAX, "All queued events delivered");
+  for (i = 0; i < log_len; i++) {
+    if (log_data[i] != i) {
+      ok = 0;
+    }
+  }
+  check_true(ok, "Events keep their order across growth");
+  close_case("Queue growth");
+}
+
+static void test_stats(void)
+{
+  unsigned long calls = 0;
+  int i;
+
+  start_case("Process statistics", NULL);
+  setup();
+  post(0, EV_NORMAL, PROCESS_PRIO_NORMAL);
+  post(1, EV_HIGH, PROCESS_PRIO_HIGH);
+  process_poll(&recorder_process);
+  while (process_run())
+    ;
+  check_equal(recorder_process.nevents, 2, "Events are counted");
+  check_equal(recorder_process.npolls, 1, "Polls are counted");
+  for (i = 0; i < PROCESS_STATS_RUN_BUCKETS; i++) {
+    calls += recorder_process.run_hist[i];
+  }
+  check_equal(calls, 3, "Every call is in the run time histogram");
+  close_case("Process statistics");
+}
+
+int main(void)
+{
+  test_priority();
+  test_burst();
+  test_grow();
+  test_stats();
+  close_run();
+  return numErrs;
+}
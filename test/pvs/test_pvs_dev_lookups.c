@@ -23,7 +23,13 @@ static uint8_t challengexl[]= {12,  0, 12, 13, 14, 15, 16, 17, 18, 19, 20, 0xAB,
 static uint8_t *name3 = (uint8_t *)"Node3";
 static uint8_t *location3 = (uint8_t *)"Location3";
 
+static uint8_t dsk_a[] = {0x11, 0x22, 1, 2, 3, 4, 5, 6, 0x18, 0x19, 0x7A, 0x50, 7, 8, 9, 10};
+static uint8_t dsk_b[] = {0x33, 0x44, 1, 2, 3, 4, 5, 6, 0x18, 0x19, 0x7A, 0x50, 7, 8, 9, 10};
+static uint8_t homeid_ab[4] = {0xD8, 0x19, 0x7A, 0x50};
+static uint8_t challenge_ab[] = {0, 0, 1, 2, 3, 4, 5, 6, 0x18, 0x19, 0x7A, 0x50, 7, 8, 9, 10, 0xAA, 0xBB};
+
 static void test_provisioning_list_dev_match_challenge(void);
+static void test_provisioning_list_index_update(void);
 
 /* Test that we can match a S2 inclusion challenge with a provisioning_list DSK.
  * In this case, the first two bytes of the challenge may be zeroed out. */
@@ -77,6 +83,51 @@ static void test_provisioning_list_dev_match_challenge(void)
   close_case("Challenge too short");
 }
 
+/* Test that the lookups follow devices that are removed and added
+ * again, also when several devices have the same HomeID. */
+static void test_provisioning_list_index_update(void)
+{
+  struct provision *pvs_a;
+  struct provision *pvs_b;
+
+  test_print_suite_title(1, "Index update");
+
+  start_case("Lookup after add and remove", log_strm);
+  pvs_a = provisioning_list_dev_add(sizeof(dsk_a), dsk_a, PVS_BOOTMODE_SMART_START);
+  pvs_b = provisioning_list_dev_add(sizeof(dsk_b), dsk_b, PVS_BOOTMODE_SMART_START);
+  check_not_null(pvs_a, "dsk_a is added");
+  check_not_null(pvs_b, "dsk_b is added");
+  check_true(pvs_a == provisioning_list_dev_get(sizeof(dsk_a), dsk_a), "dsk_a is found");
+  check_true(pvs_b == provisioning_list_dev_get(sizeof(dsk_b), dsk_b), "dsk_b is found");
+  check_true(pvs_a == provisioning_list_dev_get_homeid(homeid_ab),
+             "The HomeID finds the device that was added first");
+  check_true(pvs_a == provisioning_list_dev_match_challenge(sizeof(challenge_ab), challenge_ab),
+             "The challenge finds the device that was added first");
+
+  check_true(PVS_SUCCESS == provisioning_list_dev_remove(sizeof(dsk_a), dsk_a), "dsk_a is removed");
+  check_null(provisioning_list_dev_get(sizeof(dsk_a), dsk_a), "dsk_a is not found");
+  check_true(pvs_b == provisioning_list_dev_get_homeid(homeid_ab),
+             "The HomeID finds dsk_b after dsk_a is removed");
+  check_true(pvs_b == provisioning_list_dev_match_challenge(sizeof(challenge_ab), challenge_ab),
+             "The challenge finds dsk_b after dsk_a is removed");
+
+  check_true(PVS_SUCCESS == provisioning_list_dev_remove(sizeof(dsk_b), dsk_b), "dsk_b is removed");
+  check_null(provisioning_list_dev_get_homeid(homeid_ab), "The HomeID is not found");
+  check_null(provisioning_list_dev_match_challenge(sizeof(challenge_ab), challenge_ab),
+             "The challenge is not found");
+
+  pvs_b = provisioning_list_dev_set(sizeof(dsk_b), dsk_b, PVS_BOOTMODE_S2);
+  check_true(pvs_b == provisioning_list_dev_get(sizeof(dsk_b), dsk_b), "dsk_b is found after set");
+  check_true(pvs_b == provisioning_list_dev_get_homeid(homeid_ab), "The HomeID finds dsk_b after set");
+  close_case("Lookup after add and remove");
+
+  start_case("Lookup after clear", log_strm);
+  provisioning_list_clear();
+  check_null(provisioning_list_dev_get(sizeof(dsk_b), dsk_b), "dsk_b is not found");
+  check_null(provisioning_list_dev_get_homeid(homeid_ab), "The HomeID is not found");
+  close_case("Lookup after clear");
+}
+
 int main()
 {
     log_strm = test_create_log(TEST_CREATE_LOG_NAME);
@@ -87,6 +138,8 @@ int main()
 
     test_provisioning_list_dev_match_challenge();
 
+    test_provisioning_list_index_update();
+
     close_run();
     fclose(log_strm);
 
@@ -7,6 +7,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <lib/zgw_log.h>
 #include "test_helpers.h"
 #include "pvs_cfg_test_help.h"
@@ -75,6 +77,7 @@ static struct pvs_tlv tlv_backyard =  {NULL, PVS_TLV_TYPE_LOCATION, 9, (uint8_t
 
 static void print_dsk(uint8_t lvl, uint8_t dsk_len, uint8_t *dsk);
 static void test_filename(FILE *strm1);
+static void test_journal(FILE *strm1);
 static void add_tlv(void);
 static void add_tlv2(void);
 
@@ -175,6 +178,71 @@ static void test_filename(FILE *strm1)
 
 }
 
+static long file_size(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0) {
+        return -1;
+    }
+    return (long)st.st_size;
+}
+
+static void test_journal(FILE *strm1)
+{
+    struct provision *pvs;
+    long size;
+    long entry_size;
+    int ii;
+
+    start_case("Initialize from file with an incomplete journal record", strm1);
+    (void)remove("journal.dat");
+    provisioning_list_init("journal.dat", NULL);
+    create_test_file(2, 1, 1);
+    provisioning_list_dev_remove(test_dsks[0].dsk_len, test_dsks[0].dsk);
+    pvs = provisioning_list_dev_get(test_dsks[1].dsk_len, test_dsks[1].dsk);
+    provisioning_list_tlv_set(pvs, tlv_backyard.type, tlv_backyard.length, tlv_backyard.value);
+
+    /* Cut the last record short, as if the gateway stopped while writing it */
+    steal_file("journal.dat", "torn.dat");
+    size = file_size("torn.dat");
+    check_zero(truncate("torn.dat", size - 3), "Truncate storage file");
+
+    provisioning_list_clear();
+    provisioning_list_init("torn.dat", NULL);
+    check_true(provisioning_list_get_count() == 1, "Removal is replayed");
+    pvs = provisioning_list_dev_get(test_dsks[1].dsk_len, test_dsks[1].dsk);
+    check_not_null(pvs, "Device added in the journal is imported");
+    if (pvs != NULL) {
+        check_not_null(provisioning_list_tlv_get(pvs, PVS_TLV_TYPE_NAME), "Tlv set in the journal is imported");
+        check_null(provisioning_list_tlv_get(pvs, PVS_TLV_TYPE_LOCATION), "Incomplete record is ignored");
+    }
+    check_true(file_size("torn.dat") < size, "Storage file is compacted at init");
+    close_case("Initialize from file with an incomplete journal record");
+
+    start_case("Compact the journal", strm1);
+    /* The file now contains the header and one entry */
+    entry_size = file_size("torn.dat") - 15;
+    for (ii = 0; ii < 500; ii++) {
+        provisioning_list_status_set(pvs, (ii & 1) ? PVS_STATUS_PENDING : PVS_STATUS_PASSIVE);
+    }
+    size = file_size("torn.dat");
+    test_print(3, "Storage file is %ld bytes, entries are %ld bytes\n", size, entry_size);
+    check_true(size < 15 + 100 * entry_size, "Storage file does not grow without bound");
+
+    steal_file("torn.dat", "compact.dat");
+    provisioning_list_clear();
+    provisioning_list_init("compact.dat", NULL);
+    pvs = provisioning_list_dev_get(test_dsks[1].dsk_len, test_dsks[1].dsk);
+    check_not_null(pvs, "Device is imported after compaction");
+    if (pvs != NULL) {
+        check_true(pvs->status == PVS_STATUS_PENDING, "Last status is imported after compaction");
+    }
+    close_case("Compact the journal");
+
+    provisioning_list_clear();
+}
+
 int main()
 {
     FILE *strm1;
@@ -315,6 +383,8 @@ int main()
 
     provisioning_list_clear();
 
+    test_journal(strm1);
+
     close_run();
 
     fclose(strm1);
@@ -0,0 +1,83 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+#include "RD_internal.h"
+#include "ResourceDirectory.h"
+#include "Bridge.h"
+#include "test_helpers.h"
+#include <string.h>
+
+/**
+\defgroup rd_new_nodes_test RD new nodes unit test.
+
+Test Plan
+
+- Nodes of the controller node list which the RD does not know are new,
+  both classic and Long Range nodes.
+- Nodes which the RD knows are not new.
+- Virtual nodes in virtual_nodes_mask are not new.
+- The Long Range virtual nodes 4002 to 4005 are not new. Their ids are
+  above ZW_LR_MAX_NODE_ID, so their bits are set directly.
+*/
+
+static void test_new_nodes(void)
+{
+  nodemask_t nodelist;
+  nodemask_t new_nodes;
+  nodemask_t expected;
+  nodeid_t i;
+
+  start_case("New nodes", NULL);
+
+  rd_node_entry_alloc(2);
+  rd_node_entry_alloc(300);
+  nodemask_clear(virtual_nodes_mask);
+  nodemask_add_node(10, virtual_nodes_mask);
+
+  nodemask_clear(nodelist);
+  nodemask_add_node(2, nodelist);
+  nodemask_add_node(3, nodelist);
+  nodemask_add_node(10, nodelist);
+  nodemask_add_node(300, nodelist);
+  nodemask_add_node(301, nodelist);
+  nodemask_add_node(ZW_LR_MAX_NODE_ID, nodelist);
+  for (i = LR_VIRTUAL_NODE_FIRST; i <= LR_VIRTUAL_NODE_LAST; i++) {
+    NODEMASK_ADD_NODE(i, nodelist);
+  }
+
+  rd_new_nodes(new_nodes, nodelist);
+
+  check_true(nodemask_test_node(3, new_nodes), "An unknown node is new");
+  check_true(nodemask_test_node(301, new_nodes), "An unknown LR node is new");
+  check_true(!nodemask_test_node(2, new_nodes), "A known node is not new");
+  check_true(!nodemask_test_node(300, new_nodes), "A known LR node is not new");
+  check_true(!nodemask_test_node(10, new_nodes), "A virtual node is not new");
+  for (i = LR_VIRTUAL_NODE_FIRST; i <= LR_VIRTUAL_NODE_LAST; i++) {
+    check_true(!NODEMASK_TEST_NODE(i, new_nodes), "An LR virtual node is not new");
+  }
+  check_true(nodemask_test_node(ZW_LR_MAX_NODE_ID, new_nodes), "The last LR node id is new");
+
+  nodemask_clear(expected);
+  nodemask_add_node(3, expected);
+  nodemask_add_node(301, expected);
+  nodemask_add_node(ZW_LR_MAX_NODE_ID, expected);
+  check_equal(nodemask_equal(new_nodes, expected), 0, "There are no other new nodes");
+
+  rd_new_nodes(new_nodes, expected);
+  check_equal(nodemask_equal(new_nodes, expected), 0, "New nodes stay new until they are registered");
+
+  rd_destroy();
+  rd_new_nodes(new_nodes, nodelist);
+  check_true(nodemask_test_node(2, new_nodes), "All nodes are new after rd_destroy");
+  check_true(!NODEMASK_TEST_NODE(LR_VIRTUAL_NODE_FIRST, new_nodes),
+             "LR virtual nodes are never new");
+
+  close_case("New nodes");
+}
+
+int main()
+{
+  test_new_nodes();
+
+  close_run();
+  return numErrs;
+}
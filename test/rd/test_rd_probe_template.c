@@ -0,0 +1,127 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+#include "RD_DataStore.h"
+#include "RD_internal.h"
+#include "NodeCache.h"
+#include "test_helpers.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "provisioning_list.h"
+
+/**
+\defgroup probe_template_test Probe template unit test.
+
+Test Plan
+
+- A stored template is read back for the same key.
+- A template is not found if any part of the key differs.
+- A template is not applied if the number of controlled command
+  classes differs.
+- A template survives reopening the data store.
+*/
+
+#define TEST_DB_FILE "test_rd_probe_template.db"
+
+/* stub */
+struct pvs_tlv * provisioning_list_tlv_dsk_get(uint8_t dsk_len,
+                                               const uint8_t *dsk, uint8_t type) {
+   return NULL;
+}
+
+extern char* linux_conf_database_file;
+
+static uint8_t stored_versions[32];
+static uint8_t read_versions[32];
+
+static void node_init(rd_node_database_entry_t *n, uint8_t *versions)
+{
+  memset(n, 0, sizeof(*n));
+  n->node_cc_versions_len = sizeof(stored_versions);
+  n->node_cc_versions = (cc_version_pair_t*)versions;
+}
+
+static void key_init(rd_probe_template_key_t *key)
+{
+  memset(key, 0, sizeof(*key));
+  key->manufacturerID = 0x0000;
+  key->productType = 0x0102;
+  key->productID = 0x0304;
+  key->firmware_version = 0x0512;
+  key->security_flags = NODE_FLAG_SECURITY2_AUTHENTICATED;
+  key->nif_crc = 0xBEEF;
+}
+
+static void test_template_read_write(void)
+{
+  rd_node_database_entry_t n;
+  rd_probe_template_key_t key;
+  rd_probe_template_key_t other;
+  int i;
+
+  start_case("Template read and write", NULL);
+
+  unlink(TEST_DB_FILE);
+  linux_conf_database_file = TEST_DB_FILE;
+  check_true(data_store_init(), "Data store can be opened");
+
+  for (i = 0; i < sizeof(stored_versions); i++) {
+    stored_versions[i] = i;
+  }
+  key_init(&key);
+  node_init(&n, read_versions);
+  check_true(!rd_data_store_probe_template_read(&key, &n),
+             "No template in an empty data store");
+
+  node_init(&n, stored_versions);
+  n.node_version_cap_and_zwave_sw = 0x07;
+  n.node_is_zws_probed = 1;
+  rd_data_store_probe_template_write(&key, &n);
+
+  memset(read_versions, 0, sizeof(read_versions));
+  node_init(&n, read_versions);
+  check_true(rd_data_store_probe_template_read(&key, &n), "Stored template is found");
+  check_mem(stored_versions, read_versions, sizeof(stored_versions),
+            "Version mismatch %s\n", "Command class versions are restored");
+  check_equal(n.node_version_cap_and_zwave_sw, 0x07, "Version capabilities are restored");
+  check_equal(n.node_is_zws_probed, 1, "ZWS probe status is restored");
+
+  other = key;
+  other.firmware_version++;
+  check_true(!rd_data_store_probe_template_read(&other, &n),
+             "Template of other firmware is not found");
+  other = key;
+  other.productID++;
+  check_true(!rd_data_store_probe_template_read(&other, &n),
+             "Template of other product is not found");
+  other = key;
+  other.security_flags = 0;
+  check_true(!rd_data_store_probe_template_read(&other, &n),
+             "Template of other security class is not found");
+  other = key;
+  other.nif_crc++;
+  check_true(!rd_data_store_probe_template_read(&other, &n),
+             "Template of other NIF is not found");
+
+  n.node_cc_versions_len--;
+  check_true(!rd_data_store_probe_template_read(&key, &n),
+             "Template of another set of controlled command classes is not applied");
+
+  data_store_exit();
+  check_true(data_store_init(), "Data store can be reopened");
+  node_init(&n, read_versions);
+  check_true(rd_data_store_probe_template_read(&key, &n),
+             "Template survives reopening the data store");
+  data_store_exit();
+  unlink(TEST_DB_FILE);
+
+  close_case("Template read and write");
+}
+
+int main()
+{
+  test_template_read_write();
+
+  close_run();
+  return numErrs;
+}
@@ -0,0 +1,134 @@
+/* © 2020 Silicon Laboratories Inc. */
+
+#include "RD_DataStore.h"
+#include "RD_internal.h"
+#include "ResourceDirectory.h"
+#include "NodeCache.h"
+#include "test_helpers.h"
+#include <string.h>
+#include <unistd.h>
+
+/**
+\defgroup rd_security_nodemask_test RD security nodemask unit test.
+
+Test Plan
+
+- A new node entry is in no security nodemask, and its node id is in the
+  node nodemask.
+- Writing the security flags with SetCacheEntryFlagMasked() moves the node
+  into the masks of the set flags and out of the masks of the cleared flags.
+- An imported node entry is in the masks of its stored flags.
+- A freed node entry is in no mask.
+- rd_destroy() clears all masks.
+*/
+
+#define TEST_DB_FILE "test_rd_security_nodemask.db"
+
+extern char* linux_conf_database_file;
+
+static const BYTE all_flags[] = {
+  NODE_FLAG_SECURITY0,
+  NODE_FLAG_KNOWN_BAD,
+  NODE_FLAG_INFO_ONLY,
+  NODE_FLAG_SECURITY2_UNAUTHENTICATED,
+  NODE_FLAG_SECURITY2_AUTHENTICATED,
+  NODE_FLAG_SECURITY2_ACCESS,
+};
+
+/** Number of flags where the mask membership of \p nodeid differs from \p flags */
+static int mask_errors(nodeid_t nodeid, BYTE flags)
+{
+  int i, errors = 0;
+
+  for (i = 0; i < sizeof(all_flags); i++) {
+    if (!nodemask_test_node(nodeid, rd_security_nodemask(all_flags[i]))
+        != !(flags & all_flags[i])) {
+      errors++;
+    }
+  }
+  return errors;
+}
+
+static void test_alloc_and_flag_write(void)
+{
+  start_case("Alloc and flag write", NULL);
+
+  unlink(TEST_DB_FILE);
+  linux_conf_database_file = TEST_DB_FILE;
+  check_true(data_store_init(), "Data store can be opened");
+
+  check_true(rd_node_entry_alloc(5) != NULL, "Node 5 is allocated");
+  check_true(rd_node_entry_alloc(300) != NULL, "Long Range node 300 is allocated");
+  check_true(nodemask_test_node(5, rd_node_nodemask()), "Node 5 is in the node mask");
+  check_true(nodemask_test_node(300, rd_node_nodemask()), "Node 300 is in the node mask");
+  check_equal(mask_errors(5, 0), 0, "A new node is in no security mask");
+  check_equal(mask_errors(300, 0), 0, "A new LR node is in no security mask");
+
+  SetCacheEntryFlagMasked(5, NODE_FLAG_SECURITY2_ACCESS | NODE_FLAG_SECURITY2_AUTHENTICATED,
+                          0xff);
+  check_equal(mask_errors(5, NODE_FLAG_SECURITY2_ACCESS | NODE_FLAG_SECURITY2_AUTHENTICATED), 0,
+              "The node is in the masks of the set flags");
+  check_equal(mask_errors(300, 0), 0, "Other nodes are not affected");
+
+  SetCacheEntryFlagMasked(5, NODE_FLAG_SECURITY0, NODE_FLAG_SECURITY2_ACCESS | NODE_FLAG_SECURITY0);
+  check_equal(mask_errors(5, NODE_FLAG_SECURITY2_AUTHENTICATED | NODE_FLAG_SECURITY0), 0,
+              "A cleared flag removes the node, flags outside the mask are kept");
+
+  SetCacheEntryFlagMasked(300, NODE_FLAG_SECURITY2_UNAUTHENTICATED, 0xff);
+  check_equal(mask_errors(300, NODE_FLAG_SECURITY2_UNAUTHENTICATED), 0,
+              "The LR node is in the mask of its flag");
+  check_equal(GetCacheEntryFlag(300), NODE_FLAG_SECURITY2_UNAUTHENTICATED,
+              "The mask agrees with the flags of the node");
+
+  rd_destroy();
+  check_equal(mask_errors(5, 0), 0, "rd_destroy clears the masks");
+  check_equal(mask_errors(300, 0), 0, "rd_destroy clears the masks of LR nodes");
+  check_true(!nodemask_test_node(5, rd_node_nodemask()), "rd_destroy clears the node mask");
+
+  close_case("Alloc and flag write");
+}
+
+static void test_import_and_free(void)
+{
+  rd_node_database_entry_t *n;
+
+  start_case("Import and free", NULL);
+
+  /* The entries written in the previous case are still in the data store */
+  n = rd_node_entry_import(5);
+  check_true(n != NULL, "Node 5 is imported");
+  check_equal(n->security_flags, NODE_FLAG_SECURITY2_AUTHENTICATED | NODE_FLAG_SECURITY0,
+              "The stored flags are imported");
+  check_equal(mask_errors(5, NODE_FLAG_SECURITY2_AUTHENTICATED | NODE_FLAG_SECURITY0), 0,
+              "The imported node is in the masks of its flags");
+  check_true(rd_node_entry_import(300) != NULL, "Node 300 is imported");
+  check_equal(mask_errors(300, NODE_FLAG_SECURITY2_UNAUTHENTICATED), 0,
+              "The imported LR node is in the mask of its flag");
+  check_true(rd_node_entry_import(6) == NULL, "A node which was never stored is not imported");
+  check_equal(mask_errors(6, 0), 0, "A node which is not imported is in no mask");
+
+  rd_node_entry_free(5);
+  check_equal(mask_errors(5, 0), 0, "A freed node is in no mask");
+  check_true(!nodemask_test_node(5, rd_node_nodemask()), "A freed node is not in the node mask");
+  check_equal(mask_errors(300, NODE_FLAG_SECURITY2_UNAUTHENTICATED), 0,
+              "Other nodes are not affected");
+
+  n = rd_node_entry_alloc(5);
+  check_true(n != NULL, "The node id can be allocated again");
+  check_equal(mask_errors(5, 0), 0, "The new entry starts without flags");
+
+  rd_destroy();
+  data_store_exit();
+  unlink(TEST_DB_FILE);
+
+  close_case("Import and free");
+}
+
+int main()
+{
+  test_alloc_and_flag_write();
+  test_import_and_free();
+
+  close_run();
+  return numErrs;
+}
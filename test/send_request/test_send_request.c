@@ -0,0 +1,286 @@
+/* © 2020 Silicon Laboratories Inc. */
+#include <string.h>
+#include <stdint.h>
+
+#include "test_helpers.h"
+#include "ZW_SendRequest.h"
+#include "zw_node_latency.h"
+#include "zip_router_config.h"
+#include "sys/ctimer.h"
+
+/**
+ * \defgroup test_send_request Send request unit test
+ *
+ * Test plan
+ *
+ * - No more than ZipMaxSendRequests requests are pending, and a slot is
+ *   free again when its report arrives.
+ * - No more than 4 requests are pending to the same node, other nodes can
+ *   still send.
+ * - A report only completes the request of the node which sent it, also
+ *   when other nodes hash to the same bucket.
+ * - Aborting a node fails all its waiting requests, and leaves the
+ *   requests of other nodes in the bucket alone.
+ * - A timeout fails the request and frees its slot.
+ */
+
+struct router_config cfg;
+
+#define MAX_SENT 80
+#define MAX_TIMERS 80
+
+/** Frames handed to ZW_SendDataAppl */
+static struct {
+  ZW_SendDataAppl_Callback_t cb;
+  void *user;
+} sent[MAX_SENT];
+static int n_sent;
+
+/** Results of the request callbacks, indexed by the user argument */
+static int completed[MAX_SENT];
+static int failed[MAX_SENT];
+
+/** Number of frames acknowledged by ack_all() */
+static int n_acked;
+
+static struct ctimer *timers[MAX_TIMERS];
+static int n_timers;
+
+static clock_time_t now = 1000;
+
+/* Mocks */
+
+clock_time_t clock_time(void)
+{
+  return now;
+}
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr)
+{
+  int i;
+
+  c->f = f;
+  c->ptr = ptr;
+  c->p = (struct process *)1;
+  for (i = 0; i < n_timers; i++) {
+    if (timers[i] == c) {
+      return;
+    }
+  }
+  if (n_timers < MAX_TIMERS) {
+    timers[n_timers++] = c;
+  }
+}
+
+void ctimer_stop(struct ctimer *c)
+{
+  c->p = NULL;
+}
+
+uint8_t ZW_SendDataAppl(ts_param_t *p, const void *pData, uint16_t dataLength,
+                        ZW_SendDataAppl_Callback_t callback, void *user)
+{
+  if (n_sent >= MAX_SENT) {
+    return 0;
+  }
+  sent[n_sent].cb = callback;
+  sent[n_sent].user = user;
+  n_sent++;
+  return 1;
+}
+
+void ts_param_make_reply(ts_param_t *dst, const ts_param_t *src)
+{
+  dst->snode = src->dnode;
+  dst->dnode = src->snode;
+  dst->sendpoint = src->dendpoint;
+  dst->dendpoint = src->sendpoint;
+  dst->scheme = src->scheme;
+}
+
+uint8_t ts_param_cmp(ts_param_t *a1, const ts_param_t *a2)
+{
+  return (a1->snode == a2->snode && a1->dnode == a2->dnode
+          && a1->sendpoint == a2->sendpoint && a1->dendpoint == a2->dendpoint);
+}
+
+/* Helpers */
+
+static int request_cb(BYTE txStatus, BYTE rxStatus, ZW_APPLICATION_TX_BUFFER *pCmd,
+                      WORD cmdLength, void *user)
+{
+  int i = (int)(intptr_t)user;
+
+  if (txStatus == TRANSMIT_COMPLETE_OK) {
+    completed[i]++;
+  } else {
+    failed[i]++;
+  }
+  return 0;
+}
+
+static void reset(uint8_t max_requests)
+{
+  n_sent = 0;
+  n_acked = 0;
+  n_timers = 0;
+  memset(completed, 0, sizeof(completed));
+  memset(failed, 0, sizeof(failed));
+  cfg.max_send_requests = max_requests;
+  zw_node_latency_init();
+  ZW_SendRequest_init();
+}
+
+static ts_param_t param_of(nodeid_t node)
+{
+  ts_param_t p;
+
+  memset(&p, 0, sizeof(p));
+  p.snode = 1;
+  p.dnode = node;
+  p.scheme = NO_SCHEME;
+  return p;
+}
+
+/** Send a Basic Get to node, user is the index of the request */
+static int request(nodeid_t node, int user)
+{
+  static const BYTE basic_get[] = { COMMAND_CLASS_BASIC, BASIC_GET };
+  ts_param_t p = param_of(node);
+
+  return ZW_SendRequest(&p, basic_get, sizeof(basic_get), BASIC_REPORT, 100,
+                        (void *)(intptr_t)user, request_cb);
+}
+
+/** Acknowledge all frames sent since the last call */
+static void ack_all(void)
+{
+  for (; n_acked < n_sent; n_acked++) {
+    sent[n_acked].cb(TRANSMIT_COMPLETE_OK, sent[n_acked].user, NULL);
+  }
+}
+
+/** Deliver a Basic Report from node */
+static BOOL report(nodeid_t node)
+{
+  ZW_APPLICATION_TX_BUFFER cmd;
+  ts_param_t p;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.ZW_BasicReportFrame.cmdClass = COMMAND_CLASS_BASIC;
+  cmd.ZW_BasicReportFrame.cmd = BASIC_REPORT;
+  memset(&p, 0, sizeof(p));
+  p.snode = node;
+  p.dnode = 1;
+  p.scheme = NO_SCHEME;
+  return SendRequest_ApplicationCommandHandler(&p, &cmd, sizeof(ZW_BASIC_REPORT_FRAME));
+}
+
+/* Tests */
+
+static void test_pool_limit(void)
+{
+  int i;
+
+  start_case("Pool limit", NULL);
+  reset(6);
+  for (i = 0; i < 6; i++) {
+    check_true(request(10 + i, i), "Request within the pool is sent");
+  }
+  check_true(!request(20, 6), "Request beyond ZipMaxSendRequests is refused");
+  ack_all();
+  check_true(report(12), "Report is matched");
+  check_equal(completed[2], 1, "Request is completed by its report");
+  check_true(request(20, 6), "Completed request frees its slot");
+  close_case("Pool limit");
+}
+
+static void test_node_limit(void)
+{
+  int i;
+
+  start_case("Per node limit", NULL);
+  reset(16);
+  for (i = 0; i < 4; i++) {
+    check_true(request(5, i), "Request to node within the limit is sent");
+  }
+  check_true(!request(5, 4), "Fifth request to the same node is refused");
+  check_true(request(6, 5), "Other node can still send");
+  check_true(request(5 + 16, 6), "Node in the same bucket can still send");
+  close_case("Per node limit");
+}
+
+static void test_bucket_matching(void)
+{
+  start_case("Matching within a bucket", NULL);
+  reset(16);
+  /* 3, 19 and 35 hash to the same bucket */
+  check_true(request(3, 0), "Request to node 3 is sent");
+  check_true(request(19, 1), "Request to node 19 is sent");
+  check_true(!report(19), "Report before the acknowledge is not matched");
+  ack_all();
+  check_true(!report(35), "Report from a node without request is not matched");
+  check_true(report(19), "Report from node 19 is matched");
+  check_equal(completed[1], 1, "Request to node 19 is completed");
+  check_equal(completed[0], 0, "Request to node 3 is still pending");
+  check_true(!report(19), "Second report from node 19 is not matched");
+  check_true(report(3), "Report from node 3 is matched");
+  check_equal(completed[0], 1, "Request to node 3 is completed");
+  close_case("Matching within a bucket");
+}
+
+static void test_abort(void)
+{
+  int i;
+
+  start_case("Abort", NULL);
+  reset(16);
+  for (i = 0; i < 3; i++) {
+    check_true(request(7, i), "Request to node 7 is sent");
+  }
+  check_true(request(23, 3), "Request to node 23 is sent");
+  ack_all();
+  ZW_Abort_SendRequest(7);
+  for (i = 0; i < 3; i++) {
+    check_equal(failed[i], 1, "All requests to the aborted node fail");
+  }
+  check_equal(failed[3], 0, "Request to other node in the bucket is kept");
+  check_true(report(23), "Other node in the bucket can still be matched");
+  for (i = 0; i < 4; i++) {
+    check_true(request(7, 10 + i), "Aborted requests free their slots");
+  }
+  close_case("Abort");
+}
+
+static void test_timeout(void)
+{
+  int i;
+
+  start_case("Timeout", NULL);
+  reset(1);
+  check_true(request(8, 0), "Request is sent");
+  check_true(!request(9, 1), "Pool of one is full");
+  ack_all();
+  for (i = 0; i < n_timers; i++) {
+    if (timers[i]->p) {
+      timers[i]->p = NULL;
+      timers[i]->f(timers[i]->ptr);
+    }
+  }
+  check_equal(failed[0], 1, "Request fails on timeout");
+  check_true(!report(8), "Late report is not matched");
+  check_true(request(9, 1), "Timed out request frees its slot");
+  close_case("Timeout");
+}
+
+int main()
+{
+  test_pool_limit();
+  test_node_limit();
+  test_bucket_matching();
+  test_abort();
+  test_timeout();
+
+  close_run();
+  return numErrs;
+}
@@ -20,6 +20,15 @@ int testframe_len = sizeof(testframe);
 
 static nodemask_t c0, c1, c2;
 
+nodemask_t virtual_nodes_mask;
+/** Security flags of the gateway, which virtual nodes have too */
+static BYTE gw_flags;
+
+/* Only asked for the flags of the gateway */
+BYTE GetCacheEntryFlag(nodeid_t nodeid) {
+  return gw_flags;
+}
+
 static void callback(BYTE txStatus, void* user, TX_STATUS_TYPE *txStatEx) {
   cb_status = txStatus;
   cb_user = user;
@@ -51,16 +60,19 @@ uint8_t sec2_send_multicast(ts_param_t *p, const uint8_t *data,
   return sec2_send_multicast_return_value;
 }
 
-uint8_t GetCacheEntryFlag(nodeid_t node) {
-  int flags = 0;
-
-  if (nodemask_test_node(node, c2))
-    flags |= NODE_FLAG_SECURITY2_ACCESS;
-  if (nodemask_test_node(node, c1))
-    flags |= NODE_FLAG_SECURITY2_AUTHENTICATED;
-  if (nodemask_test_node(node, c0))
-    flags |= NODE_FLAG_SECURITY2_UNAUTHENTICATED;
-  return flags;;
+const uint8_t* rd_security_nodemask(BYTE flag) {
+  static const nodemask_t none = { 0 };
+
+  switch (flag) {
+  case NODE_FLAG_SECURITY2_ACCESS:
+    return c2;
+  case NODE_FLAG_SECURITY2_AUTHENTICATED:
+    return c1;
+  case NODE_FLAG_SECURITY2_UNAUTHENTICATED:
+    return c0;
+  default:
+    return none;
+  }
 }
 
 void nodemask_from_list(nodemask_t mask, const uint8_t* nodelist, uint8_t len) {
@@ -75,6 +87,8 @@ static void reset_book_keeping() {
   nodemask_from_list(c0, (uint8_t[] ) { 10, 11, 12, 13, 14 }, 5);
   nodemask_from_list(c1, (uint8_t[] ) { 20, 21, 22, 23, 24 }, 5);
   nodemask_from_list(c2, (uint8_t[] ) { 30, 31, 32, 33, 34 }, 5);
+  nodemask_clear(virtual_nodes_mask);
+  gw_flags = 0;
 
   sec2_send_multicast_auto_init();
   sec2_send_multicast_return_value = 1;
@@ -151,3 +165,54 @@ void test_one_multicast_3_groups() {
   TEST_ASSERT_EQUAL(1, cb_count);
 
 }
+
+void test_virtual_nodes_get_gateway_scheme() {
+  ts_param_t p;
+  nodemask_t expected;
+
+  reset_book_keeping();
+
+  /* Virtual nodes 50 and 51 are not in the RD masks, the gateway has S2 Authenticated */
+  nodemask_from_list(virtual_nodes_mask, (uint8_t[] ) { 50, 51 }, 2);
+  gw_flags = NODE_FLAG_SECURITY2_AUTHENTICATED | NODE_FLAG_SECURITY2_UNAUTHENTICATED;
+
+  nodemask_from_list(p.node_list, (uint8_t[] ) { 10, 20, 50, 51 }, 4);
+  sec2_send_multicast_auto_split(&p, testframe, testframe_len, 0, callback,
+      (void*) 0x42);
+
+  TEST_ASSERT_EQUAL(1, sec2_send_multicast_nc_call);
+  TEST_ASSERT_EQUAL(SECURITY_SCHEME_2_UNAUTHENTICATED,
+      sec2_send_multicast_p->scheme);
+  nodemask_from_list(expected, (uint8_t[] ) { 10 }, 1);
+  TEST_ASSERT_TRUE(nodemask_equal( sec2_send_multicast_p->node_list, expected ) ==0);
+
+  sec2_send_multicast_callback(TRANSMIT_COMPLETE_OK, 0, 0);
+
+  /* The virtual nodes are sent to with the highest class of the gateway */
+  TEST_ASSERT_EQUAL(2, sec2_send_multicast_nc_call);
+  TEST_ASSERT_EQUAL(SECURITY_SCHEME_2_AUTHENTICATED,
+      sec2_send_multicast_p->scheme);
+  nodemask_from_list(expected, (uint8_t[] ) { 20, 50, 51 }, 3);
+  TEST_ASSERT_TRUE(nodemask_equal( sec2_send_multicast_p->node_list, expected ) ==0);
+
+  sec2_send_multicast_callback(TRANSMIT_COMPLETE_OK, 0, 0);
+
+  /* No node has S2 Access, so the split is done */
+  TEST_ASSERT_EQUAL(2, sec2_send_multicast_nc_call);
+  TEST_ASSERT_EQUAL(1, cb_count);
+}
+
+void test_virtual_nodes_non_secure_gateway() {
+  ts_param_t p;
+
+  reset_book_keeping();
+
+  /* Without S2 keys on the gateway the virtual nodes are not sent with S2 */
+  nodemask_from_list(virtual_nodes_mask, (uint8_t[] ) { 50 }, 1);
+  nodemask_from_list(p.node_list, (uint8_t[] ) { 50 }, 1);
+  sec2_send_multicast_auto_split(&p, testframe, testframe_len, 0, callback,
+      (void*) 0x42);
+
+  TEST_ASSERT_EQUAL(0, sec2_send_multicast_nc_call);
+  TEST_ASSERT_EQUAL(1, cb_count);
+}